@@ -0,0 +1,128 @@
+// Material batching (Model::batchByMaterial) of a scene with many small meshes, with and without
+// merging first the textures that hold the same image under different names
+//   ./bench_batch [--quick]
+#include <cstdio>
+#include <string>
+
+#include "../mesh/model.h"
+#include "../mesh/proceduralmeshes.h"
+
+#include "benchmark.h"
+
+namespace {
+
+const char* OBJ_FILE = "bench_batch.obj";
+const char* MTL_FILE = "bench_batch.mtl";
+// Every material has its own file names, but there are only IMAGES different diffuse images
+const int MATERIALS = 64;
+const int IMAGES = 8;
+
+// A grid of small spheres, each one with the next material (the texture files do not need to
+// exist, only their paths are read)
+bool writeScene(int meshes) {
+  std::FILE* mtl = std::fopen(MTL_FILE, "w");
+  std::FILE* obj = std::fopen(OBJ_FILE, "w");
+  if (mtl == nullptr || obj == nullptr) {
+    if (mtl != nullptr) {
+      std::fclose(mtl);
+    }
+    if (obj != nullptr) {
+      std::fclose(obj);
+    }
+    return false;
+  }
+  for (int m = 0; m < MATERIALS; ++m) {
+    std::fprintf(mtl, "newmtl material%d\nmap_Kd diffuse%d.png\nmap_Ks specular.png\n", m, m);
+  }
+  std::fclose(mtl);
+  const mesh::Mesh sphere = mesh::icosphere(1);
+  mesh::ArrayView<mesh::Vertex> vertices = sphere.viewVertices();
+  mesh::ArrayView<unsigned int> indices = sphere.viewIndices();
+  std::fprintf(obj, "mtllib %s\n", MTL_FILE);
+  for (int k = 0; k < meshes; ++k) {
+    const glm::vec3 offset(3.0f * (k % 64), 3.0f * (k / 64), 0.0f);
+    for (const mesh::Vertex& v : vertices) {
+      std::fprintf(obj, "v %g %g %g\nvt %g %g\n", v.position.x + offset.x,
+          v.position.y + offset.y, v.position.z + offset.z, v.textCoords.x, v.textCoords.y);
+    }
+    std::fprintf(obj, "o mesh%d\nusemtl material%d\n", k, k % MATERIALS);
+    const long base = -static_cast<long>(vertices.size());
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+      const long a = base + indices[t];
+      const long b = base + indices[t + 1];
+      const long c = base + indices[t + 2];
+      std::fprintf(obj, "f %ld/%ld %ld/%ld %ld/%ld\n", a, a, b, b, c, c);
+    }
+  }
+  std::fclose(obj);
+  return true;
+}
+
+// The texture binds of TemplateApplication::render drawing the separators in order
+size_t textureBinds(mesh::ArrayView<mesh::MeshData> separators) {
+  size_t binds = 0;
+  int diffuse = -1;
+  int specular = -1;
+  for (const mesh::MeshData& sep : separators) {
+    binds += (sep.diffuseIndex != diffuse ? 1 : 0) + (sep.specIndex != specular ? 1 : 0);
+    diffuse = sep.diffuseIndex;
+    specular = sep.specIndex;
+  }
+  return binds;
+}
+
+void run(const mesh::Model& loaded, bool mergeFirst, const bench::Options& options) {
+  // The keys the application gets from the decoded pixels
+  std::vector<uint64_t> keys;
+  for (const mesh::TextureImage& texture : loaded.viewTextures()) {
+    int number = -1;
+    keys.push_back(std::sscanf(texture.filePath.c_str(), "diffuse%d", &number) == 1 ?
+        number % IMAGES : IMAGES);
+  }
+  mesh::Model model;
+  bench::Timing timing = bench::measure([&]() {
+    model = loaded;
+  }, [&]() {
+    if (mergeFirst) {
+      model.mergeTextures(keys);
+    }
+    model.batchByMaterial();
+  }, options.quick ? 1 : 5);
+  const size_t triangles = model.viewIndices().size() / 3;
+  bench::printRow(mergeFirst ? "merge textures, then batch" : "batch", timing, triangles / 1e6,
+      "Mtris/s");
+  char note[128];
+  std::snprintf(note, sizeof(note), "%zu textures, %zu draw calls, %zu texture binds",
+      model.viewTextures().size(), model.viewSeparators().size(),
+      textureBinds(model.viewSeparators()));
+  bench::printNote(note);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options = bench::parseOptions(argc, argv);
+  const int meshes = options.quick ? 512 : 4096;
+  if (!writeScene(meshes)) {
+    std::fprintf(stderr, "Could not write %s\n", OBJ_FILE);
+    return 1;
+  }
+  mesh::Model loaded;
+  const bool read = loaded.load(OBJ_FILE, false);
+  std::remove(OBJ_FILE);
+  std::remove(MTL_FILE);
+  if (!read) {
+    std::fprintf(stderr, "Could not load %s\n", OBJ_FILE);
+    return 1;
+  }
+  bench::printHeader("Material batching: " + std::to_string(meshes) + " spheres, " +
+      std::to_string(MATERIALS) + " materials with " + std::to_string(IMAGES) + " images");
+  char note[128];
+  std::snprintf(note, sizeof(note), "as loaded: %zu textures, %zu draw calls, %zu texture binds",
+      loaded.viewTextures().size(), loaded.viewSeparators().size(),
+      textureBinds(loaded.viewSeparators()));
+  bench::printNote(note);
+  run(loaded, false, options);
+  run(loaded, true, options);
+  return 0;
+}
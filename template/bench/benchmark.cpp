@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "../mesh/vertexkernels.h"
+#include "../parallel/threadpool.h"
+
+#include "benchmark.h"
+
+namespace bench {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+Options parseOptions(int argc, char** argv) {
+  Options options;
+  options.quick = false;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--quick") == 0) {
+      options.quick = true;
+    } else {
+      options.files.push_back(argv[i]);
+    }
+  }
+  return options;
+}
+
+Timing measure(const std::function<void()>& work, size_t minRuns, double minSeconds) {
+  return measure(std::function<void()>(), work, minRuns, minSeconds);
+}
+
+Timing measure(const std::function<void()>& setup, const std::function<void()>& work,
+    size_t minRuns, double minSeconds) {
+  if (setup) {
+    setup();
+  }
+  work();
+  std::vector<double> times;
+  double total = 0.0;
+  while (times.size() < minRuns || total < minSeconds) {
+    if (setup) {
+      setup();
+    }
+    Clock::time_point start = Clock::now();
+    work();
+    times.push_back(secondsSince(start));
+    total += times.back();
+  }
+  std::sort(times.begin(), times.end());
+  Timing timing = {times[times.size() / 2], times.front(), times.size()};
+  return timing;
+}
+
+void printHeader(const std::string& title) {
+  std::printf("\n%s\n", title.c_str());
+  std::printf("(%u threads, %s vertex kernels)\n", parallel::ThreadPool::global().size(),
+      mesh::vertexKernelName(mesh::bestVertexKernelPath()));
+  std::printf("%-40s %12s %12s %6s %14s\n", "", "median ms", "best ms", "runs", "rate");
+}
+
+void printRow(const std::string& name, const Timing& timing, double items,
+    const std::string& unit) {
+  std::printf("%-40s %12.3f %12.3f %6zu", name.c_str(), 1000.0 * timing.median,
+      1000.0 * timing.best, timing.runs);
+  if (items > 0.0) {
+    std::printf(" %8.2f %s", items / timing.median, unit.c_str());
+  }
+  std::printf("\n");
+}
+
+void printNote(const std::string& note) {
+  std::printf("  %s\n", note.c_str());
+}
+
+bool fileExists(const std::string& fileName) {
+  return std::ifstream(fileName).good();
+}
+
+} // namespace bench
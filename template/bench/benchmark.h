@@ -0,0 +1,56 @@
+#ifndef BENCH_BENCHMARK_H_
+#define BENCH_BENCHMARK_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+//! Time of a piece of work repeated several times, in seconds
+struct Timing {
+  double median;
+  double best;
+  size_t runs;
+};
+
+//! Options shared by all the benchmarks
+struct Options {
+  //! Smaller inputs and fewer runs, to check that everything works
+  bool quick;
+  //! Model files given in the command line (the benchmark chooses a default if empty)
+  std::vector<std::string> files;
+};
+
+//! Read the command line: [--quick] [model files...]
+Options parseOptions(int argc, char** argv);
+
+//! Run the work at least minRuns times and for at least minSeconds
+/*!
+  The first run is a warm up and is not measured. The setup (if any) runs
+  before every run of the work and is not measured either, it is meant to
+  restore an input that the work modifies.
+*/
+Timing measure(const std::function<void()>& work, size_t minRuns = 5, double minSeconds = 0.25);
+Timing measure(const std::function<void()>& setup, const std::function<void()>& work,
+    size_t minRuns = 5, double minSeconds = 0.25);
+
+//! Print the machine (hardware threads and best vertex kernels) and a title
+void printHeader(const std::string& title);
+//! Print a line of results: the median and best time and, if items is not zero, the rate
+/*!
+  @param items how many things one run processes (triangles, rays...)
+  @param unit what the items are, for the rate (for example "Mrays/s" with items / 1e6)
+*/
+void printRow(const std::string& name, const Timing& timing, double items = 0.0,
+    const std::string& unit = "");
+//! Print a line of text under the results (a check, a size...)
+void printNote(const std::string& note);
+
+//! Queries if a file can be read
+bool fileExists(const std::string& fileName);
+
+} // namespace bench
+
+#endif
@@ -0,0 +1,220 @@
+// Build and traversal of mesh::Bvh on the procedural meshes and on model files, and picking
+//   ./bench_bvh [--quick] [model files...]   (default model: models/Nyra/Nyra_pose.obj)
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../mesh/bvh.h"
+#include "../mesh/picker.h"
+#include "../mesh/proceduralmeshes.h"
+
+#include "benchmark.h"
+
+using glm::vec3;
+using mesh::Bvh;
+
+namespace {
+
+// Rays from a sphere around the mesh towards random points near its center
+void makeRays(const vec3& center, float radius, size_t count, std::vector<vec3>& origins,
+    std::vector<vec3>& directions) {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  origins.resize(count);
+  directions.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    vec3 onSphere = glm::normalize(vec3(uniform(rng), uniform(rng), uniform(rng)) + vec3(1e-4f));
+    vec3 target = center + 0.3f * radius * vec3(uniform(rng), uniform(rng), uniform(rng));
+    origins[i] = center + radius * onSphere;
+    directions[i] = glm::normalize(target - origins[i]);
+  }
+}
+
+// Closest hit testing every triangle, to check the tree
+bool bruteForce(mesh::ArrayView<mesh::Vertex> vertices, mesh::ArrayView<unsigned int> indices,
+    const vec3& origin, const vec3& direction, float& distance) {
+  bool found = false;
+  distance = FLT_MAX;
+  for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+    vec3 p0 = vertices[indices[t]].position;
+    vec3 e1 = vertices[indices[t + 1]].position - p0;
+    vec3 e2 = vertices[indices[t + 2]].position - p0;
+    vec3 pv = glm::cross(direction, e2);
+    float det = glm::dot(e1, pv);
+    if (det == 0.0f) {
+      continue;
+    }
+    vec3 tv = origin - p0;
+    float u = glm::dot(tv, pv) / det;
+    vec3 qv = glm::cross(tv, e1);
+    float v = glm::dot(direction, qv) / det;
+    float d = glm::dot(e2, qv) / det;
+    if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && d >= 0.0f && d < distance) {
+      distance = d;
+      found = true;
+    }
+  }
+  return found;
+}
+
+void run(const std::string& name, const mesh::Mesh& source, const bench::Options& options) {
+  const size_t triangles = source.viewIndices().size() / 3;
+  const size_t rays = options.quick ? 10000 : 100000;
+  vec3 center = source.getBBCenter();
+  float radius = glm::length(source.getBBSize());
+  std::vector<vec3> origins;
+  std::vector<vec3> directions;
+  makeRays(center, radius, rays, origins, directions);
+  for (bool quantized : {false, true}) {
+    const std::string label = name + (quantized ? " (quantized)" : "");
+    Bvh bvh(Bvh::DEFAULT_LEAF_SIZE, quantized);
+    bench::Timing build = bench::measure([&]() {
+      bvh.build(source);
+    }, options.quick ? 1 : 3);
+    bench::printRow(label + " build", build, triangles / 1e6, "Mtris/s");
+    size_t hits = 0;
+    bench::Timing cast = bench::measure([&]() {
+      hits = 0;
+      mesh::BvhRayHit hit;
+      for (size_t i = 0; i < rays; ++i) {
+        hits += bvh.intersect(origins[i], directions[i], hit) ? 1 : 0;
+      }
+    }, 3);
+    bench::printRow(label + " rays", cast, rays / 1e6, "Mrays/s");
+    const size_t points = rays / 10;
+    bench::Timing closest = bench::measure([&]() {
+      mesh::BvhClosestPoint result;
+      for (size_t i = 0; i < points; ++i) {
+        bvh.closestPoint(origins[i] - 0.5f * radius * directions[i], result);
+      }
+    }, 3);
+    bench::printRow(label + " closest points", closest, points / 1e6, "Mpts/s");
+    char note[160];
+    std::snprintf(note, sizeof(note), "%zu triangles, %zu nodes, %.2f MB, SAH cost %.1f, "
+        "%zu of %zu rays hit", bvh.triangleCount(), bvh.nodeCount(), bvh.memoryUsage() / 1e6,
+        bvh.cost(), hits, rays);
+    bench::printNote(note);
+  }
+  // Refit after the vertices moved
+  mesh::Mesh moved = source;
+  moved.transform(glm::rotate(glm::mat4(1.0f), 0.7f, vec3(1.0f, 1.0f, 0.0f)));
+  Bvh bvh;
+  bvh.build(source);
+  bench::Timing refit = bench::measure([&]() {
+    bvh.refit(moved.viewVertices());
+  }, 3);
+  bench::printRow(name + " refit", refit, triangles / 1e6, "Mtris/s");
+  // Every hit of a sample of rays, against testing all the triangles
+  const size_t checked = triangles > 100000 ? 0 : 200;
+  size_t mismatches = 0;
+  bvh.build(source);
+  for (size_t i = 0; i < checked; ++i) {
+    mesh::BvhRayHit hit;
+    float distance;
+    bool found = bruteForce(source.viewVertices(), source.viewIndices(), origins[i],
+        directions[i], distance);
+    bool hitTree = bvh.intersect(origins[i], directions[i], hit);
+    if (found != hitTree || (found && std::abs(distance - hit.distance) > 1e-4f * radius)) {
+      ++mismatches;
+    }
+  }
+  if (checked > 0) {
+    char note[96];
+    std::snprintf(note, sizeof(note), "%zu of %zu rays differ from the brute force", mismatches,
+        checked);
+    bench::printNote(note);
+  }
+}
+
+// The separators of a Model as a single Mesh (the indices of a Model are relative to the
+// startVertex of their separator)
+mesh::Mesh flatten(const mesh::Model& model) {
+  mesh::ArrayView<mesh::Vertex> vertices = model.viewVertices();
+  mesh::ArrayView<unsigned int> indices = model.viewIndices();
+  std::vector<unsigned int> absolute;
+  for (const mesh::MeshData& sep : model.viewSeparators()) {
+    for (GLsizei k = 0; k < sep.howMany; ++k) {
+      absolute.push_back(sep.startVertex + indices[sep.startIndex + k]);
+    }
+  }
+  mesh::Mesh flat;
+  flat.loadVerticesAndIndices(std::vector<mesh::Vertex>(vertices.begin(), vertices.end()),
+      std::move(absolute), model.hasNormals(), model.hasTexture());
+  return flat;
+}
+
+// Picks at random pixels of a 1200 x 800 window, with the matrices the application uses
+void runPicker(const bench::Options& options) {
+  mesh::Model model;
+  mesh::Mesh torus = mesh::torus(1.0f, 0.25f, 360, 120);
+  torus.transform(glm::translate(glm::mat4(1.0f), vec3(0.5f, 0.0f, 0.0f)));
+  model.addMesh(mesh::teapot());
+  model.addMesh(torus);
+  model.addMesh(mesh::icosphere(options.quick ? 5 : 7));
+  // addMesh keeps the bounding box, a transform computes it again
+  model.transform(glm::mat4(1.0f));
+  model.toUnitCube();
+  mesh::Picker picker;
+  bench::Timing build = bench::measure([&]() {
+    picker.build(model);
+  }, options.quick ? 1 : 3);
+  const size_t triangles = picker.bvh().triangleCount();
+  bench::printRow("picker build", build, triangles / 1e6, "Mtris/s");
+  const glm::ivec2 window(1200, 800);
+  glm::mat4 M = glm::scale(glm::mat4(1.0f), vec3(2.0f));
+  glm::mat4 V = glm::lookAt(vec3(0.0f, 0.0f, 3.5f), vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 P = glm::perspective(6.28318f / 8.0f, 1.5f, 1.0f, 5.0f);
+  const glm::mat4 PVM = P * V * M;
+  std::mt19937 rng(2);
+  std::uniform_real_distribution<float> x(0.0f, 1200.0f);
+  std::uniform_real_distribution<float> y(0.0f, 800.0f);
+  const size_t picks = 2000;
+  std::vector<glm::vec2> mouse(picks);
+  for (glm::vec2& m : mouse) {
+    m = glm::vec2(x(rng), y(rng));
+  }
+  size_t hits = 0;
+  double worst = 0.0;
+  bench::Timing pick = bench::measure([&]() {
+    hits = 0;
+    for (const glm::vec2& m : mouse) {
+      mesh::PickResult result = picker.pick(m, window, PVM);
+      hits += result.hit ? 1 : 0;
+      worst = std::max(worst, result.milliseconds);
+    }
+  }, 3);
+  bench::printRow("picks", pick, picks / 1e3, "kpicks/s");
+  char note[128];
+  std::snprintf(note, sizeof(note), "%zu triangles, %zu of %zu picks hit, slowest pick %.3f ms",
+      triangles, hits, picks, worst);
+  bench::printNote(note);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options = bench::parseOptions(argc, argv);
+  if (options.files.empty() && bench::fileExists("models/Nyra/Nyra_pose.obj")) {
+    options.files.push_back("models/Nyra/Nyra_pose.obj");
+  }
+  bench::printHeader("Bvh: build, ray casts, closest points and refit");
+  run("teapot", mesh::teapot(), options);
+  run("torus", mesh::torus(1.0f, 0.25f, 360, 120), options);
+  run("icosphere", mesh::icosphere(options.quick ? 6 : 8), options);
+  for (const std::string& file : options.files) {
+    mesh::Model model;
+    if (!model.load(file)) {
+      std::fprintf(stderr, "Could not load %s\n", file.c_str());
+      continue;
+    }
+    run(file, flatten(model), options);
+  }
+  bench::printHeader("Picker: rays through random pixels (teapot, torus and sphere)");
+  runPicker(options);
+  return 0;
+}
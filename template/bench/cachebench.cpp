@@ -0,0 +1,162 @@
+// Cold load (import) against warm load (binary cache) of model files, and the processing the
+// application does after every load
+//   ./bench_cache [--quick] [model files...]
+// Without files it writes a subdivided icosphere with a material library and also reads
+// models/Nyra/Nyra_pose.obj if it is there.
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+
+#include "../mesh/meshcache.h"
+#include "../mesh/meshoptimizer.h"
+#include "../mesh/meshwriter.h"
+#include "../mesh/picker.h"
+#include "../mesh/proceduralmeshes.h"
+
+#include "benchmark.h"
+
+namespace {
+
+const char* GENERATED = "bench_cache.obj";
+const char* GENERATED_MTL = "bench_cache.mtl";
+
+// The sphere, with a material library at the end (it only needs to be named)
+bool writeGenerated(const bench::Options& options) {
+  mesh::Mesh sphere = mesh::icosphere(options.quick ? 6 : 8);
+  mesh::MeshData all = {0, 0, static_cast<GLsizei>(sphere.viewIndices().size()), -1, -1, -1,
+      GL_UNSIGNED_INT, 0};
+  if (!mesh::writeMesh(GENERATED, mesh::OBJ_TEXT, sphere.viewVertices(), sphere.viewIndices(),
+      mesh::ArrayView<mesh::MeshData>(&all, 1), true, true)) {
+    return false;
+  }
+  std::ofstream(GENERATED, std::ios::app) << "mtllib " << GENERATED_MTL << "\n";
+  std::ofstream(GENERATED_MTL) << "newmtl sphere\nmap_Kd sphere.png\n";
+  return true;
+}
+
+// The steps of TemplateApplication::load_model_data_and_send_to_gpu after the load, each one
+// timed from the model the previous one left
+void runProcessing(const mesh::Model& loaded, double warm, const bench::Options& options) {
+  const size_t runs = options.quick ? 1 : 3;
+  const size_t triangles = loaded.viewIndices().size() / 3;
+  mesh::Model state = loaded;
+  state.toUnitCube();
+  double total = 0.0;
+  auto step = [&](const std::string& name, const std::function<void(mesh::Model&)>& work) {
+    mesh::Model model;
+    // Only the runs count, some steps do nothing on some models and the copy is not timed
+    bench::Timing timing = bench::measure([&]() {
+      model = state;
+    }, [&]() {
+      work(model);
+    }, runs, 0.0);
+    bench::printRow("  " + name, timing, triangles / 1e6, "Mtris/s");
+    total += timing.median;
+    state = model;
+  };
+  step("batch by material", [](mesh::Model& model) {
+    model.batchByMaterial();
+  });
+  step("estimate overdraw (menu option)", [](mesh::Model& model) {
+    model.estimateOverdraw();
+  });
+  step("optimize vertex order", [](mesh::Model& model) {
+    model.optimizeVertexOrder();
+  });
+  step("split large meshes", [](mesh::Model& model) {
+    model.splitLargeMeshes();
+  });
+  step("generate levels of detail", [](mesh::Model& model) {
+    model.generateLods();
+  });
+  step("build index buffer", [](mesh::Model& model) {
+    model.buildIndexBuffer();
+  });
+  mesh::Picker picker;
+  bench::Timing pickerBuild = bench::measure([&]() {
+    picker.build(state);
+  }, runs);
+  bench::printRow("  picker build", pickerBuild, triangles / 1e6, "Mtris/s");
+  total += pickerBuild.median;
+  char note[128];
+  std::snprintf(note, sizeof(note), "processing %.1f ms after a warm load of %.1f ms",
+      1000.0 * total, 1000.0 * warm);
+  bench::printNote(note);
+}
+
+void run(const std::string& fileName, const bench::Options& options) {
+  std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+  const double megabytes = static_cast<double>(file.tellg()) / (1024.0 * 1024.0);
+  const size_t runs = options.quick ? 1 : 5;
+  std::printf("%s (%.1f MB)\n", fileName.c_str(), megabytes);
+  // Without the cache: the native reader or Assimp, as Model::load chooses
+  mesh::Model model;
+  bool loaded = true;
+  bench::Timing cold = bench::measure([&]() {
+    loaded = model.load(fileName, false);
+  }, runs);
+  if (!loaded) {
+    bench::printNote("could not load it");
+    return;
+  }
+  bench::printRow("cold load (import)", cold, megabytes, "MB/s");
+  // The first load with the cache writes it, the next ones map it
+  const std::string cacheFile = mesh::MeshCache::cacheFileFor(fileName);
+  const bool hadCache = bench::fileExists(cacheFile);
+  model.load(fileName);
+  bool fromCache = true;
+  bench::Timing warm = bench::measure([&]() {
+    model.load(fileName);
+    fromCache = fromCache && model.loadedFromCache();
+  }, runs);
+  bench::printRow("warm load (binary cache)", warm, megabytes, "MB/s");
+  char note[128];
+  std::snprintf(note, sizeof(note), fromCache ? "%.1fx the cold load, %zu triangles" :
+      "the cache was not used (%.1fx), %zu triangles", cold.median / warm.median,
+      model.viewIndices().size() / 3);
+  bench::printNote(note);
+  // A change in the material library must import it again
+  if (fileName == GENERATED) {
+    size_t reused = 0;
+    bench::Timing edited = bench::measure([&]() {
+      std::ofstream(GENERATED_MTL, std::ios::app) << "# edited\n";
+    }, [&]() {
+      model.load(fileName);
+      reused += model.loadedFromCache() ? 1 : 0;
+    }, runs, 0.0);
+    bench::printRow("load after editing the MTL", edited, megabytes, "MB/s");
+    std::snprintf(note, sizeof(note), "%zu of %zu loads used the stale cache", reused,
+        edited.runs + 1);
+    bench::printNote(note);
+  }
+  runProcessing(model, warm.median, options);
+  if (!hadCache) {
+    std::remove(cacheFile.c_str());
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options = bench::parseOptions(argc, argv);
+  bool generated = false;
+  if (options.files.empty()) {
+    generated = writeGenerated(options);
+    if (generated) {
+      options.files.push_back(GENERATED);
+    }
+    if (bench::fileExists("models/Nyra/Nyra_pose.obj")) {
+      options.files.push_back("models/Nyra/Nyra_pose.obj");
+    }
+  }
+  bench::printHeader("Model loading: import against binary cache, and the processing after it");
+  for (const std::string& file : options.files) {
+    run(file, options);
+  }
+  if (generated) {
+    std::remove(GENERATED);
+    std::remove(GENERATED_MTL);
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+// Frustum culling of many boxes: every box tested or the hierarchy walked, with every
+// instruction set the CPU has
+//   ./bench_culling [--quick]
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../mesh/frustumculler.h"
+
+#include "benchmark.h"
+
+using glm::vec3;
+
+namespace {
+
+// Small boxes spread over a wide and flat area, as the meshes of a city
+void makeBoxes(size_t count, std::vector<vec3>& lower, std::vector<vec3>& upper) {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> ground(-100.0f, 100.0f);
+  std::uniform_real_distribution<float> height(0.0f, 10.0f);
+  std::uniform_real_distribution<float> size(0.1f, 2.0f);
+  lower.resize(count);
+  upper.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    lower[i] = vec3(ground(rng), height(rng), ground(rng));
+    upper[i] = lower[i] + vec3(size(rng), size(rng), size(rng));
+  }
+}
+
+void run(size_t count, const bench::Options& options) {
+  std::vector<vec3> lower;
+  std::vector<vec3> upper;
+  makeBoxes(count, lower, upper);
+  mesh::FrustumCuller culler;
+  bench::Timing build = bench::measure([&]() {
+    culler.build(mesh::ArrayView<vec3>(lower), mesh::ArrayView<vec3>(upper));
+  }, options.quick ? 1 : 3);
+  const std::string size = std::to_string(count) + " boxes";
+  bench::printRow("build, " + size, build, count / 1e6, "Mboxes/s");
+  // From the border of the area, looking over it
+  const glm::mat4 P = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.5f, 150.0f);
+  const glm::mat4 V = glm::lookAt(vec3(-110.0f, 20.0f, 0.0f), vec3(0.0f, 0.0f, 30.0f),
+      vec3(0.0f, 1.0f, 0.0f));
+  const glm::mat4 PV = P * V;
+  // The scalar test of every box is the reference of the rest
+  culler.cull(PV, false, mesh::KERNEL_SCALAR);
+  std::vector<bool> reference(count);
+  for (size_t i = 0; i < count; ++i) {
+    reference[i] = culler.isVisible(i);
+  }
+  const mesh::VertexKernelPath best = mesh::bestVertexKernelPath();
+  for (bool hierarchy : {false, true}) {
+    for (int p = mesh::KERNEL_SCALAR; p <= best; ++p) {
+      const mesh::VertexKernelPath path = static_cast<mesh::VertexKernelPath>(p);
+      mesh::FrustumCullStats stats = {};
+      bench::Timing timing = bench::measure([&]() {
+        stats = culler.cull(PV, hierarchy, path);
+      }, options.quick ? 3 : 10);
+      const std::string name = std::string(hierarchy ? "hierarchy, " : "every box, ") +
+          mesh::vertexKernelName(path) + ", " + size;
+      bench::printRow(name, timing, count / 1e6, "Mboxes/s");
+      size_t differences = 0;
+      for (size_t i = 0; i < count; ++i) {
+        differences += culler.isVisible(i) != reference[i] ? 1 : 0;
+      }
+      char note[192];
+      std::snprintf(note, sizeof(note), "%.3f ms per 100k boxes, %zu visible, %zu tests, "
+          "%zu nodes out, %zu nodes in, %zu differences", 1000.0 * timing.median * 1e5 / count,
+          stats.visible, stats.tests, stats.nodesOutside, stats.nodesInside, differences);
+      bench::printNote(note);
+    }
+  }
+  // Moving 1% of the boxes (the instances of nodes that moved) refits the hierarchy above them
+  std::mt19937 rng(2);
+  std::uniform_int_distribution<size_t> anyBox(0, count - 1);
+  std::vector<size_t> moved(count / 100);
+  for (size_t& box : moved) {
+    box = anyBox(rng);
+  }
+  const glm::mat4 step = glm::translate(glm::mat4(1.0f), vec3(1.0f, 0.0f, 0.0f));
+  bench::Timing move = bench::measure([&]() {
+    for (size_t box : moved) {
+      culler.moveInstance(box, 0, step);
+    }
+  }, options.quick ? 3 : 10);
+  bench::printRow("move 1% of the boxes, " + size, move, moved.size() / 1e6, "Mboxes/s");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options = bench::parseOptions(argc, argv);
+  bench::printHeader("Frustum culling: every box against the hierarchy of boxes");
+  run(options.quick ? 20000 : 200000, options);
+  run(options.quick ? 100000 : 1000000, options);
+  return 0;
+}
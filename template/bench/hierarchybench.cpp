@@ -0,0 +1,150 @@
+// Updates of scene::TransformHierarchy after a few, some and all of the nodes changed, against
+// computing every world matrix in a plain loop
+//   ./bench_hierarchy [--quick]
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../scene/transformhierarchy.h"
+
+#include "benchmark.h"
+
+using glm::mat4;
+using glm::vec3;
+using scene::TransformHierarchy;
+
+namespace {
+
+const uint32_t ROOTS = 64;
+
+// A forest where every node has 4 children, as deep as the number of nodes needs
+std::vector<uint32_t> makeParents(size_t count) {
+  std::vector<uint32_t> parents(count, TransformHierarchy::NO_PARENT);
+  for (size_t i = ROOTS; i < count; ++i) {
+    parents[i] = static_cast<uint32_t>((i - ROOTS) / 4);
+  }
+  return parents;
+}
+
+mat4 randomLocal(std::mt19937& rng) {
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  mat4 local = glm::translate(mat4(1.0f), vec3(uniform(rng), uniform(rng), uniform(rng)));
+  return glm::rotate(local, 3.0f * uniform(rng), vec3(uniform(rng), 1.0f, uniform(rng)));
+}
+
+void build(TransformHierarchy& hierarchy, const std::vector<uint32_t>& parents,
+    const std::vector<mat4>& locals) {
+  hierarchy.clear();
+  hierarchy.reserve(parents.size());
+  for (size_t i = 0; i < parents.size(); ++i) {
+    hierarchy.addNode(parents[i], locals[i]);
+  }
+}
+
+std::string describe(const scene::HierarchyUpdateStats& stats) {
+  char note[128];
+  std::snprintf(note, sizeof(note), "%zu marked, %zu subtrees, %zu updated%s", stats.dirtyNodes,
+      stats.subtrees, stats.updated, stats.levelSweep ? " (level sweep)" : "");
+  return note;
+}
+
+// Changes the local matrix of some random nodes and then updates
+void runChanges(TransformHierarchy& hierarchy, const std::string& name,
+    const std::vector<uint32_t>& nodes, const bench::Options& options) {
+  std::mt19937 rng(2);
+  const mat4 local = randomLocal(rng);
+  scene::HierarchyUpdateStats stats = {};
+  bench::Timing timing = bench::measure([&]() {
+    for (uint32_t node : nodes) {
+      hierarchy.setLocal(node, local);
+    }
+  }, [&]() {
+    stats = hierarchy.update();
+  }, options.quick ? 3 : 10);
+  bench::printRow(name, timing, stats.updated / 1e6, "Mnodes/s");
+  bench::printNote(describe(stats));
+}
+
+void run(size_t count, const bench::Options& options) {
+  const std::vector<uint32_t> parents = makeParents(count);
+  std::mt19937 rng(1);
+  std::vector<mat4> locals(count);
+  for (mat4& local : locals) {
+    local = randomLocal(rng);
+  }
+  const std::string size = std::to_string(count) + " nodes";
+  const size_t runs = options.quick ? 3 : 10;
+  // The plain loop: the parents come first, so one pass in order computes everything
+  std::vector<mat4> worlds(count);
+  bench::Timing plain = bench::measure([&]() {
+    for (size_t i = 0; i < count; ++i) {
+      worlds[i] = parents[i] == TransformHierarchy::NO_PARENT ? locals[i] :
+          worlds[parents[i]] * locals[i];
+    }
+  }, runs);
+  bench::printRow("plain loop, all, " + size, plain, count / 1e6, "Mnodes/s");
+  // The first update also lays the nodes out
+  TransformHierarchy hierarchy;
+  scene::HierarchyUpdateStats stats = {};
+  bench::Timing first = bench::measure([&]() {
+    build(hierarchy, parents, locals);
+  }, [&]() {
+    stats = hierarchy.update();
+  }, runs);
+  bench::printRow("first update, " + size, first, count / 1e6, "Mnodes/s");
+  float error = 0.0f;
+  for (size_t i = 0; i < count; ++i) {
+    const mat4& world = hierarchy.world(static_cast<uint32_t>(i));
+    for (int c = 0; c < 4; ++c) {
+      error = std::max(error, glm::length(world[c] - worlds[i][c]));
+    }
+  }
+  char note[128];
+  std::snprintf(note, sizeof(note), "%zu levels, largest difference with the plain loop %.1e",
+      hierarchy.levels(), error);
+  bench::printNote(note);
+  // A leaf, a node every 100 and every root
+  std::uniform_int_distribution<uint32_t> anyNode(0, static_cast<uint32_t>(count - 1));
+  std::vector<uint32_t> leaf(1, static_cast<uint32_t>(count - 1));
+  std::vector<uint32_t> some(count / 100);
+  for (uint32_t& node : some) {
+    node = anyNode(rng);
+  }
+  std::vector<uint32_t> roots;
+  for (uint32_t r = 0; r < ROOTS && r < count; ++r) {
+    roots.push_back(r);
+  }
+  runChanges(hierarchy, "one leaf changed, " + size, leaf, options);
+  runChanges(hierarchy, "1% of the nodes changed, " + size, some, options);
+  runChanges(hierarchy, "every root changed, " + size, roots, options);
+  // Finding which nodes moved after 1% of them changed, as the application does for the
+  // nodes of its instances
+  for (uint32_t node : some) {
+    hierarchy.setLocal(node, locals[node]);
+  }
+  hierarchy.update();
+  const size_t queries = 10000;
+  size_t moved = 0;
+  bench::Timing query = bench::measure([&]() {
+    moved = 0;
+    for (size_t q = 0; q < queries; ++q) {
+      moved += hierarchy.wasUpdated(static_cast<uint32_t>(q * 7919 % count)) ? 1 : 0;
+    }
+  }, runs);
+  bench::printRow("wasUpdated queries", query, queries / 1e6, "Mqueries/s");
+  std::snprintf(note, sizeof(note), "%zu of %zu queried nodes moved", moved, queries);
+  bench::printNote(note);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options = bench::parseOptions(argc, argv);
+  bench::printHeader("Transform hierarchy: updates after some of the nodes changed");
+  run(options.quick ? 20000 : 100000, options);
+  run(options.quick ? 100000 : 1000000, options);
+  return 0;
+}
@@ -0,0 +1,119 @@
+// The vertex kernels (transform and bounds) against the scalar path Mesh::transform used before
+//   ./bench_kernels [--quick]
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../mesh/vertexkernels.h"
+
+#include "benchmark.h"
+
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+using mesh::Vertex;
+
+namespace {
+
+// The previous updateBoundingBox, which copied every Vertex
+void scalarBounds(const std::vector<Vertex>& vertices, vec3& lower, vec3& upper) {
+  lower = vec3(FLT_MAX);
+  upper = vec3(-FLT_MAX);
+  for (Vertex v : vertices) {
+    lower = glm::min(lower, v.position);
+    upper = glm::max(upper, v.position);
+  }
+}
+
+// The previous Mesh::transform: a mat4 * vec4 per position, another one per normal (with the
+// inverse transpose) and then updateBoundingBox
+void scalarTransform(std::vector<Vertex>& vertices, const mat4& T, vec3& lower, vec3& upper) {
+  for (Vertex& v : vertices) {
+    v.position = vec3(T * vec4(v.position, 1.0f));
+  }
+  mat4 N = glm::inverse(glm::transpose(T));
+  for (Vertex& v : vertices) {
+    v.normal = vec3(N * vec4(v.normal, 0.0f));
+  }
+  scalarBounds(vertices, lower, upper);
+}
+
+std::vector<Vertex> randomVertices(size_t count) {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  std::vector<Vertex> vertices(count);
+  for (Vertex& v : vertices) {
+    v.position = vec3(uniform(rng), uniform(rng), uniform(rng));
+    v.normal = glm::normalize(vec3(uniform(rng), uniform(rng), uniform(rng)) + vec3(1e-3f));
+    v.textCoords = glm::vec2(uniform(rng), uniform(rng));
+  }
+  return vertices;
+}
+
+void run(size_t count, const bench::Options& options) {
+  const std::vector<Vertex> source = randomVertices(count);
+  const mat4 T = glm::translate(glm::rotate(glm::scale(mat4(1.0f), vec3(2.0f, 1.0f, 0.5f)), 0.7f,
+      vec3(1.0f, 2.0f, 3.0f)), vec3(0.3f, -1.0f, 2.0f));
+  const std::string size = std::to_string(count) + " vertices";
+  const size_t runs = options.quick ? 3 : 10;
+  std::vector<Vertex> vertices;
+  auto restore = [&]() {
+    vertices = source;
+  };
+  // The result of the scalar path is the reference of the kernels
+  std::vector<Vertex> reference = source;
+  vec3 referenceLower;
+  vec3 referenceUpper;
+  scalarTransform(reference, T, referenceLower, referenceUpper);
+  vec3 lower;
+  vec3 upper;
+  bench::Timing scalar = bench::measure(restore, [&]() {
+    scalarTransform(vertices, T, lower, upper);
+  }, runs);
+  bench::printRow("transform, previous path, " + size, scalar, count / 1e6, "Mverts/s");
+  const mesh::VertexKernelPath best = mesh::bestVertexKernelPath();
+  for (int p = mesh::KERNEL_SCALAR; p <= best; ++p) {
+    const mesh::VertexKernelPath path = static_cast<mesh::VertexKernelPath>(p);
+    bench::Timing fused = bench::measure(restore, [&]() {
+      mesh::transformVertices(vertices.data(), vertices.size(), T, true, lower, upper, path);
+    }, runs);
+    bench::printRow(std::string("transform, ") + mesh::vertexKernelName(path) + ", " + size,
+        fused, count / 1e6, "Mverts/s");
+    float error = glm::length(lower - referenceLower) + glm::length(upper - referenceUpper);
+    for (size_t i = 0; i < count; ++i) {
+      error = std::max(error, glm::length(vertices[i].position - reference[i].position));
+      error = std::max(error, glm::length(vertices[i].normal - reference[i].normal));
+    }
+    char note[96];
+    std::snprintf(note, sizeof(note), "%.1fx the previous path, largest difference %.1e",
+        scalar.median / fused.median, error);
+    bench::printNote(note);
+  }
+  bench::Timing scalarBox = bench::measure([&]() {
+    scalarBounds(source, lower, upper);
+  }, runs);
+  bench::printRow("bounds, previous path, " + size, scalarBox, count / 1e6, "Mverts/s");
+  for (int p = mesh::KERNEL_SCALAR; p <= best; ++p) {
+    const mesh::VertexKernelPath path = static_cast<mesh::VertexKernelPath>(p);
+    bench::Timing box = bench::measure([&]() {
+      mesh::vertexBounds(source.data(), source.size(), lower, upper, path);
+    }, runs);
+    bench::printRow(std::string("bounds, ") + mesh::vertexKernelName(path) + ", " + size, box,
+        count / 1e6, "Mverts/s");
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options = bench::parseOptions(argc, argv);
+  bench::printHeader("Vertex kernels: transform (positions, normals and bounds) and bounds");
+  // In the caches, and one that is bound by the memory
+  run(8192, options);
+  run(options.quick ? 262144 : 2097152, options);
+  return 0;
+}
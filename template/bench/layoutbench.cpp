@@ -0,0 +1,99 @@
+// The vertex storages of VertexStream: interleaved (array of structures, as the Vertex struct)
+// against split (structure of arrays), for the loops that only read or write the positions
+//   ./bench_layout [--quick]
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../mesh/vertexlayout.h"
+
+#include "benchmark.h"
+
+using glm::mat4;
+using glm::vec3;
+using mesh::Vertex;
+
+namespace {
+
+typedef mesh::VertexStream<mesh::StandardFormat> Interleaved;
+typedef mesh::VertexStream<mesh::VertexFormat<mesh::SPLIT, mesh::Position, mesh::Normal,
+    mesh::TextCoords> > Split;
+
+std::vector<Vertex> randomVertices(size_t count) {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  std::vector<Vertex> vertices(count);
+  for (Vertex& v : vertices) {
+    v.position = vec3(uniform(rng), uniform(rng), uniform(rng));
+    v.normal = glm::normalize(vec3(uniform(rng), uniform(rng), uniform(rng)) + vec3(1e-3f));
+    v.textCoords = glm::vec2(uniform(rng), uniform(rng));
+  }
+  return vertices;
+}
+
+// The conversion, the transform and the bounding box of one storage
+template <typename Stream>
+void runStorage(const std::string& name, const std::vector<Vertex>& source, const mat4& T,
+    size_t runs, Stream& stream, bench::Timing& transform, bench::Timing& box) {
+  const std::string size = std::to_string(source.size()) + " vertices";
+  const mesh::ArrayView<Vertex> vertices(source);
+  bench::Timing convert = bench::measure([&]() {
+    stream.assign(vertices);
+  }, runs);
+  bench::printRow("convert, " + name + ", " + size, convert, source.size() / 1e6, "Mverts/s");
+  transform = bench::measure([&]() {
+    stream.assign(vertices);
+  }, [&]() {
+    stream.transformPositions(T);
+  }, runs);
+  bench::printRow("transform, " + name + ", " + size, transform, source.size() / 1e6,
+      "Mverts/s");
+  vec3 lower;
+  vec3 upper;
+  box = bench::measure([&]() {
+    stream.boundingBox(lower, upper);
+  }, runs);
+  bench::printRow("bounds, " + name + ", " + size, box, source.size() / 1e6, "Mverts/s");
+}
+
+void run(size_t count, const bench::Options& options) {
+  const std::vector<Vertex> source = randomVertices(count);
+  const mat4 T = glm::translate(glm::rotate(glm::scale(mat4(1.0f), vec3(2.0f, 1.0f, 0.5f)), 0.7f,
+      vec3(1.0f, 2.0f, 3.0f)), vec3(0.3f, -1.0f, 2.0f));
+  const size_t runs = options.quick ? 3 : 10;
+  Interleaved interleaved;
+  bench::Timing interleavedTransform;
+  bench::Timing interleavedBox;
+  runStorage("interleaved", source, T, runs, interleaved, interleavedTransform, interleavedBox);
+  Split split;
+  bench::Timing splitTransform;
+  bench::Timing splitBox;
+  runStorage("split", source, T, runs, split, splitTransform, splitBox);
+  // Both storages keep the positions that the last run of the transform left
+  vec3 interleavedLower;
+  vec3 interleavedUpper;
+  interleaved.boundingBox(interleavedLower, interleavedUpper);
+  vec3 splitLower;
+  vec3 splitUpper;
+  split.boundingBox(splitLower, splitUpper);
+  const float difference = glm::length(interleavedLower - splitLower) +
+      glm::length(interleavedUpper - splitUpper);
+  char note[128];
+  std::snprintf(note, sizeof(note), "split: %.1fx the interleaved transform, %.1fx the bounds, "
+      "bounds difference %.1e", interleavedTransform.median / splitTransform.median,
+      interleavedBox.median / splitBox.median, difference);
+  bench::printNote(note);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options = bench::parseOptions(argc, argv);
+  bench::printHeader("Vertex storage: interleaved against split, for the position only loops");
+  // In the caches, and one that is bound by the memory
+  run(8192, options);
+  run(options.quick ? 262144 : 2097152, options);
+  return 0;
+}
@@ -0,0 +1,124 @@
+// The native OBJ reader against the Assimp importer on big OBJ files, and the mesh writer
+//   ./bench_obj [--quick] [OBJ files...]
+// Without files it writes a subdivided icosphere (with texture coordinates and normals) and
+// also reads models/Nyra/Nyra_pose.obj if it is there.
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include "../mesh/meshwriter.h"
+#include "../mesh/objreader.h"
+#include "../mesh/proceduralmeshes.h"
+
+#include "benchmark.h"
+
+namespace {
+
+const char* GENERATED = "bench_icosphere.obj";
+
+void run(const std::string& fileName, const bench::Options& options) {
+  std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+  const double megabytes = static_cast<double>(file.tellg()) / (1024.0 * 1024.0);
+  const size_t runs = options.quick ? 1 : 5;
+  std::printf("%s (%.1f MB)\n", fileName.c_str(), megabytes);
+  // The same work on both sides: triangles, welded vertices and smooth normals if missing
+  size_t vertices = 0;
+  size_t triangles = 0;
+  bool native = true;
+  bench::Timing reader = bench::measure([&]() {
+    mesh::ObjReader obj;
+    native = obj.read(fileName);
+    vertices = obj.releaseVertices().size();
+    triangles = obj.releaseIndices().size() / 3;
+  }, runs);
+  if (native) {
+    bench::printRow("native reader", reader, megabytes, "MB/s");
+  } else {
+    bench::printNote("the native reader could not read it");
+  }
+  size_t assimpVertices = 0;
+  bool imported = true;
+  bench::Timing assimp = bench::measure([&]() {
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFile(fileName, aiProcess_GenSmoothNormals |
+        aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+    imported = scene != nullptr;
+    assimpVertices = 0;
+    for (unsigned int m = 0; imported && m < scene->mNumMeshes; ++m) {
+      assimpVertices += scene->mMeshes[m]->mNumVertices;
+    }
+  }, runs);
+  if (imported) {
+    bench::printRow("Assimp", assimp, megabytes, "MB/s");
+  } else {
+    bench::printNote("Assimp could not read it");
+  }
+  char note[128];
+  if (native && imported) {
+    std::snprintf(note, sizeof(note), "%.1fx Assimp, %zu triangles, %zu vertices (Assimp %zu)",
+        assimp.median / reader.median, triangles, vertices, assimpVertices);
+  } else {
+    std::snprintf(note, sizeof(note), "%zu triangles, %zu vertices", triangles, vertices);
+  }
+  bench::printNote(note);
+}
+
+// Writing the same mesh in every format
+void runWriter(const bench::Options& options) {
+  mesh::Mesh sphere = mesh::icosphere(options.quick ? 6 : 9);
+  mesh::MeshData all = {0, 0, static_cast<GLsizei>(sphere.viewIndices().size()), -1, -1, -1,
+      GL_UNSIGNED_INT, 0};
+  const size_t triangles = sphere.viewIndices().size() / 3;
+  const char* names[] = {"write OBJ", "write binary PLY", "write binary STL"};
+  const char* files[] = {"bench_written.obj", "bench_written.ply", "bench_written.stl"};
+  const mesh::MeshFileFormat formats[] = {mesh::OBJ_TEXT, mesh::PLY_BINARY, mesh::STL_BINARY};
+  for (int f = 0; f < 3; ++f) {
+    bool written = true;
+    bench::Timing timing = bench::measure([&]() {
+      written = mesh::writeMesh(files[f], formats[f], sphere.viewVertices(), sphere.viewIndices(),
+          mesh::ArrayView<mesh::MeshData>(&all, 1), true, true);
+    }, options.quick ? 1 : 3);
+    std::ifstream file(files[f], std::ios::binary | std::ios::ate);
+    const double megabytes = static_cast<double>(file.tellg()) / (1024.0 * 1024.0);
+    bench::printRow(names[f], timing, triangles / 1e6, "Mtris/s");
+    char note[96];
+    std::snprintf(note, sizeof(note), written ? "%zu triangles, %.1f MB" : "could not write",
+        triangles, megabytes);
+    bench::printNote(note);
+    std::remove(files[f]);
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options = bench::parseOptions(argc, argv);
+  bool generated = false;
+  if (options.files.empty()) {
+    mesh::Mesh sphere = mesh::icosphere(options.quick ? 6 : 8);
+    mesh::MeshData all = {0, 0, static_cast<GLsizei>(sphere.viewIndices().size()), -1, -1, -1,
+        GL_UNSIGNED_INT, 0};
+    generated = mesh::writeMesh(GENERATED, mesh::OBJ_TEXT, sphere.viewVertices(),
+        sphere.viewIndices(), mesh::ArrayView<mesh::MeshData>(&all, 1), true, true);
+    if (generated) {
+      options.files.push_back(GENERATED);
+    }
+    if (bench::fileExists("models/Nyra/Nyra_pose.obj")) {
+      options.files.push_back("models/Nyra/Nyra_pose.obj");
+    }
+  }
+  bench::printHeader("OBJ reading: native reader and Assimp");
+  for (const std::string& file : options.files) {
+    run(file, options);
+  }
+  if (generated) {
+    std::remove(GENERATED);
+  }
+  bench::printHeader("Mesh writer: the same sphere as OBJ, binary PLY and binary STL");
+  runWriter(options);
+  return 0;
+}
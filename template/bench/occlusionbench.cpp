@@ -0,0 +1,98 @@
+// Occlusion culling of the props of a city behind its buildings, seen from above and from the
+// street (where the walls next to the camera cross the near plane and are clipped)
+//   ./bench_occlusion [--quick]
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../mesh/frustumculler.h"
+#include "../mesh/occlusionculler.h"
+#include "../mesh/proceduralmeshes.h"
+
+#include "benchmark.h"
+
+using glm::mat4;
+using glm::vec3;
+
+namespace {
+
+// Blocks of the grid: a building of BUILDING x BUILDING and a street of the rest
+const float BLOCK = 20.0f;
+const float BUILDING = 12.0f;
+
+// A grid of buildings with small spheres along the streets
+mesh::Model makeCity(int blocks, size_t props) {
+  mesh::Model city;
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> height(20.0f, 40.0f);
+  const float half = 0.5f * blocks * BLOCK;
+  for (int x = 0; x < blocks; ++x) {
+    for (int z = 0; z < blocks; ++z) {
+      const float h = height(rng);
+      mesh::Mesh building = mesh::cube();
+      building.transform(glm::scale(glm::translate(mat4(1.0f),
+          vec3(x * BLOCK - half, 0.5f * h, z * BLOCK - half)), vec3(BUILDING, h, BUILDING)));
+      city.addMesh(std::move(building));
+    }
+  }
+  // In the middle of the streets, between two buildings on x or on z
+  std::uniform_int_distribution<int> anyBlock(0, blocks - 1);
+  std::uniform_real_distribution<float> along(-0.5f * BLOCK, 0.5f * BLOCK);
+  const mesh::Mesh sphere = mesh::icosphere(1);
+  for (size_t p = 0; p < props; ++p) {
+    const float street = (anyBlock(rng) + 0.5f) * BLOCK - half;
+    const float other = anyBlock(rng) * BLOCK - half + along(rng);
+    mesh::Mesh prop = sphere;
+    prop.transform(glm::translate(mat4(1.0f), p % 2 == 0 ? vec3(street, 0.5f, other) :
+        vec3(other, 0.5f, street)));
+    city.addMesh(std::move(prop));
+  }
+  city.generateLods();
+  return city;
+}
+
+void runView(const std::string& name, const mat4& PV, const mesh::Model& city,
+    mesh::FrustumCuller& frustum, mesh::OcclusionCuller& occlusion,
+    const bench::Options& options) {
+  frustum.cull(PV);
+  mesh::OcclusionCullStats stats = {};
+  bench::Timing timing = bench::measure([&]() {
+    stats = occlusion.cull(PV, frustum);
+  }, options.quick ? 5 : 20);
+  bench::printRow("cull, " + name, timing, stats.tested / 1e6, "Mboxes/s");
+  char note[160];
+  std::snprintf(note, sizeof(note), "%zu of %zu occluder triangles rasterized, %zu of %zu boxes "
+      "in the frustum occluded (%zu boxes)", stats.rasterizedTriangles, stats.occluderTriangles,
+      stats.occluded, stats.tested, city.viewSeparators().size());
+  bench::printNote(note);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options = bench::parseOptions(argc, argv);
+  const int blocks = options.quick ? 8 : 16;
+  const mesh::Model city = makeCity(blocks, options.quick ? 2000 : 20000);
+  bench::printHeader("Occlusion culling: " + std::to_string(blocks * blocks) + " buildings and " +
+      std::to_string(city.viewSeparators().size() - blocks * blocks) + " props");
+  mesh::FrustumCuller frustum;
+  frustum.build(city);
+  mesh::OcclusionCuller occlusion;
+  bench::Timing build = bench::measure([&]() {
+    occlusion.build(city);
+  }, options.quick ? 1 : 5);
+  bench::printRow("build", build, city.viewSeparators().size() / 1e6, "Mmeshes/s");
+  const mat4 P = glm::perspective(glm::radians(60.0f), 2.0f, 0.5f, 1000.0f);
+  const float half = 0.5f * blocks * BLOCK;
+  // Over the city, looking down to its center
+  runView("from above", P * glm::lookAt(vec3(-half, 120.0f, -half), vec3(0.0f),
+      vec3(0.0f, 1.0f, 0.0f)), city, frustum, occlusion, options);
+  // In a street, at the height of the props and next to a wall, looking along the street and a
+  // bit towards the wall
+  const vec3 eye(0.5f * BLOCK - half + 0.5f * (BLOCK - BUILDING) - 1.0f, 1.5f, 0.0f);
+  runView("in a street", P * glm::lookAt(eye, eye + vec3(0.3f, 0.0f, -1.0f),
+      vec3(0.0f, 1.0f, 0.0f)), city, frustum, occlusion, options);
+  return 0;
+}
@@ -74,7 +74,15 @@ void mouse_button_callback(GLFWwindow* windowPtr, int button, int action, int mo
     double mouse_y;
     glfwGetCursorPos(windowPtr, &mouse_x, &mouse_y);
     app->mBall.startDrag(glm::ivec2(int(mouse_x), int(mouse_y)));
+    app->mPressPosition = glm::ivec2(int(mouse_x), int(mouse_y));
   } else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE) {
+    // If the mouse did not move it was a click, pick what is under the cursor
+    double mouse_x;
+    double mouse_y;
+    glfwGetCursorPos(windowPtr, &mouse_x, &mouse_y);
+    if (app->mMouseDrag && glm::ivec2(int(mouse_x), int(mouse_y)) == app->mPressPosition) {
+      app->pick(glm::vec2(float(mouse_x), float(mouse_y)));
+    }
     // Stops the mouse dragging (exit edit camera mode)
     app->mBall.endDrag();
     app->mMouseDrag = false;
@@ -1,3 +1,4 @@
+#include <cstring>
 #include <iostream>
 #include <string>
 
@@ -83,6 +84,35 @@ GLuint Texture::get_id() const {
   return m_texture_id;
 }
 
+size_t Texture::get_bytes() const {
+  return m_data.size();
+}
+
+uint64_t Texture::content_hash() const {
+  // FNV-1a over 8 bytes at a time, with a shift so every bit reaches the low ones
+  const uint64_t prime = 1099511628211ull;
+  uint64_t hash = 14695981039346656037ull;
+  hash = (hash ^ ((uint64_t(m_width) << 32) | m_height)) * prime;
+  const size_t words = m_data.size() / sizeof(uint64_t);
+  const unsigned char* data = m_data.data();
+  for (size_t i = 0; i < words; ++i, data += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 32;
+  }
+  for (size_t i = words * sizeof(uint64_t); i < m_data.size(); ++i) {
+    hash = (hash ^ m_data[i]) * prime;
+  }
+  return hash;
+}
+
+bool Texture::same_content(const Texture& other) const {
+  return m_width == other.m_width && m_height == other.m_height &&
+      m_data.size() == other.m_data.size() &&
+      (m_data.empty() || std::memcmp(m_data.data(), other.m_data.data(), m_data.size()) == 0);
+}
+
 void Texture::send_to_gpu() {
   // If you don't have one yet, ask for a GPU handle
   if (m_texture_id == 0) {
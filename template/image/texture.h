@@ -2,6 +2,8 @@
 #define TEXTURE_H_
 
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -45,6 +47,17 @@ public:
   int get_height() const;
   //! Return OpenGL handle for this texture
   GLuint get_id() const;
+  //! Get the size in bytes of the pixels (in main memory, without the mipmaps)
+  size_t get_bytes() const;
+  //! Hash of the size and the pixels, equal for two files with the same image
+  /*!
+    Used to find textures that are loaded more than once under different
+    names (See mesh::Model::mergeTextures). Two different images can still
+    give the same hash, so confirm it with same_content before merging them.
+  */
+  uint64_t content_hash() const;
+  //! Queries if the other texture has the same size and the same pixels
+  bool same_content(const Texture& other) const;
   //! Save the texture data into a file
   bool save(const std::string& output_png_file) const;
   //! Returns a procedurally created texture of a radial diffusee circle
@@ -30,6 +30,25 @@ void TemplateApplication::create_menu() {
       mCurrentAngle = 0.0f; // So, besides setting variable we can execute code
     }
     ImGui::SliderFloat("Alpha", &mAlpha, 1.0f, 16.0f, "%.1f", 2.0f);
+    ImGui::Checkbox("Frustum culling", &mFrustumCulling);
+    if (mFrustumCulling) {
+      ImGui::Checkbox("Culling hierarchy", &mCullingHierarchy);
+      ImGui::Checkbox("Occlusion culling", &mOcclusionCulling);
+    }
+    ImGui::Checkbox("Meshlet culling", &mMeshletCulling);
+    ImGui::Checkbox("Automatic level of detail", &mAutoLod);
+    if (mAutoLod) {
+      ImGui::SliderFloat("Pixel error", &mLodPixelError, 0.25f, 16.0f, "%.2f");
+    } else {
+      ImGui::SliderInt("Level of detail", &mLodLevel, 0, static_cast<int>(mLods.size()));
+    }
+    // Options applied when the model is loaded, changing them loads it again
+    if (ImGui::Checkbox("Estimate overdraw (reloads)", &mEstimateOverdraw)) {
+      mReloadModel = true;
+    }
+    if (ImGui::Checkbox("Packed vertices (reloads)", &mQuantizedVertices)) {
+      mReloadModel = true;
+    }
     if (ImGui::CollapsingHeader("Enviroment info:")) { // Submenu
       ImGui::Text("%s", "Hardware");
       ImGui::TextColored(ImVec4(0,0.5,1,1), "GPU:");
@@ -69,6 +88,86 @@ void TemplateApplication::create_menu() {
       ImGui::Text("Average frame: %.3f ms", 1000.0f / ImGui::GetIO().Framerate);
       ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate);
       ImGui::Text("OpenGL's debug log is %s", mHasDebug ? "enabled" : "disabled");
+      ImGui::Text("Model load: %.1f ms (%s)", 1000.0 * mModelLoadTime,
+          mModelFromCache ? "warm, binary cache" : "cold, Assimp import");
+      ImGui::Text("Model processing: %.1f ms", 1000.0 * mModelProcessTime);
+      ImGui::Text("Vertex cache ACMR: %.3f -> %.3f", mCacheReport.before.acmr,
+          mCacheReport.after.acmr);
+      ImGui::Text("Vertex cache ATVR: %.3f -> %.3f", mCacheReport.before.atvr,
+          mCacheReport.after.atvr);
+      if (mEstimateOverdraw) {
+        ImGui::Text("Overdraw: %.3f -> %.3f", mOverdrawBefore.overdraw,
+            mOverdrawAfter.overdraw);
+      }
+      ImGui::Text("Vertex buffer: %.2f MB (%s)", mVertexBytes / (1024.0 * 1024.0),
+          mQuantizedVertices ? "packed, 16 bytes per vertex" : "32 bytes per vertex");
+      if (mTangentBytes > 0) {
+        ImGui::Text("Tangent buffer: %.2f MB (for the normal maps)",
+            mTangentBytes / (1024.0 * 1024.0));
+      }
+      ImGui::Text("Index buffer: %.2f MB (%.2f MB with 32 bits indices)",
+          mIndexBytes / (1024.0 * 1024.0), mIndexBytes32 / (1024.0 * 1024.0));
+      ImGui::Text("Meshes: %zu loaded, %zu after batching by material", mSeparatorsLoaded,
+          mSeparatorsBatched);
+      ImGui::Text("Draw calls: %zu, texture binds: %zu", mDrawStats.drawCalls,
+          mDrawStats.textureBinds);
+      ImGui::Text("Instances: %zu stored, %zu drawn", mInstanceCount, mDrawStats.instances);
+      ImGui::Text("Scene: %zu nodes in %zu levels, %zu updated in %.3f ms", mScene.size(),
+          mScene.levels(), mSceneStats.updated, 1000.0 * mSceneUpdateTime);
+      ImGui::Text("Textures: %zu sent of %zu, %.2f MB saved (%s)", mTextures.size(),
+          mTexturesLoaded, mTextureBytesSaved / (1024.0 * 1024.0),
+          mDedupTextures ? "same pixels merged" : "merged by path only");
+      ImGui::Text("Levels of detail: %zu, created in %.1f ms", mLodTriangles.size(),
+          1000.0 * mLodTime);
+      for (size_t level = 0; level < mLodTriangles.size(); ++level) {
+        ImGui::Text("  LOD %zu: %zu triangles, error %.2e", level, mLodTriangles[level],
+            mLodErrors[level]);
+      }
+      ImGui::Text("Triangles submitted: %zu of %zu at full detail (%zu meshes simplified)",
+          mLodStats.submittedTriangles, mLodStats.fullTriangles, mLodStats.simplified);
+      if (mFrustumCulling) {
+        ImGui::Text("Frustum: %zu of %zu boxes visible, %zu tests (%zu nodes out, %zu in)",
+            mFrustumStats.visible, mFrustumStats.boxes, mFrustumStats.tests,
+            mFrustumStats.nodesOutside, mFrustumStats.nodesInside);
+        ImGui::Text("Frustum culling: %.3f ms, %.3f ms per 100k boxes", 1000.0 * mFrustumCullTime,
+            mFrustumStats.boxes > 0 ? 1000.0 * mFrustumCullTime * 100000.0 / mFrustumStats.boxes :
+            0.0);
+      }
+      if (mFrustumCulling && mOcclusionCulling) {
+        ImGui::Text("Occlusion: %zu of %zu boxes hidden (%.1f%%), %.3f ms",
+            mOcclusionStats.occluded, mOcclusionStats.tested, mOcclusionStats.tested > 0 ?
+            100.0 * mOcclusionStats.occluded / mOcclusionStats.tested : 0.0,
+            1000.0 * mOcclusionCullTime);
+        ImGui::Text("Occluders: %zu, %zu of %zu triangles rasterized", mOcclusionStats.occluders,
+            mOcclusionStats.rasterizedTriangles, mOcclusionStats.occluderTriangles);
+      }
+      if (mMeshletCulling) {
+        ImGui::Text("Meshlets: %zu, culled %zu (frustum) + %zu (back facing)", mCullStats.meshlets,
+            mCullStats.frustumCulled, mCullStats.backfaceCulled);
+        ImGui::Text("Triangles drawn: %zu of %zu", mCullStats.visibleTriangles,
+            mCullStats.triangles);
+      }
+      if (mQuantizedVertices) {
+        ImGui::Text("Position error: %.2e max, %.2e avg", mQuantizationError.maxPosition,
+            mQuantizationError.averagePosition);
+        ImGui::Text("Normal error: %.4f max, %.4f avg (degrees)",
+            mQuantizationError.maxNormalDegrees, mQuantizationError.averageNormalDegrees);
+        ImGui::Text("Texture coordinates error: %.2e max, %.2e avg",
+            mQuantizationError.maxTextCoords, mQuantizationError.averageTextCoords);
+      }
+    }
+    if (ImGui::CollapsingHeader("Picking (click the model)")) {
+      ImGui::Text("Tree: %zu triangles, %zu nodes, %.2f MB, built in %.1f ms",
+          mPicker.bvh().triangleCount(), mPicker.bvh().nodeCount(),
+          mPicker.bvh().memoryUsage() / (1024.0 * 1024.0), 1000.0 * mPickerBuildTime);
+      if (mPick.hit) {
+        ImGui::Text("Mesh: %zu, triangle: %u", mPick.separator, mPick.triangle);
+        ImGui::Text("Point: (%.3f, %.3f, %.3f)", mPick.point.x, mPick.point.y, mPick.point.z);
+      } else {
+        ImGui::Text("Nothing picked");
+      }
+      ImGui::Text("Pick time: %.3f ms%s", mPick.milliseconds,
+          mPicker.pending() ? " (picking...)" : "");
     }
   ImGui::End();
 }
\ No newline at end of file
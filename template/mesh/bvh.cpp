@@ -0,0 +1,781 @@
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+#include "../parallel/threadpool.h"
+
+#include "bvh.h"
+
+namespace mesh {
+
+using glm::vec2;
+using glm::vec3;
+
+namespace {
+
+// Cost of visiting a node, relative to testing a triangle
+const float TRAVERSAL_COST = 1.0f;
+// Nodes with more triangles than this are split with the binning in parallel
+const size_t PARALLEL_SIZE = 65536;
+// Deeper nodes are split in the middle, so the tree always fits in the stack
+const unsigned int MAX_DEPTH = 32;
+const unsigned int STACK_SIZE = 64;
+const unsigned int COUNT_BITS = 4;
+const unsigned int QUANTIZED_MAX = 65535;
+
+// No constructor, so the arrays of bins are not filled when they are created
+struct Box {
+  vec3 lower;
+  vec3 upper;
+  void grow(const vec3& l, const vec3& u) {
+    lower = vec3(std::min(lower.x, l.x), std::min(lower.y, l.y), std::min(lower.z, l.z));
+    upper = vec3(std::max(upper.x, u.x), std::max(upper.y, u.y), std::max(upper.z, u.z));
+  }
+  void grow(const Box& box) {
+    grow(box.lower, box.upper);
+  }
+  float area() const {
+    vec3 d = upper - lower;
+    return d.x < 0.0f ? 0.0f : 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+};
+
+Box emptyBox() {
+  Box box = {vec3(FLT_MAX), vec3(-FLT_MAX)};
+  return box;
+}
+
+struct Bin {
+  Box box;
+  size_t count;
+};
+
+// The bins of the three axes, small nodes use less of them
+struct Bins {
+  Bin bins[3][Bvh::BINS];
+  unsigned int size;
+  explicit Bins(unsigned int used) : size(used) {
+    for (int a = 0; a < 3; ++a) {
+      for (unsigned int b = 0; b < size; ++b) {
+        bins[a][b].box = emptyBox();
+        bins[a][b].count = 0;
+      }
+    }
+  }
+};
+
+// The bounds of a triangle, moved around with it so the build reads memory in order
+struct Reference {
+  vec3 lower;
+  unsigned int triangle;
+  vec3 upper;
+  float padding;
+  vec3 center() const {
+    return 0.5f * (lower + upper);
+  }
+};
+
+// Builds the tree over the bounds of the triangles, it reorders the references
+class Builder {
+public:
+  Builder(size_t triangles, unsigned int leafSize) : references(triangles),
+      mLeafSize(leafSize) {
+
+  }
+  std::vector<Reference> references;
+  //! Make node a leaf, or create its two children and return true. Their ranges
+  //! are [begin, middle) and [middle, end)
+  bool split(std::vector<BvhNode>& nodes, size_t node, size_t begin, size_t end,
+      unsigned int depth, bool parallel, size_t& middle);
+  //! Build everything under node, serially
+  void subtree(std::vector<BvhNode>& nodes, size_t node, size_t begin, size_t end,
+      unsigned int depth);
+
+private:
+  Box centroidBounds(size_t begin, size_t end, bool parallel) const;
+  void binning(size_t begin, size_t end, const Box& centers, const vec3& scale,
+      Bins& result, bool parallel) const;
+  Box boundsOf(size_t begin, size_t end) const;
+  size_t median(size_t begin, size_t end, const Box& centers);
+  unsigned int mLeafSize;
+};
+
+// Calls body on [begin, end), in parallel chunks or as a single one
+template <typename Body>
+void forRange(size_t begin, size_t end, bool parallel, const Body& body) {
+  if (parallel) {
+    parallel::forEachRange(end - begin, [&](size_t first, size_t last) {
+      body(begin + first, begin + last);
+    }, PARALLEL_SIZE / 8);
+  } else {
+    body(begin, end);
+  }
+}
+
+Box Builder::centroidBounds(size_t begin, size_t end, bool parallel) const {
+  Box result = emptyBox();
+  std::mutex mutex;
+  forRange(begin, end, parallel, [&](size_t first, size_t last) {
+    Box local = emptyBox();
+    for (size_t i = first; i < last; ++i) {
+      vec3 center = references[i].center();
+      local.grow(center, center);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    result.grow(local);
+  });
+  return result;
+}
+
+Box Builder::boundsOf(size_t begin, size_t end) const {
+  Box result = emptyBox();
+  for (size_t i = begin; i < end; ++i) {
+    result.grow(references[i].lower, references[i].upper);
+  }
+  return result;
+}
+
+unsigned int binOf(float coordinate, float lower, float scale, unsigned int bins) {
+  return std::min(static_cast<unsigned int>(std::max(0.0f, (coordinate - lower) * scale)),
+      bins - 1);
+}
+
+void Builder::binning(size_t begin, size_t end, const Box& centers, const vec3& scale,
+    Bins& result, bool parallel) const {
+  std::mutex mutex;
+  const float lower[3] = {centers.lower.x, centers.lower.y, centers.lower.z};
+  const float factor[3] = {scale.x, scale.y, scale.z};
+  forRange(begin, end, parallel, [&](size_t first, size_t last) {
+    Bins local(result.size);
+    for (size_t i = first; i < last; ++i) {
+      const Reference& r = references[i];
+      const float center[3] = {0.5f * (r.lower.x + r.upper.x), 0.5f * (r.lower.y + r.upper.y),
+          0.5f * (r.lower.z + r.upper.z)};
+      for (int a = 0; a < 3; ++a) {
+        if (factor[a] > 0.0f) {
+          Bin& bin = local.bins[a][binOf(center[a], lower[a], factor[a], result.size)];
+          bin.box.grow(r.lower, r.upper);
+          bin.count++;
+        }
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int a = 0; a < 3; ++a) {
+      for (unsigned int b = 0; b < result.size; ++b) {
+        result.bins[a][b].box.grow(local.bins[a][b].box);
+        result.bins[a][b].count += local.bins[a][b].count;
+      }
+    }
+  });
+}
+
+size_t Builder::median(size_t begin, size_t end, const Box& centers) {
+  vec3 extent = centers.upper - centers.lower;
+  int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+  size_t middle = begin + (end - begin) / 2;
+  std::nth_element(references.begin() + begin, references.begin() + middle,
+      references.begin() + end, [&](const Reference& a, const Reference& b) {
+    return a.lower[axis] + a.upper[axis] < b.lower[axis] + b.upper[axis];
+  });
+  return middle;
+}
+
+bool Builder::split(std::vector<BvhNode>& nodes, size_t node, size_t begin, size_t end,
+    unsigned int depth, bool parallel, size_t& middle) {
+  const size_t count = end - begin;
+  if (count <= 1) {
+    nodes[node].offset = static_cast<unsigned int>(begin);
+    nodes[node].count = static_cast<unsigned int>(count);
+    return false;
+  }
+  Box centers = centroidBounds(begin, end, parallel);
+  vec3 extent = centers.upper - centers.lower;
+  const unsigned int binCount = static_cast<unsigned int>(std::min(size_t(Bvh::BINS),
+      std::max(size_t(4), count)));
+  vec3 scale(0.0f);
+  for (int a = 0; a < 3; ++a) {
+    scale[a] = extent[a] > 0.0f ? binCount * (1.0f - 1e-5f) / extent[a] : 0.0f;
+  }
+  // The best split is after bin bestBin along bestAxis
+  int bestAxis = -1;
+  unsigned int bestBin = 0;
+  float bestCost = FLT_MAX;
+  Box bestLeft = emptyBox();
+  Box bestRight = emptyBox();
+  if (scale != vec3(0.0f) && depth < MAX_DEPTH) {
+    Bins bins(binCount);
+    binning(begin, end, centers, scale, bins, parallel);
+    for (int a = 0; a < 3; ++a) {
+      if (scale[a] == 0.0f) {
+        continue;
+      }
+      // Sweep from the right, then evaluate from the left
+      Box rightBoxes[Bvh::BINS];
+      size_t rightCounts[Bvh::BINS];
+      Box box = emptyBox();
+      size_t sum = 0;
+      for (unsigned int b = binCount - 1; b > 0; --b) {
+        box.grow(bins.bins[a][b].box);
+        sum += bins.bins[a][b].count;
+        rightBoxes[b] = box;
+        rightCounts[b] = sum;
+      }
+      box = emptyBox();
+      sum = 0;
+      for (unsigned int b = 0; b + 1 < binCount; ++b) {
+        box.grow(bins.bins[a][b].box);
+        sum += bins.bins[a][b].count;
+        if (sum == 0 || rightCounts[b + 1] == 0) {
+          continue;
+        }
+        float cost = box.area() * sum + rightBoxes[b + 1].area() * rightCounts[b + 1];
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestAxis = a;
+          bestBin = b;
+          bestLeft = box;
+          bestRight = rightBoxes[b + 1];
+        }
+      }
+    }
+  }
+  const BvhNode& current = nodes[node];
+  Box bounds = emptyBox();
+  bounds.grow(current.lower, current.upper);
+  float area = bounds.area();
+  float splitCost = TRAVERSAL_COST + (area > 0.0f ? bestCost / area : 0.0f);
+  if (count <= mLeafSize && (bestAxis < 0 || static_cast<float>(count) <= splitCost)) {
+    nodes[node].offset = static_cast<unsigned int>(begin);
+    nodes[node].count = static_cast<unsigned int>(count);
+    return false;
+  }
+  middle = begin;
+  if (bestAxis >= 0) {
+    const int a = bestAxis;
+    middle = std::partition(references.begin() + begin, references.begin() + end,
+        [&](const Reference& r) {
+      return binOf(r.center()[a], centers.lower[a], scale[a], binCount) <= bestBin;
+    }) - references.begin();
+  }
+  if (middle == begin || middle == end) {
+    // All the centers are equal (or too deep): any half is as good
+    middle = median(begin, end, centers);
+    bestLeft = boundsOf(begin, middle);
+    bestRight = boundsOf(middle, end);
+  }
+  size_t left = nodes.size();
+  nodes.resize(left + 2);
+  nodes[node].offset = static_cast<unsigned int>(left);
+  nodes[node].count = 0;
+  nodes[left].lower = bestLeft.lower;
+  nodes[left].upper = bestLeft.upper;
+  nodes[left + 1].lower = bestRight.lower;
+  nodes[left + 1].upper = bestRight.upper;
+  return true;
+}
+
+void Builder::subtree(std::vector<BvhNode>& nodes, size_t node, size_t begin, size_t end,
+    unsigned int depth) {
+  size_t middle;
+  if (split(nodes, node, begin, end, depth, false, middle)) {
+    size_t left = nodes[node].offset;
+    subtree(nodes, left, begin, middle, depth + 1);
+    subtree(nodes, left + 1, middle, end, depth + 1);
+  }
+}
+
+// A node of the top of the tree, whose subtree is built later
+struct Pending {
+  size_t node;
+  size_t begin;
+  size_t end;
+  unsigned int depth;
+};
+
+// Entry distance of a ray in a box, or FLT_MAX if it misses it before limit
+float rayBox(const vec3& lower, const vec3& upper, const vec3& origin, const vec3& inverse,
+    float limit) {
+  vec3 t0 = (lower - origin) * inverse;
+  vec3 t1 = (upper - origin) * inverse;
+  vec3 entries = glm::min(t0, t1);
+  vec3 exits = glm::max(t0, t1);
+  float enter = std::max(std::max(entries.x, entries.y), std::max(entries.z, 0.0f));
+  float exit = std::min(std::min(exits.x, exits.y), std::min(exits.z, limit));
+  return enter <= exit ? enter : FLT_MAX;
+}
+
+// Moller-Trumbore, both sides
+bool rayTriangle(const vec3& origin, const vec3& direction, const vec3* p, float& t,
+    vec2& barycentric) {
+  vec3 e1 = p[1] - p[0];
+  vec3 e2 = p[2] - p[0];
+  vec3 pv = glm::cross(direction, e2);
+  float det = glm::dot(e1, pv);
+  if (det == 0.0f) {
+    return false;
+  }
+  float inverse = 1.0f / det;
+  vec3 tv = origin - p[0];
+  float u = glm::dot(tv, pv) * inverse;
+  if (u < 0.0f || u > 1.0f) {
+    return false;
+  }
+  vec3 qv = glm::cross(tv, e1);
+  float v = glm::dot(direction, qv) * inverse;
+  if (v < 0.0f || u + v > 1.0f) {
+    return false;
+  }
+  t = glm::dot(e2, qv) * inverse;
+  barycentric = vec2(u, v);
+  return t >= 0.0f;
+}
+
+float pointBox2(const vec3& point, const vec3& lower, const vec3& upper) {
+  vec3 d = glm::max(glm::max(lower - point, point - upper), vec3(0.0f));
+  return glm::dot(d, d);
+}
+
+// Closest point of a triangle (Ericson, Real-Time Collision Detection 5.1.5)
+vec3 pointTriangle(const vec3& point, const vec3* p) {
+  vec3 ab = p[1] - p[0];
+  vec3 ac = p[2] - p[0];
+  vec3 ap = point - p[0];
+  float d1 = glm::dot(ab, ap);
+  float d2 = glm::dot(ac, ap);
+  if (d1 <= 0.0f && d2 <= 0.0f) {
+    return p[0];
+  }
+  vec3 bp = point - p[1];
+  float d3 = glm::dot(ab, bp);
+  float d4 = glm::dot(ac, bp);
+  if (d3 >= 0.0f && d4 <= d3) {
+    return p[1];
+  }
+  float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+    return p[0] + ab * (d1 / (d1 - d3));
+  }
+  vec3 cp = point - p[2];
+  float d5 = glm::dot(ab, cp);
+  float d6 = glm::dot(ac, cp);
+  if (d6 >= 0.0f && d5 <= d6) {
+    return p[2];
+  }
+  float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+    return p[0] + ac * (d2 / (d2 - d6));
+  }
+  float va = d3 * d6 - d5 * d4;
+  if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) {
+    return p[1] + (p[2] - p[1]) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  }
+  float denominator = va + vb + vc;
+  if (denominator == 0.0f) {
+    // Degenerated triangle
+    return p[0];
+  }
+  float v = vb / denominator;
+  float w = vc / denominator;
+  return p[0] + ab * v + ac * w;
+}
+
+} // namespace
+
+Bvh::Bvh(unsigned int leafSize, bool quantized) : mLeafSize(std::max(1u,
+    std::min(leafSize, static_cast<unsigned int>(MAX_LEAF_SIZE)))), mQuantized(quantized),
+    mOrigin(0.0f), mScale(0.0f) {
+
+}
+
+void Bvh::build(const Model& model) {
+  ArrayView<InstanceRange> instances = model.viewInstanceRanges();
+  if (instances.empty()) {
+    build(model.viewVertices(), model.viewIndices(), model.viewSeparators());
+    return;
+  }
+  // The separators with instances are not drawn where they are stored
+  std::vector<MeshData> separators;
+  ArrayView<MeshData> all = model.viewSeparators();
+  for (size_t i = 0; i < all.size(); ++i) {
+    if (instances[i].count == 0) {
+      separators.push_back(all[i]);
+    }
+  }
+  build(model.viewVertices(), model.viewIndices(), ArrayView<MeshData>(separators));
+}
+
+void Bvh::build(const Mesh& mesh) {
+  ArrayView<unsigned int> indices = mesh.viewIndices();
+  // All the mesh is a single range
+  MeshData all = {0, 0, static_cast<GLsizei>(indices.size()), -1, -1, -1, GL_UNSIGNED_INT, 0};
+  build(mesh.viewVertices(), indices, ArrayView<MeshData>(&all, 1));
+}
+
+void Bvh::build(ArrayView<Vertex> vertices, ArrayView<unsigned int> indices,
+    ArrayView<MeshData> separators) {
+  mNodes.clear();
+  mQuantizedNodes.clear();
+  // The triangles of every separator, with their corners in the whole vertex buffer
+  std::vector<size_t> firstOf(separators.size() + 1, 0);
+  for (size_t i = 0; i < separators.size(); ++i) {
+    firstOf[i + 1] = firstOf[i] + separators[i].howMany / 3;
+  }
+  const size_t n = firstOf.back();
+  std::vector<unsigned int> corners(3 * n);
+  std::vector<unsigned int> triangles(n);
+  parallel::forEachRange(separators.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const MeshData& sep = separators[i];
+      for (size_t t = firstOf[i]; t < firstOf[i + 1]; ++t) {
+        size_t k = 3 * (t - firstOf[i]);
+        triangles[t] = static_cast<unsigned int>(sep.startIndex / 3 + k / 3);
+        for (int c = 0; c < 3; ++c) {
+          corners[3 * t + c] = sep.startVertex + indices[sep.startIndex + k + c];
+        }
+      }
+    }
+  }, 1);
+  Builder builder(n, mLeafSize);
+  Box bounds = emptyBox();
+  std::mutex mutex;
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    Box local = emptyBox();
+    for (size_t t = first; t < last; ++t) {
+      const vec3& p0 = vertices[corners[3 * t]].position;
+      const vec3& p1 = vertices[corners[3 * t + 1]].position;
+      const vec3& p2 = vertices[corners[3 * t + 2]].position;
+      Reference& r = builder.references[t];
+      r.lower = glm::min(p0, glm::min(p1, p2));
+      r.upper = glm::max(p0, glm::max(p1, p2));
+      r.triangle = static_cast<unsigned int>(t);
+      r.padding = 0.0f;
+      local.grow(r.lower, r.upper);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    bounds.grow(local);
+  });
+  if (n == 0) {
+    mPositions.clear();
+    mCorners.clear();
+    mTriangles.clear();
+    return;
+  }
+  mNodes.reserve(2 * n / mLeafSize + 1);
+  mNodes.resize(1);
+  mNodes[0].lower = bounds.lower;
+  mNodes[0].upper = bounds.upper;
+  // The top of the tree splits the big nodes with parallel binning
+  const size_t subtreeSize = std::max(PARALLEL_SIZE / 16, n / 64);
+  std::vector<Pending> pending(1, Pending{0, 0, n, 0});
+  std::vector<Pending> subtrees;
+  while (!pending.empty()) {
+    Pending job = pending.back();
+    pending.pop_back();
+    if (job.end - job.begin <= subtreeSize) {
+      subtrees.push_back(job);
+      continue;
+    }
+    size_t middle;
+    if (builder.split(mNodes, job.node, job.begin, job.end, job.depth,
+        job.end - job.begin > PARALLEL_SIZE, middle)) {
+      size_t left = mNodes[job.node].offset;
+      pending.push_back(Pending{left, job.begin, middle, job.depth + 1});
+      pending.push_back(Pending{left + 1, middle, job.end, job.depth + 1});
+    }
+  }
+  // Then every subtree is built on its own and appended
+  std::vector<std::vector<BvhNode> > parts(subtrees.size());
+  parallel::forEachRange(subtrees.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const Pending& job = subtrees[i];
+      parts[i].resize(1, mNodes[job.node]);
+      builder.subtree(parts[i], 0, job.begin, job.end, job.depth);
+    }
+  }, 1);
+  for (size_t i = 0; i < subtrees.size(); ++i) {
+    // The local node k > 0 goes to base + k - 1, the local root replaces the pending node
+    const std::vector<BvhNode>& part = parts[i];
+    const unsigned int base = static_cast<unsigned int>(mNodes.size());
+    for (size_t k = 0; k < part.size(); ++k) {
+      BvhNode node = part[k];
+      if (node.count == 0) {
+        node.offset = base + node.offset - 1;
+      }
+      if (k == 0) {
+        mNodes[subtrees[i].node] = node;
+      } else {
+        mNodes.push_back(node);
+      }
+    }
+  }
+  // The triangles in the order of the leaves
+  mPositions.resize(3 * n);
+  mCorners.resize(3 * n);
+  mTriangles.resize(n);
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      unsigned int t = builder.references[i].triangle;
+      mTriangles[i] = triangles[t];
+      for (int c = 0; c < 3; ++c) {
+        mCorners[3 * i + c] = corners[3 * t + c];
+        mPositions[3 * i + c] = vertices[corners[3 * t + c]].position;
+      }
+    }
+  });
+  if (mQuantized) {
+    quantize();
+  }
+}
+
+void Bvh::quantize() {
+  mOrigin = mNodes[0].lower;
+  mScale = glm::max(mNodes[0].upper - mNodes[0].lower, vec3(FLT_MIN)) /
+      static_cast<float>(QUANTIZED_MAX);
+  mQuantizedNodes.resize(mNodes.size());
+  parallel::forEachRange(mNodes.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const BvhNode& node = mNodes[i];
+      QuantizedBvhNode& q = mQuantizedNodes[i];
+      for (int a = 0; a < 3; ++a) {
+        // One extra step on each side covers the rounding of the decoding
+        float lower = std::floor((node.lower[a] - mOrigin[a]) / mScale[a]) - 1.0f;
+        float upper = std::ceil((node.upper[a] - mOrigin[a]) / mScale[a]) + 1.0f;
+        q.lower[a] = static_cast<unsigned short>(glm::clamp(lower, 0.0f, float(QUANTIZED_MAX)));
+        q.upper[a] = static_cast<unsigned short>(glm::clamp(upper, 0.0f, float(QUANTIZED_MAX)));
+      }
+      q.offsetAndCount = (node.offset << COUNT_BITS) | node.count;
+    }
+  });
+  mNodes.clear();
+  mNodes.shrink_to_fit();
+}
+
+void Bvh::node(size_t i, vec3& lower, vec3& upper, unsigned int& offset,
+    unsigned int& count) const {
+  if (mQuantized) {
+    const QuantizedBvhNode& q = mQuantizedNodes[i];
+    lower = mOrigin + mScale * vec3(q.lower[0], q.lower[1], q.lower[2]);
+    upper = mOrigin + mScale * vec3(q.upper[0], q.upper[1], q.upper[2]);
+    offset = q.offsetAndCount >> COUNT_BITS;
+    count = q.offsetAndCount & ((1u << COUNT_BITS) - 1);
+  } else {
+    const BvhNode& node = mNodes[i];
+    lower = node.lower;
+    upper = node.upper;
+    offset = node.offset;
+    count = node.count;
+  }
+}
+
+void Bvh::refit(ArrayView<Vertex> vertices) {
+  if (empty()) {
+    return;
+  }
+  parallel::forEachRange(mCorners.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      mPositions[i] = vertices[mCorners[i]].position;
+    }
+  });
+  if (mQuantized) {
+    // Back to full precision, only the structure is needed
+    mNodes.resize(mQuantizedNodes.size());
+    for (size_t i = 0; i < mNodes.size(); ++i) {
+      node(i, mNodes[i].lower, mNodes[i].upper, mNodes[i].offset, mNodes[i].count);
+    }
+  }
+  // The leaves in parallel, then the children always come after their parent
+  parallel::forEachRange(mNodes.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      BvhNode& node = mNodes[i];
+      if (node.count == 0) {
+        continue;
+      }
+      Box box = emptyBox();
+      for (size_t k = 3 * node.offset; k < 3 * (node.offset + node.count); ++k) {
+        box.grow(mPositions[k], mPositions[k]);
+      }
+      node.lower = box.lower;
+      node.upper = box.upper;
+    }
+  });
+  for (size_t i = mNodes.size(); i-- > 0;) {
+    BvhNode& node = mNodes[i];
+    if (node.count == 0) {
+      const BvhNode& left = mNodes[node.offset];
+      const BvhNode& right = mNodes[node.offset + 1];
+      node.lower = glm::min(left.lower, right.lower);
+      node.upper = glm::max(left.upper, right.upper);
+    }
+  }
+  if (mQuantized) {
+    quantize();
+  }
+}
+
+bool Bvh::intersect(const vec3& origin, const vec3& direction, BvhRayHit& hit,
+    float maxDistance) const {
+  if (empty()) {
+    return false;
+  }
+  const vec3 inverse = vec3(1.0f) / direction;
+  float best = maxDistance;
+  bool found = false;
+  vec3 lower, upper;
+  unsigned int offset, count;
+  node(0, lower, upper, offset, count);
+  if (rayBox(lower, upper, origin, inverse, best) == FLT_MAX) {
+    return false;
+  }
+  unsigned int stack[STACK_SIZE];
+  unsigned int top = 0;
+  unsigned int current = 0;
+  while (true) {
+    node(current, lower, upper, offset, count);
+    if (count > 0) {
+      for (unsigned int k = offset; k < offset + count; ++k) {
+        float t;
+        vec2 barycentric;
+        if (rayTriangle(origin, direction, &mPositions[3 * k], t, barycentric) && t <= best) {
+          best = t;
+          found = true;
+          hit.distance = t;
+          hit.triangle = mTriangles[k];
+          hit.barycentric = barycentric;
+        }
+      }
+    } else {
+      // Visit the closest child first, the other one later
+      unsigned int childOffset, childCount;
+      node(offset, lower, upper, childOffset, childCount);
+      float closer = rayBox(lower, upper, origin, inverse, best);
+      node(offset + 1, lower, upper, childOffset, childCount);
+      float further = rayBox(lower, upper, origin, inverse, best);
+      unsigned int first = offset;
+      unsigned int second = offset + 1;
+      if (further < closer) {
+        std::swap(closer, further);
+        std::swap(first, second);
+      }
+      if (closer != FLT_MAX) {
+        if (further != FLT_MAX) {
+          stack[top++] = second;
+        }
+        current = first;
+        continue;
+      }
+    }
+    if (top == 0) {
+      break;
+    }
+    current = stack[--top];
+  }
+  return found;
+}
+
+bool Bvh::intersectSegment(const vec3& from, const vec3& to, BvhRayHit& hit) const {
+  vec3 direction = to - from;
+  float length = glm::length(direction);
+  if (length == 0.0f) {
+    return false;
+  }
+  return intersect(from, direction / length, hit, length);
+}
+
+bool Bvh::closestPoint(const vec3& point, BvhClosestPoint& result, float maxDistance) const {
+  if (empty()) {
+    return false;
+  }
+  float best2 = maxDistance < FLT_MAX ? maxDistance * maxDistance : FLT_MAX;
+  bool found = false;
+  vec3 lower, upper;
+  unsigned int offset, count;
+  unsigned int stack[STACK_SIZE];
+  unsigned int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    unsigned int current = stack[--top];
+    node(current, lower, upper, offset, count);
+    if (pointBox2(point, lower, upper) >= best2) {
+      continue;
+    }
+    if (count > 0) {
+      for (unsigned int k = offset; k < offset + count; ++k) {
+        vec3 closest = pointTriangle(point, &mPositions[3 * k]);
+        float d2 = glm::length2(closest - point);
+        if (d2 < best2) {
+          best2 = d2;
+          found = true;
+          result.point = closest;
+          result.triangle = mTriangles[k];
+        }
+      }
+      continue;
+    }
+    // Push the furthest child first, so the closest one is visited next
+    unsigned int childOffset, childCount;
+    node(offset, lower, upper, childOffset, childCount);
+    float left = pointBox2(point, lower, upper);
+    node(offset + 1, lower, upper, childOffset, childCount);
+    float right = pointBox2(point, lower, upper);
+    if (left < right) {
+      stack[top++] = offset + 1;
+      stack[top++] = offset;
+    } else {
+      stack[top++] = offset;
+      stack[top++] = offset + 1;
+    }
+  }
+  if (found) {
+    result.distance = std::sqrt(best2);
+  }
+  return found;
+}
+
+bool Bvh::empty() const {
+  return mTriangles.empty();
+}
+
+size_t Bvh::triangleCount() const {
+  return mTriangles.size();
+}
+
+size_t Bvh::nodeCount() const {
+  return mQuantized ? mQuantizedNodes.size() : mNodes.size();
+}
+
+size_t Bvh::memoryUsage() const {
+  return mNodes.size() * sizeof(BvhNode) + mQuantizedNodes.size() * sizeof(QuantizedBvhNode) +
+      mPositions.size() * sizeof(vec3) + mCorners.size() * sizeof(unsigned int) +
+      mTriangles.size() * sizeof(unsigned int);
+}
+
+float Bvh::cost() const {
+  if (empty()) {
+    return 0.0f;
+  }
+  vec3 lower, upper;
+  unsigned int offset, count;
+  double total = 0.0;
+  double rootArea = 0.0;
+  for (size_t i = 0; i < nodeCount(); ++i) {
+    node(i, lower, upper, offset, count);
+    Box box = emptyBox();
+    box.grow(lower, upper);
+    double area = box.area();
+    if (i == 0) {
+      rootArea = area;
+    }
+    total += area * (count > 0 ? static_cast<double>(count) : TRAVERSAL_COST);
+  }
+  return rootArea > 0.0 ? static_cast<float>(total / rootArea) : 0.0f;
+}
+
+unsigned int Bvh::triangleOf(size_t place) const {
+  return mTriangles[place];
+}
+
+ArrayView<BvhNode> Bvh::viewNodes() const {
+  return ArrayView<BvhNode>(mNodes);
+}
+
+} // namespace mesh
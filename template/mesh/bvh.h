@@ -0,0 +1,147 @@
+#ifndef MESH_BVH_H_
+#define MESH_BVH_H_
+
+#include <cfloat>
+#include <cstddef>
+#include <vector>
+
+#include "model.h"
+
+namespace mesh {
+
+//! A node of a \class Bvh (32 bytes)
+/*!
+  Inner nodes have count zero and offset is the index of the first child, the
+  second one is next to it. Leaves have the triangles [offset, offset + count)
+  in the order of the tree (See Bvh::triangleOf).
+*/
+struct BvhNode {
+  glm::vec3 lower;
+  unsigned int offset;
+  glm::vec3 upper;
+  unsigned int count;
+};
+
+//! A node of a \class Bvh with its bounds quantized to 16 bits (16 bytes)
+/*!
+  The bounds are rounded outwards on a grid over the bounds of the whole
+  tree, so they are conservative. The four lower bits of offsetAndCount are
+  the count and the rest is the offset (See \struct BvhNode).
+*/
+struct QuantizedBvhNode {
+  unsigned short lower[3];
+  unsigned short upper[3];
+  unsigned int offsetAndCount;
+};
+
+//! The closest intersection of a ray with the triangles
+struct BvhRayHit {
+  //! Distance along the ray, in units of the direction
+  float distance;
+  //! Triangle hit: its first index is at 3 * triangle in the index buffer
+  unsigned int triangle;
+  //! The point is (1 - u - v) * p0 + u * p1 + v * p2
+  glm::vec2 barycentric;
+};
+
+//! The closest point of the triangles to a query point
+struct BvhClosestPoint {
+  glm::vec3 point;
+  float distance;
+  //! Triangle of the point: its first index is at 3 * triangle in the index buffer
+  unsigned int triangle;
+};
+
+//! Bounding volume hierarchy over the triangles of a \class Mesh or \class Model
+/*!
+  It is built top down, splitting every node where the surface area heuristic
+  (SAH) estimates the cheapest traversal. The candidate splits are the limits
+  of a few bins along each axis. The top of the tree is built with the binning
+  done in parallel, then the subtrees are built in parallel.
+
+  The tree keeps its own copy of the positions of the triangles, in the order
+  of the leaves, so the queries do not touch the vertex buffer. After the
+  vertices move (for example Mesh::transform) call refit, which updates the
+  bounds without changing the tree. A big deformation makes the tree slower,
+  but never wrong.
+
+  Queries are read only, so several threads can use the same tree.
+*/
+class Bvh {
+public:
+  //! Default and maximum number of triangles per leaf
+  static const unsigned int DEFAULT_LEAF_SIZE = 4;
+  static const unsigned int MAX_LEAF_SIZE = 15;
+  //! Number of bins per axis used to find the splits
+  static const unsigned int BINS = 16;
+  //! Creates an empty tree
+  /*!
+    @param leafSize maximum triangles per leaf (up to MAX_LEAF_SIZE)
+    @param quantized store the nodes in 16 bytes (See \struct QuantizedBvhNode)
+  */
+  explicit Bvh(unsigned int leafSize = DEFAULT_LEAF_SIZE, bool quantized = false);
+  //! Clear and build the tree of all the separators of a Model (not the levels of detail)
+  /*!
+    The separators with instances (See Model::viewInstanceRanges) are left out.
+  */
+  void build(const Model& model);
+  //! Clear and build the tree of a Mesh
+  void build(const Mesh& mesh);
+  //! Clear and build the tree of the given ranges (indices relative to startVertex)
+  void build(ArrayView<Vertex> vertices, ArrayView<unsigned int> indices,
+      ArrayView<MeshData> separators);
+  //! Update the bounds after the vertices moved (same mesh, same triangles)
+  void refit(ArrayView<Vertex> vertices);
+  //! Closest intersection along a ray
+  /*!
+    @param origin start of the ray
+    @param direction direction of the ray, the distances are in its units
+    @param hit the closest intersection, only written if there is one
+    @param maxDistance ignore the intersections further than this
+    @return true if the ray hits a triangle (from any side)
+  */
+  bool intersect(const glm::vec3& origin, const glm::vec3& direction, BvhRayHit& hit,
+      float maxDistance = FLT_MAX) const;
+  //! Closest intersection of the segment from -> to (the distance is measured from)
+  bool intersectSegment(const glm::vec3& from, const glm::vec3& to, BvhRayHit& hit) const;
+  //! Closest point on the triangles to a point
+  /*!
+    @return false if there is no triangle closer than maxDistance
+  */
+  bool closestPoint(const glm::vec3& point, BvhClosestPoint& result,
+      float maxDistance = FLT_MAX) const;
+  //! Queries if there are no triangles in the tree
+  bool empty() const;
+  //! Number of triangles and nodes
+  size_t triangleCount() const;
+  size_t nodeCount() const;
+  //! Bytes used by the nodes and the triangles
+  size_t memoryUsage() const;
+  //! The SAH cost of the tree (the expected work of a random ray, relative to a single triangle)
+  float cost() const;
+  //! The triangle (its place in the index buffer divided by three) at a place in the tree
+  unsigned int triangleOf(size_t place) const;
+  //! Read only view of the nodes, the root is the first one (empty if quantized)
+  ArrayView<BvhNode> viewNodes() const;
+
+private:
+  // Bounds and children of node i, in either layout
+  void node(size_t i, glm::vec3& lower, glm::vec3& upper, unsigned int& offset,
+      unsigned int& count) const;
+  void quantize();
+  unsigned int mLeafSize;
+  bool mQuantized;
+  std::vector<BvhNode> mNodes;
+  std::vector<QuantizedBvhNode> mQuantizedNodes;
+  // Quantization grid: bound = mOrigin + q * mScale
+  glm::vec3 mOrigin;
+  glm::vec3 mScale;
+  // Three per triangle, in the order of the leaves
+  std::vector<glm::vec3> mPositions;
+  std::vector<unsigned int> mCorners;
+  std::vector<unsigned int> mTriangles;
+};
+
+} // namespace mesh
+
+#endif
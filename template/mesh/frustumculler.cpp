@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+// The AVX2 test is compiled for its own target and only called if the CPU has it
+#if defined(__SSE2__) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MESH_AVX2_CULLING
+#include <immintrin.h>
+#endif
+
+#include "../parallel/threadpool.h"
+
+#include "frustumculler.h"
+
+namespace mesh {
+
+using glm::vec3;
+using glm::vec4;
+
+namespace {
+
+// Children per node of the hierarchy, and boxes per SIMD test
+const size_t WIDTH = 8;
+const size_t SHIFT = 3;
+// Blocks of 8 boxes per parallel task, when the hierarchy is not used
+const size_t GRAIN = 256;
+// Bounds of an empty box, always outside
+const float EMPTY_MIN = FLT_MAX;
+const float EMPTY_MAX = -FLT_MAX;
+
+// The planes and, for every one of them, the bounds arrays of its corners
+// (0 to 2 are min x, y, z and 3 to 5 max x, y, z)
+struct PlaneSet {
+  float coefficients[6][4];
+  int farCorner[6][3];
+  int nearCorner[6][3];
+};
+
+PlaneSet makePlaneSet(const glm::mat4& PVM) {
+  vec4 planes[6];
+  frustumPlanes(PVM, planes);
+  PlaneSet set;
+  for (int p = 0; p < 6; ++p) {
+    for (int k = 0; k < 4; ++k) {
+      set.coefficients[p][k] = planes[p][k];
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+      const bool positive = planes[p][axis] >= 0.0f;
+      set.farCorner[p][axis] = positive ? axis + 3 : axis;
+      set.nearCorner[p][axis] = positive ? axis : axis + 3;
+    }
+  }
+  return set;
+}
+
+// Morton code of a point in [0, 1023]^3
+uint32_t expandBits(uint32_t v) {
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+// The box of a box transformed by T (from its center and half extent)
+void transformBox(const glm::mat4& T, const vec3& lower, const vec3& upper, vec3& outLower,
+    vec3& outUpper) {
+  if (lower.x > upper.x) {
+    outLower = lower;
+    outUpper = upper;
+    return;
+  }
+  const vec3 center = vec3(T * vec4(0.5f * (lower + upper), 1.0f));
+  const vec3 half = 0.5f * (upper - lower);
+  vec3 extent(0.0f);
+  for (int c = 0; c < 3; ++c) {
+    extent += glm::abs(vec3(T[c])) * half[c];
+  }
+  outLower = center - extent;
+  outUpper = center + extent;
+}
+
+// Test 8 boxes: a bit per box in outside (behind a plane) and inside (in front of all)
+void testScalar(const float* const bounds[6], size_t first, const PlaneSet& set, int& outside,
+    int& inside) {
+  outside = 0;
+  inside = 0;
+  for (size_t k = 0; k < WIDTH; ++k) {
+    const size_t i = first + k;
+    bool in = true;
+    bool out = false;
+    for (int p = 0; p < 6 && !out; ++p) {
+      const float* c = set.coefficients[p];
+      const int* far = set.farCorner[p];
+      const int* near = set.nearCorner[p];
+      out = c[0] * bounds[far[0]][i] + c[1] * bounds[far[1]][i] + c[2] * bounds[far[2]][i] +
+          c[3] < 0.0f;
+      in = in && c[0] * bounds[near[0]][i] + c[1] * bounds[near[1]][i] +
+          c[2] * bounds[near[2]][i] + c[3] >= 0.0f;
+    }
+    if (out) {
+      outside |= 1 << k;
+    } else if (in) {
+      inside |= 1 << k;
+    }
+  }
+}
+
+#if defined(__SSE2__)
+void testSse2(const float* const bounds[6], size_t first, const PlaneSet& set, int& outside,
+    int& inside) {
+  outside = 0;
+  inside = 0;
+  const __m128 zero = _mm_setzero_ps();
+  for (size_t half = 0; half < WIDTH; half += 4) {
+    const size_t i = first + half;
+    __m128 out = _mm_setzero_ps();
+    __m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; ++p) {
+      const float* c = set.coefficients[p];
+      const int* far = set.farCorner[p];
+      const int* near = set.nearCorner[p];
+      const __m128 a = _mm_set1_ps(c[0]);
+      const __m128 b = _mm_set1_ps(c[1]);
+      const __m128 e = _mm_set1_ps(c[2]);
+      const __m128 d = _mm_set1_ps(c[3]);
+      __m128 farDistance = _mm_add_ps(_mm_add_ps(
+          _mm_mul_ps(a, _mm_loadu_ps(bounds[far[0]] + i)),
+          _mm_mul_ps(b, _mm_loadu_ps(bounds[far[1]] + i))),
+          _mm_add_ps(_mm_mul_ps(e, _mm_loadu_ps(bounds[far[2]] + i)), d));
+      __m128 nearDistance = _mm_add_ps(_mm_add_ps(
+          _mm_mul_ps(a, _mm_loadu_ps(bounds[near[0]] + i)),
+          _mm_mul_ps(b, _mm_loadu_ps(bounds[near[1]] + i))),
+          _mm_add_ps(_mm_mul_ps(e, _mm_loadu_ps(bounds[near[2]] + i)), d));
+      out = _mm_or_ps(out, _mm_cmplt_ps(farDistance, zero));
+      in = _mm_and_ps(in, _mm_cmpge_ps(nearDistance, zero));
+    }
+    const int outMask = _mm_movemask_ps(out);
+    outside |= outMask << half;
+    inside |= (_mm_movemask_ps(in) & ~outMask) << half;
+  }
+}
+#endif
+
+#if defined(MESH_AVX2_CULLING)
+// The 8 boxes in one register, three multiply-adds per corner and plane
+__attribute__((target("avx2,fma")))
+void testAvx2(const float* const bounds[6], size_t first, const PlaneSet& set, int& outside,
+    int& inside) {
+  const __m256 zero = _mm256_setzero_ps();
+  __m256 out = _mm256_setzero_ps();
+  __m256 in = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  for (int p = 0; p < 6; ++p) {
+    const float* c = set.coefficients[p];
+    const int* far = set.farCorner[p];
+    const int* near = set.nearCorner[p];
+    const __m256 a = _mm256_broadcast_ss(c);
+    const __m256 b = _mm256_broadcast_ss(c + 1);
+    const __m256 e = _mm256_broadcast_ss(c + 2);
+    const __m256 d = _mm256_broadcast_ss(c + 3);
+    __m256 farDistance = _mm256_fmadd_ps(a, _mm256_loadu_ps(bounds[far[0]] + first), d);
+    farDistance = _mm256_fmadd_ps(b, _mm256_loadu_ps(bounds[far[1]] + first), farDistance);
+    farDistance = _mm256_fmadd_ps(e, _mm256_loadu_ps(bounds[far[2]] + first), farDistance);
+    __m256 nearDistance = _mm256_fmadd_ps(a, _mm256_loadu_ps(bounds[near[0]] + first), d);
+    nearDistance = _mm256_fmadd_ps(b, _mm256_loadu_ps(bounds[near[1]] + first), nearDistance);
+    nearDistance = _mm256_fmadd_ps(e, _mm256_loadu_ps(bounds[near[2]] + first), nearDistance);
+    out = _mm256_or_ps(out, _mm256_cmp_ps(farDistance, zero, _CMP_LT_OQ));
+    in = _mm256_and_ps(in, _mm256_cmp_ps(nearDistance, zero, _CMP_GE_OQ));
+  }
+  outside = _mm256_movemask_ps(out);
+  inside = _mm256_movemask_ps(in) & ~outside;
+}
+#endif
+
+void testBlock(const float* const bounds[6], size_t first, const PlaneSet& set,
+    VertexKernelPath path, int& outside, int& inside) {
+  switch (path) {
+#if defined(MESH_AVX2_CULLING)
+    case KERNEL_AVX2:
+      testAvx2(bounds, first, set, outside, inside);
+      return;
+#endif
+#if defined(__SSE2__)
+    case KERNEL_SSE2:
+      testSse2(bounds, first, set, outside, inside);
+      return;
+#endif
+    default:
+      testScalar(bounds, first, set, outside, inside);
+  }
+}
+
+} // namespace
+
+void frustumPlanes(const glm::mat4& PVM, vec4 planes[6]) {
+  vec4 rows[4];
+  for (int r = 0; r < 4; ++r) {
+    rows[r] = vec4(PVM[0][r], PVM[1][r], PVM[2][r], PVM[3][r]);
+  }
+  planes[0] = rows[3] + rows[0]; // Left
+  planes[1] = rows[3] - rows[0]; // Right
+  planes[2] = rows[3] + rows[1]; // Bottom
+  planes[3] = rows[3] - rows[1]; // Top
+  planes[4] = rows[3] + rows[2]; // Near
+  planes[5] = rows[3] - rows[2]; // Far
+  for (int p = 0; p < 6; ++p) {
+    float length = glm::length(vec3(planes[p]));
+    if (length > 0.0f) {
+      planes[p] = planes[p] * (1.0f / length);
+    }
+  }
+}
+
+FrustumCuller::FrustumCuller() : mFirstBox(1, 0) {
+
+}
+
+void FrustumCuller::build(const Model& model) {
+  ArrayView<MeshData> separators = model.viewSeparators();
+  ArrayView<Vertex> vertices = model.viewVertices();
+  ArrayView<unsigned int> indices = model.viewIndices();
+  ArrayView<InstanceRange> ranges = model.viewInstanceRanges();
+  ArrayView<glm::mat4> transforms = model.viewInstanceTransforms();
+  const size_t n = separators.size();
+  // One box per separator drawn once, and one per instance
+  mFirstBox.assign(n + 1, 0);
+  for (size_t s = 0; s < n; ++s) {
+    const bool instanced = s < ranges.size() && ranges[s].count > 0;
+    mFirstBox[s + 1] = mFirstBox[s] + (instanced ? ranges[s].count : 1);
+  }
+  std::vector<vec3> lower(mFirstBox[n], vec3(EMPTY_MIN));
+  std::vector<vec3> upper(mFirstBox[n], vec3(EMPTY_MAX));
+  mMeshLower.assign(n, vec3(EMPTY_MIN));
+  mMeshUpper.assign(n, vec3(EMPTY_MAX));
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    for (size_t s = first; s < last; ++s) {
+      const MeshData& sep = separators[s];
+      const Vertex* base = vertices.data() + sep.startVertex;
+      const unsigned int* triangles = indices.data() + sep.startIndex;
+      vec3 boxLower(EMPTY_MIN);
+      vec3 boxUpper(EMPTY_MAX);
+      for (GLsizei k = 0; k < sep.howMany; ++k) {
+        boxLower = glm::min(boxLower, base[triangles[k]].position);
+        boxUpper = glm::max(boxUpper, base[triangles[k]].position);
+      }
+      mMeshLower[s] = boxLower;
+      mMeshUpper[s] = boxUpper;
+      if (s >= ranges.size() || ranges[s].count == 0) {
+        lower[mFirstBox[s]] = boxLower;
+        upper[mFirstBox[s]] = boxUpper;
+        continue;
+      }
+      for (size_t k = 0; k < ranges[s].count; ++k) {
+        transformBox(transforms[ranges[s].first + k], boxLower, boxUpper,
+            lower[mFirstBox[s] + k], upper[mFirstBox[s] + k]);
+      }
+    }
+  }, 1);
+  buildHierarchy(lower, upper);
+}
+
+void FrustumCuller::build(ArrayView<vec3> lower, ArrayView<vec3> upper) {
+  mFirstBox.resize(lower.size() + 1);
+  for (size_t i = 0; i < mFirstBox.size(); ++i) {
+    mFirstBox[i] = i;
+  }
+  mMeshLower.assign(lower.begin(), lower.end());
+  mMeshUpper.assign(upper.begin(), upper.end());
+  buildHierarchy(std::vector<vec3>(lower.begin(), lower.end()),
+      std::vector<vec3>(upper.begin(), upper.end()));
+}
+
+void FrustumCuller::buildHierarchy(const std::vector<vec3>& lower,
+    const std::vector<vec3>& upper) {
+  const size_t n = lower.size();
+  mLevels.clear();
+  mSlot.assign(n, 0);
+  mVisible.assign(n, 1);
+  if (n == 0) {
+    return;
+  }
+  // Sort the boxes by the Morton code of their centers, so the nodes are compact
+  vec3 sceneLower(FLT_MAX);
+  vec3 sceneUpper(-FLT_MAX);
+  for (size_t i = 0; i < n; ++i) {
+    if (lower[i].x <= upper[i].x) {
+      sceneLower = glm::min(sceneLower, lower[i]);
+      sceneUpper = glm::max(sceneUpper, upper[i]);
+    }
+  }
+  const vec3 size = glm::max(sceneUpper - sceneLower, vec3(FLT_MIN));
+  std::vector<std::pair<uint32_t, uint32_t> > keys(n);
+  for (size_t i = 0; i < n; ++i) {
+    uint32_t code = 0;
+    if (lower[i].x <= upper[i].x) {
+      vec3 cell = glm::clamp((0.5f * (lower[i] + upper[i]) - sceneLower) / size, 0.0f, 1.0f) *
+          1023.0f;
+      code = (expandBits(static_cast<uint32_t>(cell.x)) << 2) |
+          (expandBits(static_cast<uint32_t>(cell.y)) << 1) |
+          expandBits(static_cast<uint32_t>(cell.z));
+    }
+    keys[i] = std::make_pair(code, static_cast<uint32_t>(i));
+  }
+  std::sort(keys.begin(), keys.end());
+  // Level 0: the sorted boxes, padded with empty ones
+  Level boxes;
+  boxes.count = n;
+  const size_t padded = (n + WIDTH - 1) / WIDTH * WIDTH;
+  for (int b = 0; b < 3; ++b) {
+    boxes.bounds[b].assign(padded, EMPTY_MIN);
+    boxes.bounds[b + 3].assign(padded, EMPTY_MAX);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    const uint32_t box = keys[i].second;
+    mSlot[box] = i;
+    for (int b = 0; b < 3; ++b) {
+      boxes.bounds[b][i] = lower[box][b];
+      boxes.bounds[b + 3][i] = upper[box][b];
+    }
+  }
+  mLevels.push_back(boxes);
+  // Every node bounds 8 nodes of the level below
+  while (mLevels.back().count > WIDTH) {
+    const Level& below = mLevels.back();
+    Level level;
+    level.count = (below.count + WIDTH - 1) / WIDTH;
+    const size_t nodes = (level.count + WIDTH - 1) / WIDTH * WIDTH;
+    for (int b = 0; b < 3; ++b) {
+      level.bounds[b].assign(nodes, EMPTY_MIN);
+      level.bounds[b + 3].assign(nodes, EMPTY_MAX);
+    }
+    for (size_t i = 0; i < level.count; ++i) {
+      for (size_t k = WIDTH * i; k < WIDTH * (i + 1); ++k) {
+        for (int b = 0; b < 3; ++b) {
+          level.bounds[b][i] = std::min(level.bounds[b][i], below.bounds[b][k]);
+          level.bounds[b + 3][i] = std::max(level.bounds[b + 3][i], below.bounds[b + 3][k]);
+        }
+      }
+    }
+    mLevels.push_back(level);
+  }
+}
+
+size_t FrustumCuller::size() const {
+  return mVisible.size();
+}
+
+size_t FrustumCuller::firstBoxOf(size_t separator) const {
+  return separator < mFirstBox.size() ? mFirstBox[separator] : mVisible.size();
+}
+
+void FrustumCuller::bounds(size_t box, vec3& lower, vec3& upper) const {
+  const size_t slot = mSlot[box];
+  const Level& boxes = mLevels[0];
+  lower = vec3(boxes.bounds[0][slot], boxes.bounds[1][slot], boxes.bounds[2][slot]);
+  upper = vec3(boxes.bounds[3][slot], boxes.bounds[4][slot], boxes.bounds[5][slot]);
+}
+
+void FrustumCuller::moveInstance(size_t separator, size_t instance, const glm::mat4& world) {
+  vec3 lower;
+  vec3 upper;
+  transformBox(world, mMeshLower[separator], mMeshUpper[separator], lower, upper);
+  size_t node = mSlot[mFirstBox[separator] + instance];
+  for (int b = 0; b < 3; ++b) {
+    mLevels[0].bounds[b][node] = lower[b];
+    mLevels[0].bounds[b + 3][node] = upper[b];
+  }
+  // Every node above it bounds its 8 children again
+  for (size_t level = 1; level < mLevels.size(); ++level) {
+    node >>= SHIFT;
+    const Level& below = mLevels[level - 1];
+    Level& above = mLevels[level];
+    for (int b = 0; b < 3; ++b) {
+      float low = EMPTY_MIN;
+      float high = EMPTY_MAX;
+      for (size_t k = WIDTH * node; k < WIDTH * (node + 1); ++k) {
+        low = std::min(low, below.bounds[b][k]);
+        high = std::max(high, below.bounds[b + 3][k]);
+      }
+      above.bounds[b][node] = low;
+      above.bounds[b + 3][node] = high;
+    }
+  }
+}
+
+bool FrustumCuller::isVisible(size_t box) const {
+  return mVisible[mSlot[box]] != 0;
+}
+
+FrustumCullStats FrustumCuller::cull(const glm::mat4& PVM, bool hierarchy,
+    VertexKernelPath path) {
+  const size_t n = mVisible.size();
+  FrustumCullStats stats = {n, 0, 0, 0, 0};
+  if (n == 0) {
+    return stats;
+  }
+  path = std::min(path, bestVertexKernelPath());
+  const PlaneSet set = makePlaneSet(PVM);
+  if (!hierarchy) {
+    const float* const bounds[6] = {mLevels[0].bounds[0].data(), mLevels[0].bounds[1].data(),
+        mLevels[0].bounds[2].data(), mLevels[0].bounds[3].data(), mLevels[0].bounds[4].data(),
+        mLevels[0].bounds[5].data()};
+    parallel::forEachRange((n + WIDTH - 1) / WIDTH, [&](size_t firstBlock, size_t lastBlock) {
+      for (size_t block = firstBlock; block < lastBlock; ++block) {
+        int outside;
+        int inside;
+        testBlock(bounds, block * WIDTH, set, path, outside, inside);
+        for (size_t k = 0; k < WIDTH && block * WIDTH + k < n; ++k) {
+          mVisible[block * WIDTH + k] = (outside >> k) & 1 ? 0 : 1;
+        }
+      }
+    }, GRAIN);
+    stats.tests = n;
+    stats.visible = static_cast<size_t>(std::count(mVisible.begin(), mVisible.end(), 1));
+    return stats;
+  }
+  // From the top level: the nodes to open, as (level, first child)
+  std::vector<std::pair<size_t, size_t> > open;
+  open.push_back(std::make_pair(mLevels.size() - 1, size_t(0)));
+  while (!open.empty()) {
+    const size_t level = open.back().first;
+    const size_t first = open.back().second;
+    open.pop_back();
+    const Level& nodes = mLevels[level];
+    const float* const bounds[6] = {nodes.bounds[0].data(), nodes.bounds[1].data(),
+        nodes.bounds[2].data(), nodes.bounds[3].data(), nodes.bounds[4].data(),
+        nodes.bounds[5].data()};
+    int outside;
+    int inside;
+    testBlock(bounds, first, set, path, outside, inside);
+    for (size_t k = 0; k < WIDTH && first + k < nodes.count; ++k) {
+      const size_t node = first + k;
+      // The boxes under a node are a range of the sorted boxes
+      const size_t begin = node << (SHIFT * level);
+      const size_t end = std::min(n, (node + 1) << (SHIFT * level));
+      ++stats.tests;
+      if ((outside >> k) & 1) {
+        std::fill(mVisible.begin() + begin, mVisible.begin() + end, 0);
+        stats.nodesOutside += level > 0 ? 1 : 0;
+      } else if (((inside >> k) & 1) || level == 0) {
+        std::fill(mVisible.begin() + begin, mVisible.begin() + end, 1);
+        stats.visible += end - begin;
+        stats.nodesInside += level > 0 && ((inside >> k) & 1) ? 1 : 0;
+      } else {
+        open.push_back(std::make_pair(level - 1, node * WIDTH));
+      }
+    }
+  }
+  return stats;
+}
+
+} // namespace mesh
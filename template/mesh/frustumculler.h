@@ -0,0 +1,108 @@
+#ifndef MESH_FRUSTUM_CULLER_H_
+#define MESH_FRUSTUM_CULLER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "model.h"
+#include "vertexkernels.h"
+
+namespace mesh {
+
+//! Planes of the view frustum of a matrix (left, right, bottom, top, near, far), normalized
+/*!
+  The planes are in the coordinates the matrix takes (model coordinates for
+  a projection-view-model matrix). A point p is in front of plane k (inside)
+  if dot(planes[k], vec4(p, 1)) >= 0.
+*/
+void frustumPlanes(const glm::mat4& PVM, glm::vec4 planes[6]);
+
+//! Statistics of the last frustum culling
+struct FrustumCullStats {
+  //! Boxes (separators drawn once and instances) and the ones inside or crossing the frustum
+  size_t boxes;
+  size_t visible;
+  //! Boxes and hierarchy nodes tested against the planes
+  size_t tests;
+  //! Hierarchy nodes found outside (rejected whole) or inside (accepted whole)
+  size_t nodesOutside;
+  size_t nodesInside;
+};
+
+//! Culls the separators and the instances of a \class Model against the view frustum
+/*!
+  Every separator drawn once has an axis aligned box (in model coordinates)
+  and an instanced separator has one box per instance (the box of its
+  vertices, transformed by the instance). The boxes are computed when the
+  culler is built.
+
+  The boxes are sorted along a Morton curve and kept as structure of arrays
+  (min x, min y... each one in its own array). On top of them there is a
+  hierarchy where every node bounds 8 consecutive nodes (or boxes) of the
+  level below. Culling walks it from the top: a node outside a plane
+  rejects all its boxes, a node inside all the planes accepts them, and
+  only the ones crossing a plane are opened. Without the hierarchy every box
+  is tested, in parallel.
+
+  The 8 children of a node are tested at once against the 6 planes: in one
+  AVX2 register, in two SSE2 registers or one by one. Every plane is tested
+  with the corner of the box farthest along its normal (outside if it is
+  behind) and the closest one (inside if it is in front).
+*/
+class FrustumCuller {
+public:
+  FrustumCuller();
+  //! Clear and take the boxes of the separators and the instances of a Model
+  /*!
+    Call it before the separators are released. The boxes are computed in parallel.
+  */
+  void build(const Model& model);
+  //! Clear and take a set of boxes, one separator each
+  void build(ArrayView<glm::vec3> lower, ArrayView<glm::vec3> upper);
+  //! Number of boxes
+  size_t size() const;
+  //! The boxes of a separator are [firstBoxOf(s), firstBoxOf(s + 1)), one per instance
+  size_t firstBoxOf(size_t separator) const;
+  //! The bounds of a box, in model coordinates
+  void bounds(size_t box, glm::vec3& lower, glm::vec3& upper) const;
+  //! Move an instance of a separator (after the node of the instance moved)
+  /*!
+    Its box becomes the box of the mesh transformed by world, and the nodes
+    of the hierarchy above it are fitted again. The order of the boxes is
+    kept, so the hierarchy gets looser if the instances move far (build the
+    culler again then).
+  */
+  void moveInstance(size_t separator, size_t instance, const glm::mat4& world);
+  //! Test the boxes against the frustum. The results are queried with isVisible
+  /*!
+    @param PVM the projection-view-model matrix used to render
+    @param hierarchy walk the hierarchy, instead of testing every box
+    @param path forced instruction set, it falls back to the best supported one
+  */
+  FrustumCullStats cull(const glm::mat4& PVM, bool hierarchy = true,
+      VertexKernelPath path = bestVertexKernelPath());
+  //! Queries if a box passed the last culling (true if cull was never called)
+  bool isVisible(size_t box) const;
+
+private:
+  // A level of the hierarchy: the bounds (min x, y, z and max x, y, z) padded to 8 nodes
+  struct Level {
+    std::vector<float> bounds[6];
+    size_t count;
+  };
+  void buildHierarchy(const std::vector<glm::vec3>& lower, const std::vector<glm::vec3>& upper);
+  std::vector<size_t> mFirstBox;
+  // The box of the vertices of every separator, before any instance transform
+  std::vector<glm::vec3> mMeshLower;
+  std::vector<glm::vec3> mMeshUpper;
+  // The position of every box in the sorted order
+  std::vector<size_t> mSlot;
+  // Level 0 are the sorted boxes, the top level has 8 nodes or less
+  std::vector<Level> mLevels;
+  // One result per sorted box
+  std::vector<unsigned char> mVisible;
+};
+
+} // namespace mesh
+
+#endif
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "../parallel/threadpool.h"
+
+#include "lodselector.h"
+
+namespace mesh {
+
+using glm::vec3;
+using glm::vec4;
+
+const float LodSelector::DEFAULT_PIXEL_ERROR = 1.0f;
+const float LodSelector::DEFAULT_HYSTERESIS = 0.25f;
+
+LodSelector::LodSelector(float pixelError, float hysteresis) : mPixelError(pixelError),
+    mHysteresis(hysteresis), mLevels(1) {
+
+}
+
+void LodSelector::build(const Model& model) {
+  ArrayView<MeshData> separators = model.viewLod(0);
+  ArrayView<Vertex> vertices = model.viewVertices();
+  ArrayView<unsigned int> indices = model.viewIndices();
+  const size_t n = separators.size();
+  mLevels = model.lodCount();
+  mSpheres.assign(n, vec4(0.0f));
+  mLevel.assign(n, 0);
+  mInstances.assign(n, 0);
+  ArrayView<InstanceRange> instances = model.viewInstanceRanges();
+  for (size_t i = 0; i < n && i < instances.size(); ++i) {
+    mInstances[i] = instances[i].count;
+  }
+  // The levels use a subset of the vertices, so the sphere of level 0 holds all of them
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const MeshData& sep = separators[i];
+      if (sep.howMany == 0) {
+        continue;
+      }
+      const Vertex* base = vertices.data() + sep.startVertex;
+      const unsigned int* triangles = indices.data() + sep.startIndex;
+      vec3 lower = base[triangles[0]].position;
+      vec3 upper = lower;
+      for (GLsizei k = 1; k < sep.howMany; ++k) {
+        lower = glm::min(lower, base[triangles[k]].position);
+        upper = glm::max(upper, base[triangles[k]].position);
+      }
+      vec3 center = 0.5f * (lower + upper);
+      float radius2 = 0.0f;
+      for (GLsizei k = 0; k < sep.howMany; ++k) {
+        radius2 = std::max(radius2, glm::length2(base[triangles[k]].position - center));
+      }
+      mSpheres[i] = vec4(center, std::sqrt(radius2));
+    }
+  }, 1);
+  mErrors.assign(mLevels * n, 0.0f);
+  mTriangles.assign(mLevels * n, 0);
+  for (size_t k = 0; k < mLevels; ++k) {
+    ArrayView<MeshData> level = model.viewLod(k);
+    for (size_t i = 0; i < n; ++i) {
+      mErrors[k * n + i] = model.lodError(k, i);
+      mTriangles[k * n + i] = level[i].howMany / 3;
+    }
+  }
+}
+
+LodSelectionStats LodSelector::select(const glm::mat4& modelView, float fovy,
+    int viewportHeight) {
+  const size_t n = mLevel.size();
+  // The biggest scale of the matrix (model units to view units)
+  float scale = std::sqrt(std::max(glm::length2(vec3(modelView[0])),
+      std::max(glm::length2(vec3(modelView[1])), glm::length2(vec3(modelView[2])))));
+  // Pixels covered by one view unit at distance one
+  float pixelsPerUnit = viewportHeight / (2.0f * std::tan(0.5f * fovy));
+  const float relaxed = mPixelError * (1.0f - mHysteresis);
+  for (size_t i = 0; i < n; ++i) {
+    if (mInstances[i] > 0) {
+      continue;
+    }
+    vec3 center = vec3(modelView * vec4(vec3(mSpheres[i]), 1.0f));
+    float distance = glm::length(center) - mSpheres[i].w * scale;
+    // Inside the sphere: nothing can be simplified
+    float factor = distance > 0.0f ? scale * pixelsPerUnit / distance : FLT_MAX;
+    size_t current = mLevel[i];
+    size_t desired = 0;
+    size_t comfortable = 0;
+    for (size_t k = 1; k < mLevels; ++k) {
+      float pixels = mErrors[k * n + i] * factor;
+      if (pixels <= mPixelError) {
+        desired = k;
+      }
+      if (pixels <= relaxed) {
+        comfortable = k;
+      }
+    }
+    // Coarser only when it is clearly good enough, finer as soon as it is needed
+    mLevel[i] = static_cast<unsigned char>(desired > current ?
+        std::max(current, comfortable) : desired);
+  }
+  return stats();
+}
+
+LodSelectionStats LodSelector::force(size_t level) {
+  const unsigned char clamped = static_cast<unsigned char>(std::min(level, mLevels - 1));
+  for (size_t i = 0; i < mLevel.size(); ++i) {
+    mLevel[i] = mInstances[i] > 0 ? 0 : clamped;
+  }
+  return stats();
+}
+
+LodSelectionStats LodSelector::stats() const {
+  const size_t n = mLevel.size();
+  LodSelectionStats result = {0, 0, 0};
+  for (size_t i = 0; i < n; ++i) {
+    const size_t copies = std::max(mInstances[i], 1u);
+    result.fullTriangles += copies * mTriangles[i];
+    result.submittedTriangles += copies * mTriangles[mLevel[i] * n + i];
+    result.simplified += mLevel[i] > 0 ? 1 : 0;
+  }
+  return result;
+}
+
+size_t LodSelector::levelOf(size_t separator) const {
+  return separator < mLevel.size() ? mLevel[separator] : 0;
+}
+
+size_t LodSelector::levels() const {
+  return mLevels;
+}
+
+float LodSelector::getPixelError() const {
+  return mPixelError;
+}
+
+void LodSelector::setPixelError(float pixelError) {
+  mPixelError = pixelError;
+}
+
+} // namespace mesh
@@ -0,0 +1,84 @@
+#ifndef MESH_LOD_SELECTOR_H_
+#define MESH_LOD_SELECTOR_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "model.h"
+
+namespace mesh {
+
+//! Statistics of the last level of detail selection
+struct LodSelectionStats {
+  //! Triangles of all the separators at full detail, and of the selected levels
+  /*! A separator with instances counts once per instance */
+  size_t fullTriangles;
+  size_t submittedTriangles;
+  //! Number of separators drawn with a simplified level (not level 0)
+  size_t simplified;
+};
+
+//! Chooses a level of detail for every separator of a \class Model by its error on screen
+/*!
+  The error of every level (See Model::lodError) is projected to pixels at
+  the closest point of the bounding sphere of the separator, and the coarsest
+  level under the allowed pixel error is drawn.
+
+  To avoid popping when the camera moves around the limit, a separator only
+  switches to a coarser level when its error is under (1 - hysteresis) times
+  the allowed error. It switches to a finer level as soon as the current one
+  is over the allowed error.
+
+  The separators with instances are always drawn at level 0, as the error
+  of the stored mesh says nothing of where its instances are.
+*/
+class LodSelector {
+public:
+  //! Default allowed error on screen, in pixels
+  static const float DEFAULT_PIXEL_ERROR;
+  //! Default fraction of the allowed error used as hysteresis
+  static const float DEFAULT_HYSTERESIS;
+  //! Creates an empty selector (everything is drawn at level 0)
+  explicit LodSelector(float pixelError = DEFAULT_PIXEL_ERROR,
+      float hysteresis = DEFAULT_HYSTERESIS);
+  //! Clear and take the bounding spheres, errors and triangles of every level of a Model
+  /*!
+    Call it after Model::generateLods and before the levels are released.
+    The spheres are computed in parallel.
+  */
+  void build(const Model& model);
+  //! Choose the level of every separator for the current camera
+  /*!
+    @param modelView the view-model matrix used to render (it can scale the model)
+    @param fovy vertical field of view of the projection, in radians
+    @param viewportHeight height of the viewport, in pixels
+  */
+  LodSelectionStats select(const glm::mat4& modelView, float fovy, int viewportHeight);
+  //! Draw every separator at the given level (clamped), until the next select
+  LodSelectionStats force(size_t level);
+  //! The level chosen for a separator by the last select (or force)
+  size_t levelOf(size_t separator) const;
+  //! Number of levels, including the original one
+  size_t levels() const;
+  //! Get and set the allowed error on screen, in pixels
+  float getPixelError() const;
+  void setPixelError(float pixelError);
+
+private:
+  LodSelectionStats stats() const;
+  float mPixelError;
+  float mHysteresis;
+  size_t mLevels;
+  // Bounding sphere of every separator: center and radius
+  std::vector<glm::vec4> mSpheres;
+  // Error and triangles of separator i in level k at [k * separators + i]
+  std::vector<float> mErrors;
+  std::vector<size_t> mTriangles;
+  // Instances of every separator (0 if it is drawn once)
+  std::vector<unsigned int> mInstances;
+  std::vector<unsigned char> mLevel;
+};
+
+} // namespace mesh
+
+#endif
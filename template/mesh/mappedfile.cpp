@@ -0,0 +1,59 @@
+#include <fstream>
+
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.h"
+
+namespace mesh {
+
+const unsigned char* mapFile(const std::string& fileName, size_t& size) {
+  size = 0;
+#ifdef _WIN32
+  // No mmap, just read it into a heap buffer
+  std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return nullptr;
+  }
+  size = static_cast<size_t>(file.tellg());
+  unsigned char* buffer = new unsigned char[size > 0 ? size : 1];
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(buffer), size);
+  return buffer;
+#else
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    ::close(fd);
+    return nullptr;
+  }
+  void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  size = static_cast<size_t>(info.st_size);
+  return static_cast<const unsigned char*>(data);
+#endif
+}
+
+void unmapFile(const unsigned char* data, size_t size) {
+  if (!data) {
+    return;
+  }
+#ifdef _WIN32
+  delete[] data;
+#else
+  munmap(const_cast<unsigned char*>(data), size);
+#endif
+}
+
+} // namespace mesh
@@ -0,0 +1,21 @@
+#ifndef MESH_MAPPED_FILE_H_
+#define MESH_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+namespace mesh {
+
+//! Maps a whole file in memory as read only. Release it with unmapFile
+/*!
+  Where there is no mmap (Windows) the file is read into a heap buffer.
+  @param size output, the size of the file in bytes
+  @return the contents of the file, or nullptr if it can not be read (or it is empty)
+*/
+const unsigned char* mapFile(const std::string& fileName, size_t& size);
+//! Release the memory returned by mapFile
+void unmapFile(const unsigned char* data, size_t size);
+
+} // namespace mesh
+
+#endif
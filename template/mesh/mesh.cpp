@@ -1,7 +1,15 @@
 #include "mesh.h"
 
 #include <iostream>
-#include <set>
+#include <utility>
+
+#include "meshoptimizer.h"
+#include "meshwriter.h"
+#include "normalgenerator.h"
+#include "tangentspace.h"
+#include "simplifier.h"
+#include "vertexkernels.h"
+#include "vertexwelder.h"
 
 namespace mesh {
 
@@ -29,6 +37,95 @@ std::vector<Vertex> Mesh::getVertices() const {
   return mVertices;
 }
 
+ArrayView<unsigned int> Mesh::viewIndices() const {
+  return ArrayView<unsigned int>(mIndices);
+}
+
+ArrayView<Vertex> Mesh::viewVertices() const {
+  return ArrayView<Vertex>(mVertices);
+}
+
+std::vector<unsigned int> Mesh::releaseIndices() {
+  std::vector<unsigned int> indices;
+  indices.swap(mIndices);
+  return indices;
+}
+
+std::vector<Vertex> Mesh::releaseVertices() {
+  std::vector<Vertex> vertices;
+  vertices.swap(mVertices);
+  return vertices;
+}
+
+ArrayView<vec4> Mesh::viewTangents() const {
+  return ArrayView<vec4>(mTangents);
+}
+
+std::vector<vec4> Mesh::releaseTangents() {
+  std::vector<vec4> tangents;
+  tangents.swap(mTangents);
+  return tangents;
+}
+
+VertexCacheReport Mesh::optimizeVertexOrder(unsigned int cacheSize, float overdrawThreshold) {
+  return optimizeRange(0, mVertices.size(), 0, mIndices.size(), cacheSize, overdrawThreshold,
+      true);
+}
+
+OverdrawStats Mesh::estimateOverdraw(unsigned int directions, unsigned int resolution) const {
+  // All the mesh is a single range
+  MeshData all = {0, 0, static_cast<GLsizei>(mIndices.size()), -1, -1, -1, GL_UNSIGNED_INT, 0};
+  return analyzeOverdraw(viewVertices(), viewIndices(), ArrayView<MeshData>(&all, 1),
+      directions, resolution);
+}
+
+float Mesh::simplify(float ratio) {
+  if (!(ratio > 0.0f && ratio <= 1.0f)) {
+    std::cerr << "The simplification ratio must be in (0, 1]" << std::endl;
+    return 0.0f;
+  }
+  std::vector<size_t> target(1, static_cast<size_t>(ratio * trianglesCount()));
+  Simplifier simplifier;
+  std::vector<SimplifiedLevel> levels = simplifier.simplify(viewVertices(), viewIndices(), target);
+  mIndices.swap(levels[0].indices);
+  return levels[0].error;
+}
+
+size_t Mesh::recalculateNormals(float creaseAngle) {
+  NormalGenerator generator(creaseAngle);
+  size_t added = generator.generate(mVertices, mIndices);
+  mHasNormals = true;
+  mTangents.clear();
+  return added;
+}
+
+size_t Mesh::recalculateTangents() {
+  if (!mHasTexture) {
+    return 0;
+  }
+  size_t added = mHasNormals ? 0 : recalculateNormals();
+  return added + generateTangents(mVertices, mIndices, mTangents);
+}
+
+VertexCacheReport Mesh::optimizeRange(size_t startVertex, size_t vertexCount,
+    size_t startIndex, size_t indexCount, unsigned int cacheSize, float overdrawThreshold,
+    bool reorderVertices) {
+  unsigned int* indices = mIndices.data() + startIndex;
+  VertexCacheReport report;
+  report.before = analyzeVertexCache(indices, indexCount, vertexCount, cacheSize);
+  optimizeVertexCache(indices, indexCount, vertexCount, cacheSize);
+  if (overdrawThreshold >= 1.0f) {
+    optimizeOverdraw(indices, indexCount, mVertices.data() + startVertex, vertexCount,
+        overdrawThreshold, cacheSize);
+  }
+  if (reorderVertices) {
+    optimizeVertexFetch(mVertices.data() + startVertex, vertexCount, indices, indexCount,
+        mTangents.empty() ? nullptr : mTangents.data() + startVertex);
+  }
+  report.after = analyzeVertexCache(indices, indexCount, vertexCount, cacheSize);
+  return report;
+}
+
 bool Mesh::loadFromFile(const std::string& fileName) {
   using std::cerr;
   using std::endl;
@@ -64,6 +161,9 @@ bool Mesh::loadFromFile(const std::string& fileName) {
   Vertex v;
   mHasNormals = mesh->HasNormals();
   mHasTexture = mesh->HasTextureCoords(0);
+  // We asked for the tangent space, keep it (w is the handedness of the bitangent)
+  bool tangents = mHasNormals && mesh->HasTangentsAndBitangents();
+  mTangents.clear();
   for (unsigned int i = 0; i < mesh->mNumVertices; ++i) {
     v.position.x = mesh->mVertices[i].x;
     v.position.y = mesh->mVertices[i].y;
@@ -78,6 +178,14 @@ bool Mesh::loadFromFile(const std::string& fileName) {
       v.textCoords.t = mesh->mTextureCoords[0][i].y;
     }
     mVertices.push_back(v);
+    if (tangents) {
+      const aiVector3D& t = mesh->mTangents[i];
+      const aiVector3D& b = mesh->mBitangents[i];
+      vec3 tangent(t.x, t.y, t.z);
+      float sign = glm::dot(glm::cross(v.normal, tangent), vec3(b.x, b.y, b.z)) < 0.0f ?
+          -1.0f : 1.0f;
+      mTangents.push_back(vec4(tangent, sign));
+    }
   }
   // See if the mesh uses a diffuse texture
   if (mesh->mMaterialIndex > 0) {
@@ -103,6 +211,7 @@ bool Mesh::loadVerticesAndIndices(const std::vector<Vertex>& vertices,
   } else {
     mIndices = indices;
   }
+  mTangents.clear();
 
   mHasNormals = normals;
   mHasTexture = textCoords;
@@ -111,57 +220,39 @@ bool Mesh::loadVerticesAndIndices(const std::vector<Vertex>& vertices,
   return true;
 }
 
-bool Mesh::loadFromTriangles(const std::vector<Triangle>& triangles) {
+bool Mesh::loadVerticesAndIndices(std::vector<Vertex>&& vertices,
+    std::vector<unsigned int>&& indices, bool normals, bool textCoords) {
+  // Blindlly trust the supplied parameters
+  if (vertices.empty() || indices.empty()) {
+    return false;
+  }
+  mVertices = std::move(vertices);
+  mTangents.clear();
+  mIndices = std::move(indices);
 
-  auto lessThan = [](const vec3& a, const vec3& b){
-    //Two vertex positions that are less than square root of EPSILON
-    //apart are consider the same vertex
-    const float EPSILON = 0.00000001f;  // sqrt(EPSILON) = 0.0001
-    //check equality
-    if (glm::length2(a - b) < EPSILON) {
-      return false;
-    }
-    //Lexicographical order
-    if (glm::abs(a.x - b.x) > EPSILON) {
-      return a.x < b.x;
-    } else if (glm::abs(a.y - b.y) > EPSILON) {
-      return a.y < b.y;
-    } else {
-      return a.z < b.z;
-    }
-  };
-  //This set will be used to get rid of the duplicate vertex
-  std::set<vec3, decltype(lessThan)> tmpStorage(lessThan);
+  mHasNormals = normals;
+  mHasTexture = textCoords;
+
+  updateBoundingBox();
+  return true;
+}
+
+bool Mesh::loadFromTriangles(const std::vector<Triangle>& triangles) {
+  //Two vertex positions that are less than 0.0001 apart are consider the same vertex
+  const float DELTA = 0.0001f;
+  VertexWelder welder(DELTA);
   //Clear the previous data in the indices and points arrays, since we are about to
   //start a new indexing
   mIndices.clear();
   mVertices.clear();
-  //Insert all the vertex in the tmp_storage
-  for (auto t : triangles) {
-    tmpStorage.insert(t.p0);
-    tmpStorage.insert(t.p1);
-    tmpStorage.insert(t.p2);
-  }
-  //Insert indexes for the vertices
-  for (auto t : triangles) {
-    // First vertex of triangle
-    auto it = tmpStorage.find(t.p0);
-    auto index = std::distance(tmpStorage.begin(), it);
-    mIndices.push_back(static_cast<unsigned int>(index));
-    // Second
-    it = tmpStorage.find(t.p1);
-    index = std::distance(tmpStorage.begin(), it);
-    mIndices.push_back(static_cast<unsigned int>(index));
-    // Third
-    it = tmpStorage.find(t.p2);
-    index = std::distance(tmpStorage.begin(), it);
-    mIndices.push_back(static_cast<unsigned int>(index));
-  }
+  mTangents.clear();
+  //Join the corners of the triangles using all the cores
+  std::vector<vec3> positions;
+  welder.weldParallel(triangles, positions, mIndices);
   //Create the Vertex buffer storage
-  Vertex tmpVertex;
-  for (auto position : tmpStorage) {
-    tmpVertex.position = position;
-    mVertices.push_back(tmpVertex);
+  mVertices.resize(positions.size());
+  for (size_t i = 0; i < positions.size(); ++i) {
+    mVertices[i].position = positions[i];
   }
   //Since we created the mesh from triangles, we do no have normal nor texture coordinates
   mHasNormals = mHasTexture = false;
@@ -181,27 +272,31 @@ bool Mesh::hasNormals() const {
   return mHasNormals;
 }
 
+bool Mesh::hasTangents() const {
+  return !mTangents.empty();
+}
+
 void Mesh::clear() {
   mVertices.clear();
   mIndices.clear();
+  mTangents.clear();
   mHasNormals = mHasTexture = false;
   mLowerCorner = mUpperCorner = vec3(0.0f);
 }
 
 void Mesh::transform(const mat4& T) {
-  // Apply troansformation to the vertices
-  for (auto& v : mVertices) {
-    v.position = vec3(T * vec4(v.position, 1.0f));
-  }
-  // If you have normals, then you need to trasmform them as well
-  if (mHasNormals) {
-    mat4 normalMat = glm::inverse(glm::transpose(T)); // Get rid of scaling
-    for (auto& v : mVertices) {
-        v.normal = vec3(normalMat * vec4(v.normal, 0.0f));
+  // Apply troansformation to the vertices, and to the normals if you have them (by the
+  // inverse transpose to get rid of scaling). The same pass computes the new bounding box
+  transformVertices(mVertices.data(), mVertices.size(), T, mHasNormals, mLowerCorner,
+      mUpperCorner);
+  // Tangents live on the surface, a mirror flips the bitangent
+  transformTangents(mTangents.data(), mTangents.size(), T);
+  // and the front of the triangles, unless two indices of each one are swapped
+  if (glm::determinant(glm::mat3(T)) < 0.0f) {
+    for (size_t t = 0; t + 2 < mIndices.size(); t += 3) {
+      std::swap(mIndices[t + 1], mIndices[t + 2]);
     }
   }
-  // We just moved the vertex we need to recalculate our bb
-  updateBoundingBox();
 }
 
 void Mesh::toUnitCube() {
@@ -242,85 +337,18 @@ size_t Mesh::vertexCount() const {
 }
 
 bool Mesh::save(const std::string& fileName) const {
-  //Create a scene
-  aiScene* scene = new aiScene();
-  scene->mRootNode = new aiNode();
-  //Assimp requires a material to work. I create an empthy one
-  scene->mMaterials = new aiMaterial* [1];
-  scene->mMaterials[0] = nullptr;
-  scene->mNumMaterials = 1;
-  scene->mMaterials[0] = new aiMaterial();
-  //Now create the mesh
-  scene->mMeshes = new aiMesh* [1];
-  scene->mMeshes[0] = nullptr;
-  scene->mNumMeshes = 1;
-  //Now allocate the mesh and regiter the material
-  scene->mMeshes[0] = new aiMesh();
-  scene->mMeshes[0]->mMaterialIndex = 0;
-  //Register the mesh in the scene
-  scene->mRootNode->mMeshes = new unsigned int[1];
-  scene->mRootNode->mMeshes[0] = 0;
-  scene->mRootNode->mNumMeshes = 1;
-  //Get handle
-  auto meshPtr = scene->mMeshes[0];
-  //Allocate space for vertex data
-  meshPtr->mVertices = new aiVector3D[mVertices.size()];
-  // If you have normal allocate space for them too
-  if (mHasNormals) {
-    meshPtr->mNormals = new aiVector3D[mVertices.size()];
-    meshPtr->mNumVertices = static_cast<unsigned int>(mVertices.size());
-  }
-  // If you have texture coordinates allocate space for them too
-  if (mHasTexture) {
-    meshPtr->mTextureCoords[0] = new aiVector3D[mVertices.size()];
-    meshPtr->mNumUVComponents[0] = static_cast<unsigned int>(mVertices.size());
-  }
-  //Fill vertex data
-  Vertex v;
-  for (size_t i = 0; i < mVertices.size(); ++i) {
-    v = mVertices[i];
-    meshPtr->mVertices[i] = aiVector3D(v.position.x, v.position.y, v.position.z);
-    
-    if (mHasNormals) {
-      meshPtr->mNormals[i] = aiVector3D(v.normal.x, v.normal.y, v.normal.z);
-    }
-
-    if (mHasTexture) {
-      meshPtr->mTextureCoords[0][i] = aiVector3D(v.textCoords.s, v.textCoords.t, 0);
-    }
-  }
-  //Alocate space for face data (trinagular faces)
-  meshPtr->mFaces = new aiFace[mIndices.size() / 3];
-  meshPtr->mNumFaces = static_cast<unsigned int>(mIndices.size() / 3);
-  //Fil face data
-  for (size_t i = 0; i < mIndices.size(); i += 3) {
-    aiFace& face = meshPtr->mFaces[i / 3];
-    face.mIndices = new unsigned int[3];
-    face.mNumIndices = 3;
-    face.mIndices[0] = mIndices[i];
-    face.mIndices[1] = mIndices[i + 1];
-    face.mIndices[2] = mIndices[i + 2];
-  }
-  // Data structure is complete, now use importer and save it to disk
-  if (scene) {
-    Assimp::Exporter exporter;
-    exporter.Export(scene, "obj", fileName.c_str());
-    delete scene;
-  }
-
-  return true;
+  // All the mesh is a single range, written straight from our buffers
+  MeshData all = {0, 0, static_cast<GLsizei>(mIndices.size()), -1, -1, -1, GL_UNSIGNED_INT, 0};
+  return writeMesh(fileName, meshFormatFor(fileName), viewVertices(), viewIndices(),
+      ArrayView<MeshData>(&all, 1), mHasNormals, mHasTexture);
 }
 
 void Mesh::updateBoundingBox() {
   // Numeric limit boundaries, minimun ans maximum float point values
   mLowerCorner = FLT_MAX * vec3(1.0f);
   mUpperCorner = -FLT_MAX * vec3(1.0f);
-  // Loop trought all vertex
-  for (auto v : mVertices) {
-    //Check if this vertex changes the bounding box
-    mUpperCorner = glm::max(v.position, mUpperCorner);
-    mLowerCorner = glm::min(v.position, mLowerCorner);
-  }
+  // Loop trought all vertex (in parallel, with SIMD)
+  vertexBounds(mVertices.data(), mVertices.size(), mLowerCorner, mUpperCorner);
 }
 
 void Mesh::addDiffuseTexture(const aiMaterial* mat) {
@@ -1,7 +1,9 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <cstddef>
 #include <string>
+#include <vector>
 
 #define GLM_FORCE_PURE
 #define GLM_FORCE_RADIANS
@@ -20,6 +22,9 @@
 
 namespace mesh {
 
+struct VertexCacheReport;
+struct OverdrawStats;
+
 //! A struct that represents a simple \struct Vertex.
 /*!
   It contains a simple vertex with interleaved data of the most common
@@ -42,6 +47,32 @@ struct Triangle {
   glm::vec3 p1;
   glm::vec3 p2;
 };
+//! A read only view of an array owned by another object
+/*!
+  It is just a pointer and a number of elements. It is used by \class Mesh and
+  \class Model to give access to their buffers without copying them (for example
+  to pass them directly to glBufferData).
+  The view is only valid while the owner is alive and its data is not modified.
+*/
+template <typename T>
+struct ArrayView {
+  const T* ptr;
+  size_t count;
+
+  ArrayView() : ptr(nullptr), count(0) {}
+  ArrayView(const T* data, size_t size) : ptr(data), count(size) {}
+  explicit ArrayView(const std::vector<T>& v) : ptr(v.data()), count(v.size()) {}
+  //! Pointer to the first element
+  const T* data() const { return ptr; }
+  //! Number of elements in the view
+  size_t size() const { return count; }
+  //! Size of the viewed data in bytes
+  size_t bytes() const { return count * sizeof(T); }
+  bool empty() const { return count == 0; }
+  const T& operator[](size_t i) const { return ptr[i]; }
+  const T* begin() const { return ptr; }
+  const T* end() const { return ptr + count; }
+};
 //! A class  that can be used to load a \class Mesh from file and do basic operations with it
 /*!
   This class only deals with simple model that contain just a single mesh. If you
@@ -61,11 +92,21 @@ protected:
   bool mHasTexture;
   std::vector<Vertex> mVertices;
   std::vector<unsigned int> mIndices;
+  //! Optional stream, one per vertex: tangent and sign of the bitangent (empty if none)
+  std::vector<glm::vec4> mTangents;
   glm::vec3 mUpperCorner;
   glm::vec3 mLowerCorner;
   std::string mDiffuseText;
-  void updateBoundingBox();
+  virtual void updateBoundingBox();
   void addDiffuseTexture(const aiMaterial* mat);
+  //! Optimize the triangles in [startIndex, startIndex + indexCount) for the vertex caches
+  /*!
+    The indices are relative to startVertex and the triangles only use the
+    vertexCount vertices starting there. If reorderVertices is false only the
+    triangles are reordered (for ranges that share vertices with others)
+  */
+  VertexCacheReport optimizeRange(size_t startVertex, size_t vertexCount, size_t startIndex,
+      size_t indexCount, unsigned int cacheSize, float overdrawThreshold, bool reorderVertices);
 public:
   //! Simple constructor that does nothing.
   /*!
@@ -79,7 +120,7 @@ public:
     give you the date you will need to render it.
   */
   explicit Mesh(const std::string& fileName);
-  ~Mesh();
+  virtual ~Mesh();
   //! Erases the data and then load a new \class Mesh from the file.
   bool loadFromFile(const std::string& fileName);
   //! Queries if this Mesh has no data.
@@ -88,15 +129,38 @@ public:
   bool hasTexture() const;
   //! Queries if the Vertices of the Mesh has normal vectors
   bool hasNormals() const;
+  //! Queries if the Mesh has a tangent for every vertex (See viewTangents)
+  bool hasTangents() const;
   //! Release the memmory on this Mesh
   void clear();
   //! Transform all the vertices of the mesh by T
-  void transform(const glm::mat4& T);
+  /*!
+    If T mirrors (negative determinant) the triangles are turned around, so
+    they keep facing outwards.
+  */
+  virtual void transform(const glm::mat4& T);
   //! Center and scale this Mesh. So it if thigly contained by a unit cube
   //! center at the origin.
   void toUnitCube();
-  //! Not yet implemented!
-  void recalculateNormals();
+  //! Compute smooth normals from the triangles (See \class NormalGenerator)
+  /*!
+    Every normal is weighted by the area and the angle of the triangles
+    around the vertex. The work is done in parallel.
+    @param creaseAngle in degrees, triangles whose normals differ by more are
+    not smoothed together and the vertices on those hard edges are split.
+    The default (180) smooths everything and does not add vertices.
+    The tangents are discarded, since they depend on the normals.
+    @return the number of vertices added at the end by the crease angle
+  */
+  virtual size_t recalculateNormals(float creaseAngle = 180.0f);
+  //! Compute the tangents for normal mapping (See generateTangents)
+  /*!
+    It needs texture coordinates, otherwise it does nothing. If there are no
+    normals they are computed first. Vertices shared by triangles with
+    mirrored texture coordinates are split.
+    @return the number of vertices added at the end
+  */
+  virtual size_t recalculateTangents();
   //! get the indices needed for glElementDraw* commands in a vector
   /*!
     One of the important interface functions. Since Model always stores data
@@ -114,6 +178,53 @@ public:
     indices is number of triangles times three
   */
   std::vector<Vertex> getVertices() const;
+  //! Read only view of the indices, without copying them (See getIndices)
+  ArrayView<unsigned int> viewIndices() const;
+  //! Read only view of the vertices, without copying them (See getVertices)
+  ArrayView<Vertex> viewVertices() const;
+  //! Move the indices out of this Mesh.
+  /*!
+    After this call the Mesh does not have indices anymore. Use it together with
+    releaseVertices when the Mesh is no longer needed, to avoid holding two copies
+    of the data
+  */
+  std::vector<unsigned int> releaseIndices();
+  //! Move the vertices out of this Mesh. (See releaseIndices)
+  std::vector<Vertex> releaseVertices();
+  //! Read only view of the tangents, one per vertex or empty (See hasTangents)
+  /*!
+    The xyz components are a unit tangent orthogonal to the normal and w is
+    the sign of the bitangent: bitangent = w * cross(normal, tangent).
+    It is a separate stream, so the meshes without normal maps do not pay for it
+  */
+  ArrayView<glm::vec4> viewTangents() const;
+  //! Move the tangents out of this Mesh. (See releaseIndices)
+  std::vector<glm::vec4> releaseTangents();
+  //! Reorder the triangles and vertices to render faster
+  /*!
+    First the triangles are reordered to reuse the post-transform vertex cache
+    (See optimizeVertexCache), then clusters of triangles are sorted to reduce
+    overdraw (See optimizeOverdraw) and finally the vertices are renumbered in
+    the order that the triangles use them (See optimizeVertexFetch). The shape
+    does not change.
+    @param cacheSize the vertex cache size to optimize for (See DEFAULT_CACHE_SIZE)
+    @param overdrawThreshold how much worse the ACMR can get to reduce overdraw
+    (See DEFAULT_OVERDRAW_THRESHOLD), less than 1 skips the overdraw step
+    @return the cache statistics before and after (See \struct VertexCacheReport)
+  */
+  virtual VertexCacheReport optimizeVertexOrder(unsigned int cacheSize = 16,
+      float overdrawThreshold = 1.05f);
+  //! Estimate the overdraw of this Mesh from several view directions (See analyzeOverdraw)
+  virtual OverdrawStats estimateOverdraw(unsigned int directions = 16,
+      unsigned int resolution = 256) const;
+  //! Reduce the number of triangles with edge collapses (See \class Simplifier)
+  /*!
+    Only the indices change, the simplified triangles use a subset of the
+    same vertices. To keep several levels of detail use Model::generateLods.
+    @param ratio fraction of the triangles to keep, in (0, 1]
+    @return the estimated error (in model units) of the simplified surface
+  */
+  virtual float simplify(float ratio);
   //! Clear and creates a new Mesh using the data provided
   /*!
     Recreates the object by providing data. The Mesh are indexed, so they
@@ -123,14 +234,21 @@ public:
   */
   bool loadVerticesAndIndices(const std::vector<Vertex>& vertices,
       const std::vector<unsigned int>& indices, bool normals = false, bool textCoords = false);
+  //! Clear and creates a new Mesh taking ownership of the data provided
+  /*!
+    Same as above, but the buffers are moved into the Mesh instead of copied.
+  */
+  bool loadVerticesAndIndices(std::vector<Vertex>&& vertices,
+      std::vector<unsigned int>&& indices, bool normals = false, bool textCoords = false);
   //! Clear and creates a new Mesh using a set of triangles
   /*!
     Recreates the object by providing data. Since the mesh is triangulated
     you can provide a set of triangles. The format of the triangles is fixed
     In order to create an indexed mesh for triangles, the Mesh will join all
     the vertex that are DELTA apart and will consider them the same vertex.
-    This tends to create smoth meshes.
+    (See \class VertexWelder). This tends to create smoth meshes.
     It will produce a mesh without normal nor texture coordinates.
+    (See recalculateNormals).
   */
   bool loadFromTriangles(const std::vector<Triangle>& triangles);
   //! Calculate the scale factor that will make this Mesh tighly fit in a unit cube
@@ -146,6 +264,10 @@ public:
   //! Get the number of vertices in the Mesh
   size_t vertexCount() const;
   //! Save the mesh on a file
+  /*!
+    The format is chosen by the extension: binary PLY (.ply), binary STL
+    (.stl) or OBJ (anything else). See \fn writeMesh
+  */
   bool save(const std::string& fileName = "") const;
   //! Get the file (name and path) of the diffuse texture.
   /*!
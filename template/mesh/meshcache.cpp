@@ -0,0 +1,379 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <sys/stat.h>
+
+#include "mappedfile.h"
+#include "meshcache.h"
+
+namespace mesh {
+
+namespace {
+
+const char MAGIC[8] = {'O', 'G', 'L', 'T', 'M', 'S', 'H', '\0'};
+const uint32_t ENDIANNESS = 0x01020304u;
+// Every section starts at a multiple of this
+const uint64_t ALIGNMENT = 64;
+
+struct Section {
+  uint64_t offset;
+  uint64_t count;
+};
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endianness;
+  uint32_t vertexSize;
+  uint32_t separatorSize;
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  uint64_t sourceHash;
+  uint64_t fileSize;
+  Section vertices;
+  Section tangents;
+  Section indices;
+  Section separators;
+  Section instanceRanges;
+  Section instanceTransforms;
+  Section nodes;
+  Section instanceNodes;
+  Section textures;
+  Section strings;
+};
+
+struct TextureEntry {
+  int32_t type;
+  uint32_t length;
+  uint64_t offset; // In the strings section
+};
+
+enum CacheFlags {HAS_NORMALS = 1, HAS_TEXTURE = 2};
+
+uint64_t alignUp(uint64_t offset) {
+  return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// Fast non cryptographic hash, it only needs to detect that a file changed
+uint64_t hashBytes(const unsigned char* data, size_t size) {
+  const uint64_t PRIME = 0x9e3779b97f4a7c15ull;
+  uint64_t h = 0xcbf29ce484222325ull ^ (size * PRIME);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    h = (h ^ word) * PRIME;
+    h ^= h >> 29;
+  }
+  for (; i < size; ++i) {
+    h = (h ^ data[i]) * PRIME;
+  }
+  h ^= h >> 32;
+  return h;
+}
+
+template <typename T>
+void writeSection(std::ofstream& out, uint64_t& position, const Section& section,
+    const T* data) {
+  // Zero padding up to the start of the section
+  static const char zeros[ALIGNMENT] = {};
+  out.write(zeros, static_cast<std::streamsize>(section.offset - position));
+  uint64_t bytes = section.count * sizeof(T);
+  if (bytes > 0) {
+    out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+  }
+  position = section.offset + bytes;
+}
+
+} // namespace
+
+MeshCache::MeshCache() : mData(nullptr), mSize(0) {
+
+}
+
+MeshCache::~MeshCache() {
+  close();
+}
+
+bool MeshCache::stampOf(const std::string& fileName, SourceStamp& stamp,
+    const std::vector<std::string>& dependencies) {
+  struct stat info;
+  if (stat(fileName.c_str(), &info) != 0) {
+    return false;
+  }
+  stamp.size = static_cast<uint64_t>(info.st_size);
+  stamp.modificationTime = static_cast<int64_t>(info.st_mtime);
+  size_t size = 0;
+  const unsigned char* data = mapFile(fileName, size);
+  if (!data) {
+    return false;
+  }
+  stamp.hash = hashBytes(data, size);
+  unmapFile(data, size);
+  // Every dependency changes the hash, a missing one too (it can appear later)
+  for (const std::string& dependency : dependencies) {
+    SourceStamp other = {0, 0, 0};
+    uint64_t values[3] = {0, 0, 0};
+    if (stampOf(dependency, other)) {
+      values[0] = other.size;
+      values[1] = static_cast<uint64_t>(other.modificationTime);
+      values[2] = other.hash;
+    }
+    values[0] ^= stamp.hash;
+    stamp.hash = hashBytes(reinterpret_cast<const unsigned char*>(values), sizeof(values));
+  }
+  return true;
+}
+
+std::string MeshCache::cacheFileFor(const std::string& fileName) {
+  return fileName + ".meshcache";
+}
+
+bool MeshCache::write(const std::string& cacheFile, const SourceStamp& stamp,
+    bool normals, bool textCoords, ArrayView<Vertex> vertices,
+    ArrayView<glm::vec4> tangents, ArrayView<unsigned int> indices, ArrayView<MeshData> separators,
+    ArrayView<TextureImage> textures, ArrayView<InstanceRange> instanceRanges,
+    ArrayView<glm::mat4> instanceTransforms, ArrayView<ModelNode> nodes,
+    ArrayView<uint32_t> instanceNodes) {
+  // Build the texture table and string blob
+  std::vector<TextureEntry> entries(textures.size());
+  std::string strings;
+  for (size_t i = 0; i < textures.size(); ++i) {
+    entries[i].type = static_cast<int32_t>(textures[i].type);
+    entries[i].length = static_cast<uint32_t>(textures[i].filePath.size());
+    entries[i].offset = strings.size();
+    strings += textures[i].filePath;
+  }
+  // Fill the header and compute the place of each section
+  CacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.endianness = ENDIANNESS;
+  header.vertexSize = sizeof(Vertex);
+  header.separatorSize = sizeof(MeshData);
+  header.flags = (normals ? HAS_NORMALS : 0) | (textCoords ? HAS_TEXTURE : 0);
+  header.sourceSize = stamp.size;
+  header.sourceTime = stamp.modificationTime;
+  header.sourceHash = stamp.hash;
+  header.vertices.offset = alignUp(sizeof(CacheHeader));
+  header.vertices.count = vertices.size();
+  header.tangents.offset = alignUp(header.vertices.offset + vertices.bytes());
+  header.tangents.count = tangents.size();
+  header.indices.offset = alignUp(header.tangents.offset + tangents.bytes());
+  header.indices.count = indices.size();
+  header.separators.offset = alignUp(header.indices.offset + indices.bytes());
+  header.separators.count = separators.size();
+  header.instanceRanges.offset = alignUp(header.separators.offset + separators.bytes());
+  header.instanceRanges.count = instanceRanges.size();
+  header.instanceTransforms.offset =
+      alignUp(header.instanceRanges.offset + instanceRanges.bytes());
+  header.instanceTransforms.count = instanceTransforms.size();
+  header.nodes.offset = alignUp(header.instanceTransforms.offset + instanceTransforms.bytes());
+  header.nodes.count = nodes.size();
+  header.instanceNodes.offset = alignUp(header.nodes.offset + nodes.bytes());
+  header.instanceNodes.count = instanceNodes.size();
+  header.textures.offset = alignUp(header.instanceNodes.offset + instanceNodes.bytes());
+  header.textures.count = entries.size();
+  header.strings.offset = alignUp(header.textures.offset + entries.size() * sizeof(TextureEntry));
+  header.strings.count = strings.size();
+  header.fileSize = header.strings.offset + strings.size();
+  // Write everything in a temporal file
+  std::string tmpFile = cacheFile + ".tmp";
+  std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    return false;
+  }
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  uint64_t position = sizeof(header);
+  writeSection(out, position, header.vertices, vertices.data());
+  writeSection(out, position, header.tangents, tangents.data());
+  writeSection(out, position, header.indices, indices.data());
+  writeSection(out, position, header.separators, separators.data());
+  writeSection(out, position, header.instanceRanges, instanceRanges.data());
+  writeSection(out, position, header.instanceTransforms, instanceTransforms.data());
+  writeSection(out, position, header.nodes, nodes.data());
+  writeSection(out, position, header.instanceNodes, instanceNodes.data());
+  writeSection(out, position, header.textures, entries.data());
+  writeSection(out, position, header.strings, strings.data());
+  out.close();
+  if (!out) {
+    std::remove(tmpFile.c_str());
+    return false;
+  }
+  // Then replace the old cache (if any) in one step
+  if (std::rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+    std::remove(tmpFile.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool MeshCache::open(const std::string& cacheFile, const SourceStamp& expected) {
+  close();
+  mData = mapFile(cacheFile, mSize);
+  if (!mData) {
+    return false;
+  }
+  bool valid = mSize >= sizeof(CacheHeader);
+  CacheHeader header;
+  if (valid) {
+    std::memcpy(&header, mData, sizeof(header));
+    valid = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+        header.version == VERSION &&
+        header.endianness == ENDIANNESS &&
+        header.vertexSize == sizeof(Vertex) &&
+        header.separatorSize == sizeof(MeshData) &&
+        header.fileSize == mSize;
+  }
+  // Is it a cache of the same source file?
+  valid = valid && header.sourceSize == expected.size &&
+      header.sourceTime == expected.modificationTime &&
+      header.sourceHash == expected.hash;
+  // Finally, all the sections need to be inside the file
+  valid = valid &&
+      header.vertices.offset + header.vertices.count * sizeof(Vertex) <= mSize &&
+      (header.tangents.count == 0 || header.tangents.count == header.vertices.count) &&
+      header.tangents.offset + header.tangents.count * sizeof(glm::vec4) <= mSize &&
+      header.indices.offset + header.indices.count * sizeof(unsigned int) <= mSize &&
+      header.separators.offset + header.separators.count * sizeof(MeshData) <= mSize &&
+      (header.instanceRanges.count == 0 ||
+          header.instanceRanges.count == header.separators.count) &&
+      header.instanceRanges.offset + header.instanceRanges.count * sizeof(InstanceRange) <= mSize &&
+      header.instanceTransforms.offset +
+          header.instanceTransforms.count * sizeof(glm::mat4) <= mSize &&
+      header.nodes.offset + header.nodes.count * sizeof(ModelNode) <= mSize &&
+      (header.instanceNodes.count == 0 ||
+          header.instanceNodes.count == header.instanceTransforms.count) &&
+      header.instanceNodes.offset + header.instanceNodes.count * sizeof(uint32_t) <= mSize &&
+      header.textures.offset + header.textures.count * sizeof(TextureEntry) <= mSize &&
+      header.strings.offset + header.strings.count <= mSize;
+  if (!valid) {
+    close();
+  }
+  return valid;
+}
+
+void MeshCache::close() {
+  unmapFile(mData, mSize);
+  mData = nullptr;
+  mSize = 0;
+}
+
+bool MeshCache::isOpen() const {
+  return mData != nullptr;
+}
+
+bool MeshCache::hasNormals() const {
+  return isOpen() && (reinterpret_cast<const CacheHeader*>(mData)->flags & HAS_NORMALS);
+}
+
+bool MeshCache::hasTexture() const {
+  return isOpen() && (reinterpret_cast<const CacheHeader*>(mData)->flags & HAS_TEXTURE);
+}
+
+const unsigned char* MeshCache::section(uint64_t offset) const {
+  return mData + offset;
+}
+
+ArrayView<Vertex> MeshCache::vertices() const {
+  if (!isOpen()) {
+    return ArrayView<Vertex>();
+  }
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(mData);
+  return ArrayView<Vertex>(reinterpret_cast<const Vertex*>(section(header->vertices.offset)),
+      static_cast<size_t>(header->vertices.count));
+}
+
+ArrayView<glm::vec4> MeshCache::tangents() const {
+  if (!isOpen()) {
+    return ArrayView<glm::vec4>();
+  }
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(mData);
+  return ArrayView<glm::vec4>(
+      reinterpret_cast<const glm::vec4*>(section(header->tangents.offset)),
+      static_cast<size_t>(header->tangents.count));
+}
+
+ArrayView<unsigned int> MeshCache::indices() const {
+  if (!isOpen()) {
+    return ArrayView<unsigned int>();
+  }
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(mData);
+  return ArrayView<unsigned int>(
+      reinterpret_cast<const unsigned int*>(section(header->indices.offset)),
+      static_cast<size_t>(header->indices.count));
+}
+
+ArrayView<MeshData> MeshCache::separators() const {
+  if (!isOpen()) {
+    return ArrayView<MeshData>();
+  }
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(mData);
+  return ArrayView<MeshData>(reinterpret_cast<const MeshData*>(section(header->separators.offset)),
+      static_cast<size_t>(header->separators.count));
+}
+
+ArrayView<InstanceRange> MeshCache::instanceRanges() const {
+  if (!isOpen()) {
+    return ArrayView<InstanceRange>();
+  }
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(mData);
+  return ArrayView<InstanceRange>(
+      reinterpret_cast<const InstanceRange*>(section(header->instanceRanges.offset)),
+      static_cast<size_t>(header->instanceRanges.count));
+}
+
+ArrayView<glm::mat4> MeshCache::instanceTransforms() const {
+  if (!isOpen()) {
+    return ArrayView<glm::mat4>();
+  }
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(mData);
+  return ArrayView<glm::mat4>(
+      reinterpret_cast<const glm::mat4*>(section(header->instanceTransforms.offset)),
+      static_cast<size_t>(header->instanceTransforms.count));
+}
+
+ArrayView<ModelNode> MeshCache::nodes() const {
+  if (!isOpen()) {
+    return ArrayView<ModelNode>();
+  }
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(mData);
+  return ArrayView<ModelNode>(reinterpret_cast<const ModelNode*>(section(header->nodes.offset)),
+      static_cast<size_t>(header->nodes.count));
+}
+
+ArrayView<uint32_t> MeshCache::instanceNodes() const {
+  if (!isOpen()) {
+    return ArrayView<uint32_t>();
+  }
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(mData);
+  return ArrayView<uint32_t>(
+      reinterpret_cast<const uint32_t*>(section(header->instanceNodes.offset)),
+      static_cast<size_t>(header->instanceNodes.count));
+}
+
+std::vector<TextureImage> MeshCache::textures() const {
+  std::vector<TextureImage> result;
+  if (!isOpen()) {
+    return result;
+  }
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(mData);
+  const TextureEntry* entries =
+      reinterpret_cast<const TextureEntry*>(section(header->textures.offset));
+  const char* strings = reinterpret_cast<const char*>(section(header->strings.offset));
+  result.resize(static_cast<size_t>(header->textures.count));
+  for (size_t i = 0; i < result.size(); ++i) {
+    // A corrupted entry just produces an empty path
+    if (entries[i].offset + entries[i].length <= header->strings.count) {
+      result[i].filePath.assign(strings + entries[i].offset, entries[i].length);
+    }
+    result[i].type = static_cast<TextType>(entries[i].type);
+  }
+  return result;
+}
+
+} // namespace mesh
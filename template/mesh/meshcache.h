@@ -0,0 +1,112 @@
+#ifndef MESH_CACHE_H_
+#define MESH_CACHE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "model.h"
+
+namespace mesh {
+
+//! Identifies the exact version of a model file that was used to create a cache
+struct SourceStamp {
+  //! Size of the file in bytes
+  uint64_t size;
+  //! Last modification time of the file (as reported by the file system)
+  int64_t modificationTime;
+  //! Hash of the whole content of the file
+  uint64_t hash;
+};
+
+//! A binary container with all the data of a \class Model
+/*!
+  Importing a model with Assimp (parsing, triangulating and joining vertices)
+  is slow. This class stores the result of such import in a file, with a
+  layout that is identical to the one in memory: a header, followed by the
+  \struct Vertex array, the optional tangents array, the indices array, the \struct MeshData separators,
+  the optional \struct InstanceRange of every separator and the instance transforms,
+  the \struct ModelNode scene graph and the node of every instance, and the
+  \struct TextureImage table (as a table of offsets into a string blob).
+  Every section starts at a 64 bytes boundary.
+
+  Therefore, the file can be memory mapped and its sections used as they are
+  (for example passed directly to glBufferData) without parsing anything.
+
+  The header keeps a \struct SourceStamp of the model file and the files it
+  reads, so a cache is only used if none of them changed since the cache was
+  written.
+*/
+class MeshCache {
+public:
+  //! Version of the format, any change in the layout needs to increase it
+  static const uint32_t VERSION = 7;
+
+  MeshCache();
+  ~MeshCache();
+  //! Compute the stamp (size, modification time and content hash) of a file
+  /*!
+    @param dependencies other files read with it (as the material libraries of
+    an OBJ file). Their size, time and content (or that they are missing) are
+    part of the hash, so a change in any of them also invalidates the cache
+  */
+  static bool stampOf(const std::string& fileName, SourceStamp& stamp,
+      const std::vector<std::string>& dependencies = std::vector<std::string>());
+  //! Name of the cache file for a given model file (same folder, extra extension)
+  static std::string cacheFileFor(const std::string& fileName);
+  //! Write the data of a model to a cache file
+  /*!
+    The file is written under a temporary name and then renamed, so a reader
+    never sees a half written cache.
+  */
+  static bool write(const std::string& cacheFile, const SourceStamp& stamp,
+      bool normals, bool textCoords, ArrayView<Vertex> vertices,
+      ArrayView<glm::vec4> tangents, ArrayView<unsigned int> indices, ArrayView<MeshData> separators,
+      ArrayView<TextureImage> textures, ArrayView<InstanceRange> instanceRanges,
+      ArrayView<glm::mat4> instanceTransforms, ArrayView<ModelNode> nodes,
+      ArrayView<uint32_t> instanceNodes);
+  //! Map a cache file into memory
+  /*!
+    It fails if the file is not a valid cache of this version, or it was not
+    created from a source file with the expected stamp.
+  */
+  bool open(const std::string& cacheFile, const SourceStamp& expected);
+  //! Unmap the current cache file (if any)
+  void close();
+  //! Queries if a cache file is currently mapped
+  bool isOpen() const;
+  //! Queries if the cached vertices have normal vectors
+  bool hasNormals() const;
+  //! Queries if the cached vertices have texture coordinates
+  bool hasTexture() const;
+  //! View of the vertices, directly in the mapped file
+  ArrayView<Vertex> vertices() const;
+  //! View of the tangents (empty if the model had none), directly in the mapped file
+  ArrayView<glm::vec4> tangents() const;
+  //! View of the indices, directly in the mapped file
+  ArrayView<unsigned int> indices() const;
+  //! View of the separators, directly in the mapped file
+  ArrayView<MeshData> separators() const;
+  //! View of the instances of every separator (empty if there are none)
+  ArrayView<InstanceRange> instanceRanges() const;
+  //! View of the instance transforms, directly in the mapped file
+  ArrayView<glm::mat4> instanceTransforms() const;
+  //! View of the nodes of the scene graph (empty if there is none)
+  ArrayView<ModelNode> nodes() const;
+  //! View of the node of every instance (empty if there is no scene graph)
+  ArrayView<uint32_t> instanceNodes() const;
+  //! Decode the textures table
+  std::vector<TextureImage> textures() const;
+
+private:
+  MeshCache(const MeshCache&) = delete;
+  MeshCache& operator=(const MeshCache&) = delete;
+  const unsigned char* section(uint64_t offset) const;
+
+  const unsigned char* mData;
+  size_t mSize;
+};
+
+} // namespace mesh
+
+#endif
@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../parallel/threadpool.h"
+
+#include "frustumculler.h"
+#include "meshlets.h"
+
+namespace mesh {
+
+using glm::vec3;
+using glm::vec4;
+
+namespace {
+
+enum CullState {VISIBLE = 0, OUTSIDE_FRUSTUM = 1, BACK_FACING = 2};
+
+// Above one: the normal cone test never culls
+const float NO_CONE = 2.0f;
+
+// Bounding sphere and normal cone of the triangles of a meshlet
+void computeBounds(const Vertex* vertices, const unsigned int* indices, Meshlet& meshlet) {
+  const GLsizei count = meshlet.howMany;
+  vec3 lower(FLT_MAX);
+  vec3 upper(-FLT_MAX);
+  for (GLsizei k = 0; k < count; ++k) {
+    const vec3& p = vertices[indices[k]].position;
+    lower = glm::min(lower, p);
+    upper = glm::max(upper, p);
+  }
+  meshlet.center = 0.5f * (lower + upper);
+  float radius2 = 0.0f;
+  for (GLsizei k = 0; k < count; ++k) {
+    radius2 = glm::max(radius2, glm::length2(vertices[indices[k]].position - meshlet.center));
+  }
+  meshlet.radius = std::sqrt(radius2);
+  // The axis is the average of the normals (by area)
+  std::vector<vec3> normals;
+  normals.reserve(count / 3);
+  vec3 axis(0.0f);
+  for (GLsizei k = 0; k + 2 < count; k += 3) {
+    const vec3& p0 = vertices[indices[k]].position;
+    vec3 n = glm::cross(vertices[indices[k + 1]].position - p0,
+        vertices[indices[k + 2]].position - p0);
+    axis += n;
+    float length = glm::length(n);
+    if (length > 0.0f) {
+      normals.push_back(n / length);
+    }
+  }
+  meshlet.coneAxis = vec3(0.0f);
+  meshlet.coneApex = meshlet.center;
+  meshlet.coneCutoff = NO_CONE;
+  float axisLength = glm::length(axis);
+  if (axisLength <= 0.0f || normals.empty()) {
+    return;
+  }
+  axis /= axisLength;
+  float minDot = 1.0f;
+  for (const vec3& n : normals) {
+    minDot = glm::min(minDot, glm::dot(n, axis));
+  }
+  meshlet.coneAxis = axis;
+  // With a cone wider than a half space there is no viewer that sees all the backs
+  if (minDot <= 0.1f) {
+    return;
+  }
+  // The apex is the point of the axis that is behind the planes of all the triangles
+  float maxT = 0.0f;
+  for (GLsizei k = 0; k + 2 < count; k += 3) {
+    const vec3& p0 = vertices[indices[k]].position;
+    vec3 normal = glm::cross(vertices[indices[k + 1]].position - p0,
+        vertices[indices[k + 2]].position - p0);
+    float length = glm::length(normal);
+    if (length <= 0.0f) {
+      continue;
+    }
+    normal /= length;
+    float dc = glm::dot(p0 - meshlet.center, normal);
+    float dn = glm::dot(axis, normal);
+    maxT = glm::max(maxT, -dc / dn);
+  }
+  meshlet.coneApex = meshlet.center - axis * maxT;
+  meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+// Meshlets of one separator, the triangles are taken in order
+void buildSeparator(const Vertex* vertices, const unsigned int* indices, const MeshData& sep,
+    GLint separator, size_t maxVertices, size_t maxTriangles, std::vector<Meshlet>& out) {
+  const Vertex* base = vertices + sep.startVertex;
+  const unsigned int* first = indices + sep.startIndex;
+  // The vertex was used in the current meshlet if its stamp is the current one
+  std::vector<unsigned int> stamp;
+  unsigned int current = 1;
+  Meshlet meshlet;
+  meshlet.separator = separator;
+  meshlet.startIndex = sep.startIndex;
+  meshlet.howMany = 0;
+  meshlet.vertexCount = 0;
+  auto close = [&]() {
+    computeBounds(base, indices + meshlet.startIndex, meshlet);
+    out.push_back(meshlet);
+    meshlet.startIndex += meshlet.howMany;
+    meshlet.howMany = 0;
+    meshlet.vertexCount = 0;
+    ++current;
+  };
+  for (GLsizei t = 0; t + 2 < sep.howMany; t += 3) {
+    const unsigned int* tri = first + t;
+    size_t needed = std::max(tri[0], std::max(tri[1], tri[2])) + size_t(1);
+    if (stamp.size() < needed) {
+      stamp.resize(std::max(needed, 2 * stamp.size()), 0);
+    }
+    size_t fresh = (stamp[tri[0]] != current ? 1 : 0) +
+        (stamp[tri[1]] != current && tri[1] != tri[0] ? 1 : 0) +
+        (stamp[tri[2]] != current && tri[2] != tri[0] && tri[2] != tri[1] ? 1 : 0);
+    if (meshlet.howMany > 0 && (meshlet.vertexCount + fresh > maxVertices ||
+        static_cast<size_t>(meshlet.howMany / 3) + 1 > maxTriangles)) {
+      close();
+      fresh = 3 - (tri[1] == tri[0] ? 1 : 0) - (tri[2] == tri[0] || tri[2] == tri[1] ? 1 : 0);
+    }
+    for (int c = 0; c < 3; ++c) {
+      stamp[tri[c]] = current;
+    }
+    meshlet.vertexCount += static_cast<GLint>(fresh);
+    meshlet.howMany += 3;
+  }
+  if (meshlet.howMany > 0) {
+    close();
+  }
+}
+
+} // namespace
+
+Meshlets::Meshlets(size_t maxVertices, size_t maxTriangles) :
+    mMaxVertices(std::max(maxVertices, size_t(3))), mMaxTriangles(std::max(maxTriangles, size_t(1))) {
+
+}
+
+void Meshlets::build(const Model& model) {
+  build(model.viewVertices(), model.viewIndices(), model.viewSeparators());
+}
+
+void Meshlets::build(const Mesh& mesh) {
+  MeshData all = {0, 0, static_cast<GLsizei>(mesh.indicesCount()), -1, -1, -1, GL_UNSIGNED_INT, 0};
+  build(mesh.viewVertices(), mesh.viewIndices(), ArrayView<MeshData>(&all, 1));
+}
+
+void Meshlets::build(ArrayView<Vertex> vertices, ArrayView<unsigned int> indices,
+    ArrayView<MeshData> separators) {
+  // Every separator is split on its own
+  std::vector<std::vector<Meshlet> > parts(separators.size());
+  parallel::forEachRange(separators.size(), [&](size_t first, size_t last) {
+    for (size_t s = first; s < last; ++s) {
+      buildSeparator(vertices.data(), indices.data(), separators[s], static_cast<GLint>(s),
+          mMaxVertices, mMaxTriangles, parts[s]);
+    }
+  }, 1);
+  mMeshlets.clear();
+  mFirst.assign(1, 0);
+  for (const auto& part : parts) {
+    mMeshlets.insert(mMeshlets.end(), part.begin(), part.end());
+    mFirst.push_back(mMeshlets.size());
+  }
+  // The structure of arrays copy, used by the culling
+  const size_t n = mMeshlets.size();
+  for (auto* v : {&mCenterX, &mCenterY, &mCenterZ, &mRadius, &mAxisX, &mAxisY, &mAxisZ,
+      &mCutoff, &mApexX, &mApexY, &mApexZ}) {
+    v->resize(n);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    const Meshlet& m = mMeshlets[i];
+    mCenterX[i] = m.center.x;
+    mCenterY[i] = m.center.y;
+    mCenterZ[i] = m.center.z;
+    mRadius[i] = m.radius;
+    mAxisX[i] = m.coneAxis.x;
+    mAxisY[i] = m.coneAxis.y;
+    mAxisZ[i] = m.coneAxis.z;
+    mCutoff[i] = m.coneCutoff;
+    mApexX[i] = m.coneApex.x;
+    mApexY[i] = m.coneApex.y;
+    mApexZ[i] = m.coneApex.z;
+  }
+  mState.assign(n, VISIBLE);
+}
+
+size_t Meshlets::size() const {
+  return mMeshlets.size();
+}
+
+ArrayView<Meshlet> Meshlets::view() const {
+  return ArrayView<Meshlet>(mMeshlets);
+}
+
+size_t Meshlets::firstOf(size_t separator) const {
+  return separator < mFirst.size() ? mFirst[separator] : mMeshlets.size();
+}
+
+bool Meshlets::isVisible(size_t meshlet) const {
+  return mState[meshlet] == VISIBLE;
+}
+
+MeshletCullStats Meshlets::cull(const glm::mat4& PVM, const vec3& eye) {
+  vec4 planes[6];
+  frustumPlanes(PVM, planes);
+  const size_t n = mMeshlets.size();
+  // One meshlet at a time, for the ones that do not fill a SIMD register
+  auto cullOne = [&](size_t i) {
+    for (int p = 0; p < 6; ++p) {
+      float d = planes[p].x * mCenterX[i] + planes[p].y * mCenterY[i] +
+          planes[p].z * mCenterZ[i] + planes[p].w;
+      if (d < -mRadius[i]) {
+        mState[i] = OUTSIDE_FRUSTUM;
+        return;
+      }
+    }
+    vec3 view(mApexX[i] - eye.x, mApexY[i] - eye.y, mApexZ[i] - eye.z);
+    float dot = view.x * mAxisX[i] + view.y * mAxisY[i] + view.z * mAxisZ[i];
+    mState[i] = dot >= mCutoff[i] * glm::length(view) ? BACK_FACING : VISIBLE;
+  };
+  const size_t GRAIN = 4096; // Meshlets per task, a multiple of 4
+  parallel::forEachRange((n + GRAIN - 1) / GRAIN, [&](size_t firstBlock, size_t lastBlock) {
+    size_t begin = firstBlock * GRAIN;
+    size_t end = std::min(n, lastBlock * GRAIN);
+    size_t i = begin;
+#if defined(__SSE2__)
+    __m128 a[6], b[6], c[6], d[6];
+    for (int p = 0; p < 6; ++p) {
+      a[p] = _mm_set1_ps(planes[p].x);
+      b[p] = _mm_set1_ps(planes[p].y);
+      c[p] = _mm_set1_ps(planes[p].z);
+      d[p] = _mm_set1_ps(planes[p].w);
+    }
+    const __m128 ex = _mm_set1_ps(eye.x);
+    const __m128 ey = _mm_set1_ps(eye.y);
+    const __m128 ez = _mm_set1_ps(eye.z);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= end; i += 4) {
+      __m128 x = _mm_loadu_ps(&mCenterX[i]);
+      __m128 y = _mm_loadu_ps(&mCenterY[i]);
+      __m128 z = _mm_loadu_ps(&mCenterZ[i]);
+      __m128 minusRadius = _mm_sub_ps(zero, _mm_loadu_ps(&mRadius[i]));
+      // Inside (or crossing) every plane
+      __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+      for (int p = 0; p < 6; ++p) {
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[p], x), _mm_mul_ps(b[p], y)),
+            _mm_add_ps(_mm_mul_ps(c[p], z), d[p]));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, minusRadius));
+      }
+      // Normal cone: back facing if dot(apex - eye, axis) >= cutoff * |apex - eye|
+      __m128 vx = _mm_sub_ps(_mm_loadu_ps(&mApexX[i]), ex);
+      __m128 vy = _mm_sub_ps(_mm_loadu_ps(&mApexY[i]), ey);
+      __m128 vz = _mm_sub_ps(_mm_loadu_ps(&mApexZ[i]), ez);
+      __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_loadu_ps(&mAxisX[i])),
+          _mm_mul_ps(vy, _mm_loadu_ps(&mAxisY[i]))), _mm_mul_ps(vz, _mm_loadu_ps(&mAxisZ[i])));
+      __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)),
+          _mm_mul_ps(vz, vz)));
+      __m128 back = _mm_cmpge_ps(dot, _mm_mul_ps(_mm_loadu_ps(&mCutoff[i]), length));
+      int insideMask = _mm_movemask_ps(inside);
+      int backMask = _mm_movemask_ps(back);
+      for (int k = 0; k < 4; ++k) {
+        mState[i + k] = !(insideMask & (1 << k)) ? OUTSIDE_FRUSTUM :
+            (backMask & (1 << k)) ? BACK_FACING : VISIBLE;
+      }
+    }
+#endif
+    for (; i < end; ++i) {
+      cullOne(i);
+    }
+  }, 1);
+  MeshletCullStats stats = {n, 0, 0, 0, 0};
+  for (size_t i = 0; i < n; ++i) {
+    size_t triangles = mMeshlets[i].howMany / 3;
+    stats.triangles += triangles;
+    switch (mState[i]) {
+      case OUTSIDE_FRUSTUM: stats.frustumCulled++; break;
+      case BACK_FACING: stats.backfaceCulled++; break;
+      default: stats.visibleTriangles += triangles; break;
+    }
+  }
+  return stats;
+}
+
+} // namespace mesh
@@ -0,0 +1,105 @@
+#ifndef MESH_MESHLETS_H_
+#define MESH_MESHLETS_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "model.h"
+
+namespace mesh {
+
+//! A small cluster of triangles of one separator, with the data needed to cull it
+/*!
+  The triangles of a meshlet are a contiguous range of the index buffer, so a
+  run of visible meshlets is drawn with a single glDrawElementsBaseVertex.
+*/
+struct Meshlet {
+  //! Separator (mesh of the \class Model) that contains this meshlet
+  GLint separator;
+  //! The place of the first index of this meshlet (same as MeshData::startIndex)
+  GLint startIndex;
+  //! Number of indexes in this meshlet
+  GLsizei howMany;
+  //! Number of different vertices used by the triangles
+  GLint vertexCount;
+  //! Bounding sphere
+  glm::vec3 center;
+  float radius;
+  //! Normal cone: all the triangles face away from a viewer inside the cone
+  /*!
+    The meshlet is back facing if dot(normalize(coneApex - eye), coneAxis) >= coneCutoff.
+    A cutoff bigger than one means the triangles are too spread to be culled this way
+  */
+  glm::vec3 coneAxis;
+  float coneCutoff;
+  glm::vec3 coneApex;
+};
+
+//! Statistics of the last culling
+struct MeshletCullStats {
+  //! Number of meshlets tested
+  size_t meshlets;
+  //! Meshlets outside the view frustum
+  size_t frustumCulled;
+  //! Meshlets inside the frustum, but back facing
+  size_t backfaceCulled;
+  //! Triangles of all the meshlets, and of the visible ones
+  size_t triangles;
+  size_t visibleTriangles;
+};
+
+//! Splits the separators of a \class Model in meshlets and culls them on the CPU
+/*!
+  The triangles of every separator are taken in index order (so, call
+  Model::optimizeVertexOrder first to get compact clusters) and a new meshlet
+  starts when the current one would use more than maxVertices vertices or
+  more than maxTriangles triangles.
+
+  Culling tests four meshlets at a time (SSE) against the six planes of the
+  view frustum and against their normal cones.
+*/
+class Meshlets {
+public:
+  //! Default limits, the usual ones for mesh shaders
+  static const size_t MAX_VERTICES = 64;
+  static const size_t MAX_TRIANGLES = 124;
+  //! Creates an empty set with the given limits per meshlet
+  explicit Meshlets(size_t maxVertices = MAX_VERTICES, size_t maxTriangles = MAX_TRIANGLES);
+  //! Clear and create the meshlets of every separator of a Model (in parallel)
+  void build(const Model& model);
+  //! Clear and create the meshlets of a Mesh (as a single separator)
+  void build(const Mesh& mesh);
+  //! Clear and create the meshlets of the given ranges of the buffers
+  void build(ArrayView<Vertex> vertices, ArrayView<unsigned int> indices,
+      ArrayView<MeshData> separators);
+  //! Number of meshlets
+  size_t size() const;
+  //! Read only view of the meshlets, sorted by separator
+  ArrayView<Meshlet> view() const;
+  //! The meshlets of separator s are [firstOf(s), firstOf(s + 1))
+  size_t firstOf(size_t separator) const;
+  //! Test every meshlet for visibility. The results are queried with isVisible
+  /*!
+    @param PVM the projection-view-model matrix used to render
+    @param eye the camera position in model coordinates
+  */
+  MeshletCullStats cull(const glm::mat4& PVM, const glm::vec3& eye);
+  //! Queries if the meshlet passed the last culling (true if cull was never called)
+  bool isVisible(size_t meshlet) const;
+
+private:
+  size_t mMaxVertices;
+  size_t mMaxTriangles;
+  std::vector<Meshlet> mMeshlets;
+  std::vector<size_t> mFirst;
+  // The culling data as structure of arrays, for the SIMD tests
+  std::vector<float> mCenterX, mCenterY, mCenterZ, mRadius;
+  std::vector<float> mAxisX, mAxisY, mAxisZ, mCutoff;
+  std::vector<float> mApexX, mApexY, mApexZ;
+  // One of the culling results per meshlet
+  std::vector<unsigned char> mState;
+};
+
+} // namespace mesh
+
+#endif
@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "../parallel/threadpool.h"
+
+#include "meshoptimizer.h"
+
+namespace mesh {
+
+namespace {
+
+const unsigned int NONE = ~0u;
+
+//! Triangles around each vertex, stored as a compressed sparse row table
+struct Adjacency {
+  //! Triangles of vertex v are triangles[offsets[v]] ... triangles[offsets[v + 1] - 1]
+  std::vector<unsigned int> offsets;
+  std::vector<unsigned int> triangles;
+
+  Adjacency(const unsigned int* indices, size_t indexCount, size_t vertexCount) :
+      offsets(vertexCount + 1, 0), triangles(indexCount) {
+    for (size_t i = 0; i < indexCount; ++i) {
+      offsets[indices[i] + 1]++;
+    }
+    for (size_t v = 0; v < vertexCount; ++v) {
+      offsets[v + 1] += offsets[v];
+    }
+    std::vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indexCount; ++i) {
+      triangles[cursor[indices[i]]++] = static_cast<unsigned int>(i / 3);
+    }
+  }
+
+  unsigned int count(unsigned int v) const {
+    return offsets[v + 1] - offsets[v];
+  }
+};
+
+//! A FIFO post-transform cache simulation
+class FifoCache {
+public:
+  FifoCache(size_t vertexCount, unsigned int cacheSize) :
+      mEntered(vertexCount, 0), mSize(cacheSize), mTime(cacheSize + 1) {}
+  //! Use vertex v, returns 1 if it was not in the cache
+  unsigned int use(unsigned int v) {
+    // A vertex is in the FIFO if it entered less than cacheSize misses ago
+    if (mTime - mEntered[v] > mSize) {
+      mEntered[v] = mTime++;
+      return 1;
+    }
+    return 0;
+  }
+  //! Empty the cache
+  void flush() {
+    mTime += mSize + 1;
+  }
+
+private:
+  std::vector<size_t> mEntered;
+  size_t mSize;
+  size_t mTime;
+};
+
+//! Number of cache misses of the triangles
+size_t countMisses(const unsigned int* indices, size_t triangleCount, size_t vertexCount,
+    unsigned int cacheSize) {
+  FifoCache cache(vertexCount, cacheSize);
+  size_t misses = 0;
+  for (size_t i = 0; i < 3 * triangleCount; ++i) {
+    misses += cache.use(indices[i]);
+  }
+  return misses;
+}
+
+//! Twice the area times the normal of a triangle
+glm::vec3 areaNormal(const Vertex* vertices, const unsigned int* tri) {
+  const glm::vec3& p0 = vertices[tri[0]].position;
+  return glm::cross(vertices[tri[1]].position - p0, vertices[tri[2]].position - p0);
+}
+
+//! Draws triangles with depth test into a square depth buffer and counts the fragments
+class OverdrawRasterizer {
+public:
+  OverdrawRasterizer(unsigned int resolution) :
+      mResolution(resolution), mDepth(resolution * resolution, -FLT_MAX), mShaded(0) {}
+  //! Draw a triangle given in pixels (x, y) and depth (z, bigger is closer)
+  void draw(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    float area = edge(a, b, c);
+    // Back facing (clockwise) or degenerated
+    if (area <= 0.0f) {
+      return;
+    }
+    const int last = static_cast<int>(mResolution) - 1;
+    int x0 = std::max(0, static_cast<int>(std::floor(std::min(a.x, std::min(b.x, c.x)))));
+    int x1 = std::min(last, static_cast<int>(std::ceil(std::max(a.x, std::max(b.x, c.x)))));
+    int y0 = std::max(0, static_cast<int>(std::floor(std::min(a.y, std::min(b.y, c.y)))));
+    int y1 = std::min(last, static_cast<int>(std::ceil(std::max(a.y, std::max(b.y, c.y)))));
+    float inverse = 1.0f / area;
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        glm::vec3 p(x + 0.5f, y + 0.5f, 0.0f);
+        float w0 = edge(b, c, p);
+        float w1 = edge(c, a, p);
+        float w2 = edge(a, b, p);
+        if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+          continue;
+        }
+        float z = (w0 * a.z + w1 * b.z + w2 * c.z) * inverse;
+        float& depth = mDepth[y * mResolution + x];
+        if (z > depth) {
+          depth = z;
+          mShaded++;
+        }
+      }
+    }
+  }
+  size_t shaded() const {
+    return mShaded;
+  }
+  size_t covered() const {
+    size_t count = 0;
+    for (float d : mDepth) {
+      count += d > -FLT_MAX ? 1 : 0;
+    }
+    return count;
+  }
+
+private:
+  unsigned int mResolution;
+  std::vector<float> mDepth;
+  size_t mShaded;
+
+  static float edge(const glm::vec3& a, const glm::vec3& b, const glm::vec3& p) {
+    return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+  }
+};
+
+} // namespace
+
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount,
+    size_t vertexCount, unsigned int cacheSize) {
+  VertexCacheStats stats = {0.0f, 0.0f, 0, indexCount / 3, 0};
+  FifoCache cache(vertexCount, cacheSize);
+  std::vector<bool> used(vertexCount, false);
+  for (size_t i = 0; i < 3 * stats.triangles; ++i) {
+    unsigned int v = indices[i];
+    stats.transformed += cache.use(v);
+    if (!used[v]) {
+      used[v] = true;
+      stats.vertices++;
+    }
+  }
+  if (stats.triangles > 0) {
+    stats.acmr = static_cast<float>(stats.transformed) / stats.triangles;
+  }
+  if (stats.vertices > 0) {
+    stats.atvr = static_cast<float>(stats.transformed) / stats.vertices;
+  }
+  return stats;
+}
+
+void optimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount,
+    unsigned int cacheSize) {
+  const size_t triangleCount = indexCount / 3;
+  if (triangleCount == 0 || vertexCount == 0) {
+    return;
+  }
+  Adjacency adjacency(indices, 3 * triangleCount, vertexCount);
+  // Triangles that still need to be emitted around every vertex
+  std::vector<unsigned int> live(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    live[v] = adjacency.count(static_cast<unsigned int>(v));
+  }
+  std::vector<size_t> cacheTime(vertexCount, 0);
+  std::vector<bool> emitted(triangleCount, false);
+  // Vertices of the emitted triangles, to go back to them in a dead end
+  std::vector<unsigned int> deadEnd;
+  deadEnd.reserve(indexCount);
+  std::vector<unsigned int> candidates;
+  std::vector<unsigned int> result;
+  result.reserve(3 * triangleCount);
+  size_t time = cacheSize + 1;
+  size_t cursor = 0;
+  unsigned int fanning = 0;
+  while (fanning != NONE) {
+    candidates.clear();
+    // Emit all the pending triangles around the fanning vertex
+    for (unsigned int k = adjacency.offsets[fanning]; k < adjacency.offsets[fanning + 1]; ++k) {
+      unsigned int t = adjacency.triangles[k];
+      if (emitted[t]) {
+        continue;
+      }
+      for (int c = 0; c < 3; ++c) {
+        unsigned int v = indices[3 * t + c];
+        result.push_back(v);
+        deadEnd.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        if (time - cacheTime[v] > cacheSize) {
+          cacheTime[v] = time++;
+        }
+      }
+      emitted[t] = true;
+    }
+    // Next, the candidate that will still be in the cache after fanning around it
+    unsigned int next = NONE;
+    size_t bestPriority = 0;
+    for (unsigned int v : candidates) {
+      if (live[v] == 0) {
+        continue;
+      }
+      size_t priority = 0;
+      if (time - cacheTime[v] + 2 * live[v] <= cacheSize) {
+        priority = time - cacheTime[v];
+      }
+      if (next == NONE || priority > bestPriority) {
+        bestPriority = priority;
+        next = v;
+      }
+    }
+    if (next == NONE) {
+      // Dead end: the most recent vertex with work left, or the next one in input order
+      while (!deadEnd.empty() && next == NONE) {
+        unsigned int v = deadEnd.back();
+        deadEnd.pop_back();
+        if (live[v] > 0) {
+          next = v;
+        }
+      }
+      while (cursor < vertexCount && next == NONE) {
+        if (live[cursor] > 0) {
+          next = static_cast<unsigned int>(cursor);
+        }
+        ++cursor;
+      }
+    }
+    fanning = next;
+  }
+  std::copy(result.begin(), result.end(), indices);
+}
+
+void optimizeOverdraw(unsigned int* indices, size_t indexCount, const Vertex* vertices,
+    size_t vertexCount, float threshold, unsigned int cacheSize) {
+  const size_t triangleCount = indexCount / 3;
+  if (triangleCount < 2 || vertexCount == 0) {
+    return;
+  }
+  size_t before = countMisses(indices, triangleCount, vertexCount, cacheSize);
+  const float limit = threshold * before / triangleCount;
+  // Split in clusters. Every cluster is simulated from an empty cache, since
+  // after sorting them it can be drawn after any other cluster
+  std::vector<size_t> starts(1, 0);
+  FifoCache cache(vertexCount, cacheSize);
+  size_t clusterMisses = 0;
+  for (size_t t = 0; t < triangleCount; ++t) {
+    const unsigned int* tri = indices + 3 * t;
+    clusterMisses += cache.use(tri[0]) + cache.use(tri[1]) + cache.use(tri[2]);
+    // Close the cluster as soon as it is good enough
+    if (t + 1 < triangleCount && clusterMisses <= limit * (t + 1 - starts.back())) {
+      starts.push_back(t + 1);
+      clusterMisses = 0;
+      cache.flush();
+    }
+  }
+  starts.push_back(triangleCount);
+  const size_t clusterCount = starts.size() - 1;
+  if (clusterCount < 2) {
+    return;
+  }
+  // Centroid of the whole mesh (by area)
+  glm::vec3 meshCentroid(0.0f);
+  float meshArea = 0.0f;
+  std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f));
+  std::vector<glm::vec3> normals(clusterCount, glm::vec3(0.0f));
+  for (size_t c = 0; c < clusterCount; ++c) {
+    float clusterArea = 0.0f;
+    for (size_t t = starts[c]; t < starts[c + 1]; ++t) {
+      const unsigned int* tri = indices + 3 * t;
+      glm::vec3 n = areaNormal(vertices, tri);
+      float area = glm::length(n);
+      glm::vec3 center = (vertices[tri[0]].position + vertices[tri[1]].position +
+          vertices[tri[2]].position) / 3.0f;
+      centroids[c] += area * center;
+      normals[c] += n;
+      clusterArea += area;
+    }
+    meshCentroid += centroids[c];
+    meshArea += clusterArea;
+    if (clusterArea > 0.0f) {
+      centroids[c] /= clusterArea;
+    }
+  }
+  if (meshArea > 0.0f) {
+    meshCentroid /= meshArea;
+  }
+  // Clusters far from the center and facing outwards are the likely occluders
+  std::vector<float> score(clusterCount);
+  std::vector<size_t> order(clusterCount);
+  for (size_t c = 0; c < clusterCount; ++c) {
+    float length = glm::length(normals[c]);
+    glm::vec3 n = length > 0.0f ? normals[c] / length : glm::vec3(0.0f);
+    score[c] = glm::dot(centroids[c] - meshCentroid, n);
+    order[c] = c;
+  }
+  std::stable_sort(order.begin(), order.end(), [&score](size_t a, size_t b) {
+    return score[a] > score[b];
+  });
+  std::vector<unsigned int> result;
+  result.reserve(3 * triangleCount);
+  for (size_t c : order) {
+    result.insert(result.end(), indices + 3 * starts[c], indices + 3 * starts[c + 1]);
+  }
+  // Keep the limit on the vertex cache, whatever the clusters did
+  size_t after = countMisses(result.data(), triangleCount, vertexCount, cacheSize);
+  if (after <= threshold * before) {
+    std::copy(result.begin(), result.end(), indices);
+  }
+}
+
+void optimizeVertexFetch(Vertex* vertices, size_t vertexCount, unsigned int* indices,
+    size_t indexCount, glm::vec4* tangents) {
+  std::vector<unsigned int> remap(vertexCount, NONE);
+  unsigned int next = 0;
+  for (size_t i = 0; i < indexCount; ++i) {
+    unsigned int& v = indices[i];
+    if (remap[v] == NONE) {
+      remap[v] = next++;
+    }
+    v = remap[v];
+  }
+  // The unused vertices keep their relative order at the end
+  for (size_t v = 0; v < vertexCount; ++v) {
+    if (remap[v] == NONE) {
+      remap[v] = next++;
+    }
+  }
+  std::vector<Vertex> reordered(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    reordered[remap[v]] = vertices[v];
+  }
+  std::copy(reordered.begin(), reordered.end(), vertices);
+  if (tangents) {
+    std::vector<glm::vec4> moved(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+      moved[remap[v]] = tangents[v];
+    }
+    std::copy(moved.begin(), moved.end(), tangents);
+  }
+}
+
+OverdrawStats analyzeOverdraw(ArrayView<Vertex> vertices, ArrayView<unsigned int> indices,
+    ArrayView<MeshData> ranges, unsigned int directions, unsigned int resolution) {
+  OverdrawStats stats = {0.0f, 0, 0};
+  if (vertices.empty() || directions == 0 || resolution == 0) {
+    return stats;
+  }
+  // Every view is an orthographic projection of the bounding sphere
+  glm::vec3 lower(FLT_MAX);
+  glm::vec3 upper(-FLT_MAX);
+  for (const Vertex& v : vertices) {
+    lower = glm::min(lower, v.position);
+    upper = glm::max(upper, v.position);
+  }
+  const glm::vec3 center = 0.5f * (upper + lower);
+  const float radius = glm::max(0.5f * glm::length(upper - lower), FLT_MIN);
+  const float scale = 0.5f * resolution / radius;
+  std::vector<size_t> covered(directions, 0);
+  std::vector<size_t> shaded(directions, 0);
+  parallel::forEachRange(directions, [&](size_t first, size_t last) {
+    std::vector<glm::vec3> projected(vertices.size());
+    for (size_t k = first; k < last; ++k) {
+      // Directions spread over the sphere with a Fibonacci spiral
+      const float GOLDEN_ANGLE = 2.39996323f;
+      float z = 1.0f - (2.0f * k + 1.0f) / directions;
+      float r = std::sqrt(glm::max(0.0f, 1.0f - z * z));
+      float phi = GOLDEN_ANGLE * k;
+      glm::vec3 d(r * std::cos(phi), z, r * std::sin(phi));
+      // Camera basis (u, v, d) with d pointing to the camera
+      glm::vec3 up = std::fabs(d.y) < 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+      glm::vec3 u = glm::normalize(glm::cross(up, d));
+      glm::vec3 v = glm::cross(d, u);
+      for (size_t i = 0; i < vertices.size(); ++i) {
+        glm::vec3 p = vertices[i].position - center;
+        projected[i] = glm::vec3((glm::dot(p, u) + radius) * scale,
+            (glm::dot(p, v) + radius) * scale, glm::dot(p, d));
+      }
+      OverdrawRasterizer rasterizer(resolution);
+      for (const MeshData& range : ranges) {
+        const glm::vec3* base = projected.data() + range.startVertex;
+        const unsigned int* tri = indices.data() + range.startIndex;
+        for (GLsizei t = 0; t + 2 < range.howMany; t += 3, tri += 3) {
+          rasterizer.draw(base[tri[0]], base[tri[1]], base[tri[2]]);
+        }
+      }
+      covered[k] = rasterizer.covered();
+      shaded[k] = rasterizer.shaded();
+    }
+  }, 1);
+  for (unsigned int k = 0; k < directions; ++k) {
+    stats.covered += covered[k];
+    stats.shaded += shaded[k];
+  }
+  if (stats.covered > 0) {
+    stats.overdraw = static_cast<float>(stats.shaded) / stats.covered;
+  }
+  return stats;
+}
+
+VertexCacheStats combine(const VertexCacheStats& a, const VertexCacheStats& b) {
+  VertexCacheStats stats = {0.0f, 0.0f, a.transformed + b.transformed,
+      a.triangles + b.triangles, a.vertices + b.vertices};
+  if (stats.triangles > 0) {
+    stats.acmr = static_cast<float>(stats.transformed) / stats.triangles;
+  }
+  if (stats.vertices > 0) {
+    stats.atvr = static_cast<float>(stats.transformed) / stats.vertices;
+  }
+  return stats;
+}
+
+} // namespace mesh
@@ -0,0 +1,123 @@
+#ifndef MESH_OPTIMIZER_H_
+#define MESH_OPTIMIZER_H_
+
+#include <cstddef>
+
+#include "model.h"
+
+namespace mesh {
+//! Functions that reorder the triangles and vertices of an indexed mesh for faster rendering
+/*!
+  They work on raw index and vertex buffers, so they can be applied to a whole
+  \class Mesh or to each one of the ranges (separators) of a \class Model.
+  See Mesh::optimizeVertexOrder and Model::optimizeVertexOrder
+*/
+
+//! Result of simulating a post-transform vertex cache on a list of triangles
+struct VertexCacheStats {
+  //! Average cache miss ratio: vertices transformed per triangle (0.5 is ideal, 3 is the worst)
+  float acmr;
+  //! Average transform to vertex ratio: vertices transformed per vertex used (1 is ideal)
+  float atvr;
+  //! Number of vertices the GPU would transform (cache misses)
+  size_t transformed;
+  //! Number of triangles simulated
+  size_t triangles;
+  //! Number of different vertices used by the triangles
+  size_t vertices;
+};
+
+//! Results of an optimization, before and after
+struct VertexCacheReport {
+  VertexCacheStats before;
+  VertexCacheStats after;
+};
+
+//! Result of rendering a mesh from several directions and counting the shaded fragments
+struct OverdrawStats {
+  //! Shaded fragments per covered pixel (1 is ideal: every pixel shaded once)
+  float overdraw;
+  //! Pixels covered by the mesh (adding all the directions)
+  size_t covered;
+  //! Fragments that passed the depth test (adding all the directions)
+  size_t shaded;
+};
+
+//! Size of the FIFO cache used by default to simulate and optimize
+const unsigned int DEFAULT_CACHE_SIZE = 16;
+//! Default limit of the ACMR increase allowed to reduce overdraw (5% worse)
+const float DEFAULT_OVERDRAW_THRESHOLD = 1.05f;
+
+//! Simulates a FIFO post-transform cache over the triangles
+/*!
+  @param indices the triangles (three indices each)
+  @param indexCount number of indices
+  @param vertexCount all the indices need to be less than this
+  @param cacheSize number of entries of the simulated cache
+*/
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount,
+    size_t vertexCount, unsigned int cacheSize = DEFAULT_CACHE_SIZE);
+//! Reorders the triangles to increase the post-transform cache hit rate
+/*!
+  Uses the linear time Tipsify algorithm (Sander, Nehab and Barczak. 2007. Fast
+  triangle reordering for vertex locality and reduced overdraw). It fans around
+  a vertex, then continues with the vertex (recently used) that is most likely to
+  still be in the cache.
+  @param indices the triangles to reorder (in place)
+  @param indexCount number of indices
+  @param vertexCount all the indices need to be less than this
+  @param cacheSize the cache size to optimize for
+*/
+void optimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount,
+    unsigned int cacheSize = DEFAULT_CACHE_SIZE);
+//! Reorders clusters of triangles so the ones that occlude others are drawn first
+/*!
+  Second part of Tipsify. The triangles (already in vertex cache order, see
+  \fn optimizeVertexCache) are split in clusters. A cluster is closed when its
+  ACMR (starting with an empty cache) is under threshold times the original,
+  so the clusters can be drawn in any order. Then the clusters that are on
+  the outside of the mesh and face outwards are moved first, since from most
+  view directions they hide the rest.
+  If the final ACMR goes over the limit the triangles are left as they were.
+  @param indices the triangles to reorder (in place)
+  @param indexCount number of indices
+  @param vertices the vertices used by the triangles
+  @param vertexCount all the indices need to be less than this
+  @param threshold maximum ACMR allowed, as a factor of the current one
+  @param cacheSize the cache size used to compute the ACMR
+*/
+void optimizeOverdraw(unsigned int* indices, size_t indexCount, const Vertex* vertices,
+    size_t vertexCount, float threshold = DEFAULT_OVERDRAW_THRESHOLD,
+    unsigned int cacheSize = DEFAULT_CACHE_SIZE);
+//! Renumbers the vertices in the order the triangles use them for the first time
+/*!
+  It improves the locality of the vertex fetch (the pre-transform cache). The
+  vertices that no triangle uses are moved to the end.
+  @param vertices the vertices to reorder (in place)
+  @param vertexCount number of vertices
+  @param indices the triangles, they are updated with the new numbers
+  @param indexCount number of indices
+  @param tangents optional stream (one per vertex) reordered in the same way
+*/
+void optimizeVertexFetch(Vertex* vertices, size_t vertexCount, unsigned int* indices,
+    size_t indexCount, glm::vec4* tangents = nullptr);
+//! Estimates the overdraw by rasterizing the mesh in the CPU from several directions
+/*!
+  The ranges are drawn in order (as with glDrawElementsBaseVertex), with
+  depth test and back face culling (counter clockwise is front), using
+  orthographic views from directions spread evenly over a sphere. The
+  directions are rendered in parallel.
+  @param vertices the vertex buffer
+  @param indices the index buffer
+  @param ranges the separators to draw
+  @param directions number of view directions
+  @param resolution width and height (in pixels) of every view
+*/
+OverdrawStats analyzeOverdraw(ArrayView<Vertex> vertices, ArrayView<unsigned int> indices,
+    ArrayView<MeshData> ranges, unsigned int directions = 16, unsigned int resolution = 256);
+//! Adds the totals of two simulations (to report a whole Model)
+VertexCacheStats combine(const VertexCacheStats& a, const VertexCacheStats& b);
+
+} // namespace mesh
+
+#endif
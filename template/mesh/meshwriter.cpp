@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "../parallel/threadpool.h"
+
+#include "meshwriter.h"
+
+namespace mesh {
+
+using glm::vec3;
+
+namespace {
+
+// Bytes kept in memory before writing them
+const size_t BUFFER_BYTES = 4 << 20;
+// Vertices or triangles formatted as text by a task
+const size_t TEXT_BLOCK = 32768;
+
+// A file written through a fixed size buffer
+class BufferedFile {
+public:
+  explicit BufferedFile(const std::string& fileName) :
+      mFile(std::fopen(fileName.c_str(), "wb")), mBuffer(BUFFER_BYTES), mUsed(0),
+      mGood(mFile != nullptr) {
+
+  }
+  ~BufferedFile() {
+    close();
+  }
+  bool good() const {
+    return mGood;
+  }
+  void write(const void* data, size_t bytes) {
+    if (mUsed + bytes > mBuffer.size()) {
+      flush();
+    }
+    if (bytes > mBuffer.size()) {
+      mGood = mGood && std::fwrite(data, 1, bytes, mFile) == bytes;
+      return;
+    }
+    std::memcpy(mBuffer.data() + mUsed, data, bytes);
+    mUsed += bytes;
+  }
+  template <typename T> void put(const T& value) {
+    write(&value, sizeof(T));
+  }
+  void write(const std::string& text) {
+    write(text.data(), text.size());
+  }
+  //! Write what is left and close, returns false if anything failed
+  bool close() {
+    if (mFile) {
+      flush();
+      mGood = std::fclose(mFile) == 0 && mGood;
+      mFile = nullptr;
+    }
+    return mGood;
+  }
+
+private:
+  BufferedFile(const BufferedFile&) = delete;
+  BufferedFile& operator=(const BufferedFile&) = delete;
+  void flush() {
+    if (mFile && mUsed > 0) {
+      mGood = mGood && std::fwrite(mBuffer.data(), 1, mUsed, mFile) == mUsed;
+    }
+    mUsed = 0;
+  }
+  std::FILE* mFile;
+  std::vector<char> mBuffer;
+  size_t mUsed;
+  bool mGood;
+};
+
+bool littleEndian() {
+  const uint32_t one = 1;
+  unsigned char first;
+  std::memcpy(&first, &one, 1);
+  return first == 1;
+}
+
+size_t triangleCount(ArrayView<MeshData> ranges) {
+  size_t triangles = 0;
+  for (const MeshData& range : ranges) {
+    triangles += range.howMany / 3;
+  }
+  return triangles;
+}
+
+void appendUnsigned(std::string& text, uint64_t value) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  while (n > 0) {
+    text += digits[--n];
+  }
+}
+
+// Floats with nine digits, enough to read back the same value
+void appendFloats(std::string& text, const char* keyword, const float* values, int count) {
+  char line[128];
+  int length = count == 2 ?
+      std::snprintf(line, sizeof(line), "%s %.9g %.9g\n", keyword, values[0], values[1]) :
+      std::snprintf(line, sizeof(line), "%s %.9g %.9g %.9g\n", keyword, values[0], values[1],
+          values[2]);
+  text.append(line, static_cast<size_t>(length));
+}
+
+// Format [0, count) in blocks: a batch of blocks is formatted in parallel and then written
+template <typename Format>
+void writeText(BufferedFile& file, size_t count, const Format& format) {
+  const size_t blocks = (count + TEXT_BLOCK - 1) / TEXT_BLOCK;
+  const size_t batch = std::max<size_t>(1, parallel::chunksFor(count, TEXT_BLOCK));
+  std::vector<std::string> texts(batch);
+  for (size_t b = 0; b < blocks; b += batch) {
+    const size_t n = std::min(batch, blocks - b);
+    parallel::forEachRange(n, [&](size_t first, size_t last) {
+      for (size_t i = first; i < last; ++i) {
+        size_t begin = (b + i) * TEXT_BLOCK;
+        texts[i].clear();
+        format(begin, std::min(count, begin + TEXT_BLOCK), texts[i]);
+      }
+    }, 1);
+    for (size_t i = 0; i < n; ++i) {
+      file.write(texts[i]);
+    }
+  }
+}
+
+void writeObj(BufferedFile& file, ArrayView<Vertex> vertices, ArrayView<unsigned int> indices,
+    ArrayView<MeshData> ranges, bool normals, bool textCoords) {
+  file.write(std::string("# Written by the OpenGL template\n"));
+  writeText(file, vertices.size(), [&](size_t first, size_t last, std::string& text) {
+    for (size_t i = first; i < last; ++i) {
+      appendFloats(text, "v", &vertices[i].position.x, 3);
+    }
+  });
+  if (textCoords) {
+    writeText(file, vertices.size(), [&](size_t first, size_t last, std::string& text) {
+      for (size_t i = first; i < last; ++i) {
+        appendFloats(text, "vt", &vertices[i].textCoords.x, 2);
+      }
+    });
+  }
+  if (normals) {
+    writeText(file, vertices.size(), [&](size_t first, size_t last, std::string& text) {
+      for (size_t i = first; i < last; ++i) {
+        appendFloats(text, "vn", &vertices[i].normal.x, 3);
+      }
+    });
+  }
+  // The same number for all the attributes of a corner: v, v/vt, v//vn or v/vt/vn
+  const char* separator = textCoords ? "/" : "//";
+  for (size_t r = 0; r < ranges.size(); ++r) {
+    const MeshData& range = ranges[r];
+    std::string group = "g mesh";
+    appendUnsigned(group, r);
+    group += '\n';
+    file.write(group);
+    const unsigned int* triangles = indices.data() + range.startIndex;
+    const uint64_t base = static_cast<uint64_t>(range.startVertex) + 1;
+    writeText(file, static_cast<size_t>(range.howMany / 3),
+        [&](size_t first, size_t last, std::string& text) {
+      for (size_t t = first; t < last; ++t) {
+        text += 'f';
+        for (int k = 0; k < 3; ++k) {
+          uint64_t index = base + triangles[3 * t + k];
+          text += ' ';
+          appendUnsigned(text, index);
+          if (textCoords || normals) {
+            text += separator;
+            if (textCoords) {
+              appendUnsigned(text, index);
+            }
+            if (textCoords && normals) {
+              text += '/';
+            }
+            if (normals) {
+              appendUnsigned(text, index);
+            }
+          }
+        }
+        text += '\n';
+      }
+    });
+  }
+}
+
+void writePly(BufferedFile& file, ArrayView<Vertex> vertices, ArrayView<unsigned int> indices,
+    ArrayView<MeshData> ranges, bool normals, bool textCoords) {
+  // Binary in the byte order of this machine
+  std::string header = "ply\nformat ";
+  header += littleEndian() ? "binary_little_endian" : "binary_big_endian";
+  header += " 1.0\ncomment Written by the OpenGL template\nelement vertex ";
+  appendUnsigned(header, vertices.size());
+  header += "\nproperty float x\nproperty float y\nproperty float z\n";
+  if (normals) {
+    header += "property float nx\nproperty float ny\nproperty float nz\n";
+  }
+  if (textCoords) {
+    header += "property float s\nproperty float t\n";
+  }
+  header += "element face ";
+  appendUnsigned(header, triangleCount(ranges));
+  header += "\nproperty list uchar int vertex_indices\nend_header\n";
+  file.write(header);
+  for (const Vertex& v : vertices) {
+    file.write(&v.position.x, 3 * sizeof(float));
+    if (normals) {
+      file.write(&v.normal.x, 3 * sizeof(float));
+    }
+    if (textCoords) {
+      file.write(&v.textCoords.x, 2 * sizeof(float));
+    }
+  }
+  for (const MeshData& range : ranges) {
+    const unsigned int* triangles = indices.data() + range.startIndex;
+    for (GLsizei t = 0; t < range.howMany / 3; ++t) {
+      unsigned char face[1 + 3 * sizeof(int32_t)];
+      face[0] = 3;
+      for (int k = 0; k < 3; ++k) {
+        int32_t index = static_cast<int32_t>(range.startVertex + triangles[3 * t + k]);
+        std::memcpy(face + 1 + k * sizeof(int32_t), &index, sizeof(int32_t));
+      }
+      file.write(face, sizeof(face));
+    }
+  }
+}
+
+// STL is little endian, as the machines we run on
+void writeStl(BufferedFile& file, ArrayView<Vertex> vertices, ArrayView<unsigned int> indices,
+    ArrayView<MeshData> ranges) {
+  // The header must not start with "solid" (that is the text format)
+  char header[80] = {};
+  std::strncpy(header, "Binary STL written by the OpenGL template", sizeof(header) - 1);
+  file.write(header, sizeof(header));
+  file.put(static_cast<uint32_t>(triangleCount(ranges)));
+  for (const MeshData& range : ranges) {
+    const Vertex* base = vertices.data() + range.startVertex;
+    const unsigned int* triangles = indices.data() + range.startIndex;
+    for (GLsizei t = 0; t < range.howMany / 3; ++t) {
+      const vec3& p0 = base[triangles[3 * t]].position;
+      const vec3& p1 = base[triangles[3 * t + 1]].position;
+      const vec3& p2 = base[triangles[3 * t + 2]].position;
+      vec3 n = glm::cross(p1 - p0, p2 - p0);
+      float length = glm::length(n);
+      n = length > 0.0f ? n / length : vec3(0.0f);
+      // Normal, three corners and an unused attribute count (50 bytes)
+      float facet[12] = {n.x, n.y, n.z, p0.x, p0.y, p0.z, p1.x, p1.y, p1.z, p2.x, p2.y, p2.z};
+      const uint16_t attributes = 0;
+      file.write(facet, sizeof(facet));
+      file.put(attributes);
+    }
+  }
+}
+
+} // namespace
+
+MeshFileFormat meshFormatFor(const std::string& fileName) {
+  std::string extension = fileName.substr(std::min(fileName.size(), fileName.find_last_of('.')));
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  if (extension == ".ply") {
+    return PLY_BINARY;
+  }
+  if (extension == ".stl") {
+    return STL_BINARY;
+  }
+  return OBJ_TEXT;
+}
+
+bool writeMesh(const std::string& fileName, MeshFileFormat format, ArrayView<Vertex> vertices,
+    ArrayView<unsigned int> indices, ArrayView<MeshData> ranges, bool normals, bool textCoords) {
+  if (fileName.empty() || (format == STL_BINARY && triangleCount(ranges) > 0xFFFFFFFFu) ||
+      (format == PLY_BINARY && vertices.size() > 0x7FFFFFFF)) {
+    return false;
+  }
+  BufferedFile file(fileName);
+  if (!file.good()) {
+    return false;
+  }
+  switch (format) {
+    case PLY_BINARY:
+      writePly(file, vertices, indices, ranges, normals, textCoords);
+    break;
+    case STL_BINARY:
+      writeStl(file, vertices, indices, ranges);
+    break;
+    default:
+      writeObj(file, vertices, indices, ranges, normals, textCoords);
+  }
+  return file.close();
+}
+
+} // namespace mesh
@@ -0,0 +1,39 @@
+#ifndef MESH_MESH_WRITER_H_
+#define MESH_MESH_WRITER_H_
+
+#include <string>
+
+#include "model.h"
+
+namespace mesh {
+
+//! File formats written by \fn writeMesh
+enum MeshFileFormat {OBJ_TEXT, PLY_BINARY, STL_BINARY};
+
+//! The format for a file name, by its extension (.ply, .stl, anything else is OBJ)
+MeshFileFormat meshFormatFor(const std::string& fileName);
+
+//! Write triangles to a file, straight from the vertex and index buffers
+/*!
+  The file is streamed in blocks of a few MB, so the extra memory does not
+  depend on the size of the mesh. The OBJ text of every batch of blocks is
+  formatted in parallel and written in order.
+
+  - OBJ: positions, and the texture coordinates and normals if requested.
+    One group per range (named mesh0, mesh1...).
+  - PLY: binary in the byte order of the machine, the vertex attributes as
+    floats (nx ny nz, s t) and the faces as a list of three ints.
+  - STL: binary, one face normal and three positions per triangle (STL has
+    no shared vertices nor texture coordinates).
+
+  @param ranges the triangles of every range, with indices relative to its startVertex
+  @param normals write the normals (OBJ and PLY)
+  @param textCoords write the texture coordinates (OBJ and PLY)
+  @return false if the file could not be written
+*/
+bool writeMesh(const std::string& fileName, MeshFileFormat format, ArrayView<Vertex> vertices,
+    ArrayView<unsigned int> indices, ArrayView<MeshData> ranges, bool normals, bool textCoords);
+
+} // namespace mesh
+
+#endif
@@ -1,23 +1,109 @@
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
 #include <iostream>
+#include <map>
 
+#include "../parallel/threadpool.h"
+
+#include "meshcache.h"
+#include "meshoptimizer.h"
+#include "meshwriter.h"
 #include "model.h"
+#include "normalgenerator.h"
+#include "objreader.h"
+#include "simplifier.h"
+#include "tangentspace.h"
+#include "vertexkernels.h"
 
 namespace mesh {
 
-Model::Model() : Mesh() {
+namespace {
+// Assimp matrices are stored by rows, glm ones by columns
+glm::mat4 toMat4(const aiMatrix4x4& m) {
+  return glm::mat4(glm::vec4(m.a1, m.b1, m.c1, m.d1), glm::vec4(m.a2, m.b2, m.c2, m.d2),
+      glm::vec4(m.a3, m.b3, m.c3, m.d3), glm::vec4(m.a4, m.b4, m.c4, m.d4));
+}
+
+bool isIdentity(const glm::mat4& m) {
+  for (int c = 0; c < 4; ++c) {
+    for (int r = 0; r < 4; ++r) {
+      if (m[c][r] != (c == r ? 1.0f : 0.0f)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+}
+
+const uint32_t ModelNode::NO_PARENT = 0xFFFFFFFFu;
+
+Model::Model() : Mesh(), mInstanceBase(1.0f), mLodStart(0), mFromCache(false) {
 
 }
 
-Model::Model(const std::string& fileName) : Mesh(){
+Model::Model(const std::string& fileName) : Model() {
   load(fileName);
 }
 
-bool Model::load(const std::string& fileName) {
+bool Model::load(const std::string& fileName, bool useCache) {
+  mFromCache = false;
+  discardLods();
+  mInstanceRanges.clear();
+  mInstanceTransforms.clear();
+  mNodes.clear();
+  mInstanceNodes.clear();
+  mInstanceBase = glm::mat4(1.0f);
+  // Try the binary cache first, it is only valid if the file (and the material libraries of
+  // an OBJ file, where the textures come from) did not change
+  SourceStamp stamp;
+  bool stamped = useCache && MeshCache::stampOf(fileName, stamp, ObjReader::handles(fileName) ?
+      ObjReader::materialLibraries(fileName) : std::vector<std::string>());
+  if (stamped && loadFromCache(fileName, stamp)) {
+    mFromCache = true;
+    return true;
+  }
+  // OBJ files are read natively (in parallel), the rest (or an OBJ it can not read) with Assimp
+  bool native = false;
+  if (ObjReader::handles(fileName)) {
+    ObjReader reader;
+    native = reader.read(fileName);
+    if (native) {
+      mVertices = reader.releaseVertices();
+      mIndices = reader.releaseIndices();
+      mSeparators = reader.releaseSeparators();
+      mTexturesData = reader.releaseTextures();
+      mTextureIndex.clear();
+      mTangents.clear();
+      mHasNormals = true;
+      mHasTexture = reader.hasTexture();
+    } else {
+      std::cerr << reader.error() << " (" << fileName << "), using Assimp" << std::endl;
+    }
+  }
+  if (!native && !loadWithAssimp(fileName)) {
+    return false;
+  }
+  updateBoundingBox();
+  // Save the result, so next time we do not need to parse the file
+  if (stamped && !MeshCache::write(MeshCache::cacheFileFor(fileName), stamp, mHasNormals,
+      mHasTexture, viewVertices(), viewTangents(), viewIndices(), viewSeparators(),
+      viewTextures(), viewInstanceRanges(), viewInstanceTransforms(), viewNodes(),
+      viewInstanceNodes())) {
+    std::cerr << "Could not write the mesh cache for: " << fileName << std::endl;
+  }
+
+  return true;
+}
+
+bool Model::loadWithAssimp(const std::string& fileName) {
   // Create an instance of the Importer class
   Assimp::Importer importer;
   // Loads the mesh data and metadata into memmory
   const aiScene* scenePtr = importer.ReadFile( fileName,
       aiProcess_GenNormals       |
+      aiProcess_CalcTangentSpace       |
       aiProcess_Triangulate            |
       aiProcess_JoinIdenticalVertices);
 
@@ -30,14 +116,114 @@ bool Model::load(const std::string& fileName) {
   // Clear our data buffers
   mIndices.clear();
   mVertices.clear();
+  mTangents.clear();
   mSeparators.clear();
+  mTexturesData.clear();
+  mTextureIndex.clear();
+  mInstanceRanges.clear();
+  mInstanceTransforms.clear();
+  mNodes.clear();
+  mInstanceNodes.clear();
   //Start the recursivelly process at the root
   processNode(scenePtr->mRootNode, scenePtr);
-  updateBoundingBox();
+  return true;
+}
 
+bool Model::loadFromCache(const std::string& fileName, const SourceStamp& stamp) {
+  MeshCache cache;
+  if (!cache.open(MeshCache::cacheFileFor(fileName), stamp)) {
+    return false;
+  }
+  // The sections have the same layout as our buffers, so this is a plain copy
+  ArrayView<Vertex> vertices = cache.vertices();
+  ArrayView<unsigned int> indices = cache.indices();
+  ArrayView<MeshData> separators = cache.separators();
+  mVertices.assign(vertices.begin(), vertices.end());
+  ArrayView<glm::vec4> tangents = cache.tangents();
+  mTangents.assign(tangents.begin(), tangents.end());
+  mIndices.assign(indices.begin(), indices.end());
+  mSeparators.assign(separators.begin(), separators.end());
+  mTexturesData = cache.textures();
+  mTextureIndex.clear();
+  ArrayView<InstanceRange> ranges = cache.instanceRanges();
+  ArrayView<glm::mat4> transforms = cache.instanceTransforms();
+  mInstanceRanges.assign(ranges.begin(), ranges.end());
+  mInstanceTransforms.assign(transforms.begin(), transforms.end());
+  ArrayView<ModelNode> nodes = cache.nodes();
+  ArrayView<uint32_t> instanceNodes = cache.instanceNodes();
+  mNodes.assign(nodes.begin(), nodes.end());
+  mInstanceNodes.assign(instanceNodes.begin(), instanceNodes.end());
+  mHasNormals = cache.hasNormals();
+  mHasTexture = cache.hasTexture();
+  updateBoundingBox();
   return true;
 }
 
+bool Model::loadedFromCache() const {
+  return mFromCache;
+}
+
+bool Model::save(const std::string& fileName) const {
+  if (!hasInstances()) {
+    return writeMesh(fileName, meshFormatFor(fileName), viewVertices(), viewIndices(),
+        viewSeparators(), mHasNormals, mHasTexture);
+  }
+  // Every instance becomes a copy of its separator in world space, as it is drawn
+  std::vector<size_t> used = usedVertices();
+  std::map<GLint, size_t> extent;
+  for (size_t i = 0; i < mSeparators.size(); ++i) {
+    if (instancesOf(i).count == 0) {
+      size_t& e = extent[mSeparators[i].startVertex];
+      e = std::max(e, used[i]);
+    }
+  }
+  std::map<GLint, GLint> moved;
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  std::vector<MeshData> ranges;
+  for (size_t i = 0; i < mSeparators.size(); ++i) {
+    const MeshData& sep = mSeparators[i];
+    const unsigned int* source = mIndices.data() + sep.startIndex;
+    const InstanceRange instances = instancesOf(i);
+    if (instances.count == 0) {
+      // The separators drawn once keep sharing their vertices
+      if (moved.find(sep.startVertex) == moved.end()) {
+        moved[sep.startVertex] = static_cast<GLint>(vertices.size());
+        vertices.insert(vertices.end(), mVertices.begin() + sep.startVertex,
+            mVertices.begin() + sep.startVertex + extent[sep.startVertex]);
+      }
+      MeshData range = sep;
+      range.startVertex = moved[sep.startVertex];
+      range.startIndex = static_cast<GLint>(indices.size());
+      indices.insert(indices.end(), source, source + sep.howMany);
+      ranges.push_back(range);
+      continue;
+    }
+    for (uint32_t k = 0; k < instances.count; ++k) {
+      const glm::mat4& W = mInstanceTransforms[instances.first + k];
+      MeshData range = sep;
+      range.startVertex = static_cast<GLint>(vertices.size());
+      range.startIndex = static_cast<GLint>(indices.size());
+      vertices.insert(vertices.end(), mVertices.begin() + sep.startVertex,
+          mVertices.begin() + sep.startVertex + used[i]);
+      glm::vec3 lower;
+      glm::vec3 upper;
+      transformVertices(vertices.data() + range.startVertex, used[i], W, mHasNormals, lower,
+          upper);
+      indices.insert(indices.end(), source, source + sep.howMany);
+      // A mirroring transform turns the triangles inside out, unless they are flipped
+      if (glm::determinant(glm::mat3(W)) < 0.0f) {
+        for (size_t t = range.startIndex; t + 2 < indices.size(); t += 3) {
+          std::swap(indices[t + 1], indices[t + 2]);
+        }
+      }
+      ranges.push_back(range);
+    }
+  }
+  return writeMesh(fileName, meshFormatFor(fileName), ArrayView<Vertex>(vertices),
+      ArrayView<unsigned int>(indices), ArrayView<MeshData>(ranges), mHasNormals, mHasTexture);
+}
+
 std::vector<MeshData> Model::getSeparators() const {
   return mSeparators;
 }
@@ -47,24 +233,619 @@ int Model::numMeshes() const {
   return static_cast<int>(mSeparators.size() - 1);
 }
 
+std::vector<size_t> Model::usedVertices() const {
+  std::vector<size_t> used(mSeparators.size(), 0);
+  parallel::forEachRange(mSeparators.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const MeshData& sep = mSeparators[i];
+      for (GLsizei k = 0; k < sep.howMany; ++k) {
+        used[i] = std::max(used[i], static_cast<size_t>(mIndices[sep.startIndex + k]) + 1);
+      }
+    }
+  }, 1);
+  return used;
+}
+
+VertexCacheReport Model::optimizeVertexOrder(unsigned int cacheSize, float overdrawThreshold) {
+  // The vertices get new numbers, the levels of detail would be wrong
+  discardLods();
+  const size_t n = mSeparators.size();
+  // Vertices used by every separator: [startVertex, startVertex + used)
+  std::vector<size_t> used = usedVertices();
+  // Vertices can only be renumbered if no other separator uses them
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    return mSeparators[a].startVertex < mSeparators[b].startVertex;
+  });
+  // A separator can overlap any earlier one, not only the previous one: keep
+  // the farthest end seen so far and the separator it belongs to
+  std::vector<bool> shared(n, false);
+  size_t end = 0;
+  size_t owner = 0;
+  for (size_t k = 0; k < n; ++k) {
+    size_t b = order[k];
+    size_t start = static_cast<size_t>(mSeparators[b].startVertex);
+    if (k > 0 && start < end) {
+      shared[owner] = shared[b] = true;
+    }
+    if (k == 0 || start + used[b] > end) {
+      end = start + used[b];
+      owner = b;
+    }
+  }
+  // The separators do not share indices, so they can be optimized in parallel
+  std::vector<VertexCacheReport> reports(n);
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const MeshData& sep = mSeparators[i];
+      reports[i] = optimizeRange(sep.startVertex, used[i], sep.startIndex, sep.howMany,
+          cacheSize, overdrawThreshold, !shared[i]);
+    }
+  }, 1);
+  VertexCacheReport total = {{0.0f, 0.0f, 0, 0, 0}, {0.0f, 0.0f, 0, 0, 0}};
+  for (const VertexCacheReport& r : reports) {
+    total.before = combine(total.before, r.before);
+    total.after = combine(total.after, r.after);
+  }
+  return total;
+}
+
+void Model::absoluteIndices(bool absolute) {
+  parallel::forEachRange(mSeparators.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const MeshData& sep = mSeparators[i];
+      unsigned int offset = static_cast<unsigned int>(sep.startVertex);
+      for (GLsizei k = 0; k < sep.howMany; ++k) {
+        mIndices[sep.startIndex + k] += absolute ? offset : 0u - offset;
+      }
+    }
+  }, 1);
+}
+
+void Model::placeAddedVertices(const std::vector<size_t>& used, size_t firstAdded) {
+  if (mVertices.size() == firstAdded) {
+    absoluteIndices(false);
+    return;
+  }
+  const unsigned int NONE = ~0u;
+  // As in splitLargeMeshes, the separators that start at the same vertex share
+  // their vertices, they are copied once with the added vertices any of them uses
+  std::map<GLint, std::vector<size_t> > groups;
+  std::map<GLint, size_t> extent;
+  for (size_t i = 0; i < mSeparators.size(); ++i) {
+    groups[mSeparators[i].startVertex].push_back(i);
+    size_t& e = extent[mSeparators[i].startVertex];
+    e = std::max(e, used[i]);
+  }
+  std::vector<Vertex> vertices;
+  std::vector<glm::vec4> tangents;
+  const bool hasTangents = !mTangents.empty();
+  vertices.reserve(mVertices.size());
+  tangents.reserve(mTangents.size());
+  std::vector<unsigned int> remap(mVertices.size() - firstAdded, NONE);
+  std::vector<size_t> touched;
+  for (const auto& group : groups) {
+    const size_t from = static_cast<size_t>(group.first);
+    const size_t start = vertices.size();
+    auto first = mVertices.begin() + from;
+    vertices.insert(vertices.end(), first, first + extent[group.first]);
+    if (hasTangents) {
+      auto tangent = mTangents.begin() + from;
+      tangents.insert(tangents.end(), tangent, tangent + extent[group.first]);
+    }
+    for (size_t added : touched) {
+      remap[added] = NONE;
+    }
+    touched.clear();
+    for (size_t i : group.second) {
+      MeshData& sep = mSeparators[i];
+      unsigned int* index = mIndices.data() + sep.startIndex;
+      for (GLsizei k = 0; k < sep.howMany; ++k) {
+        if (index[k] < firstAdded) {
+          index[k] -= static_cast<unsigned int>(from);
+          continue;
+        }
+        const size_t added = index[k] - firstAdded;
+        if (remap[added] == NONE) {
+          remap[added] = static_cast<unsigned int>(vertices.size() - start);
+          touched.push_back(added);
+          vertices.push_back(mVertices[index[k]]);
+          if (hasTangents) {
+            tangents.push_back(mTangents[index[k]]);
+          }
+        }
+        index[k] = remap[added];
+      }
+      sep.startVertex = static_cast<GLint>(start);
+    }
+  }
+  mVertices.swap(vertices);
+  mTangents.swap(tangents);
+}
+
+size_t Model::recalculateNormals(float creaseAngle) {
+  discardLods();
+  mTangents.clear();
+  // The generator works with the indices of the whole vertex buffer. The added
+  // vertices are at the end, then they go after the separators that use them
+  std::vector<size_t> used = usedVertices();
+  const size_t firstAdded = mVertices.size();
+  absoluteIndices(true);
+  NormalGenerator generator(creaseAngle);
+  size_t added = generator.generate(mVertices, mIndices);
+  placeAddedVertices(used, firstAdded);
+  mHasNormals = true;
+  return added;
+}
+
+size_t Model::recalculateTangents() {
+  if (!mHasTexture) {
+    return 0;
+  }
+  size_t added = mHasNormals ? 0 : recalculateNormals();
+  discardLods();
+  std::vector<size_t> used = usedVertices();
+  const size_t firstAdded = mVertices.size();
+  absoluteIndices(true);
+  added += generateTangents(mVertices, mIndices, mTangents);
+  placeAddedVertices(used, firstAdded);
+  return added;
+}
+
+size_t Model::batchByMaterial(size_t maxVertices) {
+  const size_t n = mSeparators.size();
+  if (n < 2) {
+    return 0;
+  }
+  discardLods();
+  std::vector<size_t> used = usedVertices();
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    const MeshData& lhs = mSeparators[a];
+    const MeshData& rhs = mSeparators[b];
+    if (lhs.diffuseIndex != rhs.diffuseIndex) {
+      return lhs.diffuseIndex < rhs.diffuseIndex;
+    }
+    if (lhs.specIndex != rhs.specIndex) {
+      return lhs.specIndex < rhs.specIndex;
+    }
+    return lhs.normalIndex < rhs.normalIndex;
+  });
+  // As in splitLargeMeshes, the separators that start at the same vertex share
+  // their vertices, which are copied once (the longest extent of them)
+  std::map<GLint, size_t> extent;
+  for (size_t i = 0; i < n; ++i) {
+    size_t& e = extent[mSeparators[i].startVertex];
+    e = std::max(e, used[i]);
+  }
+  std::map<GLint, size_t> moved;
+  std::vector<Vertex> vertices;
+  std::vector<glm::vec4> tangents;
+  std::vector<unsigned int> indices;
+  std::vector<MeshData> separators;
+  std::vector<InstanceRange> ranges;
+  const bool hasTangents = !mTangents.empty();
+  vertices.reserve(mVertices.size());
+  tangents.reserve(mTangents.size());
+  indices.reserve(mIndices.size());
+  for (size_t k = 0; k < n; ++k) {
+    const MeshData& sep = mSeparators[order[k]];
+    const InstanceRange instances = instancesOf(order[k]);
+    auto it = moved.find(sep.startVertex);
+    if (it == moved.end()) {
+      it = moved.insert(std::make_pair(sep.startVertex, vertices.size())).first;
+      auto first = mVertices.begin() + sep.startVertex;
+      vertices.insert(vertices.end(), first, first + extent[sep.startVertex]);
+      if (hasTangents) {
+        auto tangent = mTangents.begin() + sep.startVertex;
+        tangents.insert(tangents.end(), tangent, tangent + extent[sep.startVertex]);
+      }
+    }
+    const size_t start = it->second;
+    // Merge with the previous separator if it has the same textures and the
+    // vertices of this one are after its start and within maxVertices of it.
+    // The separators with instances are drawn on their own
+    bool merge = false;
+    if (!separators.empty() && instances.count == 0 && ranges.back().count == 0) {
+      const MeshData& last = separators.back();
+      const size_t base = static_cast<size_t>(last.startVertex);
+      merge = last.diffuseIndex == sep.diffuseIndex && last.specIndex == sep.specIndex &&
+          last.normalIndex == sep.normalIndex && start >= base &&
+          start + used[order[k]] - base <= maxVertices;
+    }
+    if (!merge) {
+      MeshData batch = sep;
+      batch.startVertex = static_cast<GLint>(start);
+      batch.startIndex = static_cast<GLint>(indices.size());
+      batch.howMany = 0;
+      batch.indexType = GL_UNSIGNED_INT;
+      batch.indexOffset = batch.startIndex * sizeof(unsigned int);
+      separators.push_back(batch);
+      ranges.push_back(instances);
+    }
+    MeshData& batch = separators.back();
+    const unsigned int offset = static_cast<unsigned int>(start - batch.startVertex);
+    const unsigned int* source = mIndices.data() + sep.startIndex;
+    for (GLsizei i = 0; i < sep.howMany; ++i) {
+      indices.push_back(source[i] + offset);
+    }
+    batch.howMany += sep.howMany;
+  }
+  mVertices.swap(vertices);
+  mTangents.swap(tangents);
+  mIndices.swap(indices);
+  mSeparators.swap(separators);
+  if (hasInstances()) {
+    mInstanceRanges.swap(ranges);
+  }
+  return n - mSeparators.size();
+}
+
+size_t Model::splitLargeMeshes(size_t maxVertices) {
+  const unsigned int NONE = ~0u;
+  const size_t n = mSeparators.size();
+  std::vector<size_t> used = usedVertices();
+  if (n == 0 || maxVertices == 0 || *std::max_element(used.begin(), used.end()) <= maxVertices) {
+    return 0;
+  }
+  discardLods();
+  // The meshes that are not split are copied as they are. If several of them
+  // start at the same vertex (they share vertices) they keep sharing them
+  std::map<GLint, size_t> extent;
+  for (size_t i = 0; i < n; ++i) {
+    if (used[i] <= maxVertices) {
+      size_t& e = extent[mSeparators[i].startVertex];
+      e = std::max(e, used[i]);
+    }
+  }
+  std::map<GLint, GLint> moved;
+  std::vector<Vertex> vertices;
+  std::vector<glm::vec4> tangents;
+  std::vector<unsigned int> indices;
+  std::vector<MeshData> separators;
+  std::vector<InstanceRange> ranges;
+  const bool hasTangents = !mTangents.empty();
+  vertices.reserve(mVertices.size());
+  tangents.reserve(mTangents.size());
+  indices.reserve(mIndices.size());
+  std::vector<unsigned int> remap;
+  std::vector<unsigned int> touched;
+  for (size_t i = 0; i < n; ++i) {
+    const MeshData& sep = mSeparators[i];
+    const unsigned int* source = mIndices.data() + sep.startIndex;
+    MeshData part = sep;
+    part.startIndex = static_cast<GLint>(indices.size());
+    if (used[i] <= maxVertices) {
+      auto it = moved.find(sep.startVertex);
+      if (it == moved.end()) {
+        it = moved.insert(std::make_pair(sep.startVertex, GLint(vertices.size()))).first;
+        auto first = mVertices.begin() + sep.startVertex;
+        vertices.insert(vertices.end(), first, first + extent[sep.startVertex]);
+        if (hasTangents) {
+          auto tangent = mTangents.begin() + sep.startVertex;
+          tangents.insert(tangents.end(), tangent, tangent + extent[sep.startVertex]);
+        }
+      }
+      part.startVertex = it->second;
+      part.indexOffset = part.startIndex * sizeof(unsigned int);
+      indices.insert(indices.end(), source, source + sep.howMany);
+      separators.push_back(part);
+      ranges.push_back(instancesOf(i));
+      continue;
+    }
+    // Too big: take the triangles in order, with new local vertex numbers
+    remap.assign(used[i], NONE);
+    touched.clear();
+    part.startVertex = static_cast<GLint>(vertices.size());
+    for (GLsizei t = 0; t + 2 < sep.howMany; t += 3) {
+      const unsigned int* tri = source + t;
+      size_t fresh = (remap[tri[0]] == NONE ? 1 : 0) +
+          (remap[tri[1]] == NONE && tri[1] != tri[0] ? 1 : 0) +
+          (remap[tri[2]] == NONE && tri[2] != tri[0] && tri[2] != tri[1] ? 1 : 0);
+      if (touched.size() + fresh > maxVertices) {
+        part.howMany = static_cast<GLsizei>(indices.size() - part.startIndex);
+        part.indexOffset = part.startIndex * sizeof(unsigned int);
+        separators.push_back(part);
+        ranges.push_back(instancesOf(i));
+        for (unsigned int v : touched) {
+          remap[v] = NONE;
+        }
+        touched.clear();
+        part.startVertex = static_cast<GLint>(vertices.size());
+        part.startIndex = static_cast<GLint>(indices.size());
+      }
+      for (int c = 0; c < 3; ++c) {
+        unsigned int v = tri[c];
+        if (remap[v] == NONE) {
+          remap[v] = static_cast<unsigned int>(touched.size());
+          touched.push_back(v);
+          vertices.push_back(mVertices[sep.startVertex + v]);
+          if (hasTangents) {
+            tangents.push_back(mTangents[sep.startVertex + v]);
+          }
+        }
+        indices.push_back(remap[v]);
+      }
+    }
+    part.howMany = static_cast<GLsizei>(indices.size() - part.startIndex);
+    part.indexOffset = part.startIndex * sizeof(unsigned int);
+    separators.push_back(part);
+    ranges.push_back(instancesOf(i));
+  }
+  mVertices.swap(vertices);
+  mTangents.swap(tangents);
+  mIndices.swap(indices);
+  mSeparators.swap(separators);
+  if (hasInstances()) {
+    mInstanceRanges.swap(ranges);
+  }
+  return mSeparators.size() - n;
+}
+
+std::vector<unsigned char> Model::buildIndexBuffer(bool splitLargeMeshes) {
+  const size_t SHORT_LIMIT = 65536;
+  // Splitting would discard the levels of detail, their large meshes keep unsigned int
+  if (splitLargeMeshes && mLods.empty()) {
+    this->splitLargeMeshes(SHORT_LIMIT);
+  }
+  std::vector<size_t> used = usedVertices();
+  // Every range to convert: the separators, then the ones of the levels of detail
+  // (a level uses a subset of the vertices of its separator)
+  std::vector<MeshData*> ranges;
+  std::vector<bool> fits;
+  for (size_t level = 0; level <= mLods.size(); ++level) {
+    std::vector<MeshData>& separators = level == 0 ? mSeparators : mLods[level - 1];
+    for (size_t i = 0; i < separators.size(); ++i) {
+      ranges.push_back(&separators[i]);
+      fits.push_back(used[i] <= SHORT_LIMIT);
+    }
+  }
+  // The place of every mesh, aligned to 4 bytes so the unsigned int meshes are aligned
+  size_t size = 0;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    MeshData& sep = *ranges[i];
+    sep.indexType = fits[i] ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    sep.indexOffset = static_cast<GLintptr>(size);
+    size_t bytes = sep.howMany * (fits[i] ? sizeof(unsigned short) : sizeof(unsigned int));
+    size += (bytes + 3) / 4 * 4;
+  }
+  std::vector<unsigned char> buffer(size, 0);
+  parallel::forEachRange(ranges.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const MeshData& sep = *ranges[i];
+      const unsigned int* source = mIndices.data() + sep.startIndex;
+      unsigned char* target = buffer.data() + sep.indexOffset;
+      if (sep.indexType == GL_UNSIGNED_SHORT) {
+        unsigned short* shorts = reinterpret_cast<unsigned short*>(target);
+        for (GLsizei k = 0; k < sep.howMany; ++k) {
+          shorts[k] = static_cast<unsigned short>(source[k]);
+        }
+      } else {
+        std::memcpy(target, source, sep.howMany * sizeof(unsigned int));
+      }
+    }
+  }, 1);
+  return buffer;
+}
+
+float Model::simplify(float ratio) {
+  if (!(ratio > 0.0f && ratio <= 1.0f)) {
+    std::cerr << "The simplification ratio must be in (0, 1]" << std::endl;
+    return 0.0f;
+  }
+  discardLods();
+  const size_t n = mSeparators.size();
+  std::vector<size_t> used = usedVertices();
+  // Every separator is simplified on its own, so none of them takes
+  // triangles or vertices from another one
+  std::vector<SimplifiedLevel> results(n);
+  Simplifier simplifier;
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const MeshData& sep = mSeparators[i];
+      std::vector<size_t> target(1, static_cast<size_t>(ratio * (sep.howMany / 3)));
+      results[i] = simplifier.simplify(
+          ArrayView<Vertex>(mVertices.data() + sep.startVertex, used[i]),
+          ArrayView<unsigned int>(mIndices.data() + sep.startIndex, sep.howMany), target)[0];
+    }
+  }, 1);
+  // The separators get fewer indices, so the index buffer is rebuilt in their order
+  std::vector<unsigned int> indices;
+  float error = 0.0f;
+  for (size_t i = 0; i < n; ++i) {
+    MeshData& sep = mSeparators[i];
+    sep.startIndex = static_cast<GLint>(indices.size());
+    sep.howMany = static_cast<GLsizei>(results[i].indices.size());
+    sep.indexType = GL_UNSIGNED_INT;
+    sep.indexOffset = sep.startIndex * sizeof(unsigned int);
+    indices.insert(indices.end(), results[i].indices.begin(), results[i].indices.end());
+    error = std::max(error, results[i].error);
+  }
+  mIndices.swap(indices);
+  return error;
+}
+
+size_t Model::generateLods(const std::vector<float>& ratios) {
+  for (size_t k = 0; k < ratios.size(); ++k) {
+    if (!(ratios[k] > 0.0f && ratios[k] <= 1.0f) || (k > 0 && ratios[k] >= ratios[k - 1])) {
+      std::cerr << "The ratios of the levels of detail must be in (0, 1] and decreasing"
+          << std::endl;
+      return 0;
+    }
+  }
+  discardLods();
+  const size_t n = mSeparators.size();
+  const size_t levels = ratios.size();
+  if (n == 0 || levels == 0) {
+    return 0;
+  }
+  std::vector<size_t> used = usedVertices();
+  // Every separator is simplified on its own. A big one alone still runs its
+  // first pass in parallel (the loop is serial with a single element)
+  std::vector<std::vector<SimplifiedLevel> > results(n);
+  Simplifier simplifier;
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const MeshData& sep = mSeparators[i];
+      std::vector<size_t> targets(levels);
+      for (size_t k = 0; k < levels; ++k) {
+        targets[k] = static_cast<size_t>(ratios[k] * (sep.howMany / 3));
+      }
+      results[i] = simplifier.simplify(
+          ArrayView<Vertex>(mVertices.data() + sep.startVertex, used[i]),
+          ArrayView<unsigned int>(mIndices.data() + sep.startIndex, sep.howMany), targets);
+      for (SimplifiedLevel& level : results[i]) {
+        optimizeVertexCache(level.indices.data(), level.indices.size(), used[i],
+            DEFAULT_CACHE_SIZE);
+      }
+    }
+  }, 1);
+  // Append the indices, level by level
+  mLodStart = mIndices.size();
+  mLods.assign(levels, mSeparators);
+  mLodErrors.assign(levels, std::vector<float>(n, 0.0f));
+  for (size_t k = 0; k < levels; ++k) {
+    for (size_t i = 0; i < n; ++i) {
+      const SimplifiedLevel& level = results[i][k];
+      MeshData& lod = mLods[k][i];
+      lod.startIndex = static_cast<GLint>(mIndices.size());
+      lod.howMany = static_cast<GLsizei>(level.indices.size());
+      lod.indexType = GL_UNSIGNED_INT;
+      lod.indexOffset = lod.startIndex * sizeof(unsigned int);
+      mIndices.insert(mIndices.end(), level.indices.begin(), level.indices.end());
+      mLodErrors[k][i] = level.error;
+    }
+  }
+  return levels;
+}
+
+size_t Model::lodCount() const {
+  return mLods.size() + 1;
+}
+
+ArrayView<MeshData> Model::viewLod(size_t level) const {
+  return level == 0 ? viewSeparators() : ArrayView<MeshData>(mLods[level - 1]);
+}
+
+float Model::lodError(size_t level) const {
+  if (level == 0) {
+    return 0.0f;
+  }
+  const std::vector<float>& errors = mLodErrors[level - 1];
+  return errors.empty() ? 0.0f : *std::max_element(errors.begin(), errors.end());
+}
+
+float Model::lodError(size_t level, size_t separator) const {
+  return level == 0 ? 0.0f : mLodErrors[level - 1][separator];
+}
+
+std::vector<std::vector<MeshData> > Model::releaseLods() {
+  std::vector<std::vector<MeshData> > lods;
+  lods.swap(mLods);
+  mLodErrors.clear();
+  return lods;
+}
+
+void Model::discardLods() {
+  if (!mLods.empty()) {
+    mIndices.resize(mLodStart);
+  }
+  mLods.clear();
+  mLodErrors.clear();
+}
+
+OverdrawStats Model::estimateOverdraw(unsigned int directions, unsigned int resolution) const {
+  return analyzeOverdraw(viewVertices(), viewIndices(), viewSeparators(), directions, resolution);
+}
+
 void Model::processNode(aiNode* node, const aiScene* scene) {
-  // Process all the meshes (if any) in this node
+  // Gather the meshes used by every node (in the same order as a depth first walk)
+  std::vector<MeshUse> uses;
+  collectMeshes(node, scene, ModelNode::NO_PARENT, glm::mat4(1.0f), uses);
+  std::vector<unsigned int> useCount(scene->mNumMeshes, 0);
+  for (const MeshUse& use : uses) {
+    ++useCount[use.mesh];
+  }
+  // Every mesh is converted once. The ones used by a single node are moved to
+  // world space, the ones used by several nodes are kept as they are and get
+  // an instance per node
+  std::vector<const aiMesh*> meshes;
+  std::vector<const glm::mat4*> transforms;
+  std::vector<size_t> separatorOf(scene->mNumMeshes, 0);
+  std::vector<std::vector<const MeshUse*> > worlds;
+  const size_t firstSeparator = mSeparators.size();
+  for (const MeshUse& use : uses) {
+    const aiMesh* mesh = scene->mMeshes[use.mesh];
+    if (!mesh || !mesh->HasPositions()) {
+      std::cerr << "Weird mesh without vertex positions!" << std::endl;
+      continue;
+    }
+    if (useCount[use.mesh] > 1) {
+      if (separatorOf[use.mesh] == 0) {
+        separatorOf[use.mesh] = meshes.size() + 1;
+        meshes.push_back(mesh);
+        transforms.push_back(nullptr);
+        worlds.resize(meshes.size());
+      }
+      worlds[separatorOf[use.mesh] - 1].push_back(&use);
+      continue;
+    }
+    meshes.push_back(mesh);
+    transforms.push_back(isIdentity(use.world) ? nullptr : &use.world);
+  }
+  // Then, convert them all at once
+  addMeshesData(meshes, transforms, scene);
+  worlds.resize(meshes.size());
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    if (worlds[m].empty()) {
+      continue;
+    }
+    // The mirroring instances go last, they are drawn with the other winding
+    std::stable_partition(worlds[m].begin(), worlds[m].end(), [](const MeshUse* use) {
+      return glm::determinant(glm::mat3(use->world)) >= 0.0f;
+    });
+    InstanceRange none = {0, 0};
+    mInstanceRanges.resize(mSeparators.size(), none);
+    InstanceRange range = {static_cast<uint32_t>(mInstanceTransforms.size()),
+        static_cast<uint32_t>(worlds[m].size())};
+    mInstanceRanges[firstSeparator + m] = range;
+    for (const MeshUse* use : worlds[m]) {
+      mInstanceTransforms.push_back(use->world);
+      mInstanceNodes.push_back(use->node);
+    }
+  }
+}
+
+void Model::collectMeshes(const aiNode* node, const aiScene* scene, uint32_t parent,
+    const glm::mat4& parentWorld, std::vector<MeshUse>& uses) {
+  ModelNode modelNode = {parent, toMat4(node->mTransformation)};
+  const uint32_t index = static_cast<uint32_t>(mNodes.size());
+  mNodes.push_back(modelNode);
+  const glm::mat4 world = parentWorld * modelNode.local;
+  // The meshes (if any) in this node
   for(unsigned int i = 0; i < node->mNumMeshes; i++) {
-    aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-    addMeshData(mesh, scene);
+    MeshUse use = {node->mMeshes[i], index, world};
+    uses.push_back(use);
   }
   // Then, recursivelly procees the child nodes
   for(unsigned int i = 0; i < node->mNumChildren; i++) {
-    processNode(node->mChildren[i], scene);
+    collectMeshes(node->mChildren[i], scene, index, world, uses);
   }
 }
 
 void Model::addMesh(const Mesh& mesh) {
+  discardLods();
   MeshData bookMark; // New bookmar to keep track of the new mesh
   // keep the current number of indices (before adding this mesh)
   unsigned int indicesBefore = static_cast<unsigned int>(mIndices.size());
-  // Insert new indices
-  std::vector<unsigned int> newIndices = mesh.getIndices();
+  // Insert new indices (directly from the mesh's buffer)
+  ArrayView<unsigned int> newIndices = mesh.viewIndices();
   mIndices.insert(mIndices.end(), newIndices.begin(), newIndices.end());
   // Update the bookmark to reflect the new indices
   unsigned int indicesAfter = static_cast<unsigned int>(mIndices.size());
@@ -73,73 +854,223 @@ void Model::addMesh(const Mesh& mesh) {
   // Prepare for the new vertices
   bookMark.startVertex = int(mVertices.size());
   // Insert new vertices
-  std::vector<Vertex> newVertices = mesh.getVertices();
+  ArrayView<Vertex> newVertices = mesh.viewVertices();
   mVertices.insert(mVertices.end(), newVertices.begin(), newVertices.end());
-  // Update our internal flags
-  mHasNormals = mHasNormals && mesh.hasNormals();
-  mHasTexture = mHasTexture && mesh.hasTexture();
+  // Update our internal flags (the first mesh sets them)
+  bool first = mSeparators.empty();
+  // The tangents are kept only if every mesh has them
+  if ((first || !mTangents.empty()) && mesh.hasTangents()) {
+    ArrayView<glm::vec4> newTangents = mesh.viewTangents();
+    mTangents.insert(mTangents.end(), newTangents.begin(), newTangents.end());
+  } else {
+    mTangents.clear();
+  }
+  mHasNormals = (first || mHasNormals) && mesh.hasNormals();
+  mHasTexture = (first || mHasTexture) && mesh.hasTexture();
   // Finalize to update the bookmark
   bookMark.diffuseIndex = -1;
   bookMark.specIndex = -1;
+  bookMark.normalIndex = -1;
+  bookMark.indexType = GL_UNSIGNED_INT;
+  bookMark.indexOffset = bookMark.startIndex * sizeof(unsigned int);
   mSeparators.push_back(bookMark);
+  padInstanceRanges();
 }
 
-void Model::addMeshData(const aiMesh* mesh, const aiScene* scene) {
-  // Parse Mesh data
-  if (!mesh || !mesh->HasPositions() || !scene) {
-    std::cerr << "Weird mesh without vertex positions!" << std::endl;
+void Model::addMesh(Mesh&& mesh) {
+  discardLods();
+  if (!mVertices.empty() || !mIndices.empty()) {
+    // We need to append, that is still done without intermediate copies
+    addMesh(static_cast<const Mesh&>(mesh));
+    mesh.clear();
     return;
   }
-
+  // Empty model: just take the buffers
   MeshData bookMark;
-  /* First the indices */
-  unsigned int numFaces = mesh->mNumFaces;
-  // keep the current number of indices (before adding this mesh)
-  unsigned int indicesBefore = static_cast<unsigned int>(mIndices.size());
-  for (unsigned int t = 0; t < numFaces; ++t) {
+  bool first = mSeparators.empty();
+  mHasNormals = (first || mHasNormals) && mesh.hasNormals();
+  mHasTexture = (first || mHasTexture) && mesh.hasTexture();
+  mIndices = mesh.releaseIndices();
+  mVertices = mesh.releaseVertices();
+  mTangents = mesh.releaseTangents();
+  mesh.clear();
+  bookMark.startIndex = 0;
+  bookMark.howMany = int(mIndices.size());
+  bookMark.startVertex = 0;
+  bookMark.diffuseIndex = -1;
+  bookMark.specIndex = -1;
+  bookMark.normalIndex = -1;
+  bookMark.indexType = GL_UNSIGNED_INT;
+  bookMark.indexOffset = 0;
+  mSeparators.push_back(bookMark);
+  padInstanceRanges();
+}
+
+namespace {
+// A piece of work of the conversion: a range of vertices or faces of one mesh
+struct ConvertJob {
+  size_t mesh;
+  unsigned int first;
+  unsigned int last;
+  bool faces;
+};
+// Maximum number of vertices or faces per job
+const unsigned int JOB_SIZE = 32768;
+}
+
+void Model::addMeshesData(const std::vector<const aiMesh*>& meshes,
+    const std::vector<const glm::mat4*>& transforms, const aiScene* scene) {
+  // First pass: count the indices of each mesh (faces are not always triangles)
+  std::vector<size_t> indexCount(meshes.size(), 0);
+  parallel::forEachRange(meshes.size(), [&](size_t begin, size_t end) {
+    for (size_t m = begin; m < end; ++m) {
+      const aiMesh* mesh = meshes[m];
+      if (!mesh || !mesh->HasPositions()) {
+        continue;
+      }
+      for (unsigned int t = 0; t < mesh->mNumFaces; ++t) {
+        indexCount[m] += mesh->mFaces[t].mNumIndices;
+      }
+    }
+  }, 16);
+  // Then a prefix sum gives the place of each mesh in the buffers. The separators
+  // and textures are also created here, since the texture order matters
+  std::vector<const aiMesh*> valid;
+  std::vector<const glm::mat4*> validTransforms;
+  std::vector<MeshData> bookMarks;
+  std::vector<ConvertJob> jobs;
+  size_t totalVertices = mVertices.size();
+  size_t totalIndices = mIndices.size();
+  // The tangents are kept only if every mesh has them (Assimp skips the
+  // meshes without texture coordinates)
+  bool tangents = mVertices.empty() || !mTangents.empty();
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    const aiMesh* mesh = meshes[m];
+    if (!mesh || !mesh->HasPositions() || !scene) {
+      std::cerr << "Weird mesh without vertex positions!" << std::endl;
+      continue;
+    }
+    MeshData bookMark;
+    bookMark.startIndex = int(totalIndices);
+    bookMark.howMany = int(indexCount[m]);
+    bookMark.startVertex = int(totalVertices);
+    bookMark.indexType = GL_UNSIGNED_INT;
+    bookMark.indexOffset = bookMark.startIndex * sizeof(unsigned int);
+    // Add textures for this mesh to our collection
+    bookMark.diffuseIndex = -1;
+    bookMark.specIndex = -1;
+    bookMark.normalIndex = -1;
+    if (mesh->mMaterialIndex > 0) {
+      aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+      bookMark.diffuseIndex = addTexture(material, aiTextureType_DIFFUSE);
+      bookMark.specIndex = addTexture(material, aiTextureType_SPECULAR);
+      // Only the normal maps, the height maps (map_Bump of the OBJ files) are not used
+      bookMark.normalIndex = addTexture(material, aiTextureType_NORMALS);
+    }
+    // Split the work of this mesh in jobs of similar size
+    for (unsigned int first = 0; first < mesh->mNumVertices; first += JOB_SIZE) {
+      ConvertJob job = {valid.size(), first, std::min(first + JOB_SIZE, mesh->mNumVertices), false};
+      jobs.push_back(job);
+    }
+    // Only pure triangle meshes know where each face goes, the rest is one single job
+    bool triangles = indexCount[m] == 3 * size_t(mesh->mNumFaces);
+    unsigned int faceJob = triangles ? JOB_SIZE : mesh->mNumFaces;
+    for (unsigned int first = 0; first < mesh->mNumFaces; first += faceJob) {
+      ConvertJob job = {valid.size(), first, std::min(first + faceJob, mesh->mNumFaces), true};
+      jobs.push_back(job);
+    }
+    totalVertices += mesh->mNumVertices;
+    totalIndices += indexCount[m];
+    valid.push_back(mesh);
+    validTransforms.push_back(transforms[m]);
+    bookMarks.push_back(bookMark);
+    // As in one by one loading, the flags are the ones of the last mesh
+    mHasNormals = mesh->HasNormals();
+    mHasTexture = mesh->HasTextureCoords(0);
+    tangents = tangents && mesh->HasNormals() && mesh->HasTangentsAndBitangents();
+  }
+  tangents = tangents && !valid.empty();
+  mVertices.resize(totalVertices);
+  if (tangents) {
+    mTangents.resize(totalVertices);
+  } else {
+    mTangents.clear();
+  }
+  mIndices.resize(totalIndices);
+  // Second pass: every job writes its own part of the preallocated buffers
+  parallel::forEachRange(jobs.size(), [&](size_t begin, size_t end) {
+    for (size_t j = begin; j < end; ++j) {
+      const ConvertJob& job = jobs[j];
+      const aiMesh* mesh = valid[job.mesh];
+      const MeshData& bookMark = bookMarks[job.mesh];
+      if (job.faces) {
+        // A mirroring transform turns the triangles inside out, unless they are flipped
+        const glm::mat4* T = validTransforms[job.mesh];
+        const bool mirrored = T && glm::determinant(glm::mat3(*T)) < 0.0f;
+        convertFaces(mesh, job.first, job.last,
+            mIndices.data() + bookMark.startIndex + 3 * size_t(job.first), mirrored);
+      } else {
+        Vertex* vertices = mVertices.data() + bookMark.startVertex + job.first;
+        glm::vec4* tangent = tangents ? mTangents.data() + bookMark.startVertex + job.first :
+            nullptr;
+        convertVertices(mesh, job.first, job.last, vertices, tangent);
+        // To world space, while the vertices are still in the cache
+        if (validTransforms[job.mesh]) {
+          const glm::mat4& T = *validTransforms[job.mesh];
+          glm::vec3 lower;
+          glm::vec3 upper;
+          transformVertices(vertices, job.last - job.first, T, mesh->HasNormals(), lower, upper);
+          if (tangent) {
+            transformTangents(tangent, job.last - job.first, T);
+          }
+        }
+      }
+    }
+  }, 1);
+  mSeparators.insert(mSeparators.end(), bookMarks.begin(), bookMarks.end());
+}
+
+void Model::convertFaces(const aiMesh* mesh, unsigned int first, unsigned int last,
+    unsigned int* indices, bool flipWinding) {
+  for (unsigned int t = first; t < last; ++t) {
     const aiFace* face = &mesh->mFaces[t];
     for (unsigned int i = 0; i < face->mNumIndices; ++i) {
-      mIndices.push_back(face->mIndices[i]);
+      *indices++ = face->mIndices[i];
+    }
+    if (flipWinding && face->mNumIndices == 3) {
+      std::swap(indices[-1], indices[-2]);
     }
   }
-  // Start filling this mesh's separators info
-  unsigned int indicesAfter = static_cast<unsigned int>(mIndices.size());
-  bookMark.startIndex = int(indicesBefore);
-  bookMark.howMany = int(indicesAfter - indicesBefore);
+}
 
-  /* Now, the Vertices */
-  Vertex v;
-  mHasNormals = mesh->HasNormals();
-  mHasTexture = mesh->HasTextureCoords(0);
-  bookMark.startVertex = int(mVertices.size());
-  for (unsigned int i = 0; i < mesh->mNumVertices; ++i) {
+void Model::convertVertices(const aiMesh* mesh, unsigned int first, unsigned int last,
+    Vertex* vertices, glm::vec4* tangents) {
+  bool normals = mesh->HasNormals();
+  bool textCoords = mesh->HasTextureCoords(0);
+  for (unsigned int i = first; i < last; ++i) {
+    Vertex& v = *vertices++;
     v.position.x = mesh->mVertices[i].x;
     v.position.y = mesh->mVertices[i].y;
     v.position.z = mesh->mVertices[i].z;
-    if (mHasNormals) {
+    if (normals) {
       v.normal.x = mesh->mNormals[i].x;
       v.normal.y = mesh->mNormals[i].y;
       v.normal.z = mesh->mNormals[i].z;
     }
-    if (mHasTexture) {
+    if (textCoords) {
       v.textCoords.s = mesh->mTextureCoords[0][i].x;
       v.textCoords.t = mesh->mTextureCoords[0][i].y;
     }
-    mVertices.push_back(v);
-  }
-
-  // Add textures for this mesh to our collection
-  int diffuseTexture = -1;
-  int specularTexture = -1;
-  if (mesh->mMaterialIndex > 0) {
-    aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-    diffuseTexture = addTexture(material, aiTextureType_DIFFUSE);
-    specularTexture = addTexture(material, aiTextureType_SPECULAR);
+    if (tangents) {
+      // w is the handedness of the bitangent
+      const aiVector3D& t = mesh->mTangents[i];
+      const aiVector3D& b = mesh->mBitangents[i];
+      glm::vec3 tangent(t.x, t.y, t.z);
+      float sign = glm::dot(glm::cross(v.normal, tangent), glm::vec3(b.x, b.y, b.z)) < 0.0f ?
+          -1.0f : 1.0f;
+      *tangents++ = glm::vec4(tangent, sign);
+    }
   }
-  // Finish filling the separator for this mesh
-  bookMark.diffuseIndex = diffuseTexture;
-  bookMark.specIndex = specularTexture;
-  mSeparators.push_back(bookMark);
 }
 
 int Model::addTexture(const aiMaterial* mat, aiTextureType ai_type) {
@@ -156,18 +1087,23 @@ int Model::addTexture(const aiMaterial* mat, aiTextureType ai_type) {
     //NO texture of this type for this Mesh
     return -1;
   }
-  //Check if this texture is already in the vector
-  for (size_t i = 0; i < mTexturesData.size(); ++i) {
-    if (mTexturesData[i].filePath == textPath) {
-      return int(i); // If it is, return the index
+  //Check if this texture is already in the vector (the index is built the first time)
+  if (mTextureIndex.empty()) {
+    for (size_t i = 0; i < mTexturesData.size(); ++i) {
+      mTextureIndex.insert(std::make_pair(mTexturesData[i].filePath, static_cast<int>(i)));
     }
   }
+  auto found = mTextureIndex.insert(std::make_pair(textPath,
+      static_cast<int>(mTexturesData.size())));
+  if (!found.second) {
+    return found.first->second; // If it is, return the index
+  }
   //It's is not, then create it an push it into the vector
   TextureImage text;
   text.type = toTextType(ai_type);
   text.filePath = textPath;
   mTexturesData.push_back(text);
-  return static_cast<int>(mTexturesData.size() - 1);
+  return found.first->second;
 
 }
 
@@ -202,4 +1138,162 @@ std::vector<TextureImage> Model::getDiffuseTextures() const {
     return mTexturesData;
 }
 
+ArrayView<MeshData> Model::viewSeparators() const {
+  return ArrayView<MeshData>(mSeparators);
+}
+
+ArrayView<TextureImage> Model::viewTextures() const {
+  return ArrayView<TextureImage>(mTexturesData);
+}
+
+std::vector<MeshData> Model::releaseSeparators() {
+  std::vector<MeshData> separators;
+  separators.swap(mSeparators);
+  return separators;
+}
+
+std::vector<TextureImage> Model::releaseTextures() {
+  std::vector<TextureImage> textures;
+  textures.swap(mTexturesData);
+  mTextureIndex.clear();
+  return textures;
+}
+
+bool Model::hasInstances() const {
+  return !mInstanceTransforms.empty();
+}
+
+ArrayView<InstanceRange> Model::viewInstanceRanges() const {
+  return ArrayView<InstanceRange>(mInstanceRanges);
+}
+
+ArrayView<glm::mat4> Model::viewInstanceTransforms() const {
+  return ArrayView<glm::mat4>(mInstanceTransforms);
+}
+
+ArrayView<ModelNode> Model::viewNodes() const {
+  return ArrayView<ModelNode>(mNodes);
+}
+
+ArrayView<uint32_t> Model::viewInstanceNodes() const {
+  return ArrayView<uint32_t>(mInstanceNodes);
+}
+
+const glm::mat4& Model::instanceBase() const {
+  return mInstanceBase;
+}
+
+InstanceRange Model::instancesOf(size_t separator) const {
+  InstanceRange none = {0, 0};
+  return separator < mInstanceRanges.size() ? mInstanceRanges[separator] : none;
+}
+
+void Model::padInstanceRanges() {
+  if (!mInstanceRanges.empty()) {
+    InstanceRange none = {0, 0};
+    mInstanceRanges.resize(mSeparators.size(), none);
+  }
+}
+
+void Model::transform(const glm::mat4& T) {
+  Mesh::transform(T);
+  // The nodes follow the vertices
+  for (ModelNode& node : mNodes) {
+    if (node.parent == ModelNode::NO_PARENT) {
+      node.local = T * node.local;
+    }
+  }
+  if (hasInstances()) {
+    // An instance drew W * v and the vertices are now T * v, so it becomes T * W * inverse(T)
+    const glm::mat4 inverseT = glm::inverse(T);
+    for (glm::mat4& W : mInstanceTransforms) {
+      W = T * W * inverseT;
+    }
+    mInstanceBase = mInstanceBase * inverseT;
+    updateBoundingBox();
+  }
+}
+
+void Model::updateBoundingBox() {
+  if (!hasInstances()) {
+    Mesh::updateBoundingBox();
+    return;
+  }
+  std::vector<size_t> used = usedVertices();
+  glm::vec3 lower(FLT_MAX);
+  glm::vec3 upper(-FLT_MAX);
+  for (size_t i = 0; i < mSeparators.size(); ++i) {
+    if (used[i] == 0) {
+      continue;
+    }
+    glm::vec3 low;
+    glm::vec3 high;
+    vertexBounds(mVertices.data() + mSeparators[i].startVertex, used[i], low, high);
+    InstanceRange range = instancesOf(i);
+    if (range.count == 0) {
+      lower = glm::min(lower, low);
+      upper = glm::max(upper, high);
+    }
+    // Every instance adds the eight corners of the box of the mesh
+    for (uint32_t k = range.first; k < range.first + range.count; ++k) {
+      const glm::mat4& W = mInstanceTransforms[k];
+      for (int c = 0; c < 8; ++c) {
+        glm::vec3 corner((c & 1) ? high.x : low.x, (c & 2) ? high.y : low.y,
+            (c & 4) ? high.z : low.z);
+        glm::vec3 p = glm::vec3(W * glm::vec4(corner, 1.0f));
+        lower = glm::min(lower, p);
+        upper = glm::max(upper, p);
+      }
+    }
+  }
+  mLowerCorner = lower;
+  mUpperCorner = upper;
+}
+
+std::vector<int> Model::mergeTextures(const std::vector<uint64_t>& contentKeys,
+    const std::function<bool(size_t, size_t)>& sameContent) {
+  std::vector<int> remap(contentKeys.size());
+  if (contentKeys.size() != mTexturesData.size()) {
+    for (size_t i = 0; i < remap.size(); ++i) {
+      remap[i] = static_cast<int>(i);
+    }
+    return remap;
+  }
+  // The first texture with a content keeps it, the next ones point to it. The kept textures
+  // with each key (usually one) are compared with sameContent, if given
+  std::unordered_multimap<uint64_t, size_t> keptWithKey;
+  size_t kept = 0;
+  for (size_t i = 0; i < contentKeys.size(); ++i) {
+    auto range = keptWithKey.equal_range(contentKeys[i]);
+    auto same = range.first;
+    while (same != range.second && sameContent && !sameContent(same->second, i)) {
+      ++same;
+    }
+    if (same != range.second) {
+      remap[i] = remap[same->second];
+    } else {
+      keptWithKey.insert(std::make_pair(contentKeys[i], i));
+      remap[i] = static_cast<int>(kept);
+      mTexturesData[kept++] = mTexturesData[i];
+    }
+  }
+  if (kept == mTexturesData.size()) {
+    return remap;
+  }
+  mTexturesData.resize(kept);
+  mTextureIndex.clear();
+  auto update = [&remap](std::vector<MeshData>& separators) {
+    for (MeshData& sep : separators) {
+      sep.diffuseIndex = sep.diffuseIndex < 0 ? sep.diffuseIndex : remap[sep.diffuseIndex];
+      sep.specIndex = sep.specIndex < 0 ? sep.specIndex : remap[sep.specIndex];
+      sep.normalIndex = sep.normalIndex < 0 ? sep.normalIndex : remap[sep.normalIndex];
+    }
+  };
+  update(mSeparators);
+  for (std::vector<MeshData>& level : mLods) {
+    update(level);
+  }
+  return remap;
+}
+
 } // namespace mesh
\ No newline at end of file
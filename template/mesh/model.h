@@ -1,6 +1,9 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
 #include <vector>
 #include <string>
 
@@ -16,6 +19,8 @@
 
 namespace mesh {
 
+struct SourceStamp;
+
 //!  A simple struct that act as a separator of the Meshes in this model.
 /*!
   This struct encapsulate all the data needed to draw an individual Mesh
@@ -43,8 +48,44 @@ typedef struct MeshData {
    * or -1 if this mesh does not have a Diffuse texture
   */
   int specIndex;
+  //! Index of the normal map
+  /*! The index of this mesh normal map (in tangent space) in the textures
+   * vector or -1 if this mesh does not have one. It needs the tangents
+   * of the vertices (See Mesh::viewTangents)
+  */
+  int normalIndex;
+  //! Type of the indices of this mesh in the GPU's index buffer
+  /*! GL_UNSIGNED_INT, unless the buffer was created with
+   * Model::buildIndexBuffer, which uses GL_UNSIGNED_SHORT when possible
+  */
+  GLenum indexType;
+  //! Place (in bytes) of the first index of this mesh in the GPU's index buffer
+  GLintptr indexOffset;
 } MeshData;
 
+//! The instances of a separator, a range of Model::viewInstanceTransforms
+/*!
+  A separator with instances is stored once, in the space of its mesh, and
+  drawn once per instance with its world transform. A count of zero means
+  the separator is drawn once, as it is. The instances whose transform
+  mirrors (negative determinant) come after the others: their triangles face
+  the other way, so they need glFrontFace(GL_CW).
+*/
+struct InstanceRange {
+  uint32_t first;
+  uint32_t count;
+};
+
+//! A node of the scene graph of a model file (See Model::viewNodes)
+struct ModelNode {
+  //! Parent of the root nodes
+  static const uint32_t NO_PARENT;
+  //! Index of the parent node, always before this one (or NO_PARENT)
+  uint32_t parent;
+  //! Transform relative to the parent
+  glm::mat4 local;
+};
+
 enum TextType {DIFFUSE, SPECULAR, NORMALS, OTHER};
 
 //! Holds the info for a particular texture
@@ -83,10 +124,67 @@ class Model : public Mesh {
 
 protected:
   std::vector<TextureImage> mTexturesData;
+  //! Index of every path in mTexturesData (empty until addTexture needs it)
+  std::unordered_map<std::string, int> mTextureIndex;
+  //! A mesh of the scene as a node uses it, with the world transform of the node
+  struct MeshUse {
+    unsigned int mesh;
+    uint32_t node;
+    glm::mat4 world;
+  };
   void processNode(aiNode* node, const aiScene* scene);
-  void addMeshData(const aiMesh* mesh, const aiScene* scene);
+  //! Also adds the nodes to mNodes, depth first
+  void collectMeshes(const aiNode* node, const aiScene* scene, uint32_t parent,
+      const glm::mat4& parentWorld, std::vector<MeshUse>& uses);
+  //! Converts the meshes in two passes: offsets (prefix sum) then in parallel
+  /*!
+    Every mesh is transformed by its matrix (or kept as it is if it is null).
+    The triangles of a mesh with a mirroring matrix (negative determinant)
+    are turned around, so they keep facing outwards.
+  */
+  void addMeshesData(const std::vector<const aiMesh*>& meshes,
+      const std::vector<const glm::mat4*>& transforms, const aiScene* scene);
+  //! Copies the indices of the faces, the triangles in the opposite order if flipWinding
+  static void convertFaces(const aiMesh* mesh, unsigned int first, unsigned int last,
+      unsigned int* indices, bool flipWinding = false);
+  //! Also converts the tangents, if tangents is not null
+  static void convertVertices(const aiMesh* mesh, unsigned int first, unsigned int last,
+      Vertex* vertices, glm::vec4* tangents);
   std::vector<MeshData> mSeparators;
+  //! The instances of every separator (empty if no separator has instances)
+  std::vector<InstanceRange> mInstanceRanges;
+  std::vector<glm::mat4> mInstanceTransforms;
+  //! The scene graph of the file and the node of every instance
+  std::vector<ModelNode> mNodes;
+  std::vector<uint32_t> mInstanceNodes;
+  //! From the space the instanced meshes are stored in to the one of their nodes
+  glm::mat4 mInstanceBase;
+  //! The instances of a separator (none if it is drawn once)
+  InstanceRange instancesOf(size_t separator) const;
+  //! If any separator has instances, the ones added after it are drawn once
+  void padInstanceRanges();
+  //! Separators of the levels of detail 1, 2... (See generateLods)
+  std::vector<std::vector<MeshData> > mLods;
+  //! Error of every separator in every level of detail (same layout as mLods)
+  std::vector<std::vector<float> > mLodErrors;
+  //! The indices of the levels of detail start here, after the ones of the separators
+  size_t mLodStart;
+  //! Forget the levels of detail (and their indices)
+  void discardLods();
+  bool mFromCache;
+  bool loadFromCache(const std::string& fileName, const SourceStamp& stamp);
+  //! Clears the buffers and imports the file with Assimp
+  bool loadWithAssimp(const std::string& fileName);
+  //! The box of the separators drawn once and of every instance of the rest
+  void updateBoundingBox() override;
   int addTexture(const aiMaterial* material, aiTextureType ai_type);
+  //! Number of vertices used by each separator (one more than its biggest index)
+  std::vector<size_t> usedVertices() const;
+  //! Add (or subtract) the startVertex of every separator to its indices
+  void absoluteIndices(bool absolute);
+  //! Move the vertices added at the end of the buffer (from firstAdded) right after the ones of
+  //! the separators that use them. The indices go from absolute to relative (See usedVertices)
+  void placeAddedVertices(const std::vector<size_t>& used, size_t firstAdded);
   TextType toTextType(aiTextureType ai_type);
 
 public:
@@ -95,7 +193,30 @@ public:
   //! Loads this 3D model from the fileName
   explicit Model(const std::string& fileName);
   //! Clears the current data. Then loads this 3D model from the fileName
-  bool load(const std::string& fileName);
+  /*!
+    The first time a file is imported, a binary cache is written next to it
+    (See \class MeshCache). The next loads of the same (unmodified) file
+    read the cache instead of importing it again. Changing the material
+    libraries of an OBJ file also invalidates the cache.
+    OBJ files are read with \class ObjReader (in parallel), the other formats
+    (and the OBJ files it can not read) with Assimp.
+    The transforms of the nodes are applied. A mesh used by a single node is
+    stored in world space, one used by several nodes is stored once and
+    drawn once per node (See viewInstanceRanges).
+    @param fileName the 3D model file to load
+    @param useCache if false the cache is neither read nor written
+  */
+  bool load(const std::string& fileName, bool useCache = true);
+  //! Queries if the last load was served from the binary cache
+  bool loadedFromCache() const;
+  //! Save the model on a file, one group (OBJ) or range of faces per separator
+  /*!
+    Same formats as Mesh::save (See \fn writeMesh). Only the triangles of
+    the separators are written, the levels of detail are not. The separators
+    with instances are written once per instance, transformed as they are
+    drawn (See viewInstanceRanges).
+  */
+  bool save(const std::string& fileName = "") const;
   //! Add a mesh to this model
   /*!
     Add the data from the mesh (indices and vertices) to the internal
@@ -103,6 +224,12 @@ public:
     and texture coordinates flags
   */
   void addMesh(const Mesh& mesh);
+  //! Add a mesh to this model, taking its data
+  /*!
+    Same as above, but the mesh buffers are moved (if this model is empty) or
+    appended directly from them. The mesh is left empty.
+  */
+  void addMesh(Mesh&& mesh);
   //! Get a vector of MeshData that act as a separator of the meshes.
   /*!
     Get a vector of MeshData, since all the model data is contained in a
@@ -118,6 +245,162 @@ public:
     -1 in the separator indicate that you should not query this vector
   */
   std::vector<TextureImage> getDiffuseTextures() const;
+  //! Read only view of the separators, without copying them (See getSeparators)
+  ArrayView<MeshData> viewSeparators() const;
+  //! Read only view of the textures, without copying them (See getDiffuseTextures)
+  ArrayView<TextureImage> viewTextures() const;
+  //! Move the separators out of this Model.
+  /*!
+    Useful when the model is only used to load the data to the GPU. Then the
+    separators are the only thing that you need to keep for rendering.
+    After this call the Model does not have separators anymore.
+  */
+  std::vector<MeshData> releaseSeparators();
+  //! Move the textures info out of this Model. (See releaseSeparators)
+  std::vector<TextureImage> releaseTextures();
+  //! Queries if any separator is drawn more than once (See viewInstanceRanges)
+  bool hasInstances() const;
+  //! The instances of every separator, in the same order (empty if there are none)
+  ArrayView<InstanceRange> viewInstanceRanges() const;
+  //! The world transforms of all the instances (See \struct InstanceRange)
+  ArrayView<glm::mat4> viewInstanceTransforms() const;
+  //! The nodes of the file, parents first (empty if the file has no scene graph)
+  /*!
+    The world matrix of a node is the product of the local matrices from its
+    root. A transform of this Model is applied to the roots.
+  */
+  ArrayView<ModelNode> viewNodes() const;
+  //! The node of every instance, in the order of viewInstanceTransforms
+  /*!
+    The transform of an instance is the world matrix of its node times
+    instanceBase(), so moving a node moves its instances.
+  */
+  ArrayView<uint32_t> viewInstanceNodes() const;
+  //! Takes the instanced meshes from the space they are stored in to the one of their nodes
+  const glm::mat4& instanceBase() const;
+  //! Transform all the vertices by T, the instances keep their place in the new space
+  void transform(const glm::mat4& T) override;
+  //! Merge the textures with the same content
+  /*!
+    This class only knows the paths, so the caller decodes the textures and
+    gives a key of the content of each one (See image::Texture::content_hash).
+    A texture with the key of a previous one is removed, and the separators
+    and levels of detail use the previous one instead. The order of the
+    remaining textures is kept.
+    @param contentKeys one key per texture, in the order of viewTextures
+    @param sameContent if given, called with the indices of two textures with
+        the same key, they are merged only if it returns true (a hash can give
+        the same key to different images)
+    @return the new index of every texture (the same size as contentKeys)
+  */
+  std::vector<int> mergeTextures(const std::vector<uint64_t>& contentKeys,
+      const std::function<bool(size_t, size_t)>& sameContent = nullptr);
+  //! Reorder the triangles and vertices of every mesh to render faster
+  /*!
+    Same as Mesh::optimizeVertexOrder, but every separator is optimized on
+    its own (in parallel), so the separators stay valid. The statistics are
+    the totals of all the separators.
+  */
+  VertexCacheReport optimizeVertexOrder(unsigned int cacheSize = 16,
+      float overdrawThreshold = 1.05f) override;
+  //! Compute smooth normals for all the separators (See Mesh::recalculateNormals)
+  /*!
+    The vertices shared by several separators are smoothed with all of them.
+    The vertices split by the crease angle are placed right after the ones of
+    the separators that use them, so every separator keeps a compact range of
+    the vertex buffer (which is rebuilt in the order of the startVertex of the
+    separators). The levels of detail are discarded.
+    @return the number of vertices added by the crease angle
+  */
+  size_t recalculateNormals(float creaseAngle = 180.0f) override;
+  //! Compute the tangents of all the separators (See Mesh::recalculateTangents)
+  /*!
+    As recalculateNormals, the vertices split for mirrored texture coordinates
+    are placed right after the ones of the separators that use them, and the
+    levels of detail are discarded.
+    @return the number of vertices added
+  */
+  size_t recalculateTangents() override;
+  //! Estimate the overdraw of this Model, drawing all the separators in order
+  OverdrawStats estimateOverdraw(unsigned int directions = 16,
+      unsigned int resolution = 256) const override;
+  //! Create an index buffer where each mesh uses the smallest index type it can
+  /*!
+    Meshes whose indices are all less than 65536 (the indices are relative
+    to startVertex) are stored as unsigned short, the rest as unsigned int.
+    The indexType and indexOffset of every separator are updated to point
+    into the returned buffer, which can be sent directly to glBufferData.
+    @param splitLargeMeshes if true, meshes with more than 65536 vertices are
+    split first (See splitLargeMeshes), so they can also use unsigned short.
+    It is ignored if there are levels of detail, because splitting would
+    discard them: call splitLargeMeshes before generateLods instead.
+    The separators of the levels of detail are also updated, they use the
+    same index type as the mesh they come from.
+    @return the index buffer (every mesh starts at a multiple of 4 bytes)
+  */
+  std::vector<unsigned char> buildIndexBuffer(bool splitLargeMeshes = true);
+  //! Sort the separators by material and merge the ones that share it
+  /*!
+    The separators are sorted by (diffuseIndex, specIndex, normalIndex), keeping the
+    order of the ones with the same textures. Then consecutive separators
+    with the same textures become a single one (a single draw call) while
+    it uses no more than maxVertices vertices. The vertex and index buffers
+    are rebuilt in the new order, so every merged separator is a contiguous
+    range of both. Vertices shared by several separators are not copied;
+    a separator whose vertices were already placed before the current
+    merged one starts a new one. The levels of detail are discarded, so
+    call it before splitLargeMeshes and generateLods, and after
+    mergeTextures (the separators only share the textures merged before).
+    @return the number of separators removed
+  */
+  size_t batchByMaterial(size_t maxVertices = 65536);
+  //! Split the meshes that use more than maxVertices vertices
+  /*!
+    The triangles are taken in order and a new separator (with the same
+    textures) is started when the current one would use too many vertices.
+    The vertices of each new separator are numbered in the order the
+    triangles use them. The vertices on the boundaries are duplicated.
+    The parts keep the instances of the mesh they come from.
+    If any mesh is split, the levels of detail are discarded.
+    @return the number of separators added
+  */
+  size_t splitLargeMeshes(size_t maxVertices = 65536);
+  //! Reduce the number of triangles of every mesh (See Mesh::simplify)
+  /*!
+    Every separator is simplified on its own (in parallel), so the separators
+    stay valid and no triangle moves to another one. The index buffer is
+    rebuilt in the order of the separators and the levels of detail are
+    discarded.
+    @return the biggest estimated error of the separators
+  */
+  float simplify(float ratio) override;
+  //! Create levels of detail of every mesh (in parallel, See \class Simplifier)
+  /*!
+    Every level is a new set of separators, one per original separator and in
+    the same order, with the same vertices and textures but fewer triangles.
+    Their indices are added at the end of the index buffer, so all the levels
+    live in the same buffers. Call it after optimizeVertexOrder and
+    splitLargeMeshes, because both of them discard the levels (as load and
+    addMesh do). The triangles of every level are optimized for the vertex cache.
+    @param ratios fraction of the original triangles of every level, in (0, 1]
+    and strictly decreasing (if not, nothing is done)
+    @return the number of levels created (not counting the original one)
+  */
+  size_t generateLods(const std::vector<float>& ratios = {0.5f, 0.25f, 0.125f});
+  //! Number of levels of detail, including the original meshes (level 0)
+  size_t lodCount() const;
+  //! Read only view of the separators of a level of detail (level 0 are the original ones)
+  ArrayView<MeshData> viewLod(size_t level) const;
+  //! Estimated error of a level of detail, in model units (zero for level 0)
+  /*!
+    The biggest error of the separators in this level. See the overload for
+    the error of a single separator.
+  */
+  float lodError(size_t level) const;
+  //! Estimated error of one separator in a level of detail, in model units
+  float lodError(size_t level, size_t separator) const;
+  //! Move the separators of the levels of detail 1, 2... out of this Model (See releaseSeparators)
+  std::vector<std::vector<MeshData> > releaseLods();
   //! Get the number of meshes in this Model.
   int numMeshes() const;
 };
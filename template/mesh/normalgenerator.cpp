@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../parallel/threadpool.h"
+
+#include "normalgenerator.h"
+
+namespace mesh {
+
+using glm::vec3;
+
+const float NormalGenerator::NO_CREASE = 180.0f;
+
+namespace {
+
+const float PI = 3.14159265f;
+
+// acos with an error under 7e-5 radians (Abramowitz and Stegun 4.4.45), it
+// is only used as a weight
+float acosApprox(float x) {
+  float a = std::fabs(x);
+  float r = std::sqrt(1.0f - a) * (1.5707288f + a * (-0.2121144f + a * (0.0742610f -
+      0.0187293f * a)));
+  return x < 0.0f ? PI - r : r;
+}
+
+// Cosine of the angle between two edges of lengths la and lb (one if degenerated)
+float cornerCosine(float dot, float la, float lb) {
+  float lengths = la * lb;
+  return lengths > 0.0f ? glm::clamp(dot / lengths, -1.0f, 1.0f) : 1.0f;
+}
+
+// Normal (its length is twice the area) and the angles at the corners of a triangle
+void faceValues(const Vertex* vertices, const unsigned int* triangle, vec3& normal,
+    float* angles) {
+  const vec3& p0 = vertices[triangle[0]].position;
+  const vec3& p1 = vertices[triangle[1]].position;
+  const vec3& p2 = vertices[triangle[2]].position;
+  vec3 e01 = p1 - p0;
+  vec3 e02 = p2 - p0;
+  vec3 e12 = p2 - p1;
+  normal = glm::cross(e01, e02);
+  float l01 = std::sqrt(glm::dot(e01, e01));
+  float l02 = std::sqrt(glm::dot(e02, e02));
+  float l12 = std::sqrt(glm::dot(e12, e12));
+  angles[0] = acosApprox(cornerCosine(glm::dot(e01, e02), l01, l02));
+  angles[1] = acosApprox(cornerCosine(-glm::dot(e01, e12), l01, l12));
+  angles[2] = acosApprox(cornerCosine(glm::dot(e02, e12), l02, l12));
+}
+
+#if defined(__SSE2__)
+__m128 select(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+__m128 acosApprox(__m128 x) {
+  const __m128 zero = _mm_setzero_ps();
+  __m128 a = _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+  __m128 polynomial = _mm_add_ps(_mm_set1_ps(0.0742610f), _mm_mul_ps(_mm_set1_ps(-0.0187293f), a));
+  polynomial = _mm_add_ps(_mm_set1_ps(-0.2121144f), _mm_mul_ps(a, polynomial));
+  polynomial = _mm_add_ps(_mm_set1_ps(1.5707288f), _mm_mul_ps(a, polynomial));
+  __m128 r = _mm_mul_ps(_mm_sqrt_ps(_mm_sub_ps(_mm_set1_ps(1.0f), a)), polynomial);
+  return select(_mm_cmplt_ps(x, zero), _mm_sub_ps(_mm_set1_ps(PI), r), r);
+}
+
+__m128 cornerCosine(__m128 dot, __m128 la, __m128 lb) {
+  __m128 lengths = _mm_mul_ps(la, lb);
+  __m128 valid = _mm_cmpgt_ps(lengths, _mm_setzero_ps());
+  __m128 cosine = _mm_div_ps(dot, select(valid, lengths, _mm_set1_ps(1.0f)));
+  cosine = _mm_min_ps(_mm_max_ps(cosine, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+  return select(valid, cosine, _mm_set1_ps(1.0f));
+}
+
+__m128 dot3(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+  return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+// Same as faceValues for four triangles, with the positions in structure of arrays
+void faceValues4(const Vertex* vertices, const unsigned int* triangles, vec3* normals,
+    float* angles) {
+  __m128 x[3], y[3], z[3];
+  for (int c = 0; c < 3; ++c) {
+    const vec3& a = vertices[triangles[c]].position;
+    const vec3& b = vertices[triangles[3 + c]].position;
+    const vec3& d = vertices[triangles[6 + c]].position;
+    const vec3& e = vertices[triangles[9 + c]].position;
+    x[c] = _mm_setr_ps(a.x, b.x, d.x, e.x);
+    y[c] = _mm_setr_ps(a.y, b.y, d.y, e.y);
+    z[c] = _mm_setr_ps(a.z, b.z, d.z, e.z);
+  }
+  __m128 e01x = _mm_sub_ps(x[1], x[0]), e01y = _mm_sub_ps(y[1], y[0]), e01z = _mm_sub_ps(z[1], z[0]);
+  __m128 e02x = _mm_sub_ps(x[2], x[0]), e02y = _mm_sub_ps(y[2], y[0]), e02z = _mm_sub_ps(z[2], z[0]);
+  __m128 e12x = _mm_sub_ps(x[2], x[1]), e12y = _mm_sub_ps(y[2], y[1]), e12z = _mm_sub_ps(z[2], z[1]);
+  __m128 nx = _mm_sub_ps(_mm_mul_ps(e01y, e02z), _mm_mul_ps(e01z, e02y));
+  __m128 ny = _mm_sub_ps(_mm_mul_ps(e01z, e02x), _mm_mul_ps(e01x, e02z));
+  __m128 nz = _mm_sub_ps(_mm_mul_ps(e01x, e02y), _mm_mul_ps(e01y, e02x));
+  __m128 l01 = _mm_sqrt_ps(dot3(e01x, e01y, e01z, e01x, e01y, e01z));
+  __m128 l02 = _mm_sqrt_ps(dot3(e02x, e02y, e02z, e02x, e02y, e02z));
+  __m128 l12 = _mm_sqrt_ps(dot3(e12x, e12y, e12z, e12x, e12y, e12z));
+  __m128 a0 = acosApprox(cornerCosine(dot3(e01x, e01y, e01z, e02x, e02y, e02z), l01, l02));
+  __m128 a1 = acosApprox(cornerCosine(_mm_sub_ps(_mm_setzero_ps(),
+      dot3(e01x, e01y, e01z, e12x, e12y, e12z)), l01, l12));
+  __m128 a2 = acosApprox(cornerCosine(dot3(e02x, e02y, e02z, e12x, e12y, e12z), l02, l12));
+  float n[3][4], a[3][4];
+  _mm_storeu_ps(n[0], nx);
+  _mm_storeu_ps(n[1], ny);
+  _mm_storeu_ps(n[2], nz);
+  _mm_storeu_ps(a[0], a0);
+  _mm_storeu_ps(a[1], a1);
+  _mm_storeu_ps(a[2], a2);
+  for (int k = 0; k < 4; ++k) {
+    normals[k] = vec3(n[0][k], n[1][k], n[2][k]);
+    angles[3 * k] = a[0][k];
+    angles[3 * k + 1] = a[1][k];
+    angles[3 * k + 2] = a[2][k];
+  }
+}
+#endif
+
+} // namespace
+
+NormalGenerator::NormalGenerator(float creaseAngle) : mCreaseAngle(creaseAngle) {
+
+}
+
+float NormalGenerator::getCreaseAngle() const {
+  return mCreaseAngle;
+}
+
+size_t NormalGenerator::generate(std::vector<Vertex>& vertices,
+    std::vector<unsigned int>& indices) const {
+  const size_t n = vertices.size();
+  const size_t triangles = indices.size() / 3;
+  // First pass: the values of every triangle
+  std::vector<vec3> normals(triangles);
+  std::vector<float> angles(3 * triangles);
+  {
+    const Vertex* positions = vertices.data();
+    const unsigned int* corners = indices.data();
+    parallel::forEachRange(triangles, [&](size_t first, size_t last) {
+      size_t t = first;
+#if defined(__SSE2__)
+      for (; t + 4 <= last; t += 4) {
+        faceValues4(positions, corners + 3 * t, &normals[t], &angles[3 * t]);
+      }
+#endif
+      for (; t < last; ++t) {
+        faceValues(positions, corners + 3 * t, normals[t], &angles[3 * t]);
+      }
+    });
+  }
+  // The corners of vertex v are corners[offsets[v]] ... corners[offsets[v + 1] - 1]
+  std::vector<unsigned int> offsets(n + 1, 0);
+  std::vector<unsigned int> corners(3 * triangles);
+  for (size_t i = 0; i < 3 * triangles; ++i) {
+    offsets[indices[i] + 1]++;
+  }
+  for (size_t v = 0; v < n; ++v) {
+    offsets[v + 1] += offsets[v];
+  }
+  {
+    std::vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < 3 * triangles; ++i) {
+      corners[cursor[indices[i]]++] = static_cast<unsigned int>(i);
+    }
+  }
+  auto weighted = [&](unsigned int corner) {
+    return normals[corner / 3] * angles[corner];
+  };
+  // Second pass: every vertex adds its corners, nobody else writes its normal
+  if (mCreaseAngle >= NO_CREASE) {
+    parallel::forEachRange(n, [&](size_t first, size_t last) {
+      for (size_t v = first; v < last; ++v) {
+        if (offsets[v] == offsets[v + 1]) {
+          continue;
+        }
+        vec3 sum(0.0f);
+        for (unsigned int k = offsets[v]; k < offsets[v + 1]; ++k) {
+          sum += weighted(corners[k]);
+        }
+        vertices[v].normal = glm::length2(sum) > 0.0f ? glm::normalize(sum) : vec3(0.0f);
+      }
+    });
+    return 0;
+  }
+  // With a crease angle every corner only adds the triangles close to its own
+  // normal. The corners with the same sum share a vertex
+  const float creaseCosine = std::cos(glm::radians(mCreaseAngle));
+  std::vector<vec3> units(triangles);
+  parallel::forEachRange(triangles, [&](size_t first, size_t last) {
+    for (size_t t = first; t < last; ++t) {
+      units[t] = glm::length2(normals[t]) > 0.0f ? glm::normalize(normals[t]) : vec3(0.0f);
+    }
+  });
+  // Sums of the corners of v (sums) and the distinct ones (groups[k] is the group of corner k)
+  auto smooth = [&](size_t v, std::vector<vec3>& sums, std::vector<unsigned int>& groups,
+      std::vector<vec3>& distinct) {
+    sums.clear();
+    groups.clear();
+    distinct.clear();
+    for (unsigned int k = offsets[v]; k < offsets[v + 1]; ++k) {
+      const vec3& unit = units[corners[k] / 3];
+      vec3 sum(0.0f);
+      for (unsigned int j = offsets[v]; j < offsets[v + 1]; ++j) {
+        // Degenerated triangles (no normal) are smoothed with everything
+        const vec3& other = units[corners[j] / 3];
+        if (glm::dot(unit, other) >= creaseCosine || glm::length2(unit) == 0.0f ||
+            glm::length2(other) == 0.0f) {
+          sum += weighted(corners[j]);
+        }
+      }
+      size_t group = std::find(distinct.begin(), distinct.end(), sum) - distinct.begin();
+      if (group == distinct.size()) {
+        distinct.push_back(sum);
+      }
+      sums.push_back(sum);
+      groups.push_back(static_cast<unsigned int>(group));
+    }
+  };
+  std::vector<unsigned int> added(n + 1, 0);
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    std::vector<vec3> sums;
+    std::vector<vec3> distinct;
+    std::vector<unsigned int> groups;
+    for (size_t v = first; v < last; ++v) {
+      smooth(v, sums, groups, distinct);
+      added[v + 1] = distinct.empty() ? 0 : static_cast<unsigned int>(distinct.size() - 1);
+    }
+  });
+  for (size_t v = 0; v < n; ++v) {
+    added[v + 1] += added[v];
+  }
+  vertices.resize(n + added[n]);
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    std::vector<vec3> sums;
+    std::vector<vec3> distinct;
+    std::vector<unsigned int> groups;
+    for (size_t v = first; v < last; ++v) {
+      smooth(v, sums, groups, distinct);
+      for (size_t g = 0; g < distinct.size(); ++g) {
+        // The first group keeps the vertex, the others go to its copies
+        size_t target = g == 0 ? v : n + added[v] + g - 1;
+        vertices[target] = vertices[v];
+        const vec3& sum = distinct[g];
+        vertices[target].normal = glm::length2(sum) > 0.0f ? glm::normalize(sum) : vec3(0.0f);
+      }
+      for (unsigned int k = offsets[v]; k < offsets[v + 1]; ++k) {
+        if (groups[k - offsets[v]] > 0) {
+          indices[corners[k]] = static_cast<unsigned int>(n + added[v] + groups[k - offsets[v]] - 1);
+        }
+      }
+    }
+  });
+  return added[n];
+}
+
+} // namespace mesh
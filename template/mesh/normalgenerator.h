@@ -0,0 +1,49 @@
+#ifndef MESH_NORMAL_GENERATOR_H_
+#define MESH_NORMAL_GENERATOR_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "mesh.h"
+
+namespace mesh {
+
+//! Computes smooth vertex normals from the triangles of an indexed mesh
+/*!
+  The normal of a vertex is the sum of the normals of the triangles around
+  it, weighted by the area of the triangle and by its angle at the vertex
+  (so the result does not depend on how a surface is triangulated).
+
+  It works in two parallel passes without atomics: first every triangle
+  computes its normal and the angles at its corners (four triangles at a time
+  with SSE), then every vertex adds the values of its corners, found with a
+  vertex to corner adjacency.
+
+  With a crease angle, the triangles around a vertex are only smoothed with
+  the ones whose normal is within that angle. A vertex that ends up with
+  several normals (a hard edge) is split, the copies are added at the end.
+*/
+class NormalGenerator {
+public:
+  //! Crease angle that smooths everything (no vertex is split)
+  static const float NO_CREASE;
+  //! Creates a generator with the given crease angle (in degrees)
+  explicit NormalGenerator(float creaseAngle = NO_CREASE);
+  //! Compute the normal of every vertex used by the triangles
+  /*!
+    @param vertices the positions are read, the normals are written. Split
+    vertices are added at the end
+    @param indices three per triangle, the corners of split vertices are updated
+    @return the number of vertices added by the crease angle
+  */
+  size_t generate(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) const;
+  //! Get the crease angle (in degrees)
+  float getCreaseAngle() const;
+
+private:
+  float mCreaseAngle;
+};
+
+} // namespace mesh
+
+#endif
@@ -0,0 +1,847 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <utility>
+
+#include "../parallel/threadpool.h"
+
+#include "mappedfile.h"
+#include "normalgenerator.h"
+#include "objreader.h"
+
+namespace mesh {
+
+using glm::vec2;
+using glm::vec3;
+
+namespace {
+
+// Minimum bytes of the file parsed by a chunk
+const size_t CHUNK_BYTES = 1 << 20;
+// Minimum corners of a separator welded by a bucket
+const size_t WELD_GRAIN = 65536;
+// Index of an attribute that a corner does not have
+const int MISSING = -1;
+enum Attribute {POSITION = 0, TEXT_COORDS = 1, NORMAL = 2};
+
+// A corner of a face: indices of its position, texture coordinates and normal
+struct Corner {
+  int index[3];
+  // Bit k is set while index[k] is relative to the start of its chunk (negative in the file)
+  int relative;
+};
+
+bool operator==(const Corner& a, const Corner& b) {
+  return a.index[0] == b.index[0] && a.index[1] == b.index[1] && a.index[2] == b.index[2];
+}
+
+// Something in the file that changes the state for the next faces
+enum EventKind {GROUP, MATERIAL, LIBRARY};
+struct Event {
+  // Number of faces of the chunk before the event
+  size_t face;
+  EventKind kind;
+  std::string name;
+};
+
+// The part of the file parsed by one task
+struct Chunk {
+  const char* begin;
+  const char* end;
+  std::vector<vec3> positions;
+  std::vector<vec2> textCoords;
+  std::vector<vec3> normals;
+  std::vector<Corner> corners;
+  // First corner of every face
+  std::vector<unsigned int> faces;
+  std::vector<Event> events;
+  std::string error;
+  // Attributes in the previous chunks
+  size_t offsets[3];
+};
+
+// Consecutive faces of a chunk that go to the same separator
+struct Run {
+  size_t chunk;
+  size_t firstFace;
+  size_t lastFace;
+  size_t mesh;
+  // Place of its triangulated corners, and their number
+  size_t firstCorner;
+  size_t corners;
+  // Limits of its positions and if every corner has normal and texture coordinates
+  int lowest;
+  int highest;
+  bool normals;
+  bool textCoords;
+};
+
+// A separator in the making: group and material, and the range of its corners
+struct ObjMesh {
+  std::string material;
+  size_t firstCorner;
+  size_t corners;
+  int lowest;
+  int highest;
+  bool normals;
+  bool textCoords;
+  size_t buckets;
+  size_t firstJob;
+};
+
+// The corners of a separator whose position falls in a range, welded by one task. The same
+// task first sorts one slice of the corners of the separator by their bucket
+struct WeldJob {
+  size_t mesh;
+  size_t bucket;
+  std::vector<Corner> unique;
+  size_t firstVertex;
+  // Its corners in the sorted ones: [firstSorted, lastSorted)
+  size_t firstSorted;
+  size_t lastSorted;
+  // Corners of its slice in every bucket, then where they go in the sorted ones
+  std::vector<size_t> positions;
+};
+
+struct Material {
+  std::string diffuse;
+  std::string specular;
+  std::string normal;
+};
+
+const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+bool isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+const char* skipBlanks(const char* p, const char* end) {
+  while (p < end && isBlank(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+// The rest of the line without the blanks around it
+std::string restOfLine(const char* p, const char* end) {
+  p = skipBlanks(p, end);
+  while (end > p && isBlank(end[-1])) {
+    --end;
+  }
+  return std::string(p, end);
+}
+
+// The last word of the line (the options of the MTL maps go before the file)
+std::string lastWord(const char* p, const char* end) {
+  while (end > p && isBlank(end[-1])) {
+    --end;
+  }
+  const char* start = end;
+  while (start > p && !isBlank(start[-1])) {
+    --start;
+  }
+  return std::string(start, end);
+}
+
+// Decimal floats as written by the exporters: [sign] digits [. digits] [e [sign] digits]
+// The digits are accumulated in an integer and scaled once (correct to the last bit
+// of a float for up to 19 significant digits)
+bool parseFloat(const char*& p, const char* end, float& value) {
+  const char* q = skipBlanks(p, end);
+  bool negative = false;
+  if (q < end && (*q == '-' || *q == '+')) {
+    negative = *q == '-';
+    ++q;
+  }
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+  for (; q < end && isDigit(*q); ++q) {
+    any = true;
+    if (digits < 19) {
+      mantissa = mantissa * 10 + static_cast<uint64_t>(*q - '0');
+      digits += mantissa != 0;
+    } else {
+      ++exponent;
+    }
+  }
+  if (q < end && *q == '.') {
+    for (++q; q < end && isDigit(*q); ++q) {
+      any = true;
+      if (digits < 19) {
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*q - '0');
+        digits += mantissa != 0;
+        --exponent;
+      }
+    }
+  }
+  if (!any) {
+    return false;
+  }
+  if (q < end && (*q == 'e' || *q == 'E')) {
+    const char* e = q + 1;
+    bool negativeExponent = false;
+    if (e < end && (*e == '-' || *e == '+')) {
+      negativeExponent = *e == '-';
+      ++e;
+    }
+    if (e < end && isDigit(*e)) {
+      int written = 0;
+      for (; e < end && isDigit(*e); ++e) {
+        written = std::min(written * 10 + (*e - '0'), 10000);
+      }
+      exponent += negativeExponent ? -written : written;
+      q = e;
+    }
+  }
+  double result = static_cast<double>(mantissa);
+  if (exponent < -22 || exponent > 22) {
+    result *= std::pow(10.0, exponent);
+  } else if (exponent < 0) {
+    result /= POWERS_OF_TEN[-exponent];
+  } else {
+    result *= POWERS_OF_TEN[exponent];
+  }
+  value = static_cast<float>(negative ? -result : result);
+  p = q;
+  return true;
+}
+
+bool parseInt(const char*& p, const char* end, int& value) {
+  const char* q = p;
+  bool negative = false;
+  if (q < end && (*q == '-' || *q == '+')) {
+    negative = *q == '-';
+    ++q;
+  }
+  if (q == end || !isDigit(*q)) {
+    return false;
+  }
+  long long result = 0;
+  for (; q < end && isDigit(*q); ++q) {
+    result = result * 10 + (*q - '0');
+    if (result > 0x7FFFFFFF) {
+      return false;
+    }
+  }
+  value = static_cast<int>(negative ? -result : result);
+  p = q;
+  return true;
+}
+
+// One face: position[/[textCoords][/normal]] for every corner
+bool parseFace(Chunk& chunk, const char* p, const char* end) {
+  const size_t counts[3] = {chunk.positions.size(), chunk.textCoords.size(),
+      chunk.normals.size()};
+  size_t first = chunk.corners.size();
+  for (p = skipBlanks(p, end); p < end; p = skipBlanks(p, end)) {
+    Corner corner = {{MISSING, MISSING, MISSING}, 0};
+    for (int k = 0; k < 3; ++k) {
+      // The position is required, the others can be empty (v//vn) or absent (v)
+      if (k > 0) {
+        if (p == end || *p != '/') {
+          break;
+        }
+        ++p;
+        if (p < end && *p == '/') {
+          continue;
+        }
+      }
+      int written;
+      if (!parseInt(p, end, written) || written == 0) {
+        return false;
+      }
+      if (written > 0) {
+        corner.index[k] = written - 1;
+      } else {
+        corner.index[k] = static_cast<int>(counts[k]) + written;
+        corner.relative |= 1 << k;
+      }
+    }
+    if (p < end && !isBlank(*p)) {
+      return false;
+    }
+    chunk.corners.push_back(corner);
+  }
+  if (chunk.corners.size() - first < 3) {
+    return false;
+  }
+  chunk.faces.push_back(static_cast<unsigned int>(first));
+  return true;
+}
+
+bool parseLine(Chunk& chunk, const char* p, const char* end) {
+  p = skipBlanks(p, end);
+  if (p == end || *p == '#') {
+    return true;
+  }
+  const char* word = p;
+  while (p < end && !isBlank(*p)) {
+    ++p;
+  }
+  const size_t length = static_cast<size_t>(p - word);
+  auto is = [&](const char* keyword) {
+    return std::strlen(keyword) == length && std::memcmp(word, keyword, length) == 0;
+  };
+  if (is("v")) {
+    // Extra values (w or a color) are ignored
+    vec3 v;
+    if (!parseFloat(p, end, v.x) || !parseFloat(p, end, v.y) || !parseFloat(p, end, v.z)) {
+      return false;
+    }
+    chunk.positions.push_back(v);
+  } else if (is("vt")) {
+    vec2 t(0.0f);
+    if (!parseFloat(p, end, t.x)) {
+      return false;
+    }
+    parseFloat(p, end, t.y);
+    chunk.textCoords.push_back(t);
+  } else if (is("vn")) {
+    vec3 n;
+    if (!parseFloat(p, end, n.x) || !parseFloat(p, end, n.y) || !parseFloat(p, end, n.z)) {
+      return false;
+    }
+    chunk.normals.push_back(n);
+  } else if (is("f")) {
+    return parseFace(chunk, p, end);
+  } else if (is("o") || is("g")) {
+    Event event = {chunk.faces.size(), GROUP, restOfLine(p, end)};
+    chunk.events.push_back(event);
+  } else if (is("usemtl")) {
+    Event event = {chunk.faces.size(), MATERIAL, restOfLine(p, end)};
+    chunk.events.push_back(event);
+  } else if (is("mtllib")) {
+    Event event = {chunk.faces.size(), LIBRARY, restOfLine(p, end)};
+    chunk.events.push_back(event);
+  }
+  // Anything else (s, l, p, free form geometry...) is not needed
+  return true;
+}
+
+void parseChunk(Chunk& chunk) {
+  for (const char* p = chunk.begin; p < chunk.end;) {
+    const char* line = static_cast<const char*>(std::memchr(p, '\n', chunk.end - p));
+    const char* end = line ? line : chunk.end;
+    if (!parseLine(chunk, p, end)) {
+      chunk.error = "Could not parse the line: " + restOfLine(p, std::min(end, p + 80));
+      return;
+    }
+    p = end + 1;
+  }
+}
+
+// The diffuse, specular and normal maps of every material of a MTL file
+void readMaterials(const std::string& fileName, std::map<std::string, Material>& materials) {
+  size_t size = 0;
+  const unsigned char* data = mapFile(fileName, size);
+  if (!data) {
+    return;
+  }
+  const char* p = reinterpret_cast<const char*>(data);
+  const char* fileEnd = p + size;
+  Material* current = nullptr;
+  while (p < fileEnd) {
+    const char* line = static_cast<const char*>(std::memchr(p, '\n', fileEnd - p));
+    const char* end = line ? line : fileEnd;
+    const char* word = skipBlanks(p, end);
+    const char* q = word;
+    while (q < end && !isBlank(*q)) {
+      ++q;
+    }
+    std::string keyword(word, q);
+    if (keyword == "newmtl") {
+      current = &materials[restOfLine(q, end)];
+    } else if (current && keyword == "map_Kd") {
+      current->diffuse = lastWord(q, end);
+    } else if (current && keyword == "map_Ks") {
+      current->specular = lastWord(q, end);
+    } else if (current && (keyword == "norm" || keyword == "map_Kn")) {
+      // bump and map_Bump are height maps, sampling them as normals would break the shading
+      current->normal = lastWord(q, end);
+    }
+    p = end + 1;
+  }
+  unmapFile(data, size);
+}
+
+size_t hashCorner(const Corner& c) {
+  uint64_t h = static_cast<uint32_t>(c.index[0]) * 0x9e3779b97f4a7c15ull;
+  h ^= static_cast<uint32_t>(c.index[1]) * 0xc2b2ae3d27d4eb4full;
+  h ^= static_cast<uint32_t>(c.index[2]) * 0x165667b19e3779f9ull;
+  return static_cast<size_t>(h ^ (h >> 31));
+}
+
+} // namespace
+
+ObjReader::ObjReader() : mHasTexture(false) {
+
+}
+
+bool ObjReader::handles(const std::string& fileName) {
+  if (fileName.size() < 4) {
+    return false;
+  }
+  std::string extension = fileName.substr(fileName.size() - 4);
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  return extension == ".obj";
+}
+
+std::vector<std::string> ObjReader::materialLibraries(const std::string& fileName) {
+  std::vector<std::string> libraries;
+  size_t size = 0;
+  const unsigned char* data = mapFile(fileName, size);
+  if (!data) {
+    return libraries;
+  }
+  const std::string folder = fileName.substr(0, fileName.find_last_of("/\\") + 1);
+  const char* p = reinterpret_cast<const char*>(data);
+  const char* fileEnd = p + size;
+  const size_t LENGTH = 6;
+  while (p < fileEnd) {
+    const char* line = static_cast<const char*>(std::memchr(p, '\n', fileEnd - p));
+    const char* end = line ? line : fileEnd;
+    const char* word = skipBlanks(p, end);
+    if (static_cast<size_t>(end - word) > LENGTH && std::memcmp(word, "mtllib", LENGTH) == 0 &&
+        isBlank(word[LENGTH])) {
+      // The same names and order as read
+      const std::string path = folder + restOfLine(word + LENGTH, end);
+      if (std::find(libraries.begin(), libraries.end(), path) == libraries.end()) {
+        libraries.push_back(path);
+      }
+    }
+    p = end + 1;
+  }
+  unmapFile(data, size);
+  return libraries;
+}
+
+bool ObjReader::read(const std::string& fileName) {
+  mError.clear();
+  mHasTexture = false;
+  mVertices.clear();
+  mIndices.clear();
+  mSeparators.clear();
+  mTextures.clear();
+  size_t size = 0;
+  const unsigned char* data = mapFile(fileName, size);
+  if (!data) {
+    return fail("Could not read " + fileName);
+  }
+  /* Parse chunks that start and end at a line break, in parallel */
+  const char* text = reinterpret_cast<const char*>(data);
+  std::vector<Chunk> chunks(parallel::chunksFor(size, CHUNK_BYTES));
+  const char* start = text;
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    const char* end = text + (c + 1) * size / chunks.size();
+    if (c + 1 < chunks.size()) {
+      end = std::max(end, start);
+      const char* line = static_cast<const char*>(std::memchr(end, '\n', text + size - end));
+      end = line ? line + 1 : text + size;
+    }
+    chunks[c].begin = start;
+    chunks[c].end = end;
+    start = end;
+  }
+  parallel::forEachRange(chunks.size(), [&](size_t first, size_t last) {
+    for (size_t c = first; c < last; ++c) {
+      parseChunk(chunks[c]);
+    }
+  }, 1);
+  unmapFile(data, size);
+  for (const Chunk& chunk : chunks) {
+    if (!chunk.error.empty()) {
+      return fail(chunk.error);
+    }
+  }
+  /* Resolve the indices of the faces against the attributes of the previous chunks */
+  size_t totals[3] = {0, 0, 0};
+  for (Chunk& chunk : chunks) {
+    const size_t counts[3] = {chunk.positions.size(), chunk.textCoords.size(),
+        chunk.normals.size()};
+    for (int k = 0; k < 3; ++k) {
+      chunk.offsets[k] = totals[k];
+      totals[k] += counts[k];
+    }
+  }
+  if (totals[POSITION] > 0x7FFFFFFF || totals[TEXT_COORDS] > 0x7FFFFFFF ||
+      totals[NORMAL] > 0x7FFFFFFF) {
+    return fail("Too many vertices");
+  }
+  std::vector<char> valid(chunks.size(), 1);
+  parallel::forEachRange(chunks.size(), [&](size_t first, size_t last) {
+    for (size_t c = first; c < last; ++c) {
+      Chunk& chunk = chunks[c];
+      for (Corner& corner : chunk.corners) {
+        for (int k = 0; k < 3; ++k) {
+          if (corner.relative & (1 << k)) {
+            corner.index[k] += static_cast<int>(chunk.offsets[k]);
+          }
+          if (corner.index[k] >= static_cast<int>(totals[k]) ||
+              (corner.index[k] < 0 && (k == POSITION || (corner.relative & (1 << k))))) {
+            valid[c] = 0;
+          }
+        }
+        corner.relative = 0;
+      }
+      // One more to know where the last face ends
+      chunk.faces.push_back(static_cast<unsigned int>(chunk.corners.size()));
+    }
+  }, 1);
+  if (std::find(valid.begin(), valid.end(), 0) != valid.end()) {
+    return fail("A face uses a vertex that does not exist");
+  }
+  /* Split the faces in runs of the same group and material, one separator for each pair */
+  std::vector<ObjMesh> meshes;
+  std::vector<Run> runs;
+  std::vector<std::string> libraries;
+  {
+    std::map<std::pair<std::string, std::string>, size_t> meshOf;
+    std::string group;
+    std::string material;
+    auto addRun = [&](size_t chunk, size_t firstFace, size_t lastFace) {
+      if (lastFace == firstFace) {
+        return;
+      }
+      auto found = meshOf.insert(std::make_pair(std::make_pair(group, material), meshes.size()));
+      if (found.second) {
+        ObjMesh mesh = {material, 0, 0, 0, 0, true, true, 1, 0};
+        meshes.push_back(mesh);
+      }
+      Run run = {chunk, firstFace, lastFace, found.first->second, 0, 0, 0, 0, true, true};
+      runs.push_back(run);
+    };
+    for (size_t c = 0; c < chunks.size(); ++c) {
+      size_t face = 0;
+      for (const Event& event : chunks[c].events) {
+        addRun(c, face, event.face);
+        face = event.face;
+        if (event.kind == GROUP) {
+          group = event.name;
+        } else if (event.kind == MATERIAL) {
+          material = event.name;
+        } else if (std::find(libraries.begin(), libraries.end(), event.name) == libraries.end()) {
+          libraries.push_back(event.name);
+        }
+      }
+      addRun(c, face, chunks[c].faces.size() - 1);
+    }
+  }
+  if (runs.empty()) {
+    return fail("There are no faces");
+  }
+  /* Triangulate every run (as a fan) into the corners of its separator */
+  parallel::forEachRange(runs.size(), [&](size_t first, size_t last) {
+    for (size_t r = first; r < last; ++r) {
+      Run& run = runs[r];
+      const std::vector<unsigned int>& faces = chunks[run.chunk].faces;
+      run.corners = 3 * (faces[run.lastFace] - faces[run.firstFace] -
+          2 * (run.lastFace - run.firstFace));
+    }
+  }, 16);
+  std::vector<std::vector<size_t> > runsOf(meshes.size());
+  for (size_t r = 0; r < runs.size(); ++r) {
+    runsOf[runs[r].mesh].push_back(r);
+  }
+  size_t totalCorners = 0;
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    meshes[m].firstCorner = totalCorners;
+    for (size_t r : runsOf[m]) {
+      runs[r].firstCorner = totalCorners;
+      totalCorners += runs[r].corners;
+    }
+    meshes[m].corners = totalCorners - meshes[m].firstCorner;
+  }
+  if (totalCorners > 0xFFFFFFFFu) {
+    return fail("Too many faces");
+  }
+  std::vector<Corner> corners(totalCorners);
+  parallel::forEachRange(runs.size(), [&](size_t first, size_t last) {
+    for (size_t r = first; r < last; ++r) {
+      Run& run = runs[r];
+      const Chunk& chunk = chunks[run.chunk];
+      Corner* out = corners.data() + run.firstCorner;
+      run.lowest = 0x7FFFFFFF;
+      run.highest = -1;
+      for (size_t f = run.firstFace; f < run.lastFace; ++f) {
+        const Corner* face = chunk.corners.data() + chunk.faces[f];
+        const size_t n = chunk.faces[f + 1] - chunk.faces[f];
+        for (size_t k = 0; k < n; ++k) {
+          run.lowest = std::min(run.lowest, face[k].index[POSITION]);
+          run.highest = std::max(run.highest, face[k].index[POSITION]);
+          run.textCoords = run.textCoords && face[k].index[TEXT_COORDS] != MISSING;
+          run.normals = run.normals && face[k].index[NORMAL] != MISSING;
+        }
+        for (size_t k = 1; k + 1 < n; ++k) {
+          *out++ = face[0];
+          *out++ = face[k];
+          *out++ = face[k + 1];
+        }
+      }
+    }
+  }, 1);
+  // The attributes of all the chunks together
+  std::vector<vec3> positions(totals[POSITION]);
+  std::vector<vec2> textCoords(totals[TEXT_COORDS]);
+  std::vector<vec3> normals(totals[NORMAL]);
+  parallel::forEachRange(chunks.size(), [&](size_t first, size_t last) {
+    for (size_t c = first; c < last; ++c) {
+      Chunk& chunk = chunks[c];
+      std::copy(chunk.positions.begin(), chunk.positions.end(),
+          positions.begin() + chunk.offsets[POSITION]);
+      std::copy(chunk.textCoords.begin(), chunk.textCoords.end(),
+          textCoords.begin() + chunk.offsets[TEXT_COORDS]);
+      std::copy(chunk.normals.begin(), chunk.normals.end(),
+          normals.begin() + chunk.offsets[NORMAL]);
+      // Not needed anymore
+      chunk = Chunk();
+    }
+  }, 1);
+  /* Weld the corners of every separator. Big ones are split in buckets by their position,
+     a position only goes to one bucket, so the buckets never share a vertex */
+  std::vector<WeldJob> jobs;
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    ObjMesh& mesh = meshes[m];
+    mesh.lowest = 0x7FFFFFFF;
+    mesh.highest = -1;
+    for (size_t r : runsOf[m]) {
+      const Run& run = runs[r];
+      mesh.lowest = std::min(mesh.lowest, run.lowest);
+      mesh.highest = std::max(mesh.highest, run.highest);
+      mesh.textCoords = mesh.textCoords && run.textCoords;
+      mesh.normals = mesh.normals && run.normals;
+    }
+    mesh.buckets = std::min(parallel::chunksFor(mesh.corners, WELD_GRAIN),
+        static_cast<size_t>(mesh.highest - mesh.lowest + 1));
+    mesh.firstJob = jobs.size();
+    for (size_t b = 0; b < mesh.buckets; ++b) {
+      WeldJob job = {m, b, std::vector<Corner>(), 0, 0, 0, std::vector<size_t>(mesh.buckets, 0)};
+      jobs.push_back(job);
+    }
+  }
+  auto bucketOf = [&](const ObjMesh& mesh, const Corner& corner) {
+    return static_cast<size_t>(corner.index[POSITION] - mesh.lowest) * mesh.buckets /
+        static_cast<size_t>(mesh.highest - mesh.lowest + 1);
+  };
+  // The slice of the corners of its separator that a job sorts
+  auto sliceOf = [&](const WeldJob& job, size_t& begin, size_t& end) {
+    const ObjMesh& mesh = meshes[job.mesh];
+    begin = mesh.firstCorner + job.bucket * mesh.corners / mesh.buckets;
+    end = mesh.firstCorner + (job.bucket + 1) * mesh.corners / mesh.buckets;
+  };
+  // Sort the corners of every separator by bucket (a counting sort that keeps their order), so
+  // every job only reads its own corners: count every slice, place the buckets and scatter
+  parallel::forEachRange(jobs.size(), [&](size_t first, size_t last) {
+    for (size_t j = first; j < last; ++j) {
+      WeldJob& job = jobs[j];
+      size_t begin;
+      size_t end;
+      sliceOf(job, begin, end);
+      for (size_t c = begin; c < end; ++c) {
+        ++job.positions[bucketOf(meshes[job.mesh], corners[c])];
+      }
+    }
+  }, 1);
+  for (const ObjMesh& mesh : meshes) {
+    size_t position = mesh.firstCorner;
+    for (size_t b = 0; b < mesh.buckets; ++b) {
+      jobs[mesh.firstJob + b].firstSorted = position;
+      for (size_t slice = 0; slice < mesh.buckets; ++slice) {
+        size_t& count = jobs[mesh.firstJob + slice].positions[b];
+        const size_t start = position;
+        position += count;
+        count = start;
+      }
+      jobs[mesh.firstJob + b].lastSorted = position;
+    }
+  }
+  std::vector<unsigned int> sorted(totalCorners);
+  parallel::forEachRange(jobs.size(), [&](size_t first, size_t last) {
+    for (size_t j = first; j < last; ++j) {
+      WeldJob& job = jobs[j];
+      size_t begin;
+      size_t end;
+      sliceOf(job, begin, end);
+      for (size_t c = begin; c < end; ++c) {
+        sorted[job.positions[bucketOf(meshes[job.mesh], corners[c])]++] =
+            static_cast<unsigned int>(c);
+      }
+    }
+  }, 1);
+  // The vertex of every corner, relative to the first one of its job
+  std::vector<unsigned int> local(totalCorners);
+  parallel::forEachRange(jobs.size(), [&](size_t first, size_t last) {
+    for (size_t j = first; j < last; ++j) {
+      WeldJob& job = jobs[j];
+      // Open addressing, at most half full
+      size_t capacity = 16;
+      while (capacity < 2 * (job.lastSorted - job.firstSorted)) {
+        capacity *= 2;
+      }
+      std::vector<unsigned int> table(capacity, 0xFFFFFFFFu);
+      const size_t mask = capacity - 1;
+      for (size_t k = job.firstSorted; k < job.lastSorted; ++k) {
+        const size_t c = sorted[k];
+        const Corner& corner = corners[c];
+        size_t slot = hashCorner(corner) & mask;
+        while (table[slot] != 0xFFFFFFFFu && !(job.unique[table[slot]] == corner)) {
+          slot = (slot + 1) & mask;
+        }
+        if (table[slot] == 0xFFFFFFFFu) {
+          table[slot] = static_cast<unsigned int>(job.unique.size());
+          job.unique.push_back(corner);
+        }
+        local[c] = table[slot];
+      }
+    }
+  }, 1);
+  /* Place the vertices of every job and write the vertices and indices */
+  size_t totalVertices = 0;
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    const ObjMesh& mesh = meshes[m];
+    MeshData separator;
+    separator.startVertex = static_cast<GLint>(totalVertices);
+    separator.startIndex = static_cast<GLint>(mesh.firstCorner);
+    separator.howMany = static_cast<GLsizei>(mesh.corners);
+    separator.diffuseIndex = -1;
+    separator.specIndex = -1;
+    separator.normalIndex = -1;
+    separator.indexType = GL_UNSIGNED_INT;
+    separator.indexOffset = separator.startIndex * sizeof(unsigned int);
+    mSeparators.push_back(separator);
+    for (size_t j = mesh.firstJob; j < mesh.firstJob + mesh.buckets; ++j) {
+      jobs[j].firstVertex = totalVertices - separator.startVertex;
+      totalVertices += jobs[j].unique.size();
+    }
+  }
+  if (totalVertices > 0x7FFFFFFF) {
+    return fail("Too many vertices");
+  }
+  mVertices.resize(totalVertices);
+  mIndices.resize(totalCorners);
+  parallel::forEachRange(jobs.size(), [&](size_t first, size_t last) {
+    for (size_t j = first; j < last; ++j) {
+      const WeldJob& job = jobs[j];
+      const MeshData& separator = mSeparators[job.mesh];
+      Vertex* vertices = mVertices.data() + separator.startVertex + job.firstVertex;
+      for (const Corner& corner : job.unique) {
+        Vertex& v = *vertices++;
+        v.position = positions[corner.index[POSITION]];
+        v.textCoords = corner.index[TEXT_COORDS] != MISSING ? textCoords[corner.index[TEXT_COORDS]] :
+            vec2(0.0f);
+        v.normal = corner.index[NORMAL] != MISSING ? normals[corner.index[NORMAL]] : vec3(0.0f);
+      }
+      // The indices are relative to the first vertex of the separator
+      for (size_t k = job.firstSorted; k < job.lastSorted; ++k) {
+        mIndices[sorted[k]] = static_cast<unsigned int>(job.firstVertex + local[sorted[k]]);
+      }
+    }
+  }, 1);
+  // Smooth normals for the separators that do not have them (as aiProcess_GenSmoothNormals)
+  std::vector<size_t> withoutNormals;
+  mHasTexture = true;
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    if (!meshes[m].normals) {
+      withoutNormals.push_back(m);
+    }
+    mHasTexture = mHasTexture && meshes[m].textCoords;
+  }
+  parallel::forEachRange(withoutNormals.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      // The vertices of a separator go up to the first one of the next
+      const size_t m = withoutNormals[i];
+      const MeshData& separator = mSeparators[m];
+      const size_t vertexCount = (m + 1 < mSeparators.size() ?
+          static_cast<size_t>(mSeparators[m + 1].startVertex) : mVertices.size()) -
+          static_cast<size_t>(separator.startVertex);
+      std::vector<Vertex> vertices(mVertices.begin() + separator.startVertex,
+          mVertices.begin() + separator.startVertex + vertexCount);
+      std::vector<unsigned int> indices(mIndices.begin() + separator.startIndex,
+          mIndices.begin() + separator.startIndex + separator.howMany);
+      NormalGenerator().generate(vertices, indices);
+      std::copy(vertices.begin(), vertices.end(), mVertices.begin() + separator.startVertex);
+    }
+  }, 1);
+  /* Textures of the materials, in the order the separators use them */
+  std::map<std::string, Material> materials;
+  std::string folder = fileName.substr(0, fileName.find_last_of("/\\") + 1);
+  for (const std::string& library : libraries) {
+    readMaterials(folder + library, materials);
+  }
+  std::map<std::string, int> textureOf;
+  auto addTexture = [&](const std::string& path, TextType type) {
+    if (path.empty()) {
+      return -1;
+    }
+    auto found = textureOf.insert(std::make_pair(path, static_cast<int>(mTextures.size())));
+    if (found.second) {
+      TextureImage texture;
+      texture.filePath = path;
+      texture.type = type;
+      mTextures.push_back(texture);
+    }
+    return found.first->second;
+  };
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    std::map<std::string, Material>::const_iterator material = materials.find(meshes[m].material);
+    if (meshes[m].material.empty() || material == materials.end()) {
+      continue;
+    }
+    mSeparators[m].diffuseIndex = addTexture(material->second.diffuse, DIFFUSE);
+    mSeparators[m].specIndex = addTexture(material->second.specular, SPECULAR);
+    mSeparators[m].normalIndex = addTexture(material->second.normal, NORMALS);
+  }
+  return true;
+}
+
+const std::string& ObjReader::error() const {
+  return mError;
+}
+
+bool ObjReader::hasTexture() const {
+  return mHasTexture;
+}
+
+std::vector<Vertex> ObjReader::releaseVertices() {
+  std::vector<Vertex> vertices;
+  vertices.swap(mVertices);
+  return vertices;
+}
+
+std::vector<unsigned int> ObjReader::releaseIndices() {
+  std::vector<unsigned int> indices;
+  indices.swap(mIndices);
+  return indices;
+}
+
+std::vector<MeshData> ObjReader::releaseSeparators() {
+  std::vector<MeshData> separators;
+  separators.swap(mSeparators);
+  return separators;
+}
+
+std::vector<TextureImage> ObjReader::releaseTextures() {
+  std::vector<TextureImage> textures;
+  textures.swap(mTextures);
+  return textures;
+}
+
+bool ObjReader::fail(const std::string& message) {
+  mError = message;
+  mVertices.clear();
+  mIndices.clear();
+  mSeparators.clear();
+  mTextures.clear();
+  return false;
+}
+
+} // namespace mesh
@@ -0,0 +1,70 @@
+#ifndef MESH_OBJ_READER_H_
+#define MESH_OBJ_READER_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "model.h"
+
+namespace mesh {
+
+//! Reads Wavefront OBJ files (and their MTL materials) without Assimp
+/*!
+  The result has the same layout as an Assimp import of a \class Model: one
+  separator per group and material (in order of appearance), triangulated
+  faces, welded vertices and the diffuse, specular and normal textures of the
+  materials (paths as written in the MTL file, normal maps only from norm or
+  map_Kn, the bump maps are height maps and are ignored).
+
+  The file is memory mapped and split in chunks that end at a line break,
+  every chunk is parsed in parallel (with a float parser that does not
+  touch the locale). Then the face indices (also the negative, relative
+  ones) are resolved against the counts of the previous chunks and the
+  corners are welded with hash tables, in parallel per separator and per
+  range of positions (a counting sort groups the corners by range first, so
+  every task only reads its own).
+
+  Meshes without normals get smooth ones (See \class NormalGenerator).
+  Anything the reader does not understand makes it fail, so the caller can
+  fall back to Assimp. Lines it does not need (smoothing groups, lines,
+  points, free form geometry) are ignored.
+*/
+class ObjReader {
+public:
+  ObjReader();
+  //! Queries if a file name has the OBJ extension (in any case)
+  static bool handles(const std::string& fileName);
+  //! The material libraries (MTL files) named by an OBJ file, with the folder of the file
+  /*!
+    Only the mtllib lines are read, so it is much faster than read.
+  */
+  static std::vector<std::string> materialLibraries(const std::string& fileName);
+  //! Clear and read a file
+  /*!
+    @return false if the file could not be read or parsed (See error)
+  */
+  bool read(const std::string& fileName);
+  //! Description of the last failure
+  const std::string& error() const;
+  //! Queries if the file has texture coordinates for every mesh
+  bool hasTexture() const;
+  //! Take the buffers, the reader is left empty
+  std::vector<Vertex> releaseVertices();
+  std::vector<unsigned int> releaseIndices();
+  std::vector<MeshData> releaseSeparators();
+  std::vector<TextureImage> releaseTextures();
+
+private:
+  bool fail(const std::string& message);
+  std::string mError;
+  bool mHasTexture;
+  std::vector<Vertex> mVertices;
+  std::vector<unsigned int> mIndices;
+  std::vector<MeshData> mSeparators;
+  std::vector<TextureImage> mTextures;
+};
+
+} // namespace mesh
+
+#endif
@@ -0,0 +1,429 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../parallel/threadpool.h"
+
+#include "occlusionculler.h"
+
+namespace mesh {
+
+using glm::vec3;
+using glm::vec4;
+
+namespace {
+
+// The depth buffer is split in 4 x 4 tiles, each one rasterized by one task
+const int TILE_WIDTH = 64;
+const int TILE_HEIGHT = 32;
+const int TILES_X = OcclusionCuller::WIDTH / TILE_WIDTH;
+const int TILES_Y = OcclusionCuller::HEIGHT / TILE_HEIGHT;
+const int TILES = TILES_X * TILES_Y;
+// Vertices, triangles and boxes per parallel task
+const size_t VERTEX_GRAIN = 4096;
+const size_t TRIANGLE_GRAIN = 1024;
+const size_t BOX_GRAIN = 256;
+// Points with a smaller w are too close to the camera (or behind it) to be projected
+const float MIN_W = 1e-5f;
+// Depth of an empty pixel
+const float FAR_DEPTH = 1.0f;
+
+// Window coordinates of a clip space point: x, y in pixels, depth in [0, 1] and w
+vec4 project(const vec4& clip) {
+  const float inv = 1.0f / clip.w;
+  return vec4((clip.x * inv * 0.5f + 0.5f) * OcclusionCuller::WIDTH,
+      (clip.y * inv * 0.5f + 0.5f) * OcclusionCuller::HEIGHT, clip.z * inv * 0.5f + 0.5f, clip.w);
+}
+
+// If a projected point is in front of the near plane (window depth of at least 0)
+bool inFront(const vec4& window) {
+  return window.w > MIN_W && window.z >= 0.0f;
+}
+
+// The part of a triangle in front of the near plane (z + w >= 0 in clip coordinates), in the
+// same order: returns its number of vertices (0, 3 or 4)
+int clipNear(const vec4 clip[3], vec4 polygon[4]) {
+  int count = 0;
+  for (int k = 0; k < 3; ++k) {
+    const vec4& from = clip[k];
+    const vec4& to = clip[(k + 1) % 3];
+    const float fromDistance = from.z + from.w;
+    const float toDistance = to.z + to.w;
+    if (fromDistance >= 0.0f) {
+      polygon[count++] = from;
+    }
+    if ((fromDistance >= 0.0f) != (toDistance >= 0.0f)) {
+      polygon[count++] = from + (to - from) * (fromDistance / (fromDistance - toDistance));
+    }
+  }
+  return count;
+}
+
+} // namespace
+
+OcclusionCuller::OcclusionCuller() : mOccluders(0) {
+
+}
+
+void OcclusionCuller::build(const Model& model, size_t maxOccluders, size_t maxTriangles) {
+  ArrayView<MeshData> separators = model.viewSeparators();
+  ArrayView<Vertex> vertices = model.viewVertices();
+  ArrayView<unsigned int> indices = model.viewIndices();
+  ArrayView<InstanceRange> ranges = model.viewInstanceRanges();
+  const size_t n = separators.size();
+  mOccluders = 0;
+  mPositions.clear();
+  mIndices.clear();
+  // The area of the box of every separator (zero for the instanced ones)
+  std::vector<float> areas(n, 0.0f);
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    for (size_t s = first; s < last; ++s) {
+      const MeshData& sep = separators[s];
+      if (sep.howMany == 0 || (s < ranges.size() && ranges[s].count > 0)) {
+        continue;
+      }
+      const Vertex* base = vertices.data() + sep.startVertex;
+      const unsigned int* triangles = indices.data() + sep.startIndex;
+      vec3 lower(FLT_MAX);
+      vec3 upper(-FLT_MAX);
+      for (GLsizei k = 0; k < sep.howMany; ++k) {
+        lower = glm::min(lower, base[triangles[k]].position);
+        upper = glm::max(upper, base[triangles[k]].position);
+      }
+      vec3 size = upper - lower;
+      areas[s] = 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+  }, 1);
+  std::vector<size_t> order;
+  for (size_t s = 0; s < n; ++s) {
+    if (areas[s] > 0.0f) {
+      order.push_back(s);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return areas[a] > areas[b];
+  });
+  // The biggest ones first, each one with the finest level under the proxy budget
+  const size_t levels = model.lodCount();
+  for (size_t s : order) {
+    if (mOccluders == maxOccluders) {
+      break;
+    }
+    MeshData proxy = model.viewLod(levels - 1)[s];
+    for (size_t level = 0; level < levels; ++level) {
+      if (static_cast<size_t>(model.viewLod(level)[s].howMany / 3) <= PROXY_TRIANGLES) {
+        proxy = model.viewLod(level)[s];
+        break;
+      }
+    }
+    if (proxy.howMany == 0 || mIndices.size() / 3 + proxy.howMany / 3 > maxTriangles) {
+      continue;
+    }
+    // Only the vertices used by the proxy
+    const unsigned int* triangles = indices.data() + proxy.startIndex;
+    std::vector<unsigned int> used(triangles, triangles + proxy.howMany);
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+    const unsigned int offset = static_cast<unsigned int>(mPositions.size());
+    for (unsigned int v : used) {
+      mPositions.push_back(vertices[proxy.startVertex + v].position);
+    }
+    for (GLsizei k = 0; k < proxy.howMany; ++k) {
+      mIndices.push_back(offset + static_cast<unsigned int>(
+          std::lower_bound(used.begin(), used.end(), triangles[k]) - used.begin()));
+    }
+    ++mOccluders;
+  }
+  mPyramid.clear();
+  mVisible.clear();
+}
+
+OcclusionCullStats OcclusionCuller::cull(const glm::mat4& PVM, const FrustumCuller& boxes) {
+  const size_t triangles = mIndices.size() / 3;
+  OcclusionCullStats stats = {mOccluders, triangles, 0, 0, 0};
+  if (mPyramid.empty()) {
+    mPyramid.push_back(std::vector<float>());
+  }
+  mPyramid[0].assign(WIDTH * HEIGHT, FAR_DEPTH);
+  // Project the vertices of the occluders
+  mProjected.resize(mPositions.size());
+  parallel::forEachRange(mPositions.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      vec4 clip = PVM * vec4(mPositions[i], 1.0f);
+      mProjected[i] = clip.w > MIN_W ? project(clip) : vec4(0.0f, 0.0f, 0.0f, clip.w);
+    }
+  }, VERTEX_GRAIN);
+  // Set up the triangles, and put them in the bins of the tiles they touch (one set of bins
+  // per chunk, so the chunks do not share anything). A triangle clipped by the near plane can
+  // become two, so there is room for twice as many
+  const size_t chunks = parallel::chunksFor(triangles, TRIANGLE_GRAIN);
+  mTriangles.resize(2 * triangles);
+  mBins.resize(chunks * TILES);
+  std::vector<size_t> rasterized(chunks, 0);
+  parallel::forEachRange(chunks, [&](size_t firstChunk, size_t lastChunk) {
+    for (size_t chunk = firstChunk; chunk < lastChunk; ++chunk) {
+      for (int tile = 0; tile < TILES; ++tile) {
+        mBins[chunk * TILES + tile].clear();
+      }
+      // Bins a set up triangle, stored at index
+      auto bin = [&](const Triangle& t, size_t index) {
+        for (int ty = t.minY / TILE_HEIGHT; ty <= t.maxY / TILE_HEIGHT; ++ty) {
+          for (int tx = t.minX / TILE_WIDTH; tx <= t.maxX / TILE_WIDTH; ++tx) {
+            mBins[chunk * TILES + ty * TILES_X + tx].push_back(static_cast<unsigned int>(index));
+          }
+        }
+      };
+      for (size_t i = chunk * triangles / chunks; i < (chunk + 1) * triangles / chunks; ++i) {
+        const vec4& p0 = mProjected[mIndices[3 * i]];
+        const vec4& p1 = mProjected[mIndices[3 * i + 1]];
+        const vec4& p2 = mProjected[mIndices[3 * i + 2]];
+        if (!inFront(p0) || !inFront(p1) || !inFront(p2)) {
+          // Crossing the near plane: the part in front of it, one or two triangles (the second
+          // one goes after all the others)
+          vec4 clip[3];
+          for (int k = 0; k < 3; ++k) {
+            clip[k] = PVM * vec4(mPositions[mIndices[3 * i + k]], 1.0f);
+          }
+          vec4 polygon[4];
+          const int count = clipNear(clip, polygon);
+          for (int k = 1; k + 1 < count; ++k) {
+            const size_t index = k == 1 ? i : triangles + i;
+            if (setUp(project(polygon[0]), project(polygon[k]), project(polygon[k + 1]),
+                mTriangles[index])) {
+              bin(mTriangles[index], index);
+              ++rasterized[chunk];
+            }
+          }
+        } else if (setUp(p0, p1, p2, mTriangles[i])) {
+          bin(mTriangles[i], i);
+          ++rasterized[chunk];
+        }
+      }
+    }
+  }, 1);
+  // Every tile is written by one task only, the triangles in their original order
+  parallel::forEachRange(TILES, [&](size_t firstTile, size_t lastTile) {
+    for (size_t tile = firstTile; tile < lastTile; ++tile) {
+      const int tileX = static_cast<int>(tile % TILES_X) * TILE_WIDTH;
+      const int tileY = static_cast<int>(tile / TILES_X) * TILE_HEIGHT;
+      for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        for (unsigned int i : mBins[chunk * TILES + tile]) {
+          rasterize(mTriangles[i], tileX, tileY);
+        }
+      }
+    }
+  }, 1);
+  for (size_t count : rasterized) {
+    stats.rasterizedTriangles += count;
+  }
+  buildPyramid();
+  // Test the boxes inside the frustum
+  const size_t n = boxes.size();
+  mVisible.assign(n, 1);
+  if (stats.rasterizedTriangles > 0) {
+    parallel::forEachRange(n, [&](size_t first, size_t last) {
+      vec3 lower;
+      vec3 upper;
+      for (size_t box = first; box < last; ++box) {
+        if (boxes.isVisible(box)) {
+          boxes.bounds(box, lower, upper);
+          mVisible[box] = hidden(PVM, lower, upper) ? 0 : 1;
+        }
+      }
+    }, BOX_GRAIN);
+  }
+  for (size_t box = 0; box < n; ++box) {
+    if (boxes.isVisible(box)) {
+      ++stats.tested;
+      stats.occluded += mVisible[box] ? 0 : 1;
+    }
+  }
+  return stats;
+}
+
+bool OcclusionCuller::isVisible(size_t box) const {
+  return box >= mVisible.size() || mVisible[box] != 0;
+}
+
+const std::vector<float>& OcclusionCuller::depth() const {
+  static const std::vector<float> empty;
+  return mPyramid.empty() ? empty : mPyramid[0];
+}
+
+bool OcclusionCuller::setUp(const vec4& p0, const vec4& p1, const vec4& p2, Triangle& t) {
+  // Points on the near plane of an unusual projection can still be too close to divide
+  if (p0.w <= MIN_W || p1.w <= MIN_W || p2.w <= MIN_W) {
+    return false;
+  }
+  // Counter clockwise is front facing, as in OpenGL
+  const float area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+  if (!(area > 0.0f)) {
+    return false;
+  }
+  t.minX = std::max(0, static_cast<int>(std::floor(std::min(p0.x, std::min(p1.x, p2.x)))));
+  t.maxX = std::min(WIDTH - 1, static_cast<int>(std::floor(std::max(p0.x, std::max(p1.x, p2.x)))));
+  t.minY = std::max(0, static_cast<int>(std::floor(std::min(p0.y, std::min(p1.y, p2.y)))));
+  t.maxY = std::min(HEIGHT - 1,
+      static_cast<int>(std::floor(std::max(p0.y, std::max(p1.y, p2.y)))));
+  if (t.minX > t.maxX || t.minY > t.maxY) {
+    return false;
+  }
+  const vec4* corners[3] = {&p0, &p1, &p2};
+  for (int k = 0; k < 3; ++k) {
+    const vec4& from = *corners[k];
+    const vec4& to = *corners[(k + 1) % 3];
+    t.a[k] = from.y - to.y;
+    t.b[k] = to.x - from.x;
+    t.c[k] = -(t.a[k] * from.x + t.b[k] * from.y);
+  }
+  // The depth is linear in window coordinates
+  const float dzdx = ((p1.z - p0.z) * (p2.y - p0.y) - (p2.z - p0.z) * (p1.y - p0.y)) / area;
+  const float dzdy = ((p2.z - p0.z) * (p1.x - p0.x) - (p1.z - p0.z) * (p2.x - p0.x)) / area;
+  t.depth[0] = dzdx;
+  t.depth[1] = dzdy;
+  t.depth[2] = p0.z - dzdx * p0.x - dzdy * p0.y;
+  return true;
+}
+
+void OcclusionCuller::rasterize(const Triangle& t, int tileX, int tileY) {
+  const int x0 = std::max(t.minX, tileX);
+  const int x1 = std::min(t.maxX, tileX + TILE_WIDTH - 1);
+  const int y0 = std::max(t.minY, tileY);
+  const int y1 = std::min(t.maxY, tileY + TILE_HEIGHT - 1);
+  float* depth = mPyramid[0].data();
+  for (int y = y0; y <= y1; ++y) {
+    // The edge functions and the depth at the pixel centers
+    const float py = y + 0.5f;
+    float* row = depth + y * WIDTH;
+    int x = x0;
+#if defined(__SSE2__)
+    // Four pixels at a time, the tiles start at a multiple of four
+    x = x0 & ~3;
+    const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 a[3];
+    __m128 rowEdge[3];
+    for (int k = 0; k < 3; ++k) {
+      a[k] = _mm_set1_ps(t.a[k]);
+      rowEdge[k] = _mm_set1_ps(t.b[k] * py + t.c[k]);
+    }
+    const __m128 dzdx = _mm_set1_ps(t.depth[0]);
+    const __m128 rowDepth = _mm_set1_ps(t.depth[1] * py + t.depth[2]);
+    for (; x <= x1; x += 4) {
+      const __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+      __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[0], px), rowEdge[0]), zero);
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[1], px), rowEdge[1]), zero));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[2], px), rowEdge[2]), zero));
+      const __m128 current = _mm_loadu_ps(row + x);
+      const __m128 closest = _mm_min_ps(current, _mm_add_ps(_mm_mul_ps(dzdx, px), rowDepth));
+      _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closest),
+          _mm_andnot_ps(inside, current)));
+    }
+#endif
+    for (; x <= x1; ++x) {
+      const float px = x + 0.5f;
+      if (t.a[0] * px + t.b[0] * py + t.c[0] >= 0.0f &&
+          t.a[1] * px + t.b[1] * py + t.c[1] >= 0.0f &&
+          t.a[2] * px + t.b[2] * py + t.c[2] >= 0.0f) {
+        row[x] = std::min(row[x], t.depth[0] * px + t.depth[1] * py + t.depth[2]);
+      }
+    }
+  }
+}
+
+void OcclusionCuller::buildPyramid() {
+  // Every texel keeps the farthest depth of the (up to) four texels below it
+  size_t level = 0;
+  int width = WIDTH;
+  int height = HEIGHT;
+  while (width > 1 || height > 1) {
+    const int nextWidth = std::max(1, width / 2);
+    const int nextHeight = std::max(1, height / 2);
+    if (mPyramid.size() <= level + 1) {
+      mPyramid.push_back(std::vector<float>());
+    }
+    const std::vector<float>& below = mPyramid[level];
+    std::vector<float>& next = mPyramid[level + 1];
+    next.resize(nextWidth * nextHeight);
+    for (int y = 0; y < nextHeight; ++y) {
+      const int y0 = std::min(2 * y, height - 1);
+      const int y1 = std::min(2 * y + 1, height - 1);
+      for (int x = 0; x < nextWidth; ++x) {
+        const int x0 = std::min(2 * x, width - 1);
+        const int x1 = std::min(2 * x + 1, width - 1);
+        next[y * nextWidth + x] = std::max(
+            std::max(below[y0 * width + x0], below[y0 * width + x1]),
+            std::max(below[y1 * width + x0], below[y1 * width + x1]));
+      }
+    }
+    width = nextWidth;
+    height = nextHeight;
+    ++level;
+  }
+}
+
+bool OcclusionCuller::hidden(const glm::mat4& PVM, const vec3& lower, const vec3& upper) const {
+  // The rectangle on screen and the closest depth of the box
+  float minX = FLT_MAX;
+  float maxX = -FLT_MAX;
+  float minY = FLT_MAX;
+  float maxY = -FLT_MAX;
+  float closest = FLT_MAX;
+  // The corners from one of them and the three edges (the projection is linear before the divide)
+  const vec4 origin = PVM * vec4(lower, 1.0f);
+  const vec4 edges[3] = {PVM[0] * (upper.x - lower.x), PVM[1] * (upper.y - lower.y),
+      PVM[2] * (upper.z - lower.z)};
+  for (int corner = 0; corner < 8; ++corner) {
+    vec4 clip = origin;
+    for (int axis = 0; axis < 3; ++axis) {
+      if (corner & (1 << axis)) {
+        clip += edges[axis];
+      }
+    }
+    if (clip.w <= MIN_W) {
+      return false;
+    }
+    const vec4 window = project(clip);
+    minX = std::min(minX, window.x);
+    maxX = std::max(maxX, window.x);
+    minY = std::min(minY, window.y);
+    maxY = std::max(maxY, window.y);
+    closest = std::min(closest, window.z);
+  }
+  if (closest <= 0.0f) {
+    return false;
+  }
+  int x0 = std::max(0, static_cast<int>(std::floor(minX)));
+  int x1 = std::min(WIDTH - 1, static_cast<int>(std::floor(maxX)));
+  int y0 = std::max(0, static_cast<int>(std::floor(minY)));
+  int y1 = std::min(HEIGHT - 1, static_cast<int>(std::floor(maxY)));
+  if (x0 > x1 || y0 > y1) {
+    return false;
+  }
+  // The finest level where the rectangle covers at most 4 x 4 texels
+  size_t level = 0;
+  while (level + 1 < mPyramid.size() && ((x1 >> level) - (x0 >> level) > 3 ||
+      (y1 >> level) - (y0 >> level) > 3)) {
+    ++level;
+  }
+  const int width = std::max(1, WIDTH >> level);
+  const int height = std::max(1, HEIGHT >> level);
+  x0 = std::min(x0 >> level, width - 1);
+  x1 = std::min(x1 >> level, width - 1);
+  y0 = std::min(y0 >> level, height - 1);
+  y1 = std::min(y1 >> level, height - 1);
+  const std::vector<float>& texels = mPyramid[level];
+  float farthest = 0.0f;
+  for (int y = y0; y <= y1; ++y) {
+    for (int x = x0; x <= x1; ++x) {
+      farthest = std::max(farthest, texels[y * width + x]);
+    }
+  }
+  return closest > farthest;
+}
+
+} // namespace mesh
@@ -0,0 +1,109 @@
+#ifndef MESH_OCCLUSION_CULLER_H_
+#define MESH_OCCLUSION_CULLER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "frustumculler.h"
+#include "model.h"
+
+namespace mesh {
+
+//! Statistics of the last occlusion culling
+struct OcclusionCullStats {
+  //! Occluder meshes and their triangles, and the triangles that reached the depth buffer
+  size_t occluders;
+  size_t occluderTriangles;
+  size_t rasterizedTriangles;
+  //! Boxes tested against the depth pyramid (the ones inside the frustum) and the hidden ones
+  size_t tested;
+  size_t occluded;
+};
+
+//! Culls the boxes of a \class FrustumCuller hidden behind big meshes, on the CPU
+/*!
+  When it is built, the largest separators of a Model (by the area of their
+  boxes) are chosen as occluders. Each one is kept as a simplified proxy:
+  its finest level of detail under a triangle budget (See
+  Model::generateLods). Instanced separators are not occluders.
+
+  Every frame:
+  - The occluders are transformed and their triangles set up in parallel.
+    Triangles that cross the near plane are clipped by it (into one or two
+    triangles). Triangles that are back facing or fall out of the screen are
+    dropped.
+  - The triangles are binned in tiles of a small depth buffer (256 x 128),
+    and every tile is rasterized by one task, four pixels at a time (SSE2),
+    keeping the closest depth.
+  - A depth pyramid is built from it, where every texel keeps the farthest
+    depth of the four below.
+  - Every box that passed the frustum culling is projected. It is hidden if
+    its closest depth is behind the farthest depth of the (at most 4 x 4)
+    texels of the pyramid level that cover its rectangle on screen.
+  Boxes that cross the near plane are always visible.
+
+  It does not use OpenGL, so it works without a GPU.
+*/
+class OcclusionCuller {
+public:
+  //! Size of the depth buffer, in pixels
+  static const int WIDTH = 256;
+  static const int HEIGHT = 128;
+  //! Default budget of occluders and of triangles
+  static const size_t MAX_OCCLUDERS = 64;
+  static const size_t MAX_TRIANGLES = 32768;
+  //! Triangles of the proxy of an occluder (the level of detail is chosen by it)
+  static const size_t PROXY_TRIANGLES = 2048;
+  OcclusionCuller();
+  //! Clear and choose the occluders of a Model, with a budget of meshes and triangles
+  /*!
+    Call it after Model::generateLods and before the levels are released.
+  */
+  void build(const Model& model, size_t maxOccluders = MAX_OCCLUDERS,
+      size_t maxTriangles = MAX_TRIANGLES);
+  //! Rasterize the occluders and test the boxes that passed the last frustum culling
+  /*!
+    @param PVM the projection-view-model matrix used to render (and to cull the frustum)
+    @param boxes the frustum culler, its last results are used and its boxes tested
+  */
+  OcclusionCullStats cull(const glm::mat4& PVM, const FrustumCuller& boxes);
+  //! Queries if a box was not hidden in the last culling (true if cull was never called)
+  bool isVisible(size_t box) const;
+  //! The depth buffer of the last culling (WIDTH x HEIGHT, bottom row first, 1 is far)
+  const std::vector<float>& depth() const;
+
+private:
+  struct Triangle {
+    // Edge functions (a * x + b * y + c >= 0 inside) and the depth plane
+    float a[3];
+    float b[3];
+    float c[3];
+    float depth[3];
+    int minX;
+    int maxX;
+    int minY;
+    int maxY;
+  };
+  // Edge functions, depth plane and rectangle of a projected triangle, false if it is not drawn
+  static bool setUp(const glm::vec4& p0, const glm::vec4& p1, const glm::vec4& p2, Triangle& t);
+  void rasterize(const Triangle& t, int tileX, int tileY);
+  void buildPyramid();
+  bool hidden(const glm::mat4& PVM, const glm::vec3& lower, const glm::vec3& upper) const;
+  size_t mOccluders;
+  // The proxies of the occluders: positions and triangles (three indices each)
+  std::vector<glm::vec3> mPositions;
+  std::vector<unsigned int> mIndices;
+  // Per frame: the projected positions (x, y in pixels, depth, and w), the set up
+  // triangles (the second halves of the clipped ones after the rest), and the triangles of
+  // every chunk in every tile
+  std::vector<glm::vec4> mProjected;
+  std::vector<Triangle> mTriangles;
+  std::vector<std::vector<unsigned int> > mBins;
+  // Level 0 is the depth buffer, every level is half the size of the previous one
+  std::vector<std::vector<float> > mPyramid;
+  std::vector<unsigned char> mVisible;
+};
+
+} // namespace mesh
+
+#endif
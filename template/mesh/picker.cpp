@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+#include "../parallel/threadpool.h"
+
+#include "picker.h"
+
+namespace mesh {
+
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+
+namespace {
+
+PickResult missed() {
+  PickResult result = {false, 0, 0, vec3(0.0f), vec2(0.0f), 0.0f, 0.0};
+  return result;
+}
+
+} // namespace
+
+Picker::Picker() : mResult(missed()), mWaiting(false) {
+
+}
+
+Picker::~Picker() {
+  cancel();
+}
+
+void Picker::build(const Model& model) {
+  cancel();
+  mBvh.build(model);
+  // The separators sorted by their place in the index buffer
+  ArrayView<MeshData> separators = model.viewSeparators();
+  mSeparators.resize(separators.size());
+  std::iota(mSeparators.begin(), mSeparators.end(), size_t(0));
+  std::sort(mSeparators.begin(), mSeparators.end(), [&](size_t a, size_t b) {
+    return separators[a].startIndex < separators[b].startIndex;
+  });
+  mFirstTriangles.resize(separators.size());
+  for (size_t i = 0; i < mSeparators.size(); ++i) {
+    mFirstTriangles[i] = static_cast<unsigned int>(separators[mSeparators[i]].startIndex / 3);
+  }
+}
+
+PickResult Picker::pick(const vec2& mouse, const glm::ivec2& windowSize,
+    const glm::mat4& PVM) const {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  PickResult result = missed();
+  if (windowSize.x <= 0 || windowSize.y <= 0 || mBvh.empty()) {
+    return result;
+  }
+  // From window coordinates (y goes down) to normalized device coordinates
+  float x = 2.0f * mouse.x / float(windowSize.x) - 1.0f;
+  float y = 1.0f - 2.0f * mouse.y / float(windowSize.y);
+  // The points of the near and the far planes under the cursor, in model coordinates
+  glm::mat4 unproject = glm::inverse(PVM);
+  vec4 from = unproject * vec4(x, y, -1.0f, 1.0f);
+  vec4 to = unproject * vec4(x, y, 1.0f, 1.0f);
+  if (from.w == 0.0f || to.w == 0.0f) {
+    return result;
+  }
+  vec3 origin = vec3(from) / from.w;
+  vec3 end = vec3(to) / to.w;
+  BvhRayHit hit;
+  if (mBvh.intersectSegment(origin, end, hit)) {
+    result.hit = true;
+    result.triangle = hit.triangle;
+    result.separator = separatorOf(hit.triangle);
+    result.point = origin + hit.distance * glm::normalize(end - origin);
+    result.barycentric = hit.barycentric;
+    result.distance = hit.distance;
+  }
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  result.milliseconds = elapsed.count();
+  return result;
+}
+
+void Picker::pickAsync(const vec2& mouse, const glm::ivec2& windowSize, const glm::mat4& PVM) {
+  if (mTask.valid()) {
+    // Only the latest request matters, it waits for the running one
+    mWaiting = true;
+    mWaitingMouse = mouse;
+    mWaitingSize = windowSize;
+    mWaitingPVM = PVM;
+    return;
+  }
+  launch(mouse, windowSize, PVM);
+}
+
+bool Picker::poll(PickResult& result) {
+  if (!mTask.valid() ||
+      mTask.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    return false;
+  }
+  mTask.get();
+  result = mResult;
+  if (mWaiting) {
+    mWaiting = false;
+    launch(mWaitingMouse, mWaitingSize, mWaitingPVM);
+  }
+  return true;
+}
+
+bool Picker::pending() const {
+  return mTask.valid() || mWaiting;
+}
+
+size_t Picker::separatorOf(unsigned int triangle) const {
+  // The last separator that starts at or before the triangle
+  std::vector<unsigned int>::const_iterator it =
+      std::upper_bound(mFirstTriangles.begin(), mFirstTriangles.end(), triangle);
+  return it == mFirstTriangles.begin() ? 0 : mSeparators[it - mFirstTriangles.begin() - 1];
+}
+
+const Bvh& Picker::bvh() const {
+  return mBvh;
+}
+
+void Picker::cancel() {
+  if (mTask.valid()) {
+    mTask.wait();
+    mTask = std::future<void>();
+  }
+  mWaiting = false;
+}
+
+void Picker::launch(const vec2& mouse, const glm::ivec2& windowSize, const glm::mat4& PVM) {
+  // The queries of the tree are read only, only mResult is written (and read after the future)
+  mTask = parallel::ThreadPool::global().enqueue([this, mouse, windowSize, PVM]() {
+    mResult = pick(mouse, windowSize, PVM);
+  });
+}
+
+} // namespace mesh
@@ -0,0 +1,97 @@
+#ifndef MESH_PICKER_H_
+#define MESH_PICKER_H_
+
+#include <cstddef>
+#include <future>
+#include <vector>
+
+#include "bvh.h"
+
+namespace mesh {
+
+//! What is under the cursor (See \class Picker)
+struct PickResult {
+  //! False if the ray did not hit the model (the rest is not valid)
+  bool hit;
+  //! The separator (MeshData index) of the triangle
+  size_t separator;
+  //! Triangle hit: its first index is at 3 * triangle in the index buffer
+  unsigned int triangle;
+  //! Hit point and its barycentric coordinates, in model coordinates
+  glm::vec3 point;
+  glm::vec2 barycentric;
+  //! Distance from the near plane to the point, in model units
+  float distance;
+  //! Time spent tracing the ray, in milliseconds
+  double milliseconds;
+};
+
+//! Finds the triangle of a \class Model under the mouse cursor
+/*!
+  The mouse position is unprojected with the inverse of the same matrices used
+  to render (projection * view * model), which gives the segment between the
+  near and far planes in model coordinates. It is traced against a \class Bvh
+  of the model, so the model can be released after the picker is built.
+
+  The picks can run synchronously or in a worker of the global thread pool:
+  pickAsync returns immediately and the result is collected with poll (call it
+  once per frame). While a pick is running, only the latest request is kept
+  and it starts when the running one is collected.
+*/
+class Picker {
+public:
+  //! Creates an empty picker (nothing is ever hit)
+  Picker();
+  //! Waits for the running pick, if any
+  ~Picker();
+  //! Clear and build the tree of the separators of a Model (not the levels of detail)
+  /*!
+    Call it after the index buffer is final (for example after Model::buildIndexBuffer)
+    and before the separators are released.
+  */
+  void build(const Model& model);
+  //! Pick in the calling thread
+  /*!
+    @param mouse cursor position in window coordinates (origin at the top left)
+    @param windowSize size of the window, in the same units as the mouse
+    @param PVM the projection * view * model matrix used to render
+  */
+  PickResult pick(const glm::vec2& mouse, const glm::ivec2& windowSize,
+      const glm::mat4& PVM) const;
+  //! Pick in a worker thread (See pick for the parameters)
+  void pickAsync(const glm::vec2& mouse, const glm::ivec2& windowSize, const glm::mat4& PVM);
+  //! Collect the result of the last asynchronous pick
+  /*!
+    @return true (once) if a pick finished since the last call, and then result is written
+  */
+  bool poll(PickResult& result);
+  //! Queries if there is an asynchronous pick running or waiting
+  bool pending() const;
+  //! The separator of a triangle (its place in the index buffer divided by three)
+  size_t separatorOf(unsigned int triangle) const;
+  //! The tree used to trace the rays
+  const Bvh& bvh() const;
+
+private:
+  Picker(const Picker&) = delete;
+  Picker& operator=(const Picker&) = delete;
+  // Wait for the running pick and forget the waiting one
+  void cancel();
+  void launch(const glm::vec2& mouse, const glm::ivec2& windowSize, const glm::mat4& PVM);
+  Bvh mBvh;
+  // First triangle of every separator, sorted, and the separator it belongs to
+  std::vector<unsigned int> mFirstTriangles;
+  std::vector<size_t> mSeparators;
+  // The running pick writes mResult, the future tells when it is done
+  std::future<void> mTask;
+  PickResult mResult;
+  // The request waiting for the running one to finish
+  bool mWaiting;
+  glm::vec2 mWaitingMouse;
+  glm::ivec2 mWaitingSize;
+  glm::mat4 mWaitingPVM;
+};
+
+} // namespace mesh
+
+#endif
@@ -1,3 +1,5 @@
+#include <utility>
+
 #include "proceduralmeshes.h"
 
 namespace mesh {
@@ -109,7 +111,7 @@ Mesh cube() {
   indices.push_back(22);
   indices.push_back(23);
 
-  cube.loadVerticesAndIndices(vertices, indices, true, true);
+  cube.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, true);
 
   return cube;
 }
@@ -213,7 +215,7 @@ Mesh sphere(int slices, int stacks) {
     indices.push_back(c);
   }
 
-  sphere.loadVerticesAndIndices(vertices, indices, true, true);
+  sphere.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, true);
 
   return sphere;
 }
@@ -322,7 +324,7 @@ Mesh cylinder(int slices, int stacks, bool caps) {
     }
   }
 
-  cylinder.loadVerticesAndIndices(vertices, indices, true, false);
+  cylinder.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, false);
 
   return cylinder;
 }
@@ -430,7 +432,7 @@ Mesh cylinderTexture(int slices, int stacks, bool caps) {
     }
   }
 
-  cylinder.loadVerticesAndIndices(vertices, indices, true, true);
+  cylinder.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, true);
 
   return cylinder;
 }
@@ -675,7 +677,7 @@ Mesh teapot(int subdivisions) {
   indices.resize(6 * subdivisions * subdivisions * 32);
   generatePatches(vertices, indices, subdivisions);
 
-  teapot.loadVerticesAndIndices(vertices, indices, true, true);
+  teapot.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, true);
 
   glm::vec3 c = teapot.getBBCenter();
   float scaleFactor = teapot.scaleFactor();
@@ -746,7 +748,7 @@ Mesh torus(float outerRadius, float innerRadius, int rings, int sides) {
     }
   }
 
-  torus.loadVerticesAndIndices(vertices, indices, true, false);
+  torus.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, false);
 
   return torus;
 }
@@ -829,7 +831,7 @@ Mesh torusTexture(float outerRadius, float innerRadius, int rings, int sides) {
     }
   }
 
-  torus.loadVerticesAndIndices(vertices, indices, true, true);
+  torus.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, true);
 
   return torus;
 }
@@ -932,7 +934,7 @@ Mesh insideOutCube() {
   indices.push_back(23);
   indices.push_back(22);
 
-  cube.loadVerticesAndIndices(vertices, indices, true, true);
+  cube.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, true);
 
   return cube;
 }
@@ -1060,7 +1062,7 @@ Mesh pyramid() {
   indices.push_back(15);
   indices.push_back(14);
 
-  pyramid.loadVerticesAndIndices(vertices, indices, true, true);
+  pyramid.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, true);
 
   return pyramid;
 }
@@ -1145,7 +1147,7 @@ Mesh cone(int slices, int stacks, bool cap) {
     }
   }
 
-  cone.loadVerticesAndIndices(vertices, indices, true, false);
+  cone.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, false);
 
   return cone;
 }
@@ -1245,7 +1247,7 @@ Mesh coneTexture(int slices, int stacks, bool cap) {
     }
   }
 
-  cone.loadVerticesAndIndices(vertices, indices, true, true);
+  cone.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, true);
 
   return cone;
 }
@@ -1305,7 +1307,7 @@ Mesh superShape(float a, float b, float m, glm::vec3 n, int discretization) {
     }
   }
 
-  supershape.loadVerticesAndIndices(vertices, indices, true, true);
+  supershape.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, true);
 
   return supershape;
 }
@@ -1403,14 +1405,14 @@ Mesh icosphere(int subdiv) {
   //Get the vectors back to add normal and text coords
   triangles.clear();
 
-  std::vector<Vertex> vertices = sphere.getVertices();
-  std::vector<unsigned int> indices = sphere.getIndices();
+  std::vector<Vertex> vertices = sphere.releaseVertices();
+  std::vector<unsigned int> indices = sphere.releaseIndices();
 
   for (size_t i = 0; i < vertices.size(); ++i) {
     vertices[i].normal = vertices[i].position;
   }
 
-  sphere.loadVerticesAndIndices(vertices, indices, true, false);
+  sphere.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, false);
 
   return sphere;
 }
@@ -1519,7 +1521,7 @@ Mesh tethrahedra() {
   indices.push_back(10);
   indices.push_back(11);
 
-  teth.loadVerticesAndIndices(vertices, indices, true, true);
+  teth.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, true);
 
   return teth;
 }
@@ -1620,7 +1622,7 @@ Mesh plane(int sections, bool twoSide) {
   }
 
   Mesh plane;  
-  plane.loadVerticesAndIndices(vertices, indices, true, true);
+  plane.loadVerticesAndIndices(std::move(vertices), std::move(indices), true, true);
 
   return plane;
 }
@@ -0,0 +1,785 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include "../parallel/threadpool.h"
+
+#include "simplifier.h"
+
+namespace mesh {
+
+using glm::vec2;
+using glm::vec3;
+
+const float Simplifier::DEFAULT_ATTRIBUTE_WEIGHT = 1.0f;
+
+namespace {
+
+const unsigned int NONE = ~0u;
+// Weight of the planes that keep the borders and seams in place
+const double BORDER_WEIGHT = 10.0;
+// A collapse can not turn a triangle more than ~75 degrees
+const float MIN_NORMAL_COSINE = 0.25f;
+
+// The collapses a vertex allows (See Simplifier)
+enum VertexKind {MANIFOLD, BORDER, SEAM, LOCKED, REMOVED};
+
+// Symmetric 4x4 matrix of the squared distances to a set of planes, and their total weight
+struct Quadric {
+  double a00, a11, a22, a01, a02, a12, b0, b1, b2, c, weight;
+};
+
+Quadric planeQuadric(const vec3& normal, const vec3& point, double weight) {
+  double x = normal.x, y = normal.y, z = normal.z;
+  double d = -(x * point.x + y * point.y + z * point.z);
+  Quadric q;
+  q.a00 = weight * x * x;
+  q.a11 = weight * y * y;
+  q.a22 = weight * z * z;
+  q.a01 = weight * x * y;
+  q.a02 = weight * x * z;
+  q.a12 = weight * y * z;
+  q.b0 = weight * x * d;
+  q.b1 = weight * y * d;
+  q.b2 = weight * z * d;
+  q.c = weight * d * d;
+  q.weight = weight;
+  return q;
+}
+
+void accumulate(Quadric& q, const Quadric& other) {
+  q.a00 += other.a00;
+  q.a11 += other.a11;
+  q.a22 += other.a22;
+  q.a01 += other.a01;
+  q.a02 += other.a02;
+  q.a12 += other.a12;
+  q.b0 += other.b0;
+  q.b1 += other.b1;
+  q.b2 += other.b2;
+  q.c += other.c;
+  q.weight += other.weight;
+}
+
+// Weighted sum of the squared distances from p to the planes
+double evaluate(const Quadric& q, const vec3& p) {
+  double x = p.x, y = p.y, z = p.z;
+  double result = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z +
+      2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z) +
+      2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+  return std::max(result, 0.0);
+}
+
+// The state of the triangles while they are simplified
+class Collapser {
+public:
+  Collapser(ArrayView<Vertex> vertices, ArrayView<unsigned int> indices, float normalWeight,
+      float textCoordsWeight);
+  std::vector<SimplifiedLevel> run(const std::vector<size_t>& targets);
+
+private:
+  void findWedges();
+  void classify();
+  void computeQuadrics();
+  bool hasEdge(unsigned int from, unsigned int to) const;
+  bool allowed(unsigned int v, unsigned int t) const;
+  bool flips(unsigned int v, unsigned int t) const;
+  float cost(unsigned int v, unsigned int t) const;
+  float attributeCost(unsigned int v, unsigned int t) const;
+  bool keepsOrientation(unsigned int v, unsigned int t) const;
+  bool findCollapse(unsigned int v, bool checkFlips, unsigned int& target, float& cost) const;
+  void collapse(unsigned int v, unsigned int t, std::vector<unsigned int>& touched);
+  void moveTriangles(unsigned int v, unsigned int t, std::vector<unsigned int>& touched);
+  void updateLoops(unsigned int v, unsigned int t);
+  SimplifiedLevel snapshot() const;
+  // The heap of the vertices by the cost of their best collapse
+  bool cheaper(unsigned int a, unsigned int b) const;
+  void heapPlace(size_t place, unsigned int v);
+  void siftUp(size_t place);
+  void siftDown(size_t place);
+  void heapUpdate(unsigned int v, bool checkFlips);
+  void heapImprove(unsigned int v, unsigned int t);
+  void heapRemove(unsigned int v);
+
+  ArrayView<Vertex> mVertices;
+  float mNormalWeight;
+  float mTextCoordsWeight;
+  // Positions scaled to the unit cube, and the model units of one unit
+  std::vector<vec3> mPositions;
+  float mExtent;
+  std::vector<vec3> mNormals;
+  std::vector<unsigned int> mTriangles;
+  std::vector<unsigned char> mAlive;
+  size_t mLive;
+  // Triangles around every vertex (the dead ones are removed lazily)
+  std::vector<std::vector<unsigned int> > mAround;
+  // Vertices with the same position form a ring (wedges), the first one is the representative
+  std::vector<unsigned int> mWedge;
+  std::vector<unsigned int> mRepresentative;
+  // The open edge that leaves the vertex (loop) and the one that arrives (loopBack)
+  std::vector<unsigned int> mLoop;
+  std::vector<unsigned int> mLoopBack;
+  std::vector<unsigned char> mKind;
+  // Open edges of every original triangle (only while the quadrics are computed)
+  std::vector<unsigned char> mOpenEdges;
+  // Quadric of every position (indexed by the representative)
+  std::vector<Quadric> mQuadrics;
+  // Area of the triangles that will take the attributes of the vertex if it collapses
+  std::vector<float> mArea;
+  // Best collapse of every vertex, and its place in the heap (NONE if it has none)
+  std::vector<unsigned int> mTarget;
+  std::vector<float> mCost;
+  // The flips are only checked for the collapses that reach the top of the heap
+  std::vector<unsigned char> mChecked;
+  std::vector<unsigned int> mHeap;
+  std::vector<unsigned int> mHeapPlace;
+  std::vector<unsigned int> mMark;
+  unsigned int mMarkStamp;
+  double mError;
+};
+
+Collapser::Collapser(ArrayView<Vertex> vertices, ArrayView<unsigned int> indices,
+    float normalWeight, float textCoordsWeight) : mVertices(vertices),
+    mNormalWeight(normalWeight), mTextCoordsWeight(textCoordsWeight), mExtent(1.0f), mLive(0),
+    mMarkStamp(0), mError(0.0) {
+  const size_t n = vertices.size();
+  const size_t triangles = indices.size() / 3;
+  mTriangles.assign(indices.begin(), indices.begin() + triangles * 3);
+  mAlive.assign(triangles, 0);
+  // Degenerate triangles are dropped from the start
+  std::vector<unsigned int> count(n, 0);
+  for (size_t t = 0; t < triangles; ++t) {
+    const unsigned int* tri = &mTriangles[3 * t];
+    if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) {
+      continue;
+    }
+    mAlive[t] = 1;
+    mLive++;
+    count[tri[0]]++;
+    count[tri[1]]++;
+    count[tri[2]]++;
+  }
+  mAround.resize(n);
+  for (size_t v = 0; v < n; ++v) {
+    mAround[v].reserve(count[v]);
+  }
+  for (size_t t = 0; t < triangles; ++t) {
+    if (mAlive[t]) {
+      for (int c = 0; c < 3; ++c) {
+        mAround[mTriangles[3 * t + c]].push_back(static_cast<unsigned int>(t));
+      }
+    }
+  }
+  // Work in the unit cube, so the costs do not depend on the size of the model
+  vec3 lower(0.0f);
+  vec3 upper(0.0f);
+  bool first = true;
+  for (size_t v = 0; v < n; ++v) {
+    if (count[v] > 0) {
+      lower = first ? vertices[v].position : glm::min(lower, vertices[v].position);
+      upper = first ? vertices[v].position : glm::max(upper, vertices[v].position);
+      first = false;
+    }
+  }
+  vec3 size = upper - lower;
+  mExtent = std::max(size.x, std::max(size.y, size.z));
+  if (mExtent <= 0.0f) {
+    mExtent = 1.0f;
+  }
+  mPositions.resize(n);
+  mNormals.resize(n);
+  const float scale = 1.0f / mExtent;
+  parallel::forEachRange(n, [&](size_t begin, size_t end) {
+    for (size_t v = begin; v < end; ++v) {
+      mPositions[v] = (vertices[v].position - lower) * scale;
+      const vec3& normal = vertices[v].normal;
+      mNormals[v] = glm::length2(normal) > 0.0f ? glm::normalize(normal) : vec3(0.0f);
+    }
+  });
+  mMark.assign(n, 0);
+  findWedges();
+  classify();
+  computeQuadrics();
+  std::vector<unsigned char>().swap(mOpenEdges);
+}
+
+void Collapser::findWedges() {
+  const size_t n = mVertices.size();
+  std::vector<unsigned int> order;
+  order.reserve(n);
+  for (size_t v = 0; v < n; ++v) {
+    if (!mAround[v].empty()) {
+      order.push_back(static_cast<unsigned int>(v));
+    }
+  }
+  std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) {
+    const vec3& p = mVertices[a].position;
+    const vec3& q = mVertices[b].position;
+    if (p.x != q.x) {
+      return p.x < q.x;
+    }
+    if (p.y != q.y) {
+      return p.y < q.y;
+    }
+    if (p.z != q.z) {
+      return p.z < q.z;
+    }
+    return a < b;
+  });
+  mWedge.resize(n);
+  mRepresentative.resize(n);
+  for (size_t v = 0; v < n; ++v) {
+    mWedge[v] = mRepresentative[v] = static_cast<unsigned int>(v);
+  }
+  for (size_t i = 0; i < order.size();) {
+    size_t j = i + 1;
+    while (j < order.size() && mVertices[order[j]].position == mVertices[order[i]].position) {
+      j++;
+    }
+    for (size_t k = i; k < j; ++k) {
+      mRepresentative[order[k]] = order[i];
+      mWedge[order[k]] = order[k + 1 < j ? k + 1 : i];
+    }
+    i = j;
+  }
+}
+
+bool Collapser::hasEdge(unsigned int from, unsigned int to) const {
+  for (unsigned int t : mAround[from]) {
+    if (!mAlive[t]) {
+      continue;
+    }
+    const unsigned int* tri = &mTriangles[3 * t];
+    if ((tri[0] == from && tri[1] == to) || (tri[1] == from && tri[2] == to) ||
+        (tri[2] == from && tri[0] == to)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Collapser::classify() {
+  const size_t n = mVertices.size();
+  mLoop.assign(n, NONE);
+  mLoopBack.assign(n, NONE);
+  mKind.assign(n, LOCKED);
+  // Open edges: the opposite edge is not used by any triangle. Bit c of a
+  // triangle is the edge that goes from corner c to the next one
+  const size_t triangles = mAlive.size();
+  mOpenEdges.assign(triangles, 0);
+  parallel::forEachRange(triangles, [&](size_t begin, size_t end) {
+    for (size_t t = begin; t < end; ++t) {
+      const unsigned int* tri = &mTriangles[3 * t];
+      for (int c = 0; c < 3 && mAlive[t]; ++c) {
+        if (!hasEdge(tri[(c + 1) % 3], tri[c])) {
+          mOpenEdges[t] |= static_cast<unsigned char>(1 << c);
+        }
+      }
+    }
+  });
+  std::vector<unsigned char> openOut(n, 0);
+  std::vector<unsigned char> openIn(n, 0);
+  parallel::forEachRange(n, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      unsigned int v = static_cast<unsigned int>(i);
+      for (unsigned int t : mAround[v]) {
+        const unsigned int* tri = &mTriangles[3 * t];
+        int c = tri[0] == v ? 0 : (tri[1] == v ? 1 : 2);
+        unsigned int next = tri[(c + 1) % 3];
+        unsigned int previous = tri[(c + 2) % 3];
+        if (mOpenEdges[t] & (1 << c)) {
+          openOut[v] = static_cast<unsigned char>(std::min(openOut[v] + 1, 2));
+          mLoop[v] = next;
+        }
+        if (mOpenEdges[t] & (1 << ((c + 2) % 3))) {
+          openIn[v] = static_cast<unsigned char>(std::min(openIn[v] + 1, 2));
+          mLoopBack[v] = previous;
+        }
+      }
+    }
+  });
+  parallel::forEachRange(n, [&](size_t begin, size_t end) {
+    for (size_t v = begin; v < end; ++v) {
+      if (mAround[v].empty()) {
+        continue;
+      }
+      unsigned int twin = mWedge[v];
+      bool single = twin == v;
+      bool pair = !single && mWedge[twin] == v;
+      if (openOut[v] == 0 && openIn[v] == 0) {
+        // Several wedges without open edges: two surfaces that touch at a point
+        mKind[v] = single ? MANIFOLD : LOCKED;
+      } else if (openOut[v] == 1 && openIn[v] == 1) {
+        unsigned int out = mRepresentative[mLoop[v]];
+        unsigned int in = mRepresentative[mLoopBack[v]];
+        if (single) {
+          // Both open edges go to the same position at the end of a seam
+          mKind[v] = out != in ? BORDER : LOCKED;
+        } else if (pair && openOut[twin] == 1 && openIn[twin] == 1 &&
+            out == mRepresentative[mLoopBack[twin]] && in == mRepresentative[mLoop[twin]]) {
+          mKind[v] = SEAM;
+        }
+      }
+    }
+  });
+  parallel::forEachRange(n, [&](size_t begin, size_t end) {
+    for (size_t v = begin; v < end; ++v) {
+      if (mKind[v] != BORDER && mKind[v] != SEAM) {
+        mLoop[v] = mLoopBack[v] = NONE;
+      }
+    }
+  });
+}
+
+void Collapser::computeQuadrics() {
+  const size_t n = mVertices.size();
+  mQuadrics.assign(n, Quadric());
+  mArea.assign(n, 0.0f);
+  // Every position gathers the planes of the triangles of all its wedges, so
+  // there are no concurrent writes
+  parallel::forEachRange(n, [&](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; ++r) {
+      if (mRepresentative[r] != r || mAround[r].empty()) {
+        continue;
+      }
+      Quadric& q = mQuadrics[r];
+      unsigned int w = static_cast<unsigned int>(r);
+      do {
+        for (unsigned int t : mAround[w]) {
+          const unsigned int* tri = &mTriangles[3 * t];
+          const vec3& p0 = mPositions[tri[0]];
+          vec3 normal = glm::cross(mPositions[tri[1]] - p0, mPositions[tri[2]] - p0);
+          float length = glm::length(normal);
+          mArea[w] += length / 6.0f;
+          if (length <= 0.0f) {
+            continue;
+          }
+          normal /= length;
+          accumulate(q, planeQuadric(normal, p0, 0.5 * length));
+          // A plane perpendicular to the triangle keeps the open edges in place
+          int c = tri[0] == w ? 0 : (tri[1] == w ? 1 : 2);
+          unsigned int next = tri[(c + 1) % 3];
+          unsigned int previous = tri[(c + 2) % 3];
+          if (mOpenEdges[t] & (1 << c)) {
+            vec3 edge = mPositions[next] - mPositions[w];
+            vec3 side = glm::cross(edge, normal);
+            if (glm::length2(side) > 0.0f) {
+              accumulate(q, planeQuadric(glm::normalize(side), mPositions[w],
+                  BORDER_WEIGHT * glm::length2(edge)));
+            }
+          }
+          if (mOpenEdges[t] & (1 << ((c + 2) % 3))) {
+            vec3 edge = mPositions[w] - mPositions[previous];
+            vec3 side = glm::cross(edge, normal);
+            if (glm::length2(side) > 0.0f) {
+              accumulate(q, planeQuadric(glm::normalize(side), mPositions[w],
+                  BORDER_WEIGHT * glm::length2(edge)));
+            }
+          }
+        }
+        w = mWedge[w];
+      } while (w != r);
+    }
+  });
+}
+
+bool Collapser::allowed(unsigned int v, unsigned int t) const {
+  unsigned char kind = mKind[v];
+  if (kind == MANIFOLD) {
+    return mKind[t] != REMOVED;
+  }
+  if ((kind != BORDER && kind != SEAM) || mKind[t] != kind) {
+    return false;
+  }
+  // Only along the open edge, and not closing a hole of three edges
+  bool along = (mLoop[v] == t && mLoopBack[v] != mLoop[t]) ||
+      (mLoopBack[v] == t && mLoop[v] != mLoopBack[t]);
+  if (!along || kind == BORDER) {
+    return along;
+  }
+  // The other side of the seam collapses too
+  unsigned int vTwin = mWedge[v];
+  unsigned int tTwin = mWedge[t];
+  return vTwin != tTwin && ((mLoop[vTwin] == tTwin && mLoopBack[vTwin] != mLoop[tTwin]) ||
+      (mLoopBack[vTwin] == tTwin && mLoop[vTwin] != mLoopBack[tTwin]));
+}
+
+bool Collapser::flips(unsigned int v, unsigned int t) const {
+  const vec3& from = mPositions[v];
+  const vec3& to = mPositions[t];
+  for (unsigned int k : mAround[v]) {
+    if (!mAlive[k]) {
+      continue;
+    }
+    const unsigned int* tri = &mTriangles[3 * k];
+    if (tri[0] == t || tri[1] == t || tri[2] == t) {
+      continue;
+    }
+    int c = tri[0] == v ? 0 : (tri[1] == v ? 1 : 2);
+    const vec3& a = mPositions[tri[(c + 1) % 3]];
+    const vec3& b = mPositions[tri[(c + 2) % 3]];
+    vec3 before = glm::cross(a - from, b - from);
+    vec3 after = glm::cross(a - to, b - to);
+    float lengths = glm::length(before) * glm::length(after);
+    if (glm::length2(before) > 0.0f && glm::dot(before, after) <= MIN_NORMAL_COSINE * lengths) {
+      return true;
+    }
+  }
+  return false;
+}
+
+float Collapser::attributeCost(unsigned int v, unsigned int t) const {
+  float change = 0.0f;
+  const vec3& a = mNormals[v];
+  const vec3& b = mNormals[t];
+  if (glm::length2(a) > 0.0f && glm::length2(b) > 0.0f) {
+    change += mNormalWeight * (1.0f - glm::dot(a, b));
+  }
+  change += mTextCoordsWeight * glm::length2(mVertices[v].textCoords - mVertices[t].textCoords);
+  return mArea[v] * change;
+}
+
+float Collapser::cost(unsigned int v, unsigned int t) const {
+  const vec3& p = mPositions[t];
+  float result = static_cast<float>(evaluate(mQuadrics[mRepresentative[v]], p) +
+      evaluate(mQuadrics[mRepresentative[t]], p)) + attributeCost(v, t);
+  if (mKind[v] == SEAM) {
+    result += attributeCost(mWedge[v], mWedge[t]);
+  }
+  return result;
+}
+
+bool Collapser::keepsOrientation(unsigned int v, unsigned int t) const {
+  return !flips(v, t) && (mKind[v] != SEAM || !flips(mWedge[v], mWedge[t]));
+}
+
+bool Collapser::findCollapse(unsigned int v, bool checkFlips, unsigned int& target,
+    float& cost) const {
+  unsigned char kind = mKind[v];
+  if (kind != MANIFOLD && kind != BORDER && kind != SEAM) {
+    return false;
+  }
+  // Few candidates: the neighbours (or the two ends of the open edges)
+  std::pair<float, unsigned int> candidates[32];
+  size_t count = 0;
+  auto consider = [&](unsigned int t) {
+    for (size_t i = 0; i < count; ++i) {
+      if (candidates[i].second == t) {
+        return;
+      }
+    }
+    if (count < 32 && allowed(v, t)) {
+      candidates[count++] = std::make_pair(this->cost(v, t), t);
+    }
+  };
+  if (kind == MANIFOLD) {
+    for (unsigned int k : mAround[v]) {
+      if (mAlive[k]) {
+        const unsigned int* tri = &mTriangles[3 * k];
+        for (int c = 0; c < 3; ++c) {
+          if (tri[c] != v) {
+            consider(tri[c]);
+          }
+        }
+      }
+    }
+  } else {
+    if (mLoop[v] != NONE) {
+      consider(mLoop[v]);
+    }
+    if (mLoopBack[v] != NONE) {
+      consider(mLoopBack[v]);
+    }
+  }
+  if (count == 0) {
+    return false;
+  }
+  if (!checkFlips) {
+    std::pair<float, unsigned int> best = *std::min_element(candidates, candidates + count);
+    target = best.second;
+    cost = best.first;
+    return true;
+  }
+  std::sort(candidates, candidates + count);
+  for (size_t i = 0; i < count; ++i) {
+    if (keepsOrientation(v, candidates[i].second)) {
+      target = candidates[i].second;
+      cost = candidates[i].first;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Collapser::moveTriangles(unsigned int v, unsigned int t, std::vector<unsigned int>& touched) {
+  for (unsigned int k : mAround[v]) {
+    if (!mAlive[k]) {
+      continue;
+    }
+    unsigned int* tri = &mTriangles[3 * k];
+    touched.insert(touched.end(), tri, tri + 3);
+    if (tri[0] == t || tri[1] == t || tri[2] == t) {
+      mAlive[k] = 0;
+      mLive--;
+      continue;
+    }
+    for (int c = 0; c < 3; ++c) {
+      if (tri[c] == v) {
+        tri[c] = t;
+      }
+    }
+    mAround[t].push_back(k);
+  }
+  std::vector<unsigned int>().swap(mAround[v]);
+  mKind[v] = REMOVED;
+  // Forget the dead triangles of the target
+  std::vector<unsigned int>& around = mAround[t];
+  around.erase(std::remove_if(around.begin(), around.end(), [this](unsigned int k) {
+    return !mAlive[k];
+  }), around.end());
+}
+
+void Collapser::updateLoops(unsigned int v, unsigned int t) {
+  if (mLoop[v] == t) {
+    unsigned int previous = mLoopBack[v];
+    mLoopBack[t] = previous;
+    if (previous != NONE) {
+      mLoop[previous] = t;
+    }
+  } else if (mLoopBack[v] == t) {
+    unsigned int next = mLoop[v];
+    mLoop[t] = next;
+    if (next != NONE) {
+      mLoopBack[next] = t;
+    }
+  }
+}
+
+void Collapser::collapse(unsigned int v, unsigned int t, std::vector<unsigned int>& touched) {
+  unsigned char kind = mKind[v];
+  Quadric& target = mQuadrics[mRepresentative[t]];
+  accumulate(target, mQuadrics[mRepresentative[v]]);
+  if (target.weight > 0.0) {
+    mError = std::max(mError, std::sqrt(evaluate(target, mPositions[t]) / target.weight));
+  }
+  mArea[t] += mArea[v];
+  touched.clear();
+  if (kind == SEAM) {
+    unsigned int vTwin = mWedge[v];
+    unsigned int tTwin = mWedge[t];
+    mArea[tTwin] += mArea[vTwin];
+    updateLoops(vTwin, tTwin);
+    moveTriangles(vTwin, tTwin, touched);
+  }
+  if (kind != MANIFOLD) {
+    updateLoops(v, t);
+  }
+  moveTriangles(v, t, touched);
+  // The costs change around the target
+  for (unsigned int k : mAround[t]) {
+    touched.insert(touched.end(), &mTriangles[3 * k], &mTriangles[3 * k] + 3);
+  }
+  if (kind == SEAM) {
+    for (unsigned int k : mAround[mWedge[t]]) {
+      touched.insert(touched.end(), &mTriangles[3 * k], &mTriangles[3 * k] + 3);
+    }
+  }
+}
+
+SimplifiedLevel Collapser::snapshot() const {
+  SimplifiedLevel level;
+  level.indices.reserve(mLive * 3);
+  for (size_t t = 0; t < mAlive.size(); ++t) {
+    if (mAlive[t]) {
+      level.indices.insert(level.indices.end(), &mTriangles[3 * t], &mTriangles[3 * t] + 3);
+    }
+  }
+  level.error = static_cast<float>(mError) * mExtent;
+  return level;
+}
+
+bool Collapser::cheaper(unsigned int a, unsigned int b) const {
+  return mCost[a] < mCost[b];
+}
+
+void Collapser::heapPlace(size_t place, unsigned int v) {
+  mHeap[place] = v;
+  mHeapPlace[v] = static_cast<unsigned int>(place);
+}
+
+void Collapser::siftUp(size_t place) {
+  unsigned int v = mHeap[place];
+  while (place > 0) {
+    size_t parent = (place - 1) / 2;
+    if (!cheaper(v, mHeap[parent])) {
+      break;
+    }
+    heapPlace(place, mHeap[parent]);
+    place = parent;
+  }
+  heapPlace(place, v);
+}
+
+void Collapser::siftDown(size_t place) {
+  const size_t size = mHeap.size();
+  unsigned int v = mHeap[place];
+  for (;;) {
+    size_t child = 2 * place + 1;
+    if (child >= size) {
+      break;
+    }
+    if (child + 1 < size && cheaper(mHeap[child + 1], mHeap[child])) {
+      child++;
+    }
+    if (!cheaper(mHeap[child], v)) {
+      break;
+    }
+    heapPlace(place, mHeap[child]);
+    place = child;
+  }
+  heapPlace(place, v);
+}
+
+void Collapser::heapRemove(unsigned int v) {
+  size_t place = mHeapPlace[v];
+  if (place == NONE) {
+    return;
+  }
+  mHeapPlace[v] = NONE;
+  unsigned int last = mHeap.back();
+  mHeap.pop_back();
+  if (last != v) {
+    heapPlace(place, last);
+    siftUp(place);
+    siftDown(mHeapPlace[last]);
+  }
+}
+
+void Collapser::heapImprove(unsigned int v, unsigned int t) {
+  bool adjacent = false;
+  for (unsigned int k : mAround[v]) {
+    const unsigned int* tri = &mTriangles[3 * k];
+    if (mAlive[k] && (tri[0] == t || tri[1] == t || tri[2] == t)) {
+      adjacent = true;
+      break;
+    }
+  }
+  if (adjacent && allowed(v, t)) {
+    float c = cost(v, t);
+    if (c < mCost[v]) {
+      mTarget[v] = t;
+      mCost[v] = c;
+      siftUp(mHeapPlace[v]);
+    }
+  }
+}
+
+void Collapser::heapUpdate(unsigned int v, bool checkFlips) {
+  mChecked[v] = checkFlips ? 1 : 0;
+  if (!findCollapse(v, checkFlips, mTarget[v], mCost[v])) {
+    heapRemove(v);
+    return;
+  }
+  if (mHeapPlace[v] == NONE) {
+    mHeap.push_back(v);
+    mHeapPlace[v] = static_cast<unsigned int>(mHeap.size() - 1);
+  }
+  siftUp(mHeapPlace[v]);
+  siftDown(mHeapPlace[v]);
+}
+
+std::vector<SimplifiedLevel> Collapser::run(const std::vector<size_t>& targets) {
+  std::vector<SimplifiedLevel> levels;
+  levels.reserve(targets.size());
+  auto reached = [&]() {
+    while (levels.size() < targets.size() && mLive <= targets[levels.size()]) {
+      levels.push_back(snapshot());
+    }
+    return levels.size() == targets.size();
+  };
+  if (reached()) {
+    return levels;
+  }
+  // The first collapses do not change the mesh, so they are found in parallel
+  const size_t n = mVertices.size();
+  mTarget.assign(n, NONE);
+  mCost.assign(n, 0.0f);
+  mChecked.assign(n, 0);
+  std::vector<unsigned char> found(n, 0);
+  parallel::forEachRange(n, [&](size_t begin, size_t end) {
+    for (size_t v = begin; v < end; ++v) {
+      found[v] = findCollapse(static_cast<unsigned int>(v), false, mTarget[v], mCost[v]);
+    }
+  });
+  mHeapPlace.assign(n, NONE);
+  for (size_t v = 0; v < n; ++v) {
+    if (found[v]) {
+      mHeapPlace[v] = static_cast<unsigned int>(mHeap.size());
+      mHeap.push_back(static_cast<unsigned int>(v));
+    }
+  }
+  for (size_t place = mHeap.size() / 2; place-- > 0;) {
+    siftDown(place);
+  }
+  std::vector<unsigned int> touched;
+  while (!mHeap.empty()) {
+    unsigned int v = mHeap.front();
+    unsigned int t = mTarget[v];
+    if (!mChecked[v] && !keepsOrientation(v, t)) {
+      // Look for the best collapse that does not flip triangles
+      heapUpdate(v, true);
+      continue;
+    }
+    unsigned int twin = mWedge[v];
+    unsigned int targetTwin = mWedge[t];
+    bool seam = mKind[v] == SEAM;
+    collapse(v, t, touched);
+    heapRemove(v);
+    if (seam) {
+      heapRemove(twin);
+    }
+    if (reached()) {
+      break;
+    }
+    // The costs change around the target
+    mMarkStamp++;
+    for (unsigned int u : touched) {
+      if (mMark[u] == mMarkStamp || mKind[u] == REMOVED) {
+        continue;
+      }
+      mMark[u] = mMarkStamp;
+      unsigned int best = mTarget[u];
+      if (mKind[u] != MANIFOLD || mHeapPlace[u] == NONE || u == t || best == v || best == t ||
+          (seam && (u == targetTwin || best == twin || best == targetTwin))) {
+        heapUpdate(u, false);
+      } else {
+        // Only the collapses to the target changed, the others keep their cost
+        mChecked[u] = 0;
+        heapImprove(u, t);
+        if (seam) {
+          heapImprove(u, targetTwin);
+        }
+      }
+    }
+  }
+  // No more collapses are possible, the rest of the levels stay as they are
+  while (levels.size() < targets.size()) {
+    levels.push_back(snapshot());
+  }
+  return levels;
+}
+
+} // namespace
+
+Simplifier::Simplifier(float normalWeight, float textCoordsWeight) :
+    mNormalWeight(normalWeight), mTextCoordsWeight(textCoordsWeight) {
+
+}
+
+std::vector<SimplifiedLevel> Simplifier::simplify(ArrayView<Vertex> vertices,
+    ArrayView<unsigned int> indices, const std::vector<size_t>& targetTriangles) const {
+  Collapser collapser(vertices, indices, mNormalWeight, mTextCoordsWeight);
+  return collapser.run(targetTriangles);
+}
+
+} // namespace mesh
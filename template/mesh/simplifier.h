@@ -0,0 +1,69 @@
+#ifndef MESH_SIMPLIFIER_H_
+#define MESH_SIMPLIFIER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "mesh.h"
+
+namespace mesh {
+
+//! One level of detail created by the \class Simplifier
+struct SimplifiedLevel {
+  //! The triangles of this level (they use the same vertices as the original)
+  std::vector<unsigned int> indices;
+  //! Biggest distance (in model units) of the surface to the original one
+  /*!
+    It is estimated with the quadrics of the collapses done until this level,
+    so it is an approximation, but it never decreases between levels.
+  */
+  float error;
+};
+
+//! Reduces the triangles of a mesh with quadric error edge collapses
+/*!
+  Every collapse moves a vertex onto one of its neighbours (half edge
+  collapse, Garland and Heckbert. 1997. Surface simplification using quadric
+  error metrics), so the simplified triangles still index the original
+  vertices: all the levels of detail share the same vertex buffer.
+
+  The cost of a collapse is the quadric error of the vertices, plus the change
+  of the normal and texture coordinates weighted by the area around the vertex
+  that disappears. Vertices on the borders of the mesh, or on seams (the same
+  position with different normal or texture coordinates) only move along the
+  border or seam, so holes and texture charts keep their shape. Vertices where
+  the topology is more complex never move.
+
+  The collapses are taken from a heap (cheapest first), the quadrics of the
+  original vertices are computed in parallel.
+*/
+class Simplifier {
+public:
+  //! Default weight of the normals and texture coordinates in the cost
+  static const float DEFAULT_ATTRIBUTE_WEIGHT;
+  //! Creates a simplifier with the given weights for the attributes
+  /*!
+    @param normalWeight weight of the normal change (one minus the cosine)
+    @param textCoordsWeight weight of the squared texture coordinates change
+  */
+  explicit Simplifier(float normalWeight = DEFAULT_ATTRIBUTE_WEIGHT,
+      float textCoordsWeight = DEFAULT_ATTRIBUTE_WEIGHT);
+  //! Simplify the triangles to several numbers of triangles, in a single pass
+  /*!
+    @param vertices the vertices used by the triangles
+    @param indices the triangles (three indices each)
+    @param targetTriangles number of triangles of every level, in decreasing order
+    @return one level per target. A level has more triangles than its target
+    only if no more collapses were possible
+  */
+  std::vector<SimplifiedLevel> simplify(ArrayView<Vertex> vertices,
+      ArrayView<unsigned int> indices, const std::vector<size_t>& targetTriangles) const;
+
+private:
+  float mNormalWeight;
+  float mTextCoordsWeight;
+};
+
+} // namespace mesh
+
+#endif
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cmath>
+
+#include "../parallel/threadpool.h"
+
+#include "tangentspace.h"
+
+namespace mesh {
+
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+
+namespace {
+
+// Orientation of the texture coordinates of a triangle
+enum Orientation {DEGENERATED = 0, PRESERVED = 1, MIRRORED = 2};
+
+// Angle between two edges (zero if one of them is degenerated)
+float cornerAngle(const vec3& a, const vec3& b) {
+  float lengths = std::sqrt(glm::length2(a) * glm::length2(b));
+  return lengths > 0.0f ? std::acos(glm::clamp(glm::dot(a, b) / lengths, -1.0f, 1.0f)) : 0.0f;
+}
+
+// Any unit vector orthogonal to n
+vec3 orthogonal(const vec3& n) {
+  vec3 axis = std::fabs(n.x) < 0.57735f ? vec3(1.0f, 0.0f, 0.0f) :
+      (std::fabs(n.y) < 0.57735f ? vec3(0.0f, 1.0f, 0.0f) : vec3(0.0f, 0.0f, 1.0f));
+  vec3 t = glm::cross(n, axis);
+  return glm::length2(t) > 0.0f ? glm::normalize(t) : vec3(1.0f, 0.0f, 0.0f);
+}
+
+} // namespace
+
+size_t generateTangents(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices,
+    std::vector<vec4>& tangents) {
+  const size_t n = vertices.size();
+  const size_t triangles = indices.size() / 3;
+  // First pass: the tangent of every triangle and its angles
+  std::vector<vec3> directions(triangles);
+  std::vector<unsigned char> orientations(triangles);
+  std::vector<float> angles(3 * triangles);
+  parallel::forEachRange(triangles, [&](size_t first, size_t last) {
+    for (size_t t = first; t < last; ++t) {
+      const Vertex& v0 = vertices[indices[3 * t]];
+      const Vertex& v1 = vertices[indices[3 * t + 1]];
+      const Vertex& v2 = vertices[indices[3 * t + 2]];
+      vec3 e01 = v1.position - v0.position;
+      vec3 e02 = v2.position - v0.position;
+      vec3 e12 = v2.position - v1.position;
+      vec2 d01 = v1.textCoords - v0.textCoords;
+      vec2 d02 = v2.textCoords - v0.textCoords;
+      // Twice the signed area in texture space
+      float area = d01.x * d02.y - d01.y * d02.x;
+      vec3 s = (area > 0.0f ? 1.0f : -1.0f) * (d02.y * e01 - d01.y * e02);
+      bool valid = area != 0.0f && glm::length2(s) > 0.0f;
+      directions[t] = valid ? glm::normalize(s) : vec3(0.0f);
+      orientations[t] = static_cast<unsigned char>(!valid ? DEGENERATED :
+          (area > 0.0f ? PRESERVED : MIRRORED));
+      angles[3 * t] = cornerAngle(e01, e02);
+      angles[3 * t + 1] = cornerAngle(-e01, e12);
+      angles[3 * t + 2] = cornerAngle(e02, e12);
+    }
+  });
+  // The corners of vertex v are corners[offsets[v]] ... corners[offsets[v + 1] - 1]
+  std::vector<unsigned int> offsets(n + 1, 0);
+  std::vector<unsigned int> corners(3 * triangles);
+  for (size_t i = 0; i < 3 * triangles; ++i) {
+    offsets[indices[i] + 1]++;
+  }
+  for (size_t v = 0; v < n; ++v) {
+    offsets[v + 1] += offsets[v];
+  }
+  {
+    std::vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < 3 * triangles; ++i) {
+      corners[cursor[indices[i]]++] = static_cast<unsigned int>(i);
+    }
+  }
+  // The orientation of the first valid corner keeps the vertex, the other one
+  // (if any) needs a copy
+  auto firstOrientation = [&](size_t v) {
+    for (unsigned int k = offsets[v]; k < offsets[v + 1]; ++k) {
+      if (orientations[corners[k] / 3] != DEGENERATED) {
+        return orientations[corners[k] / 3];
+      }
+    }
+    return static_cast<unsigned char>(PRESERVED);
+  };
+  std::vector<unsigned int> added(n + 1, 0);
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    for (size_t v = first; v < last; ++v) {
+      unsigned char kept = firstOrientation(v);
+      for (unsigned int k = offsets[v]; k < offsets[v + 1]; ++k) {
+        unsigned char orientation = orientations[corners[k] / 3];
+        if (orientation != DEGENERATED && orientation != kept) {
+          added[v + 1] = 1;
+          break;
+        }
+      }
+    }
+  });
+  for (size_t v = 0; v < n; ++v) {
+    added[v + 1] += added[v];
+  }
+  vertices.resize(n + added[n]);
+  tangents.assign(vertices.size(), vec4(1.0f, 0.0f, 0.0f, 1.0f));
+  // Second pass: every vertex adds the projected tangents of its corners
+  parallel::forEachRange(n, [&](size_t first, size_t last) {
+    for (size_t v = first; v < last; ++v) {
+      if (offsets[v] == offsets[v + 1]) {
+        continue;
+      }
+      const vec3 normal = vertices[v].normal;
+      unsigned char kept = firstOrientation(v);
+      vec3 sums[2] = {vec3(0.0f), vec3(0.0f)};
+      for (unsigned int k = offsets[v]; k < offsets[v + 1]; ++k) {
+        unsigned int corner = corners[k];
+        unsigned char orientation = orientations[corner / 3];
+        if (orientation == DEGENERATED) {
+          continue;
+        }
+        vec3 s = directions[corner / 3];
+        s -= normal * glm::dot(normal, s);
+        if (glm::length2(s) > 0.0f) {
+          sums[orientation == kept ? 0 : 1] += angles[corner] * glm::normalize(s);
+        }
+      }
+      for (int g = 0; g < (added[v + 1] > added[v] ? 2 : 1); ++g) {
+        size_t target = g == 0 ? v : n + added[v];
+        bool mirrored = (g == 0) == (kept == MIRRORED);
+        // Orthogonal to the normal, whatever the sum did
+        vec3 t = sums[g] - normal * glm::dot(normal, sums[g]);
+        t = glm::length2(t) > 0.0f ? glm::normalize(t) : orthogonal(normal);
+        tangents[target] = vec4(t, mirrored ? -1.0f : 1.0f);
+        if (g == 1) {
+          vertices[target] = vertices[v];
+        }
+      }
+      if (added[v + 1] > added[v]) {
+        for (unsigned int k = offsets[v]; k < offsets[v + 1]; ++k) {
+          unsigned char orientation = orientations[corners[k] / 3];
+          if (orientation != DEGENERATED && orientation != kept) {
+            indices[corners[k]] = static_cast<unsigned int>(n + added[v]);
+          }
+        }
+      }
+    }
+  });
+  return added[n];
+}
+
+} // namespace mesh
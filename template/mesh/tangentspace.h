@@ -0,0 +1,37 @@
+#ifndef MESH_TANGENT_SPACE_H_
+#define MESH_TANGENT_SPACE_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "mesh.h"
+
+namespace mesh {
+
+//! Compute the tangent space of every vertex for normal mapping
+/*!
+  It follows the rules of MikkTSpace (the de facto standard of the baking
+  tools): the tangent of every triangle is the direction in which the s
+  texture coordinate grows, projected into the plane of the vertex normal and
+  weighted by the angle of the triangle at the vertex. The result is
+  orthogonal to the normal and its w component is the sign of the bitangent
+  (bitangent = w * cross(normal, tangent)).
+
+  Triangles with mirrored texture coordinates are never averaged with the
+  others: a vertex used by both kinds is split and the copy is added at the end.
+
+  As \class NormalGenerator, it works in parallel passes over the triangles
+  and then over the vertices (with a vertex to corner adjacency), so no
+  atomics are needed. The vertices need normals and texture coordinates.
+  @param vertices positions, normals and texture coordinates are read. Split
+  vertices are added at the end
+  @param indices three per triangle, the corners of split vertices are updated
+  @param tangents output, one per vertex (also for the added ones)
+  @return the number of vertices added
+*/
+size_t generateTangents(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices,
+    std::vector<glm::vec4>& tangents);
+
+} // namespace mesh
+
+#endif
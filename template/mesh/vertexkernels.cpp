@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+// The AVX2 kernel is compiled for its own target and only called if the CPU has it
+#if defined(__SSE2__) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MESH_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
+#include "../parallel/threadpool.h"
+
+#include "vertexkernels.h"
+
+namespace mesh {
+
+using glm::vec3;
+using glm::mat4;
+
+namespace {
+
+// Vertices per parallel block
+const size_t GRAIN = 16384;
+// A vertex is 8 floats: position, normal and texture coordinates
+const size_t STRIDE = 8;
+static_assert(sizeof(Vertex) == STRIDE * sizeof(float), "Vertex must be 8 floats");
+
+// The transform as an 8 x 8 affine matrix over the floats of a vertex:
+// out = (in & keep) + translation + sum(in[k] * columns[k]) for k < 6
+struct Affine {
+  float columns[6][STRIDE];
+  float translation[STRIDE];
+  unsigned int keep[STRIDE];
+};
+
+Affine makeAffine(const mat4& T, bool normals) {
+  Affine a = {};
+  mat4 normalMat = glm::inverse(glm::transpose(T));
+  for (int k = 0; k < 3; ++k) {
+    for (int r = 0; r < 3; ++r) {
+      a.columns[k][r] = T[k][r];
+      a.columns[k + 3][r + 3] = normals ? normalMat[k][r] : 0.0f;
+    }
+    a.translation[k] = T[3][k];
+  }
+  for (size_t r = 3; r < STRIDE; ++r) {
+    a.keep[r] = (r >= 6 || !normals) ? 0xFFFFFFFFu : 0u;
+  }
+  return a;
+}
+
+void transformScalar(float* p, size_t count, const mat4& T, bool normals, vec3& lower,
+    vec3& upper) {
+  glm::mat3 M(T);
+  glm::mat3 N(glm::inverse(glm::transpose(T)));
+  vec3 t(T[3]);
+  for (size_t i = 0; i < count; ++i, p += STRIDE) {
+    vec3 q = M * vec3(p[0], p[1], p[2]) + t;
+    p[0] = q.x;
+    p[1] = q.y;
+    p[2] = q.z;
+    lower = glm::min(lower, q);
+    upper = glm::max(upper, q);
+    if (normals) {
+      vec3 n = N * vec3(p[3], p[4], p[5]);
+      p[3] = n.x;
+      p[4] = n.y;
+      p[5] = n.z;
+    }
+  }
+}
+
+void boundsScalar(const float* p, size_t count, vec3& lower, vec3& upper) {
+  for (size_t i = 0; i < count; ++i, p += STRIDE) {
+    vec3 q(p[0], p[1], p[2]);
+    lower = glm::min(lower, q);
+    upper = glm::max(upper, q);
+  }
+}
+
+#if defined(__SSE2__)
+// Merge the three first lanes of the registers into the bounds
+void mergeBounds(__m128 low, __m128 high, vec3& lower, vec3& upper) {
+  float l[4];
+  float h[4];
+  _mm_storeu_ps(l, low);
+  _mm_storeu_ps(h, high);
+  lower = glm::min(lower, vec3(l[0], l[1], l[2]));
+  upper = glm::max(upper, vec3(h[0], h[1], h[2]));
+}
+
+// The vertex in two halves: [px py pz nx] and [ny nz u v]
+template <bool NORMALS>
+void transformSse2(float* p, size_t count, const Affine& a, vec3& lower, vec3& upper) {
+  __m128 low[6];
+  __m128 high[3];
+  for (int k = 0; k < 6; ++k) {
+    low[k] = _mm_loadu_ps(a.columns[k]);
+  }
+  for (int k = 0; k < 3; ++k) {
+    high[k] = _mm_loadu_ps(a.columns[k + 3] + 4);
+  }
+  const __m128 translation = _mm_loadu_ps(a.translation);
+  const __m128 keepLow = _mm_loadu_ps(reinterpret_cast<const float*>(a.keep));
+  const __m128 keepHigh = _mm_loadu_ps(reinterpret_cast<const float*>(a.keep) + 4);
+  __m128 boxLow = _mm_set1_ps(FLT_MAX);
+  __m128 boxHigh = _mm_set1_ps(-FLT_MAX);
+  for (size_t i = 0; i < count; ++i, p += STRIDE) {
+    __m128 x = _mm_load1_ps(p);
+    __m128 y = _mm_load1_ps(p + 1);
+    __m128 z = _mm_load1_ps(p + 2);
+    __m128 outLow = _mm_add_ps(_mm_and_ps(_mm_loadu_ps(p), keepLow), translation);
+    outLow = _mm_add_ps(outLow, _mm_add_ps(_mm_mul_ps(x, low[0]),
+        _mm_add_ps(_mm_mul_ps(y, low[1]), _mm_mul_ps(z, low[2]))));
+    if (NORMALS) {
+      __m128 nx = _mm_load1_ps(p + 3);
+      __m128 ny = _mm_load1_ps(p + 4);
+      __m128 nz = _mm_load1_ps(p + 5);
+      outLow = _mm_add_ps(outLow, _mm_add_ps(_mm_mul_ps(nx, low[3]),
+          _mm_add_ps(_mm_mul_ps(ny, low[4]), _mm_mul_ps(nz, low[5]))));
+      __m128 outHigh = _mm_and_ps(_mm_loadu_ps(p + 4), keepHigh);
+      outHigh = _mm_add_ps(outHigh, _mm_add_ps(_mm_mul_ps(nx, high[0]),
+          _mm_add_ps(_mm_mul_ps(ny, high[1]), _mm_mul_ps(nz, high[2]))));
+      _mm_storeu_ps(p + 4, outHigh);
+    }
+    _mm_storeu_ps(p, outLow);
+    boxLow = _mm_min_ps(boxLow, outLow);
+    boxHigh = _mm_max_ps(boxHigh, outLow);
+  }
+  mergeBounds(boxLow, boxHigh, lower, upper);
+}
+
+void boundsSse2(const float* p, size_t count, vec3& lower, vec3& upper) {
+  __m128 boxLow = _mm_set1_ps(FLT_MAX);
+  __m128 boxHigh = _mm_set1_ps(-FLT_MAX);
+  for (size_t i = 0; i < count; ++i, p += STRIDE) {
+    __m128 position = _mm_loadu_ps(p);
+    boxLow = _mm_min_ps(boxLow, position);
+    boxHigh = _mm_max_ps(boxHigh, position);
+  }
+  mergeBounds(boxLow, boxHigh, lower, upper);
+}
+#endif
+
+#if defined(MESH_AVX2_KERNELS)
+// The whole vertex in a register, the broadcasts come straight from memory
+template <bool NORMALS>
+__attribute__((target("avx2,fma")))
+void transformAvx2(float* p, size_t count, const Affine& a, vec3& lower, vec3& upper) {
+  __m256 columns[6];
+  for (int k = 0; k < 6; ++k) {
+    columns[k] = _mm256_loadu_ps(a.columns[k]);
+  }
+  const __m256 translation = _mm256_loadu_ps(a.translation);
+  const __m256 keep = _mm256_loadu_ps(reinterpret_cast<const float*>(a.keep));
+  __m256 boxLow = _mm256_set1_ps(FLT_MAX);
+  __m256 boxHigh = _mm256_set1_ps(-FLT_MAX);
+  for (size_t i = 0; i < count; ++i, p += STRIDE) {
+    __m256 out = _mm256_add_ps(_mm256_and_ps(_mm256_loadu_ps(p), keep), translation);
+    out = _mm256_fmadd_ps(_mm256_broadcast_ss(p), columns[0], out);
+    out = _mm256_fmadd_ps(_mm256_broadcast_ss(p + 1), columns[1], out);
+    out = _mm256_fmadd_ps(_mm256_broadcast_ss(p + 2), columns[2], out);
+    if (NORMALS) {
+      out = _mm256_fmadd_ps(_mm256_broadcast_ss(p + 3), columns[3], out);
+      out = _mm256_fmadd_ps(_mm256_broadcast_ss(p + 4), columns[4], out);
+      out = _mm256_fmadd_ps(_mm256_broadcast_ss(p + 5), columns[5], out);
+    }
+    _mm256_storeu_ps(p, out);
+    boxLow = _mm256_min_ps(boxLow, out);
+    boxHigh = _mm256_max_ps(boxHigh, out);
+  }
+  mergeBounds(_mm256_castps256_ps128(boxLow), _mm256_castps256_ps128(boxHigh), lower, upper);
+}
+#endif
+
+// A path this build and this CPU can run
+VertexKernelPath supported(VertexKernelPath path) {
+  return std::min(path, bestVertexKernelPath());
+}
+
+void transformRange(float* p, size_t count, const mat4& T, const Affine& a, bool normals,
+    vec3& lower, vec3& upper, VertexKernelPath path) {
+  switch (path) {
+#if defined(MESH_AVX2_KERNELS)
+    case KERNEL_AVX2:
+      if (normals) {
+        transformAvx2<true>(p, count, a, lower, upper);
+      } else {
+        transformAvx2<false>(p, count, a, lower, upper);
+      }
+      return;
+#endif
+#if defined(__SSE2__)
+    case KERNEL_SSE2:
+      if (normals) {
+        transformSse2<true>(p, count, a, lower, upper);
+      } else {
+        transformSse2<false>(p, count, a, lower, upper);
+      }
+      return;
+#endif
+    default:
+      transformScalar(p, count, T, normals, lower, upper);
+  }
+}
+
+void boundsRange(const float* p, size_t count, vec3& lower, vec3& upper, VertexKernelPath path) {
+#if defined(__SSE2__)
+  // Only loads and min/max: SSE2 is already limited by the memory
+  if (path != KERNEL_SCALAR) {
+    boundsSse2(p, count, lower, upper);
+    return;
+  }
+#endif
+  boundsScalar(p, count, lower, upper);
+}
+
+// Run a kernel over blocks of the vertices in parallel, then merge the bounds of the blocks
+template <typename Kernel>
+void forEachBlock(size_t count, vec3& lower, vec3& upper, const Kernel& kernel) {
+  lower = vec3(FLT_MAX);
+  upper = vec3(-FLT_MAX);
+  size_t blocks = parallel::chunksFor(count, GRAIN);
+  if (blocks <= 1) {
+    kernel(0, count, lower, upper);
+    return;
+  }
+  std::vector<vec3> lowers(blocks, vec3(FLT_MAX));
+  std::vector<vec3> uppers(blocks, vec3(-FLT_MAX));
+  parallel::forEachRange(blocks, [&](size_t first, size_t last) {
+    for (size_t b = first; b < last; ++b) {
+      size_t begin = b * count / blocks;
+      size_t end = (b + 1) * count / blocks;
+      kernel(begin, end - begin, lowers[b], uppers[b]);
+    }
+  }, 1);
+  for (size_t b = 0; b < blocks; ++b) {
+    lower = glm::min(lower, lowers[b]);
+    upper = glm::max(upper, uppers[b]);
+  }
+}
+
+} // namespace
+
+VertexKernelPath bestVertexKernelPath() {
+#if defined(MESH_AVX2_KERNELS)
+  static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  if (avx2) {
+    return KERNEL_AVX2;
+  }
+#endif
+#if defined(__SSE2__)
+  return KERNEL_SSE2;
+#else
+  return KERNEL_SCALAR;
+#endif
+}
+
+const char* vertexKernelName(VertexKernelPath path) {
+  switch (path) {
+    case KERNEL_AVX2:
+      return "AVX2";
+    case KERNEL_SSE2:
+      return "SSE2";
+    default:
+      return "scalar";
+  }
+}
+
+void transformVertices(Vertex* vertices, size_t count, const mat4& T, bool normals,
+    vec3& lower, vec3& upper, VertexKernelPath path) {
+  path = supported(path);
+  float* p = reinterpret_cast<float*>(vertices);
+  const Affine a = makeAffine(T, normals);
+  forEachBlock(count, lower, upper, [&](size_t first, size_t n, vec3& low, vec3& high) {
+    transformRange(p + first * STRIDE, n, T, a, normals, low, high, path);
+  });
+}
+
+void transformTangents(glm::vec4* tangents, size_t count, const mat4& T) {
+  glm::mat3 M(T);
+  float flip = glm::determinant(M) < 0.0f ? -1.0f : 1.0f;
+  parallel::forEachRange(count, [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      glm::vec4& t = tangents[i];
+      vec3 tangent = M * vec3(t);
+      float length = glm::length(tangent);
+      t = glm::vec4(length > 0.0f ? tangent / length : vec3(t), flip * t.w);
+    }
+  }, GRAIN);
+}
+
+void vertexBounds(const Vertex* vertices, size_t count, vec3& lower, vec3& upper,
+    VertexKernelPath path) {
+  path = supported(path);
+  const float* p = reinterpret_cast<const float*>(vertices);
+  forEachBlock(count, lower, upper, [&](size_t first, size_t n, vec3& low, vec3& high) {
+    boundsRange(p + first * STRIDE, n, low, high, path);
+  });
+}
+
+} // namespace mesh
@@ -0,0 +1,47 @@
+#ifndef MESH_VERTEX_KERNELS_H_
+#define MESH_VERTEX_KERNELS_H_
+
+#include <cstddef>
+
+#include "mesh.h"
+
+namespace mesh {
+
+//! Instruction sets of the vertex kernels (See transformVertices)
+enum VertexKernelPath {KERNEL_SCALAR, KERNEL_SSE2, KERNEL_AVX2};
+
+//! The fastest path supported by this CPU (checked once, at run time)
+VertexKernelPath bestVertexKernelPath();
+
+//! Name of a path, for the menu and the logs
+const char* vertexKernelName(VertexKernelPath path);
+
+//! Transform the vertices in place and compute their bounding box, in one pass
+/*!
+  Positions are transformed as points (w = 1, without the perspective divide)
+  and, if normals is true, the normals by the inverse transpose of T (they are
+  not normalized). The texture coordinates are kept.
+
+  The whole vertex is handled at once: with AVX2 it is a single 8-wide affine
+  transform (six multiply-adds and one store), with SSE2 two 4-wide halves.
+  The new bounds come from the transformed registers, so there is no second
+  pass over the vertices. Big ranges are split in blocks that run in parallel.
+  @param path forced instruction set, it falls back to the best supported one
+*/
+void transformVertices(Vertex* vertices, size_t count, const glm::mat4& T, bool normals,
+    glm::vec3& lower, glm::vec3& upper, VertexKernelPath path = bestVertexKernelPath());
+
+//! Transform tangents (See Mesh::viewTangents) by the upper 3x3 of T
+/*!
+  The directions are normalized again and the sign of the bitangent (w) is
+  flipped if T is a mirror.
+*/
+void transformTangents(glm::vec4* tangents, size_t count, const glm::mat4& T);
+
+//! Bounding box of the positions (FLT_MAX and -FLT_MAX if there are no vertices)
+void vertexBounds(const Vertex* vertices, size_t count, glm::vec3& lower, glm::vec3& upper,
+    VertexKernelPath path = bestVertexKernelPath());
+
+} // namespace mesh
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef VERTEX_LAYOUT_H_
+#define VERTEX_LAYOUT_H_
+
+#include <array>
+#include <cfloat>
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "mesh.h"
+
+namespace mesh {
+
+//! Vertex attributes that can be part of a \struct VertexFormat
+/*!
+  Each attribute knows its type, its number of (float) components and how to
+  read it from the \struct Vertex used by \class Mesh and \class Model.
+*/
+struct Position {
+  typedef glm::vec3 Type;
+  static const GLint COMPONENTS = 3;
+  static Type from(const Vertex& v) { return v.position; }
+};
+//! The normal vector attribute (See \struct Position)
+struct Normal {
+  typedef glm::vec3 Type;
+  static const GLint COMPONENTS = 3;
+  static Type from(const Vertex& v) { return v.normal; }
+};
+//! The texture coordinates attribute (See \struct Position)
+struct TextCoords {
+  typedef glm::vec2 Type;
+  static const GLint COMPONENTS = 2;
+  static Type from(const Vertex& v) { return v.textCoords; }
+};
+
+//! How the attributes of a vertex buffer are stored
+/*!
+  INTERLEAVED (array of structures) keeps all the attributes of a vertex
+  together in one buffer. SPLIT (structure of arrays) uses one buffer per
+  attribute, so a pass that only needs positions (depth only, shadows) only
+  fetches the position buffer.
+*/
+enum Storage {INTERLEAVED, SPLIT};
+
+namespace detail {
+// Total number of floats of a list of attributes
+template <typename... A> struct FloatCount;
+template <> struct FloatCount<> {
+  static const size_t value = 0;
+};
+template <typename H, typename... T> struct FloatCount<H, T...> {
+  static const size_t value = H::COMPONENTS + FloatCount<T...>::value;
+};
+// Place of attribute X in a list of attributes
+template <typename X, typename... A> struct AttributeIndex;
+template <typename X, typename... T> struct AttributeIndex<X, X, T...> {
+  static const size_t value = 0;
+};
+template <typename X, typename H, typename... T> struct AttributeIndex<X, H, T...> {
+  static const size_t value = 1 + AttributeIndex<X, T...>::value;
+};
+// Number of floats before attribute X in a list of attributes
+template <typename X, typename... A> struct FloatOffset;
+template <typename X, typename... T> struct FloatOffset<X, X, T...> {
+  static const size_t value = 0;
+};
+template <typename X, typename H, typename... T> struct FloatOffset<X, H, T...> {
+  static const size_t value = H::COMPONENTS + FloatOffset<X, T...>::value;
+};
+// Unrolls the attribute setup at compile time
+template <typename Format, typename... A> struct AttributeSetup;
+template <typename Format> struct AttributeSetup<Format> {
+  static void apply(const GLint*, const GLuint*) {}
+};
+template <typename Format, typename H, typename... T> struct AttributeSetup<Format, H, T...> {
+  static void apply(const GLint* locations, const GLuint* buffers) {
+    // Attributes that the shader does not use have location -1
+    if (*locations >= 0) {
+      GLuint location = static_cast<GLuint>(*locations);
+      glBindBuffer(GL_ARRAY_BUFFER, buffers[Format::template bufferOf<H>()]);
+      glEnableVertexAttribArray(location);
+      glVertexAttribPointer(location, H::COMPONENTS, GL_FLOAT, GL_FALSE,
+          Format::template strideOf<H>(),
+          reinterpret_cast<const GLvoid*>(Format::template offsetOf<H>()));
+    }
+    AttributeSetup<Format, T...>::apply(locations + 1, buffers);
+  }
+};
+} // namespace detail
+
+//! Describes at compile time the attributes of a vertex and how they are stored
+/*!
+  For example, VertexFormat<SPLIT, Position, Normal> is a vertex with a position
+  and a normal, stored in two buffers. All the strides and offsets are compile
+  time constants, and \fn setupAttributes generates the glVertexAttribPointer
+  calls for it.
+*/
+template <Storage S, typename... A>
+struct VertexFormat {
+  static_assert(sizeof...(A) > 0, "A vertex format needs at least one attribute");
+  //! Number of attributes
+  static const size_t ATTRIBUTES = sizeof...(A);
+  //! Number of floats per vertex (adding all the attributes)
+  static const size_t FLOATS = detail::FloatCount<A...>::value;
+  //! Number of vertex buffers needed to store this format
+  static const size_t BUFFERS = S == INTERLEAVED ? 1 : sizeof...(A);
+  //! Stride (in bytes) between two consecutive values of attribute X
+  template <typename X> static GLsizei strideOf() {
+    return static_cast<GLsizei>((S == INTERLEAVED ? FLOATS : X::COMPONENTS) * sizeof(float));
+  }
+  //! Offset (in bytes) of attribute X from the start of its buffer
+  template <typename X> static size_t offsetOf() {
+    return S == INTERLEAVED ? detail::FloatOffset<X, A...>::value * sizeof(float) : 0;
+  }
+  //! Offset (in floats) of attribute X inside an interleaved vertex
+  template <typename X> static size_t floatOffsetOf() {
+    return S == INTERLEAVED ? detail::FloatOffset<X, A...>::value : 0;
+  }
+  //! The buffer that stores attribute X
+  template <typename X> static size_t bufferOf() {
+    return S == INTERLEAVED ? 0 : detail::AttributeIndex<X, A...>::value;
+  }
+  //! Enable the attributes and point them to the buffers (the VAO needs to be bound)
+  /*!
+    @param locations shader location of each attribute (in the format's order), -1 to skip it
+    @param buffers the vertex buffer objects that store the data
+  */
+  static void setupAttributes(const GLint (&locations)[sizeof...(A)],
+      const GLuint (&buffers)[BUFFERS]) {
+    detail::AttributeSetup<VertexFormat, A...>::apply(locations, buffers);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+};
+
+//! The format of \struct Vertex: interleaved position, normal and texture coordinates
+typedef VertexFormat<INTERLEAVED, Position, Normal, TextCoords> StandardFormat;
+static_assert(StandardFormat::FLOATS * sizeof(float) == sizeof(Vertex),
+    "StandardFormat needs to match the Vertex struct");
+
+//! CPU storage of the vertices of a \class Mesh or \class Model in a given format
+/*!
+  It converts the \struct Vertex array of a Mesh to the requested format and
+  storage. Then, the buffers can be sent to the GPU (See \fn upload) and be
+  described with \fn VertexFormat::setupAttributes.
+*/
+template <typename Format> class VertexStream;
+
+template <Storage S, typename... A>
+class VertexStream<VertexFormat<S, A...> > {
+public:
+  typedef VertexFormat<S, A...> Format;
+
+  VertexStream() : mCount(0) {}
+  //! Creates the stream from the vertices of a Mesh (See Mesh::viewVertices)
+  explicit VertexStream(ArrayView<Vertex> vertices) : mCount(0) {
+    assign(vertices);
+  }
+  //! Replace the content with the vertices of a Mesh
+  void assign(ArrayView<Vertex> vertices) {
+    mCount = vertices.size();
+    for (size_t b = 0; b < Format::BUFFERS; ++b) {
+      mBuffers[b].clear();
+    }
+    // Every attribute adds its floats to the buffer that stores it
+    int expand[] = {0, (mBuffers[Format::template bufferOf<A>()].resize(
+        mBuffers[Format::template bufferOf<A>()].size() + mCount * A::COMPONENTS), 0)...};
+    (void)expand;
+    for (size_t i = 0; i < mCount; ++i) {
+      int copy[] = {0, (set<A>(i, A::from(vertices[i])), 0)...};
+      (void)copy;
+    }
+  }
+  //! Number of vertices
+  size_t size() const {
+    return mCount;
+  }
+  //! Get the data of one of the buffers (See VertexFormat::BUFFERS)
+  ArrayView<float> buffer(size_t b) const {
+    return ArrayView<float>(mBuffers[b]);
+  }
+  //! Read attribute X of vertex i
+  template <typename X> typename X::Type get(size_t i) const {
+    const float* p = &mBuffers[Format::template bufferOf<X>()][index<X>(i)];
+    typename X::Type value;
+    for (int c = 0; c < X::COMPONENTS; ++c) {
+      value[c] = p[c];
+    }
+    return value;
+  }
+  //! Write attribute X of vertex i
+  template <typename X> void set(size_t i, const typename X::Type& value) {
+    float* p = &mBuffers[Format::template bufferOf<X>()][index<X>(i)];
+    for (int c = 0; c < X::COMPONENTS; ++c) {
+      p[c] = value[c];
+    }
+  }
+  //! Send every buffer to its vertex buffer object
+  void upload(const GLuint (&buffers)[Format::BUFFERS], GLenum usage = GL_STATIC_DRAW) const {
+    for (size_t b = 0; b < Format::BUFFERS; ++b) {
+      glBindBuffer(GL_ARRAY_BUFFER, buffers[b]);
+      glBufferData(GL_ARRAY_BUFFER, mBuffers[b].size() * sizeof(float), mBuffers[b].data(), usage);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+  //! Transform the positions by T (the format needs a Position attribute)
+  void transformPositions(const glm::mat4& T) {
+    const size_t step = Format::template strideOf<Position>() / sizeof(float);
+    float* p = positionData();
+    for (size_t i = 0; i < mCount; ++i, p += step) {
+      glm::vec4 q = T * glm::vec4(p[0], p[1], p[2], 1.0f);
+      p[0] = q.x;
+      p[1] = q.y;
+      p[2] = q.z;
+    }
+  }
+  //! Axis aligned bounding box of the positions (the format needs a Position attribute)
+  void boundingBox(glm::vec3& lower, glm::vec3& upper) const {
+    const size_t step = Format::template strideOf<Position>() / sizeof(float);
+    const float* p = positionData();
+    lower = glm::vec3(FLT_MAX);
+    upper = glm::vec3(-FLT_MAX);
+    for (size_t i = 0; i < mCount; ++i, p += step) {
+      glm::vec3 q(p[0], p[1], p[2]);
+      lower = glm::min(lower, q);
+      upper = glm::max(upper, q);
+    }
+  }
+
+private:
+  std::array<std::vector<float>, Format::BUFFERS> mBuffers;
+  size_t mCount;
+
+  template <typename X> size_t index(size_t i) const {
+    return i * (Format::template strideOf<X>() / sizeof(float)) +
+        Format::template floatOffsetOf<X>();
+  }
+
+  float* positionData() {
+    return mBuffers[Format::template bufferOf<Position>()].data() +
+        Format::template floatOffsetOf<Position>();
+  }
+
+  const float* positionData() const {
+    return mBuffers[Format::template bufferOf<Position>()].data() +
+        Format::template floatOffsetOf<Position>();
+  }
+};
+
+} // namespace mesh
+
+#endif
@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#include "../parallel/threadpool.h"
+
+#include "vertexkernels.h"
+#include "vertexquantizer.h"
+
+namespace mesh {
+
+using glm::vec2;
+using glm::vec3;
+
+namespace {
+
+const float UNORM16_MAX = 65535.0f;
+const float SNORM16_MAX = 32767.0f;
+
+uint16_t toUnorm16(float value) {
+  return static_cast<uint16_t>(std::lround(glm::clamp(value, 0.0f, 1.0f) * UNORM16_MAX));
+}
+
+float fromUnorm16(uint16_t value) {
+  return value / UNORM16_MAX;
+}
+
+int16_t toSnorm16(float value) {
+  return static_cast<int16_t>(std::lround(glm::clamp(value, -1.0f, 1.0f) * SNORM16_MAX));
+}
+
+float fromSnorm16(int16_t value) {
+  return glm::max(value / SNORM16_MAX, -1.0f);
+}
+
+// IEEE 754 binary16, rounding to the nearest even
+uint16_t toHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000u);
+  uint32_t magnitude = bits & 0x7fffffffu;
+  if (magnitude >= 0x7f800000u) {
+    // Infinity or NaN
+    return sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x0200u : 0u);
+  }
+  if (magnitude >= 0x477ff000u) {
+    // Rounds to 65520 or more, too big for a half
+    return sign | 0x7c00u;
+  }
+  if (magnitude < 0x38800000u) {
+    // Subnormal half: multiples of 2^-24
+    float f;
+    std::memcpy(&f, &magnitude, sizeof(f));
+    return sign | static_cast<uint16_t>(std::lrint(f * 16777216.0f));
+  }
+  // Rebias the exponent from 127 to 15, then round the mantissa from 23 to 10 bits
+  uint32_t h = magnitude - 0x38000000u;
+  h += 0x0fffu + ((h >> 13) & 1u);
+  return sign | static_cast<uint16_t>(h >> 13);
+}
+
+float fromHalf(uint16_t value) {
+  uint32_t sign = static_cast<uint32_t>(value & 0x8000u) << 16;
+  uint32_t exponent = (value >> 10) & 0x1fu;
+  uint32_t mantissa = value & 0x03ffu;
+  uint32_t bits;
+  if (exponent == 0) {
+    float f = mantissa / 16777216.0f;
+    std::memcpy(&bits, &f, sizeof(bits));
+    bits |= sign;
+  } else if (exponent == 31) {
+    bits = sign | 0x7f800000u | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+float signNotZero(float value) {
+  return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Octahedral mapping of the unit sphere into the [-1, 1] square
+vec2 octahedralEncode(const vec3& n) {
+  float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+  if (l1 <= 0.0f) {
+    return vec2(0.0f);
+  }
+  vec2 p(n.x / l1, n.y / l1);
+  if (n.z < 0.0f) {
+    p = vec2((1.0f - std::fabs(p.y)) * signNotZero(p.x), (1.0f - std::fabs(p.x)) * signNotZero(p.y));
+  }
+  return p;
+}
+
+vec3 octahedralDecode(const vec2& e) {
+  vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+  if (n.z < 0.0f) {
+    n.x = (1.0f - std::fabs(e.y)) * signNotZero(e.x);
+    n.y = (1.0f - std::fabs(e.x)) * signNotZero(e.y);
+  }
+  return glm::normalize(n);
+}
+
+// Of the four snorm16 values around the encoded normal, keep the one that decodes closest
+void encodeNormal(const vec3& normal, int16_t* out) {
+  vec3 n = glm::length2(normal) > 0.0f ? glm::normalize(normal) : vec3(0.0f, 0.0f, 1.0f);
+  vec2 e = octahedralEncode(n) * SNORM16_MAX;
+  float best = FLT_MAX;
+  for (int i = 0; i < 4; ++i) {
+    float x = (i & 1) ? std::ceil(e.x) : std::floor(e.x);
+    float y = (i & 2) ? std::ceil(e.y) : std::floor(e.y);
+    int16_t candidate[2] = {toSnorm16(x / SNORM16_MAX), toSnorm16(y / SNORM16_MAX)};
+    // Distance instead of the dot product, it keeps the precision for tiny angles
+    float distance = glm::length2(n - octahedralDecode(vec2(fromSnorm16(candidate[0]),
+        fromSnorm16(candidate[1]))));
+    if (distance < best) {
+      best = distance;
+      out[0] = candidate[0];
+      out[1] = candidate[1];
+    }
+  }
+}
+
+// Scale that takes [lower, upper] to [0, 1] (zero for an empty range)
+float inverseExtent(float lower, float upper) {
+  return upper > lower ? 1.0f / (upper - lower) : 0.0f;
+}
+
+} // namespace
+
+VertexQuantizer::VertexQuantizer(TextCoordsEncoding encoding) : mEncoding(encoding) {
+
+}
+
+TextCoordsEncoding VertexQuantizer::getEncoding() const {
+  return mEncoding;
+}
+
+QuantizedVertices VertexQuantizer::quantize(const Mesh& mesh) const {
+  // The box of the stored vertices, the one of a Model with instances is bigger
+  ArrayView<Vertex> vertices = mesh.viewVertices();
+  vec3 lower;
+  vec3 upper;
+  vertexBounds(vertices.data(), vertices.size(), lower, upper);
+  return quantize(vertices, lower, upper);
+}
+
+QuantizedVertices VertexQuantizer::quantize(ArrayView<Vertex> vertices, const vec3& lower,
+    const vec3& upper) const {
+  QuantizedVertices result;
+  DecodeConstants& constants = result.constants;
+  constants.encoding = mEncoding;
+  constants.positionScale = upper - lower;
+  constants.positionOffset = lower;
+  // The range of the texture coordinates (only needed for UNORM16)
+  vec2 uvLower(0.0f);
+  vec2 uvUpper(1.0f);
+  if (mEncoding == UNORM16 && !vertices.empty()) {
+    uvLower = uvUpper = vertices[0].textCoords;
+    for (const Vertex& v : vertices) {
+      uvLower = glm::min(uvLower, v.textCoords);
+      uvUpper = glm::max(uvUpper, v.textCoords);
+    }
+    constants.textCoordsScale = uvUpper - uvLower;
+    constants.textCoordsOffset = uvLower;
+  } else {
+    constants.textCoordsScale = vec2(1.0f);
+    constants.textCoordsOffset = vec2(0.0f);
+  }
+  const vec3 positionFactor(inverseExtent(lower.x, upper.x), inverseExtent(lower.y, upper.y),
+      inverseExtent(lower.z, upper.z));
+  const vec2 uvFactor(inverseExtent(uvLower.x, uvUpper.x), inverseExtent(uvLower.y, uvUpper.y));
+  result.vertices.resize(vertices.size());
+  PackedVertex* packed = result.vertices.data();
+  const TextCoordsEncoding encoding = mEncoding;
+  parallel::forEachRange(vertices.size(), [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const Vertex& v = vertices[i];
+      PackedVertex& p = packed[i];
+      vec3 position = (v.position - lower) * positionFactor;
+      p.position[0] = toUnorm16(position.x);
+      p.position[1] = toUnorm16(position.y);
+      p.position[2] = toUnorm16(position.z);
+      p.position[3] = 0xffff; // w = 1
+      encodeNormal(v.normal, p.normal);
+      if (encoding == UNORM16) {
+        vec2 uv = (v.textCoords - uvLower) * uvFactor;
+        p.textCoords[0] = toUnorm16(uv.x);
+        p.textCoords[1] = toUnorm16(uv.y);
+      } else {
+        p.textCoords[0] = toHalf(v.textCoords.x);
+        p.textCoords[1] = toHalf(v.textCoords.y);
+      }
+    }
+  });
+  return result;
+}
+
+Vertex VertexQuantizer::decode(const PackedVertex& packed, const DecodeConstants& constants) {
+  Vertex v;
+  vec3 position(fromUnorm16(packed.position[0]), fromUnorm16(packed.position[1]),
+      fromUnorm16(packed.position[2]));
+  v.position = position * constants.positionScale + constants.positionOffset;
+  v.normal = octahedralDecode(vec2(fromSnorm16(packed.normal[0]), fromSnorm16(packed.normal[1])));
+  vec2 uv;
+  if (constants.encoding == UNORM16) {
+    uv = vec2(fromUnorm16(packed.textCoords[0]), fromUnorm16(packed.textCoords[1]));
+  } else {
+    uv = vec2(fromHalf(packed.textCoords[0]), fromHalf(packed.textCoords[1]));
+  }
+  v.textCoords = uv * constants.textCoordsScale + constants.textCoordsOffset;
+  return v;
+}
+
+QuantizationError VertexQuantizer::measureError(ArrayView<Vertex> original,
+    const QuantizedVertices& quantized) {
+  QuantizationError error = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  const size_t n = std::min(original.size(), quantized.vertices.size());
+  if (n == 0) {
+    return error;
+  }
+  const float DEGREES = 57.2957795f;
+  double position = 0.0;
+  double normal = 0.0;
+  double textCoords = 0.0;
+  size_t normals = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const Vertex& a = original[i];
+    Vertex b = decode(quantized.vertices[i], quantized.constants);
+    float dp = glm::length(a.position - b.position);
+    float dt = glm::length(a.textCoords - b.textCoords);
+    error.maxPosition = glm::max(error.maxPosition, dp);
+    error.maxTextCoords = glm::max(error.maxTextCoords, dt);
+    position += dp;
+    textCoords += dt;
+    // Zero normals (meshes without normals) have no direction to compare
+    if (glm::length2(a.normal) > 0.0f) {
+      vec3 n = glm::normalize(a.normal);
+      // atan2 keeps the precision for tiny angles, where acos of the dot product does not
+      float angle = std::atan2(glm::length(glm::cross(n, b.normal)), glm::dot(n, b.normal)) *
+          DEGREES;
+      error.maxNormalDegrees = glm::max(error.maxNormalDegrees, angle);
+      normal += angle;
+      normals++;
+    }
+  }
+  error.averagePosition = static_cast<float>(position / n);
+  error.averageTextCoords = static_cast<float>(textCoords / n);
+  error.averageNormalDegrees = normals > 0 ? static_cast<float>(normal / normals) : 0.0f;
+  return error;
+}
+
+void VertexQuantizer::setupAttributes(const GLint (&locations)[3], GLuint buffer,
+    TextCoordsEncoding encoding) {
+  const GLsizei stride = sizeof(PackedVertex);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  if (locations[0] >= 0) {
+    GLuint location = static_cast<GLuint>(locations[0]);
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+        reinterpret_cast<const GLvoid*>(offsetof(PackedVertex, position)));
+  }
+  if (locations[1] >= 0) {
+    GLuint location = static_cast<GLuint>(locations[1]);
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, 2, GL_SHORT, GL_TRUE, stride,
+        reinterpret_cast<const GLvoid*>(offsetof(PackedVertex, normal)));
+  }
+  if (locations[2] >= 0) {
+    GLuint location = static_cast<GLuint>(locations[2]);
+    glEnableVertexAttribArray(location);
+    if (encoding == UNORM16) {
+      glVertexAttribPointer(location, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+          reinterpret_cast<const GLvoid*>(offsetof(PackedVertex, textCoords)));
+    } else {
+      glVertexAttribPointer(location, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+          reinterpret_cast<const GLvoid*>(offsetof(PackedVertex, textCoords)));
+    }
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+} // namespace mesh
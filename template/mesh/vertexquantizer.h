@@ -0,0 +1,107 @@
+#ifndef VERTEX_QUANTIZER_H_
+#define VERTEX_QUANTIZER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "mesh.h"
+
+namespace mesh {
+
+//! A compressed \struct Vertex of 16 bytes (instead of 32)
+/*!
+  - position: unorm16, relative to the bounding box of the mesh. The fourth
+    component is always one, so the shader can read it as a vec4.
+  - normal: octahedral encoding in two snorm16 values.
+  - textCoords: unorm16 relative to the texture coordinates range, or half
+    floats (See \enum TextCoordsEncoding).
+*/
+struct PackedVertex {
+  uint16_t position[4];
+  int16_t normal[2];
+  uint16_t textCoords[2];
+};
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex needs to be 16 bytes");
+
+//! How the texture coordinates are stored in a \struct PackedVertex
+/*!
+  UNORM16 has a uniform precision over the range of the mesh's coordinates.
+  HALF keeps more precision near zero and does not depend on the range, which
+  is better for coordinates that repeat a texture many times.
+*/
+enum TextCoordsEncoding {UNORM16, HALF};
+
+//! The values a shader needs to decode a \struct PackedVertex
+/*!
+  The GPU reads the attributes as normalized values, then:
+  position = positionAttr.xyz * positionScale + positionOffset
+  textCoords = textCoordsAttr * textCoordsScale + textCoordsOffset
+  See shaders/vertex_quantized.glsl
+*/
+struct DecodeConstants {
+  glm::vec3 positionScale;
+  glm::vec3 positionOffset;
+  glm::vec2 textCoordsScale;
+  glm::vec2 textCoordsOffset;
+  TextCoordsEncoding encoding;
+};
+
+//! Errors introduced by the quantization (comparing the decoded vertices with the originals)
+struct QuantizationError {
+  //! Maximum and average distance between positions (in model units)
+  float maxPosition;
+  float averagePosition;
+  //! Maximum and average angle between normals (in degrees)
+  float maxNormalDegrees;
+  float averageNormalDegrees;
+  //! Maximum and average distance between texture coordinates
+  float maxTextCoords;
+  float averageTextCoords;
+};
+
+//! The vertices of a mesh in packed format and how to decode them
+struct QuantizedVertices {
+  std::vector<PackedVertex> vertices;
+  DecodeConstants constants;
+};
+
+//! Converts the vertices of a \class Mesh or a \class Model to \struct PackedVertex
+/*!
+  This halves the memory and bandwidth needed by the vertices. The positions
+  use 16 bits per coordinate over the bounding box, so the error is at most
+  half of the bounding box size over 65535 on each axis.
+*/
+class VertexQuantizer {
+public:
+  //! Creates a quantizer that stores the texture coordinates with an encoding
+  explicit VertexQuantizer(TextCoordsEncoding encoding = UNORM16);
+  //! Pack the vertices of a Mesh (or Model) relative to the bounding box of its vertices
+  QuantizedVertices quantize(const Mesh& mesh) const;
+  //! Pack the vertices, the positions need to be inside [lower, upper]
+  QuantizedVertices quantize(ArrayView<Vertex> vertices, const glm::vec3& lower,
+      const glm::vec3& upper) const;
+  //! Decode a packed vertex on the CPU (the same operations as the shader)
+  static Vertex decode(const PackedVertex& packed, const DecodeConstants& constants);
+  //! Compare the decoded vertices with the originals
+  static QuantizationError measureError(ArrayView<Vertex> original,
+      const QuantizedVertices& quantized);
+  //! Enable the attributes and point them to a buffer of packed vertices (the VAO needs to be bound)
+  /*!
+    @param locations shader location of the position, normal and texture coordinates, -1 to skip
+    @param buffer vertex buffer object with the packed vertices
+    @param encoding how the texture coordinates are stored
+  */
+  static void setupAttributes(const GLint (&locations)[3], GLuint buffer,
+      TextCoordsEncoding encoding);
+  //! Get the encoding used for the texture coordinates
+  TextCoordsEncoding getEncoding() const;
+
+private:
+  TextCoordsEncoding mEncoding;
+};
+
+} // namespace mesh
+
+#endif
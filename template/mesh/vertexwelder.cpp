@@ -0,0 +1,207 @@
+#include <cmath>
+#include <cstdint>
+
+#include "../parallel/threadpool.h"
+
+#include "vertexwelder.h"
+
+namespace mesh {
+
+using glm::vec3;
+
+namespace {
+
+const unsigned int NONE = ~0u;
+
+//! Uniform grid hashed into a table of buckets, each bucket is a linked list of points
+class SpatialHash {
+public:
+  SpatialHash(float tolerance, float cellSize, size_t expected, std::vector<vec3>& points) :
+      mTolerance(tolerance), mTol2(tolerance * tolerance), mPoints(points) {
+    // Cells at least twice as big as the tolerance, then a ball touches 2 cells per axis at most
+    mInvCell = 1.0f / glm::max(cellSize, 2.0f * tolerance);
+    rehash(expected);
+  }
+  //! Return the index of a point within tolerance of p, or add p to the points
+  unsigned int findOrInsert(const vec3& p) {
+    unsigned int found = find(p);
+    if (found != NONE) {
+      return found;
+    }
+    unsigned int index = static_cast<unsigned int>(mPoints.size());
+    mPoints.push_back(p);
+    mNext.push_back(NONE);
+    if (mPoints.size() > mHeads.size()) {
+      rehash(2 * mPoints.size());
+    } else {
+      link(index);
+    }
+    return index;
+  }
+
+private:
+  float mTolerance;
+  float mTol2;
+  float mInvCell;
+  size_t mMask;
+  std::vector<vec3>& mPoints;
+  // First point of each bucket, and next point in the same bucket
+  std::vector<unsigned int> mHeads;
+  std::vector<unsigned int> mNext;
+
+  static int64_t cell(float x) {
+    return static_cast<int64_t>(std::floor(x));
+  }
+
+  size_t bucket(int64_t x, int64_t y, int64_t z) const {
+    uint64_t h = static_cast<uint64_t>(x) * 0x8da6b343ull;
+    h ^= static_cast<uint64_t>(y) * 0xd8163841ull;
+    h ^= static_cast<uint64_t>(z) * 0xcb1ab31full;
+    h ^= h >> 29;
+    return static_cast<size_t>(h) & mMask;
+  }
+
+  unsigned int find(const vec3& p) const {
+    // Cells touched by the ball of radius tolerance around p
+    vec3 lo = (p - vec3(mTolerance)) * mInvCell;
+    vec3 hi = (p + vec3(mTolerance)) * mInvCell;
+    int64_t x0 = cell(lo.x), x1 = cell(hi.x);
+    int64_t y0 = cell(lo.y), y1 = cell(hi.y);
+    int64_t z0 = cell(lo.z), z1 = cell(hi.z);
+    // Keep the smallest index, so the result does not depend on the bucket order
+    unsigned int best = NONE;
+    for (int64_t x = x0; x <= x1; ++x) {
+      for (int64_t y = y0; y <= y1; ++y) {
+        for (int64_t z = z0; z <= z1; ++z) {
+          for (unsigned int i = mHeads[bucket(x, y, z)]; i != NONE; i = mNext[i]) {
+            if (i < best && glm::length2(mPoints[i] - p) < mTol2) {
+              best = i;
+            }
+          }
+        }
+      }
+    }
+    return best;
+  }
+
+  void link(unsigned int index) {
+    vec3 c = mPoints[index] * mInvCell;
+    size_t b = bucket(cell(c.x), cell(c.y), cell(c.z));
+    mNext[index] = mHeads[b];
+    mHeads[b] = index;
+  }
+
+  void rehash(size_t expected) {
+    size_t size = 1024;
+    while (size < expected) {
+      size *= 2;
+    }
+    mMask = size - 1;
+    mHeads.assign(size, NONE);
+    mNext.assign(mPoints.size(), NONE);
+    for (size_t i = 0; i < mPoints.size(); ++i) {
+      link(static_cast<unsigned int>(i));
+    }
+  }
+};
+
+// Weld the triangles in [begin, end), indices gets 3 * (end - begin) values
+void weldRange(float tolerance, float cellSize, const std::vector<Triangle>& triangles,
+    size_t begin, size_t end, std::vector<vec3>& positions, unsigned int* indices) {
+  // A closed triangle mesh has around half as many vertices as triangles
+  SpatialHash hash(tolerance, cellSize, end - begin, positions);
+  for (size_t t = begin; t < end; ++t) {
+    const Triangle& tri = triangles[t];
+    *indices++ = hash.findOrInsert(tri.p0);
+    *indices++ = hash.findOrInsert(tri.p1);
+    *indices++ = hash.findOrInsert(tri.p2);
+  }
+}
+
+// Cell size close to the average distance between vertices in the triangles in [begin, end)
+float estimateCellSize(const std::vector<Triangle>& triangles, size_t begin, size_t end) {
+  if (begin >= end) {
+    return 0.0f;
+  }
+  vec3 lower = triangles[begin].p0;
+  vec3 upper = lower;
+  for (size_t t = begin; t < end; ++t) {
+    const Triangle& tri = triangles[t];
+    lower = glm::min(lower, glm::min(tri.p0, glm::min(tri.p1, tri.p2)));
+    upper = glm::max(upper, glm::max(tri.p0, glm::max(tri.p1, tri.p2)));
+  }
+  // The vertices lie in a surface, so they are spread over an area rather than a volume.
+  // Very small cells mean a ball touches several cells, very big ones mean crowded cells
+  float diagonal = glm::length(upper - lower);
+  return 0.5f * diagonal / std::sqrt(static_cast<float>(end - begin));
+}
+
+} // namespace
+
+VertexWelder::VertexWelder(float tolerance) : mTolerance(tolerance) {
+
+}
+
+float VertexWelder::getTolerance() const {
+  return mTolerance;
+}
+
+void VertexWelder::weld(const std::vector<Triangle>& triangles, std::vector<vec3>& positions,
+    std::vector<unsigned int>& indices) const {
+  positions.clear();
+  indices.resize(3 * triangles.size());
+  float cellSize = estimateCellSize(triangles, 0, triangles.size());
+  weldRange(mTolerance, cellSize, triangles, 0, triangles.size(), positions, indices.data());
+}
+
+void VertexWelder::weldParallel(const std::vector<Triangle>& triangles,
+    std::vector<vec3>& positions, std::vector<unsigned int>& indices) const {
+  const size_t GRAIN = 32768; // Triangles per block
+  size_t blocks = parallel::chunksFor(triangles.size(), GRAIN);
+  if (blocks <= 1) {
+    weld(triangles, positions, indices);
+    return;
+  }
+  positions.clear();
+  indices.resize(3 * triangles.size());
+  // First, every block is welded on its own. indices get block local values
+  std::vector<std::vector<vec3> > blockPositions(blocks);
+  std::vector<float> blockCellSize(blocks);
+  auto blockBegin = [&](size_t b) { return b * triangles.size() / blocks; };
+  parallel::forEachRange(blocks, [&](size_t first, size_t last) {
+    for (size_t b = first; b < last; ++b) {
+      size_t begin = blockBegin(b);
+      size_t end = blockBegin(b + 1);
+      blockCellSize[b] = estimateCellSize(triangles, begin, end);
+      weldRange(mTolerance, blockCellSize[b], triangles, begin, end, blockPositions[b],
+          &indices[3 * begin]);
+    }
+  }, 1);
+  // Second, join the unique positions of every block (in block order)
+  size_t total = 0;
+  for (const auto& p : blockPositions) {
+    total += p.size();
+  }
+  std::vector<std::vector<unsigned int> > remap(blocks);
+  // Blocks cover a fraction of the surface with a fraction of the triangles
+  float cellSize = blockCellSize[0] / std::sqrt(static_cast<float>(blocks));
+  SpatialHash global(mTolerance, cellSize, total, positions);
+  for (size_t b = 0; b < blocks; ++b) {
+    remap[b].resize(blockPositions[b].size());
+    for (size_t i = 0; i < blockPositions[b].size(); ++i) {
+      remap[b][i] = global.findOrInsert(blockPositions[b][i]);
+    }
+    std::vector<vec3>().swap(blockPositions[b]);
+  }
+  // Finally, translate the block local indices into global ones
+  parallel::forEachRange(blocks, [&](size_t first, size_t last) {
+    for (size_t b = first; b < last; ++b) {
+      const std::vector<unsigned int>& table = remap[b];
+      for (size_t i = 3 * blockBegin(b); i < 3 * blockBegin(b + 1); ++i) {
+        indices[i] = table[indices[i]];
+      }
+    }
+  }, 1);
+}
+
+} // namespace mesh
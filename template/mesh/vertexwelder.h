@@ -0,0 +1,55 @@
+#ifndef VERTEX_WELDER_H_
+#define VERTEX_WELDER_H_
+
+#include <vector>
+
+#include "mesh.h"
+
+namespace mesh {
+//! Joins the corners of a triangle soup that are closer than a tolerance
+/*!
+  This class takes a set of triangles (where each corner has its own copy of
+  the position) and creates an indexed representation of them. Two corners
+  that are less than tolerance apart are considered the same vertex.
+
+  It uses a spatial hash over a uniform grid of cells, whose side is twice the
+  tolerance. Therefore, for each corner it only needs to look at most 8 cells
+  to find a vertex to join with. Which makes the whole process linear in the
+  number of triangles.
+
+  The vertices are created in the order in which they are first used by the
+  triangles. The parallel variant produces the same result as the serial one
+  (except on degenerated inputs, where several points are chained at less
+  than tolerance apart from each other)
+*/
+class VertexWelder {
+public:
+  //! Creates a welder. By default corners less than 0.0001 apart are joined
+  explicit VertexWelder(float tolerance = 0.0001f);
+  //! Index the triangles.
+  /*!
+    @param triangles the triangle soup to index
+    @param positions output, the unique positions found (cleared first)
+    @param indices output, three indices (into positions) per triangle
+  */
+  void weld(const std::vector<Triangle>& triangles, std::vector<glm::vec3>& positions,
+      std::vector<unsigned int>& indices) const;
+  //! Index the triangles using all the available cores.
+  /*!
+    Each thread welds a contiguous block of triangles on its own, then the
+    (much smaller) set of unique vertices of every block is welded together.
+    For small inputs it simply calls \fn weld
+    See \fn weld for the parameters
+  */
+  void weldParallel(const std::vector<Triangle>& triangles, std::vector<glm::vec3>& positions,
+      std::vector<unsigned int>& indices) const;
+  //! Get the distance under which two corners are considered the same vertex
+  float getTolerance() const;
+
+private:
+  float mTolerance;
+};
+
+} // namespace mesh
+
+#endif
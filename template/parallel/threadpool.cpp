@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <exception>
+
+#include "threadpool.h"
+
+namespace parallel {
+
+namespace {
+// Each worker raises this flag, so nested calls can be detected
+thread_local bool tInsideWorker = false;
+}
+
+ThreadPool::ThreadPool(unsigned int workers) : mStop(false) {
+  if (workers == 0) {
+    workers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (unsigned int i = 0; i < workers; ++i) {
+    mWorkers.emplace_back(&ThreadPool::workerLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mCondition.notify_all();
+  for (auto& worker : mWorkers) {
+    worker.join();
+  }
+}
+
+std::future<void> ThreadPool::enqueue(const std::function<void()>& task) {
+  std::packaged_task<void()> packed(task);
+  std::future<void> result = packed.get_future();
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mTasks.push(std::move(packed));
+  }
+  mCondition.notify_one();
+  return result;
+}
+
+unsigned int ThreadPool::size() const {
+  return static_cast<unsigned int>(mWorkers.size());
+}
+
+bool ThreadPool::insideWorker() {
+  return tInsideWorker;
+}
+
+ThreadPool& ThreadPool::global() {
+  // Created on first use, destroyed at program exit
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::workerLoop() {
+  tInsideWorker = true;
+  while (true) {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mCondition.wait(lock, [this]{ return mStop || !mTasks.empty(); });
+      // Only leave when there is nothing else to do
+      if (mStop && mTasks.empty()) {
+        return;
+      }
+      task = std::move(mTasks.front());
+      mTasks.pop();
+    }
+    task();
+  }
+}
+
+size_t chunksFor(size_t count, size_t grain) {
+  if (count == 0) {
+    return 0;
+  }
+  grain = std::max<size_t>(grain, 1);
+  // One chunk per worker plus the calling thread, but never smaller than grain
+  size_t maxChunks = ThreadPool::insideWorker() ? 1 : ThreadPool::global().size() + 1;
+  size_t byGrain = (count + grain - 1) / grain;
+  return std::max<size_t>(1, std::min(maxChunks, byGrain));
+}
+
+void forEachRange(size_t count, const std::function<void(size_t, size_t)>& body, size_t grain) {
+  size_t chunks = chunksFor(count, grain);
+  if (chunks == 0) {
+    return;
+  }
+  if (chunks == 1) {
+    body(0, count);
+    return;
+  }
+  // Chunk i is [i * count / chunks, (i + 1) * count / chunks)
+  std::vector<std::future<void> > pending;
+  pending.reserve(chunks - 1);
+  for (size_t i = 1; i < chunks; ++i) {
+    size_t begin = i * count / chunks;
+    size_t end = (i + 1) * count / chunks;
+    pending.push_back(ThreadPool::global().enqueue([&body, begin, end]() {
+      body(begin, end);
+    }));
+  }
+  // The caller works on the first chunk instead of just waiting
+  std::exception_ptr error;
+  try {
+    body(0, count / chunks);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  // The workers reference body, so always wait for all of them before leaving
+  for (auto& f : pending) {
+    f.wait();
+  }
+  for (auto& f : pending) {
+    f.get();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+} // namespace parallel
@@ -0,0 +1,76 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+//! A fixed size pool of worker threads that execute queued tasks
+/*!
+  This class keeps a set of threads alive, so the CPU side algorithms of the
+  template (mesh processing, culling, picking...) can split their work without
+  paying the price of creating threads every time.
+
+  Most of the time you do not need to create one. Use the shared instance
+  returned by \fn ThreadPool::global() or the \fn forEachRange helper.
+*/
+class ThreadPool {
+public:
+  //! Creates the pool with the given number of workers
+  /*!
+    @param workers number of threads in the pool. If zero, it will use the
+    number of hardware threads reported by the system.
+  */
+  explicit ThreadPool(unsigned int workers = 0);
+  //! Waits for the queued tasks to finish and then joins the threads
+  ~ThreadPool();
+  //! Queue a task to be executed by any of the workers
+  /*!
+    Returns a future that you can use to wait for the task to finish.
+    If the task throws an exception, it will be rethrown by future::get()
+  */
+  std::future<void> enqueue(const std::function<void()>& task);
+  //! Get the number of workers in this pool
+  unsigned int size() const;
+  //! Queries if the calling thread is one of the workers of any pool
+  static bool insideWorker();
+  //! Shared pool with one worker per hardware thread
+  static ThreadPool& global();
+
+private:
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  void workerLoop();
+
+  std::vector<std::thread> mWorkers;
+  std::queue<std::packaged_task<void()> > mTasks;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  bool mStop;
+};
+
+//! Split the range [0, count) in chunks and process them in parallel
+/*!
+  The body is called as body(begin, end) for contiguous, non overlapping
+  sub-ranges that cover [0, count). The calling thread also processes one of
+  the chunks, and the function returns when all of them are done.
+  If it is called from inside a worker (nested parallelism) or the range is
+  smaller than the grain, the whole range is processed serially.
+  @param count size of the range to process
+  @param body function that process a sub-range
+  @param grain minimum number of elements per chunk
+*/
+void forEachRange(size_t count, const std::function<void(size_t, size_t)>& body,
+    size_t grain = 4096);
+//! Number of chunks forEachRange will use for a range of the given size
+size_t chunksFor(size_t count, size_t grain = 4096);
+
+} // namespace parallel
+
+#endif
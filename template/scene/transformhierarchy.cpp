@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cassert>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../parallel/threadpool.h"
+
+#include "transformhierarchy.h"
+
+namespace scene {
+
+using glm::mat4;
+
+namespace {
+
+// Nodes per parallel block
+const size_t GRAIN = 4096;
+
+// out = a * b (out is neither a nor b)
+inline void multiply(const mat4& a, const mat4& b, mat4& out) {
+#if defined(__SSE2__)
+  // Every column of the result is a combination of the columns of a
+  const float* pa = &a[0][0];
+  const __m128 a0 = _mm_loadu_ps(pa);
+  const __m128 a1 = _mm_loadu_ps(pa + 4);
+  const __m128 a2 = _mm_loadu_ps(pa + 8);
+  const __m128 a3 = _mm_loadu_ps(pa + 12);
+  for (int c = 0; c < 4; ++c) {
+    const float* column = &b[c][0];
+    __m128 r = _mm_mul_ps(a0, _mm_set1_ps(column[0]));
+    r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(column[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(column[2])));
+    r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(column[3])));
+    _mm_storeu_ps(&out[c][0], r);
+  }
+#else
+  out = a * b;
+#endif
+}
+
+} // namespace
+
+const uint32_t TransformHierarchy::NO_PARENT = 0xFFFFFFFFu;
+
+TransformHierarchy::TransformHierarchy() : mLevelStart(1, 0), mLayoutDirty(false) {
+
+}
+
+void TransformHierarchy::clear() {
+  mSlotOf.clear();
+  mId.clear();
+  mParent.clear();
+  mFirstChild.clear();
+  mChildCount.clear();
+  mSubtreeSize.clear();
+  mLocal.clear();
+  mWorld.clear();
+  mDirty.clear();
+  mLevelStart.assign(1, 0);
+  mDirtyList.clear();
+  mUpdatedRoots.clear();
+  mLayoutDirty = false;
+}
+
+void TransformHierarchy::reserve(size_t nodes) {
+  mSlotOf.reserve(nodes);
+  mId.reserve(nodes);
+  mParent.reserve(nodes);
+  mLocal.reserve(nodes);
+  mWorld.reserve(nodes);
+  mDirty.reserve(nodes);
+  mDirtyList.reserve(nodes);
+}
+
+uint32_t TransformHierarchy::addNode(uint32_t parent, const glm::mat4& local) {
+  assert(parent == NO_PARENT || parent < mSlotOf.size());
+  const uint32_t id = static_cast<uint32_t>(mSlotOf.size());
+  const uint32_t slot = static_cast<uint32_t>(mId.size());
+  // New nodes go at the end (after their parent) until the next layout
+  mSlotOf.push_back(slot);
+  mId.push_back(id);
+  mParent.push_back(parent == NO_PARENT ? NO_PARENT : mSlotOf[parent]);
+  mLocal.push_back(local);
+  mWorld.push_back(local);
+  mDirty.push_back(1);
+  mDirtyList.push_back(slot);
+  mLayoutDirty = true;
+  return id;
+}
+
+void TransformHierarchy::setLocal(uint32_t node, const glm::mat4& local) {
+  const uint32_t slot = mSlotOf[node];
+  mLocal[slot] = local;
+  if (!mDirty[slot]) {
+    mDirty[slot] = 1;
+    mDirtyList.push_back(slot);
+  }
+}
+
+const glm::mat4& TransformHierarchy::local(uint32_t node) const {
+  return mLocal[mSlotOf[node]];
+}
+
+const glm::mat4& TransformHierarchy::world(uint32_t node) const {
+  return mWorld[mSlotOf[node]];
+}
+
+uint32_t TransformHierarchy::parent(uint32_t node) const {
+  const uint32_t p = mParent[mSlotOf[node]];
+  return p == NO_PARENT ? NO_PARENT : mId[p];
+}
+
+size_t TransformHierarchy::size() const {
+  return mId.size();
+}
+
+size_t TransformHierarchy::levels() const {
+  return mLevelStart.size() - 1;
+}
+
+HierarchyUpdateStats TransformHierarchy::update() {
+  HierarchyUpdateStats stats = {};
+  if (mLayoutDirty) {
+    rebuildLayout();
+  }
+  stats.dirtyNodes = mDirtyList.size();
+  mUpdatedRoots.clear();
+  if (mDirtyList.empty()) {
+    return stats;
+  }
+  // A parent always comes before its children, so the subtrees are found in order
+  std::sort(mDirtyList.begin(), mDirtyList.end());
+  std::vector<uint32_t> roots;
+  size_t nodes = 0;
+  for (uint32_t slot : mDirtyList) {
+    uint32_t p = mParent[slot];
+    while (p != NO_PARENT && !mDirty[p]) {
+      p = mParent[p];
+    }
+    if (p == NO_PARENT) {
+      roots.push_back(slot);
+      nodes += mSubtreeSize[slot];
+    }
+  }
+  stats.subtrees = roots.size();
+  if (4 * nodes >= size()) {
+    stats.levelSweep = true;
+    stats.updated = updateLevels(levelOf(mDirtyList.front()));
+  } else {
+    updateSubtrees(roots, nodes);
+    stats.updated = nodes;
+  }
+  mDirtyList.clear();
+  mUpdatedRoots.swap(roots);
+  return stats;
+}
+
+bool TransformHierarchy::wasUpdated(uint32_t node) const {
+  uint32_t slot = mSlotOf[node];
+  // Added after the last update
+  if (mLayoutDirty && slot >= mLevelStart.back()) {
+    return false;
+  }
+  for (; slot != NO_PARENT; slot = mParent[slot]) {
+    if (std::binary_search(mUpdatedRoots.begin(), mUpdatedRoots.end(), slot)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TransformHierarchy::rebuildLayout() {
+  const size_t n = mId.size();
+  // The children of every slot, in slot order
+  std::vector<uint32_t> childStart(n + 1, 0);
+  std::vector<uint32_t> order;
+  order.reserve(n);
+  for (size_t s = 0; s < n; ++s) {
+    if (mParent[s] == NO_PARENT) {
+      order.push_back(static_cast<uint32_t>(s));
+    } else {
+      ++childStart[mParent[s] + 1];
+    }
+  }
+  for (size_t s = 0; s < n; ++s) {
+    childStart[s + 1] += childStart[s];
+  }
+  std::vector<uint32_t> children(childStart[n]);
+  std::vector<uint32_t> filled(childStart.begin(), childStart.end() - 1);
+  for (size_t s = 0; s < n; ++s) {
+    if (mParent[s] != NO_PARENT) {
+      children[filled[mParent[s]]++] = static_cast<uint32_t>(s);
+    }
+  }
+  // Breadth first: the roots, then the children of every node of a level, in order
+  mLevelStart.assign(1, 0);
+  size_t begin = 0;
+  while (begin < order.size()) {
+    const size_t end = order.size();
+    for (size_t i = begin; i < end; ++i) {
+      order.insert(order.end(), children.begin() + childStart[order[i]],
+          children.begin() + childStart[order[i] + 1]);
+    }
+    mLevelStart.push_back(static_cast<uint32_t>(end));
+    begin = end;
+  }
+  std::vector<uint32_t> newSlot(n);
+  for (size_t i = 0; i < n; ++i) {
+    newSlot[order[i]] = static_cast<uint32_t>(i);
+  }
+  // Move everything to the new order
+  std::vector<uint32_t> id(n);
+  std::vector<uint32_t> parent(n);
+  std::vector<mat4> local(n);
+  std::vector<mat4> world(n);
+  std::vector<uint8_t> dirty(n);
+  mFirstChild.resize(n);
+  mChildCount.resize(n);
+  uint32_t next = mLevelStart.size() > 1 ? mLevelStart[1] : 0;
+  for (size_t i = 0; i < n; ++i) {
+    const uint32_t old = order[i];
+    id[i] = mId[old];
+    parent[i] = mParent[old] == NO_PARENT ? NO_PARENT : newSlot[mParent[old]];
+    local[i] = mLocal[old];
+    world[i] = mWorld[old];
+    dirty[i] = mDirty[old];
+    mFirstChild[i] = next;
+    mChildCount[i] = childStart[old + 1] - childStart[old];
+    next += mChildCount[i];
+    mSlotOf[id[i]] = static_cast<uint32_t>(i);
+  }
+  mId.swap(id);
+  mParent.swap(parent);
+  mLocal.swap(local);
+  mWorld.swap(world);
+  mDirty.swap(dirty);
+  for (uint32_t& slot : mDirtyList) {
+    slot = newSlot[slot];
+  }
+  // The subtree sizes, from the leaves up
+  mSubtreeSize.assign(n, 1);
+  for (size_t i = n; i-- > 0;) {
+    if (mParent[i] != NO_PARENT) {
+      mSubtreeSize[mParent[i]] += mSubtreeSize[i];
+    }
+  }
+  mLayoutDirty = false;
+}
+
+size_t TransformHierarchy::levelOf(uint32_t slot) const {
+  return std::upper_bound(mLevelStart.begin(), mLevelStart.end(), slot) - mLevelStart.begin() - 1;
+}
+
+void TransformHierarchy::updateSubtrees(const std::vector<uint32_t>& roots, size_t nodes) {
+  // Enough subtrees per block to have about GRAIN nodes in it
+  const size_t grain = std::max<size_t>(1, roots.size() * GRAIN / std::max<size_t>(1, nodes));
+  parallel::forEachRange(roots.size(), [&](size_t firstRoot, size_t lastRoot) {
+    for (size_t r = firstRoot; r < lastRoot; ++r) {
+      // The descendants in the next level of a range are a range too
+      uint32_t first = roots[r];
+      uint32_t last = first + 1;
+      while (first < last) {
+        for (uint32_t s = first; s < last; ++s) {
+          const uint32_t p = mParent[s];
+          if (p == NO_PARENT) {
+            mWorld[s] = mLocal[s];
+          } else {
+            multiply(mWorld[p], mLocal[s], mWorld[s]);
+          }
+          mDirty[s] = 0;
+        }
+        const uint32_t nextFirst = mFirstChild[first];
+        last = mFirstChild[last - 1] + mChildCount[last - 1];
+        first = nextFirst;
+      }
+    }
+  }, grain);
+}
+
+size_t TransformHierarchy::updateLevels(size_t firstLevel) {
+  for (size_t level = firstLevel; level + 1 < mLevelStart.size(); ++level) {
+    const uint32_t start = mLevelStart[level];
+    // The parents are in the previous level, which is finished
+    parallel::forEachRange(mLevelStart[level + 1] - start, [&](size_t first, size_t last) {
+      for (uint32_t s = start + static_cast<uint32_t>(first); s < start + last; ++s) {
+        const uint32_t p = mParent[s];
+        if (p == NO_PARENT) {
+          if (mDirty[s]) {
+            mWorld[s] = mLocal[s];
+          }
+        } else if (mDirty[s] || mDirty[p]) {
+          mDirty[s] = 1;
+          multiply(mWorld[p], mLocal[s], mWorld[s]);
+        }
+      }
+    }, GRAIN);
+  }
+  std::vector<uint8_t>::iterator begin = mDirty.begin() + mLevelStart[firstLevel];
+  const size_t updated = static_cast<size_t>(std::count(begin, mDirty.end(), 1));
+  std::fill(begin, mDirty.end(), 0);
+  return updated;
+}
+
+} // namespace scene
@@ -0,0 +1,110 @@
+#ifndef SCENE_TRANSFORM_HIERARCHY_H_
+#define SCENE_TRANSFORM_HIERARCHY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace scene {
+
+//! What the last \fn TransformHierarchy::update did
+struct HierarchyUpdateStats {
+  //! Nodes marked by setLocal or added since the previous update
+  size_t dirtyNodes;
+  //! Dirty nodes without a dirty ancestor (the subtrees that changed)
+  size_t subtrees;
+  //! World matrices computed
+  size_t updated;
+  //! True if the changes were big enough to sweep the levels instead of the subtrees
+  bool levelSweep;
+};
+
+//! A tree of transforms, stored in flat arrays in breadth-first order
+/*!
+  Every node has a local matrix (relative to its parent) and a world matrix
+  (the product of the local matrices from the root). The nodes are kept in
+  structure of arrays form: parent index, local matrices, world matrices and
+  dirty flags, each one in its own array and sorted by level. The children
+  of a node are contiguous, so the descendants of a node in one level are a
+  contiguous range too.
+
+  Changing a local matrix only marks the node. \fn update computes the
+  world matrices of the marked nodes and their descendants, nothing else:
+  - Few changes: the subtrees of the marked nodes are walked one level (one
+    range) at a time, and independent subtrees run in parallel.
+  - Many changes (a quarter of the nodes or more): the levels below the first
+    marked node are swept in order, every level in parallel, and the flags
+    of the parents are propagated to their children on the way.
+  The matrix products use SSE when available.
+
+  Nodes are named by the id returned by addNode, which never changes. Adding
+  nodes reorders the arrays at the next update.
+*/
+class TransformHierarchy {
+public:
+  //! Parent of the root nodes
+  static const uint32_t NO_PARENT;
+  TransformHierarchy();
+  //! Remove all the nodes
+  void clear();
+  //! Reserve memory for a number of nodes
+  void reserve(size_t nodes);
+  //! Add a node, the parent must already exist (or be NO_PARENT for a root)
+  /*!
+    @return the id of the new node. Its world matrix is valid after update()
+  */
+  uint32_t addNode(uint32_t parent, const glm::mat4& local = glm::mat4(1.0f));
+  //! Change the local matrix of a node, its subtree will be updated by update()
+  void setLocal(uint32_t node, const glm::mat4& local);
+  //! The local matrix of a node
+  const glm::mat4& local(uint32_t node) const;
+  //! The world matrix of a node, as computed by the last update()
+  const glm::mat4& world(uint32_t node) const;
+  //! The parent of a node (NO_PARENT for the roots)
+  uint32_t parent(uint32_t node) const;
+  //! Number of nodes
+  size_t size() const;
+  //! Number of levels (the depth of the deepest node plus one), as of the last update()
+  size_t levels() const;
+  //! Compute the world matrices of the changed nodes and their descendants
+  HierarchyUpdateStats update();
+  //! Queries if the last update() computed the world matrix of a node
+  /*!
+    True if the node or one of its ancestors was changed. It walks up from
+    the node, so it is meant to find which of a few nodes moved (the ones
+    something depends on) rather than to be called for every node.
+  */
+  bool wasUpdated(uint32_t node) const;
+
+private:
+  void rebuildLayout();
+  size_t levelOf(uint32_t slot) const;
+  void updateSubtrees(const std::vector<uint32_t>& roots, size_t nodes);
+  size_t updateLevels(size_t firstLevel);
+  // The position of every node id in the arrays
+  std::vector<uint32_t> mSlotOf;
+  // By slot (breadth-first order): the id, the slot of the parent, the first child and their
+  // number (childless nodes point where their children would be) and the size of the subtree
+  std::vector<uint32_t> mId;
+  std::vector<uint32_t> mParent;
+  std::vector<uint32_t> mFirstChild;
+  std::vector<uint32_t> mChildCount;
+  std::vector<uint32_t> mSubtreeSize;
+  std::vector<glm::mat4> mLocal;
+  std::vector<glm::mat4> mWorld;
+  std::vector<uint8_t> mDirty;
+  // First slot of every level, and one past the last node
+  std::vector<uint32_t> mLevelStart;
+  // Slots marked since the last update
+  std::vector<uint32_t> mDirtyList;
+  // The roots of the subtrees computed by the last update, sorted
+  std::vector<uint32_t> mUpdatedRoots;
+  // Nodes were added after the last layout
+  bool mLayoutDirty;
+};
+
+} // namespace scene
+
+#endif
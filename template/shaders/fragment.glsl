@@ -2,9 +2,13 @@
 uniform float uAlpha;
 uniform sampler2D uDiffuseMap;
 uniform sampler2D uSpecularMap;
+// Normal map in tangent space, not every mesh has one
+uniform sampler2D uNormalMap;
+uniform bool uHasNormalMap;
 
 in vec3 fNormal;
 in vec2 fTextCoord;
+in vec4 fTangent;
 
 out vec4 fragColor;
 
@@ -14,6 +18,13 @@ void main(void) {
     // This is a directional light
     vec3 l = normalize(vec3(0.0, 0.75, 1.0));
     vec3 n = normalize(fNormal);
+    if (uHasNormalMap) {
+      // The tangent frame, with the tangent made orthogonal to the interpolated normal
+      vec3 t = normalize(fTangent.xyz - n * dot(n, fTangent.xyz));
+      vec3 b = fTangent.w * cross(n, t);
+      vec3 m = 2.0 * texture2D(uNormalMap, fTextCoord).rgb - 1.0;
+      n = normalize(m.x * t + m.y * b + m.z * n);
+    }
     vec3 r = normalize(reflect(-l, n));
     vec3 h = normalize(l + v);
     //Material from texture
@@ -2,18 +2,28 @@
 in vec3 posAttr;
 in vec3 normalAttr;
 in vec2 textCoordAttr;
+// Unit tangent and sign of the bitangent (only used with a normal map)
+in vec4 tangentAttr;
+// World transform of the instance and its normal matrix (identity if not instanced)
+in mat4 instanceAttr;
+in mat3 instanceNormalAttr;
 
 uniform mat4 PVM;
 uniform mat4 NormalMat;
 
 out vec3 fNormal;
 out vec2 fTextCoord;
+out vec4 fTangent;
 
 void main(void) {
-  gl_Position = PVM * vec4(posAttr, 1.0);
+  gl_Position = PVM * (instanceAttr * vec4(posAttr, 1.0));
   // The lighting calculations will be in view space.
   // But this shader is independent, it just matters how the
   // input NormalMat is recieved
-  fNormal = vec3(NormalMat * vec4(normalAttr, 0.0));
+  fNormal = vec3(NormalMat * vec4(instanceNormalAttr * normalAttr, 0.0));
   fTextCoord = textCoordAttr;
+  // A tangent is a direction on the surface, it follows the instance matrix. The view and
+  // model matrices only rotate and scale uniformly, so NormalMat keeps its direction
+  fTangent = vec4(vec3(NormalMat * vec4(mat3(instanceAttr) * tangentAttr.xyz, 0.0)),
+      tangentAttr.w);
 }
@@ -0,0 +1,40 @@
+#version 130
+// Same as vertex.glsl, but for the packed vertices (See mesh::PackedVertex)
+in vec4 posAttr;       // unorm16, relative to the bounding box (w is always 1)
+in vec2 normalAttr;    // snorm16, octahedral encoding
+in vec2 textCoordAttr; // unorm16 relative to the coordinates range, or half float
+// Unit tangent and sign of the bitangent (only used with a normal map)
+in vec4 tangentAttr;
+// World transform of the instance and its normal matrix (identity if not instanced)
+in mat4 instanceAttr;
+in mat3 instanceNormalAttr;
+
+uniform mat4 PVM;
+uniform mat4 NormalMat;
+// Decode constants (See mesh::DecodeConstants)
+uniform vec3 uPositionScale;
+uniform vec3 uPositionOffset;
+uniform vec2 uTextCoordScale;
+uniform vec2 uTextCoordOffset;
+
+out vec3 fNormal;
+out vec2 fTextCoord;
+out vec4 fTangent;
+
+vec3 octahedralDecode(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (n.z < 0.0) {
+    vec2 signNotZero = vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    n.xy = (1.0 - abs(e.yx)) * signNotZero;
+  }
+  return normalize(n);
+}
+
+void main(void) {
+  vec3 position = posAttr.xyz * uPositionScale + uPositionOffset;
+  gl_Position = PVM * (instanceAttr * vec4(position, 1.0));
+  fNormal = vec3(NormalMat * vec4(instanceNormalAttr * octahedralDecode(normalAttr), 0.0));
+  fTextCoord = textCoordAttr * uTextCoordScale + uTextCoordOffset;
+  fTangent = vec4(vec3(NormalMat * vec4(mat3(instanceAttr) * tangentAttr.xyz, 0.0)),
+      tangentAttr.w);
+}
@@ -9,12 +9,34 @@
 #include <glm/gtc/type_ptr.hpp>
 
 //Includes from this template
+#include "mesh/vertexlayout.h"
 #include "ogl/oglhelpers.h"
 
 // Includes from this project
 #include "callbacks.h"
 #include "templateApplication.h"
 
+namespace {
+
+// Per instance: the world transform (16 floats) and its normal matrix (9 floats)
+const size_t INSTANCE_FLOATS = 16 + 9;
+
+void packInstance(const glm::mat4& world, float* instance) {
+  glm::mat3 normal = glm::inverse(glm::transpose(glm::mat3(world)));
+  for (int c = 0; c < 4; ++c) {
+    for (int r = 0; r < 4; ++r) {
+      instance[4 * c + r] = world[c][r];
+    }
+  }
+  for (int c = 0; c < 3; ++c) {
+    for (int r = 0; r < 3; ++r) {
+      instance[16 + 3 * c + r] = normal[c][r];
+    }
+  }
+}
+
+} // namespace
+
 void TemplateApplication::init_glfw() {
   using std::cerr;
   using std::endl;
@@ -67,16 +89,28 @@ void TemplateApplication::init_program() {
   /************************************************************************/
   /*                   OpenGL program (pipeline) creation                 */
   /************************************************************************/
-  mGLProgramPtr = new ogl::OGLProgram("shaders/vertex.glsl", "shaders/fragment.glsl");
+  // The packed vertices need a vertex shader that decodes them
+  const char* vertexShader = mQuantizedVertices ? "shaders/vertex_quantized.glsl" :
+      "shaders/vertex.glsl";
+  mGLProgramPtr = new ogl::OGLProgram(vertexShader, "shaders/fragment.glsl");
   /* Now, that we have the program, query location of shader variables */
   mLoc.uPVM = mGLProgramPtr->uniformLoc("PVM");
   mLoc.uNormalMat = mGLProgramPtr->uniformLoc("NormalMat");
   mLoc.uAlpha = mGLProgramPtr->uniformLoc("uAlpha");
   mLoc.uDiffuseMap = mGLProgramPtr->uniformLoc("uDiffuseMap");
   mLoc.uSpecularMap = mGLProgramPtr->uniformLoc("uSpecularMap");
+  mLoc.uNormalMap = mGLProgramPtr->uniformLoc("uNormalMap");
+  mLoc.uHasNormalMap = mGLProgramPtr->uniformLoc("uHasNormalMap");
+  mLoc.uPositionScale = mGLProgramPtr->uniformLoc("uPositionScale");
+  mLoc.uPositionOffset = mGLProgramPtr->uniformLoc("uPositionOffset");
+  mLoc.uTextCoordScale = mGLProgramPtr->uniformLoc("uTextCoordScale");
+  mLoc.uTextCoordOffset = mGLProgramPtr->uniformLoc("uTextCoordOffset");
   mLoc.aPosition = mGLProgramPtr->attribLoc("posAttr");
   mLoc.aNormal = mGLProgramPtr->attribLoc("normalAttr");
   mLoc.aTextureCoord = mGLProgramPtr->attribLoc("textCoordAttr");
+  mLoc.aTangent = mGLProgramPtr->attribLoc("tangentAttr");
+  mLoc.aInstance = mGLProgramPtr->attribLoc("instanceAttr");
+  mLoc.aInstanceNormal = mGLProgramPtr->attribLoc("instanceNormalAttr");
   /* Then, create primitives and send data to GPU */
   load_model_data_and_send_to_gpu();
   // Initialize some basic rendering state
@@ -97,6 +131,8 @@ void TemplateApplication::init_program() {
   mShowDemoMenu = false;
   mRotating = false;
   mZoomLevel = -1;
+  // The model is the root of the scene
+  mModelNode = mScene.addNode(scene::TransformHierarchy::NO_PARENT);
 }
 
 void TemplateApplication::load_model_data_and_send_to_gpu() {
@@ -104,22 +140,95 @@ void TemplateApplication::load_model_data_and_send_to_gpu() {
   // Models location in filesystem
   const std::string model_folder = "models/Nyra/";
   const std::string model_path = model_folder + "Nyra_pose.obj";
-  // Read model data
+  // Read model data (the first run imports it, the next ones read the binary cache)
+  double loadStart = glfwGetTime();
   Model model{model_path};
+  mModelLoadTime = glfwGetTime() - loadStart;
+  mModelFromCache = model.loadedFromCache();
+  const double processStart = glfwGetTime();
   model.toUnitCube(); // Rescale model
-  // Query data
-  std::vector<unsigned int> indices = model.getIndices();
-  std::vector<Vertex> vertices = model.getVertices();
-  // The separator will tell us how to render, since we destroy the model, we keep a copy
-  mSeparators = model.getSeparators();
+  // The normal maps need the tangents. Assimp computes them, the OBJ reader does not
+  bool normalMaps = false;
+  for (const MeshData& sep : model.viewSeparators()) {
+    normalMaps = normalMaps || sep.normalIndex != -1;
+  }
+  if (normalMaps && !model.hasTangents()) {
+    model.recalculateTangents();
+  }
   // Since we use the model to get the paths for the textures, I need
-  // fill the textures collection here
-  for (auto t : model.getDiffuseTextures()) {
+  // fill the textures collection here. The same image under different names
+  // is sent only once (the separators are updated, so this goes before batching them:
+  // the separators that now share their textures are merged too)
+  std::vector<image::Texture*> decoded;
+  std::vector<uint64_t> contentKeys;
+  for (const auto& t : model.viewTextures()) {
     std::string texture_file = model_folder + t.filePath;
-    image::Texture* texture = new image::Texture(texture_file);
-    texture->send_to_gpu();
-    mTextures.push_back(texture);
+    decoded.push_back(new image::Texture(texture_file));
+    contentKeys.push_back(mDedupTextures ? decoded.back()->content_hash() : contentKeys.size());
   }
+  // Equal keys are confirmed with the pixels
+  std::vector<int> textureIndex = model.mergeTextures(contentKeys, [&decoded](size_t a, size_t b) {
+    return decoded[a]->same_content(*decoded[b]);
+  });
+  mTexturesLoaded = decoded.size();
+  mTextureBytesSaved = 0;
+  for (size_t i = 0; i < decoded.size(); ++i) {
+    if (textureIndex[i] == static_cast<int>(mTextures.size())) {
+      decoded[i]->send_to_gpu();
+      mTextures.push_back(decoded[i]);
+    } else {
+      mTextureBytesSaved += decoded[i]->get_bytes();
+      delete decoded[i];
+    }
+  }
+  // One draw call per material where possible, the meshes are drawn sorted by material
+  mSeparatorsLoaded = model.viewSeparators().size();
+  model.batchByMaterial();
+  mSeparatorsBatched = model.viewSeparators().size();
+  // Reorder triangles and vertices to make a better use of the GPU's vertex caches
+  // and to draw first the triangles that hide others (less overdraw). Measuring the
+  // overdraw is only for the stats and slow, it is done if the menu asks for it
+  if (mEstimateOverdraw) {
+    mOverdrawBefore = model.estimateOverdraw();
+  }
+  mCacheReport = model.optimizeVertexOrder();
+  if (mEstimateOverdraw) {
+    mOverdrawAfter = model.estimateOverdraw();
+  }
+  // Split the big meshes before the levels of detail are created (splitting discards them)
+  model.splitLargeMeshes();
+  double lodStart = glfwGetTime();
+  model.generateLods();
+  mLodTime = glfwGetTime() - lodStart;
+  mLodTriangles.assign(model.lodCount(), 0);
+  mLodErrors.assign(model.lodCount(), 0.0f);
+  for (size_t level = 0; level < model.lodCount(); ++level) {
+    for (const MeshData& sep : model.viewLod(level)) {
+      mLodTriangles[level] += sep.howMany / 3;
+    }
+    mLodErrors[level] = model.lodError(level);
+  }
+  mLodSelector.build(model);
+  // The boxes of the separators and of their instances (level 0 holds all the levels)
+  mFrustumCuller.build(model);
+  // The biggest meshes are the occluders, simplified to one of their levels of detail
+  mOcclusionCuller.build(model);
+  // Indices in 16 bits where possible (big meshes are split), this updates the separators
+  mIndexBytes32 = model.viewIndices().bytes();
+  std::vector<unsigned char> indices = model.buildIndexBuffer();
+  mIndexBytes = indices.size();
+  // The meshlets are ranges of the final index buffer (only for the full model)
+  mMeshlets.build(model);
+  // The picker keeps its own copy of the triangles, so it can pick after the model is gone
+  double pickerStart = glfwGetTime();
+  mPicker.build(model);
+  mPickerBuildTime = glfwGetTime() - pickerStart;
+  mModelProcessTime = glfwGetTime() - processStart;
+  // Query data, the views point to the model's buffers (no copies)
+  ArrayView<Vertex> vertices = model.viewVertices();
+  // The separator will tell us how to render, since we destroy the model, we keep them
+  mSeparators = model.releaseSeparators();
+  mLods = model.releaseLods();
   // Create the vertex buffer objects and VAO
   GLuint vbo;
   GLuint indexBuffer;
@@ -129,28 +238,149 @@ void TemplateApplication::load_model_data_and_send_to_gpu() {
   // Bind the vao this need to be done before anything
   glBindVertexArray(mVao);
   // Send data to GPU: first send the vertices
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
-  glEnableVertexAttribArray(mLoc.aPosition);
-  glVertexAttribPointer(mLoc.aPosition, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        OFFSET_OF(Vertex, position));
-  glEnableVertexAttribArray(mLoc.aNormal);
-  glVertexAttribPointer(mLoc.aNormal, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          OFFSET_OF(Vertex, normal));
-  glEnableVertexAttribArray(mLoc.aTextureCoord);
-  glVertexAttribPointer(mLoc.aTextureCoord, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          OFFSET_OF(Vertex, textCoords));
+  const GLint locations[] = {mLoc.aPosition, mLoc.aNormal, mLoc.aTextureCoord};
+  if (mQuantizedVertices) {
+    // Packed vertices, relative to the bounding box of the model
+    VertexQuantizer quantizer;
+    QuantizedVertices packed = quantizer.quantize(model);
+    mDecode = packed.constants;
+    mQuantizationError = VertexQuantizer::measureError(vertices, packed);
+    ArrayView<PackedVertex> packedView(packed.vertices);
+    mVertexBytes = packedView.bytes();
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, packedView.bytes(), packedView.data(), GL_STATIC_DRAW);
+    VertexQuantizer::setupAttributes(locations, vbo, mDecode.encoding);
+  } else {
+    mVertexBytes = vertices.bytes();
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.bytes(), vertices.data(), GL_STATIC_DRAW);
+    // The Vertex struct is the standard (interleaved) format, the layout generates the pointers
+    const GLuint buffers[] = {vbo};
+    StandardFormat::setupAttributes(locations, buffers);
+  }
+  // The tangents, in their own buffer (a constant one if there is no normal map)
+  mTangentBytes = 0;
+  if (mLoc.aTangent != -1 && normalMaps && model.hasTangents()) {
+    ArrayView<glm::vec4> tangents = model.viewTangents();
+    mTangentBytes = tangents.bytes();
+    GLuint tangentBuffer;
+    glGenBuffers(1, &tangentBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer);
+    glBufferData(GL_ARRAY_BUFFER, tangents.bytes(), tangents.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(mLoc.aTangent);
+    glVertexAttribPointer(mLoc.aTangent, 4, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // The VAO keeps the buffer alive
+    glDeleteBuffers(1, &tangentBuffer);
+  } else if (mLoc.aTangent != -1) {
+    glVertexAttrib4f(mLoc.aTangent, 1.0f, 0.0f, 0.0f, 1.0f);
+  }
+  // The world transforms of the instances
+  setup_instances(model);
+  mInstanceRanges.assign(model.viewInstanceRanges().begin(), model.viewInstanceRanges().end());
+  setup_scene_nodes(model);
   // Now, the indices
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-               indices.data(), GL_STATIC_DRAW);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size(), indices.data(), GL_STATIC_DRAW);
   // Unbind the vao we will use it for render
   glBindVertexArray(0);
   // Now that we have the data in the GPU and the reference in vao we do not need to keep it
+  // (the model releases the CPU copy when it goes out of scope)
   glDeleteBuffers(1, &vbo);
   glDeleteBuffers(1, &indexBuffer);
-  vertices.clear();
-  indices.clear();
+}
+
+void TemplateApplication::setup_instances(const mesh::Model& model) {
+  const size_t FLOATS = INSTANCE_FLOATS;
+  mesh::ArrayView<glm::mat4> transforms = model.viewInstanceTransforms();
+  mInstanceCount = transforms.size();
+  mMirroredInstances.assign(transforms.size(), false);
+  std::vector<float> data((transforms.size() + 1) * FLOATS, 0.0f);
+  for (size_t i = 0; i <= transforms.size(); ++i) {
+    glm::mat4 world = i == 0 ? glm::mat4(1.0f) : transforms[i - 1];
+    if (i > 0) {
+      mMirroredInstances[i - 1] = glm::determinant(glm::mat3(world)) < 0.0f;
+    }
+    packInstance(world, data.data() + i * FLOATS);
+  }
+  // The buffer is kept, the instances are sent again when their nodes move
+  glGenBuffers(1, &mInstanceBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+  glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), data.data(), GL_DYNAMIC_DRAW);
+  // A matrix takes one location per column, and advances once per instance
+  const GLsizei stride = static_cast<GLsizei>(FLOATS * sizeof(float));
+  for (GLint c = 0; c < 4 && mLoc.aInstance != -1; ++c) {
+    glEnableVertexAttribArray(mLoc.aInstance + c);
+    glVertexAttribPointer(mLoc.aInstance + c, 4, GL_FLOAT, GL_FALSE, stride,
+        reinterpret_cast<void*>(4 * c * sizeof(float)));
+    glVertexAttribDivisor(mLoc.aInstance + c, 1);
+  }
+  for (GLint c = 0; c < 3 && mLoc.aInstanceNormal != -1; ++c) {
+    glEnableVertexAttribArray(mLoc.aInstanceNormal + c);
+    glVertexAttribPointer(mLoc.aInstanceNormal + c, 3, GL_FLOAT, GL_FALSE, stride,
+        reinterpret_cast<void*>((16 + 3 * c) * sizeof(float)));
+    glVertexAttribDivisor(mLoc.aInstanceNormal + c, 1);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void TemplateApplication::setup_scene_nodes(const mesh::Model& model) {
+  using mesh::ModelNode;
+  mesh::ArrayView<ModelNode> nodes = model.viewNodes();
+  mesh::ArrayView<uint32_t> instanceNodes = model.viewInstanceNodes();
+  mScene.reserve(mScene.size() + nodes.size());
+  // The parents come first, so they are already in the scene
+  std::vector<uint32_t> sceneNode(nodes.size());
+  for (size_t n = 0; n < nodes.size(); ++n) {
+    const uint32_t parent = nodes[n].parent;
+    sceneNode[n] = mScene.addNode(parent == ModelNode::NO_PARENT ?
+        scene::TransformHierarchy::NO_PARENT : sceneNode[parent], nodes[n].local);
+  }
+  mInstanceNodes.clear();
+  if (instanceNodes.size() == model.viewInstanceTransforms().size()) {
+    for (uint32_t node : instanceNodes) {
+      mInstanceNodes.push_back(sceneNode[node]);
+    }
+  }
+  mInstanceBase = model.instanceBase();
+  // The first frame only updates what changed after the load
+  mScene.update();
+}
+
+void TemplateApplication::update_instances() {
+  // The instances whose node, or an ancestor of it, changed
+  std::vector<bool> moved(mInstanceNodes.size(), false);
+  size_t count = 0;
+  for (size_t i = 0; i < mInstanceNodes.size(); ++i) {
+    moved[i] = mScene.wasUpdated(mInstanceNodes[i]);
+    count += moved[i] ? 1 : 0;
+  }
+  if (count == 0) {
+    return;
+  }
+  // Send them again (the first instance in the buffer is the identity)
+  std::vector<glm::mat4> worlds(mInstanceNodes.size());
+  float data[INSTANCE_FLOATS];
+  glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+  for (size_t i = 0; i < mInstanceNodes.size(); ++i) {
+    if (!moved[i]) {
+      continue;
+    }
+    worlds[i] = mScene.world(mInstanceNodes[i]) * mInstanceBase;
+    mMirroredInstances[i] = glm::determinant(glm::mat3(worlds[i])) < 0.0f;
+    packInstance(worlds[i], data);
+    glBufferSubData(GL_ARRAY_BUFFER, (i + 1) * sizeof(data), sizeof(data), data);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  // And their boxes (a range of instances can be shared by the parts of a split mesh)
+  for (size_t s = 0; s < mInstanceRanges.size(); ++s) {
+    const mesh::InstanceRange& range = mInstanceRanges[s];
+    for (uint32_t k = 0; k < range.count; ++k) {
+      if (moved[range.first + k]) {
+        mFrustumCuller.moveInstance(s, k, worlds[range.first + k]);
+      }
+    }
+  }
 }
 
 void TemplateApplication::render() {
@@ -166,6 +396,17 @@ void TemplateApplication::render() {
   if (mRotating) {
     M = glm::rotate(M, glm::radians(mCurrentAngle), glm::vec3(0.0f, 1.0f, 0.0f));
   }
+  // Only the nodes that changed (and their subtrees) are updated
+  if (M != mScene.local(mModelNode)) {
+    mScene.setLocal(mModelNode, M);
+  }
+  double sceneStart = glfwGetTime();
+  mSceneStats = mScene.update();
+  if (mSceneStats.updated > 0 && !mInstanceNodes.empty()) {
+    update_instances();
+  }
+  mSceneUpdateTime = glfwGetTime() - sceneStart;
+  M = mScene.world(mModelNode);
   // View
   glm::vec3 camera_up = glm::vec3(0.0f, 1.0f, 0.0f);
   glm::vec3 camera_position = glm::vec3(0.0f, 0.0f, 3.5f);
@@ -184,10 +425,25 @@ void TemplateApplication::render() {
   GLfloat zFar = 5.0f;
   glm::mat4 P = glm::perspective(fovy, aspect, zNear, zFar);
   /************************************************************************/
+  /* Choose the level of detail of every mesh                             */
+  /************************************************************************/
+  if (mAutoLod) {
+    // The error is measured in pixels of the framebuffer
+    int fbWidth;
+    int fbHeight;
+    glfwGetFramebufferSize(mWinPtr, &fbWidth, &fbHeight);
+    mLodSelector.setPixelError(mLodPixelError);
+    mLodStats = mLodSelector.select(V * M, fovy, fbHeight);
+  } else {
+    mLodStats = mLodSelector.force(static_cast<size_t>(mLodLevel));
+  }
+  /************************************************************************/
   /* Send uniform values to shader                                        */
   /************************************************************************/
+  glm::mat4 PVM = P * V * M;
+  mLastPVM = PVM;
   if (mLoc.uPVM != -1) {
-    glUniformMatrix4fv(mLoc.uPVM, 1, GL_FALSE, glm::value_ptr(P * V * M));
+    glUniformMatrix4fv(mLoc.uPVM, 1, GL_FALSE, glm::value_ptr(PVM));
   }
   if (mLoc.uNormalMat != -1) {
     glUniformMatrix4fv(mLoc.uNormalMat, 1, GL_FALSE,
@@ -196,30 +452,142 @@ void TemplateApplication::render() {
   if (mLoc.uAlpha != -1) {
     glUniform1f(mLoc.uAlpha, mAlpha);
   }
+  // Decode constants (only used by the shader for packed vertices)
+  if (mLoc.uPositionScale != -1) {
+    glUniform3fv(mLoc.uPositionScale, 1, glm::value_ptr(mDecode.positionScale));
+  }
+  if (mLoc.uPositionOffset != -1) {
+    glUniform3fv(mLoc.uPositionOffset, 1, glm::value_ptr(mDecode.positionOffset));
+  }
+  if (mLoc.uTextCoordScale != -1) {
+    glUniform2fv(mLoc.uTextCoordScale, 1, glm::value_ptr(mDecode.textCoordsScale));
+  }
+  if (mLoc.uTextCoordOffset != -1) {
+    glUniform2fv(mLoc.uTextCoordOffset, 1, glm::value_ptr(mDecode.textCoordsOffset));
+  }
+  /************************************************************************/
+  /* Cull the separators and the instances outside the view frustum       */
+  /* and then the ones hidden behind the occluders                        */
+  /************************************************************************/
+  mFrustumStats = mesh::FrustumCullStats();
+  mOcclusionStats = mesh::OcclusionCullStats();
+  if (mFrustumCulling) {
+    double cullStart = glfwGetTime();
+    mFrustumStats = mFrustumCuller.cull(PVM, mCullingHierarchy);
+    mFrustumCullTime = glfwGetTime() - cullStart;
+    if (mOcclusionCulling) {
+      double occlusionStart = glfwGetTime();
+      mOcclusionStats = mOcclusionCuller.cull(PVM, mFrustumCuller);
+      mOcclusionCullTime = glfwGetTime() - occlusionStart;
+    }
+  }
+  auto isVisible = [this](size_t box) {
+    return !mFrustumCulling || (mFrustumCuller.isVisible(box) &&
+        (!mOcclusionCulling || mOcclusionCuller.isVisible(box)));
+  };
   /************************************************************************/
   /* Bind buffer object and their corresponding attributes (use VAO)      */
   /************************************************************************/
   glBindVertexArray(mVao);
+  /* Cull the meshlets, with the camera position in model coordinates */
+  if (mMeshletCulling) {
+    glm::vec3 eye = glm::vec3(glm::inverse(V * M) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    mCullStats = mMeshlets.cull(PVM, eye);
+  }
   /* Draw */
+  // The diffuse texture is always in unit 0, the specular in unit 1 and the normal map in 2
+  glUniform1i(mLoc.uDiffuseMap, 0);
+  glUniform1i(mLoc.uSpecularMap, 1);
+  glUniform1i(mLoc.uNormalMap, 2);
+  mDrawStats = DrawStats();
+  // The separators are sorted by material, so a texture is only bound when it changes
+  int boundDiffuse = -1;
+  int boundSpecular = -1;
+  int boundNormal = -1;
+  glUniform1i(mLoc.uHasNormalMap, 0);
+  const mesh::InstanceRange drawnOnce = {0, 0};
   for (size_t i = 0; i < mSeparators.size(); ++i) {
-    mesh::MeshData sep = mSeparators[i];
+    // The instances are drawn at full detail (See LodSelector)
+    mesh::InstanceRange instances = i < mInstanceRanges.size() ? mInstanceRanges[i] : drawnOnce;
+    // Skip the separators (or all the instances) that are culled before binding anything
+    const size_t firstBox = mFrustumCuller.firstBoxOf(i);
+    size_t visibleInstances = 0;
+    for (GLuint k = 0; k < instances.count; ++k) {
+      visibleInstances += isVisible(firstBox + k) ? 1 : 0;
+    }
+    if (instances.count > 0 ? visibleInstances == 0 : !isVisible(firstBox)) {
+      continue;
+    }
+    size_t level = mLodSelector.levelOf(i);
+    mesh::MeshData sep = level == 0 ? mSeparators[i] : mLods[level - 1][i];
     if (sep.diffuseIndex == -1 || sep.specIndex == -1) {
       // This mesh is missing some texture
       // Do not render (Not with these shaders at least)
       continue;
     }
     // Send diffuse texture in unit 0
-    glActiveTexture(GL_TEXTURE0);
-    mTextures[sep.diffuseIndex]->bind();
-    glUniform1i(mLoc.uDiffuseMap, 0);
+    if (sep.diffuseIndex != boundDiffuse) {
+      glActiveTexture(GL_TEXTURE0);
+      mTextures[sep.diffuseIndex]->bind();
+      boundDiffuse = sep.diffuseIndex;
+      ++mDrawStats.textureBinds;
+    }
     // Send specular texture in unit 1
-    glActiveTexture(GL_TEXTURE1);
-    mTextures[sep.specIndex]->bind();
-    glUniform1i(mLoc.uSpecularMap, 1);
+    if (sep.specIndex != boundSpecular) {
+      glActiveTexture(GL_TEXTURE1);
+      mTextures[sep.specIndex]->bind();
+      boundSpecular = sep.specIndex;
+      ++mDrawStats.textureBinds;
+    }
+    // Send the normal map in unit 2, or tell the shader that there is none (a normal
+    // map without tangents can not be used)
+    const int normalIndex = mTangentBytes > 0 ? sep.normalIndex : -1;
+    if (normalIndex != boundNormal) {
+      if (normalIndex != -1) {
+        glActiveTexture(GL_TEXTURE2);
+        mTextures[normalIndex]->bind();
+        ++mDrawStats.textureBinds;
+      }
+      if ((normalIndex == -1) != (boundNormal == -1)) {
+        glUniform1i(mLoc.uHasNormalMap, normalIndex != -1);
+      }
+      boundNormal = normalIndex;
+    }
     // Now draw this mesh indexes by using (by query) the separator
-    glDrawElementsBaseVertex(GL_TRIANGLES, sep.howMany, GL_UNSIGNED_INT,
-                             reinterpret_cast<void*>(sep.startIndex * int(sizeof(unsigned int))),
-                             sep.startVertex);
+    // The meshlets belong to the full detail meshes, the other levels are drawn whole.
+    // The draws that are not instanced read the first instance, the identity
+    if (instances.count > 0) {
+      // One draw per run of consecutive visible instances. The mirroring ones (usually the
+      // last ones) are drawn in their own runs, with the clockwise triangles in front
+      const std::vector<bool>::const_iterator mirrored = mMirroredInstances.begin() +
+          instances.first;
+      GLuint run = 0;
+      for (GLuint k = 0; k <= instances.count; ++k) {
+        const bool visible = k < instances.count && isVisible(firstBox + k);
+        if (visible && (run == 0 || mirrored[k] == mirrored[k - 1])) {
+          ++run;
+          continue;
+        }
+        if (run > 0) {
+          glFrontFace(mirrored[k - 1] ? GL_CW : GL_CCW);
+          glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, sep.howMany,
+              sep.indexType, reinterpret_cast<void*>(sep.indexOffset), run, sep.startVertex,
+              instances.first + 1 + k - run);
+          ++mDrawStats.drawCalls;
+          mDrawStats.instances += run;
+        }
+        // A visible instance here starts the run of the mirroring ones
+        run = visible ? 1 : 0;
+      }
+      glFrontFace(GL_CCW);
+    } else if (mMeshletCulling && level == 0) {
+      mDrawStats.drawCalls += draw_meshlets(i);
+    } else {
+      glDrawElementsBaseVertex(GL_TRIANGLES, sep.howMany, sep.indexType,
+                               reinterpret_cast<void*>(sep.indexOffset),
+                               sep.startVertex);
+      ++mDrawStats.drawCalls;
+    }
   }
   // Clean the state for other render (could be the UI, other rendering pass, or the next frame)
   glActiveTexture(GL_TEXTURE0);
@@ -228,7 +596,70 @@ void TemplateApplication::render() {
   glUseProgram(0);
 }
 
+size_t TemplateApplication::draw_meshlets(size_t separator) {
+  const mesh::MeshData& sep = mSeparators[separator];
+  const GLintptr indexSize = sep.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+  mesh::ArrayView<mesh::Meshlet> meshlets = mMeshlets.view();
+  // A run of visible meshlets is a contiguous range of indices
+  GLint runStart = 0;
+  GLsizei runCount = 0;
+  size_t draws = 0;
+  auto flush = [&]() {
+    if (runCount > 0) {
+      GLintptr offset = sep.indexOffset + (runStart - sep.startIndex) * indexSize;
+      glDrawElementsBaseVertex(GL_TRIANGLES, runCount, sep.indexType,
+                               reinterpret_cast<void*>(offset), sep.startVertex);
+      ++draws;
+    }
+    runCount = 0;
+  };
+  for (size_t m = mMeshlets.firstOf(separator); m < mMeshlets.firstOf(separator + 1); ++m) {
+    if (!mMeshlets.isVisible(m)) {
+      flush();
+      continue;
+    }
+    if (runCount == 0) {
+      runStart = meshlets[m].startIndex;
+    }
+    runCount += meshlets[m].howMany;
+  }
+  flush();
+  return draws;
+}
+
+void TemplateApplication::pick(const glm::vec2& mousePos) {
+  int width;
+  int height;
+  glfwGetWindowSize(mWinPtr, &width, &height);
+  mPicker.pickAsync(mousePos, glm::ivec2(width, height), mLastPVM);
+}
+
+void TemplateApplication::reload_model() {
+  // Everything built from the model is built again: textures, program, buffers and scene nodes
+  for (size_t i = 0; i < mTextures.size(); ++i) {
+    delete mTextures[i];
+  }
+  mTextures.clear();
+  delete mGLProgramPtr;
+  mGLProgramPtr = nullptr;
+  glDeleteVertexArrays(1, &mVao);
+  glDeleteBuffers(1, &mInstanceBuffer);
+  mInstanceBuffer = 0;
+  const glm::mat4 modelLocal = mScene.local(mModelNode);
+  mScene.clear();
+  mModelNode = mScene.addNode(scene::TransformHierarchy::NO_PARENT, modelLocal);
+  mPick = {};
+  init_program();
+}
+
 void TemplateApplication::update() {
+  // The load options changed in the menu
+  if (mReloadModel) {
+    mReloadModel = false;
+    reload_model();
+  }
+  // Collect the pick, if it finished (it never stalls the frame)
+  mPicker.poll(mPick);
   // We use GLFW (rather than OpenGL) to timer
   double time = glfwGetTime();
   double elapsed = time - mLastTime; // elapsed is time in seconds between frames
@@ -256,6 +687,7 @@ void TemplateApplication::free_resources() {
   }
   /* Delete OpenGL program */
   delete mGLProgramPtr;
+  glDeleteBuffers(1, &mInstanceBuffer);
   // Window and context destruction
   glfwDestroyWindow(mWinPtr);
 }
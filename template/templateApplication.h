@@ -21,8 +21,16 @@
 #include "image/texture.h"
 #include "image/screengrabber.h"
 #include "mesh/model.h"
+#include "mesh/frustumculler.h"
+#include "mesh/occlusionculler.h"
+#include "mesh/lodselector.h"
+#include "mesh/meshlets.h"
+#include "mesh/meshoptimizer.h"
+#include "mesh/picker.h"
+#include "mesh/vertexquantizer.h"
 
 #include "ogl/oglprogram.h"
+#include "scene/transformhierarchy.h"
 #include "ui/trackball.h"
 
 
@@ -32,10 +40,19 @@ struct ProgramLocations {
   GLint uNormalMat;
   GLint uDiffuseMap;
   GLint uSpecularMap;
+  GLint uNormalMap;
+  GLint uHasNormalMap;
   GLint uAlpha;
+  GLint uPositionScale;
+  GLint uPositionOffset;
+  GLint uTextCoordScale;
+  GLint uTextCoordOffset;
   GLint aPosition;
   GLint aNormal;
   GLint aTextureCoord;
+  GLint aTangent;
+  GLint aInstance;
+  GLint aInstanceNormal;
 
   ProgramLocations() {
     reset();
@@ -46,14 +63,30 @@ struct ProgramLocations {
     uNormalMat = -1;
     uDiffuseMap = -1;
     uSpecularMap = -1;
+    uNormalMap = -1;
+    uHasNormalMap = -1;
     uAlpha = -1;
+    uPositionScale = -1;
+    uPositionOffset = -1;
+    uTextCoordScale = -1;
+    uTextCoordOffset = -1;
     aPosition = -1;
     aNormal = -1;
     aTextureCoord = -1;
+    aTangent = -1;
+    aInstance = -1;
+    aInstanceNormal = -1;
   }
 };
 
 
+// State changes of the last frame, to see what the material batching saves
+struct DrawStats {
+  size_t drawCalls;
+  size_t textureBinds;
+  size_t instances;
+};
+
 struct WindowState {
   GLFWmonitor* monitorPtr;
   int x_pos;
@@ -85,6 +118,8 @@ class TemplateApplication {
     ui::Trackball mBall;
     //! Keep track if we are in camera edit mode
     bool mMouseDrag = false;
+    //! Where the left button was pressed, a release in the same place is a click (not a drag)
+    glm::ivec2 mPressPosition;
     //! The current zoom level of the camera
     int mZoomLevel;
     //! Keep track if we are in roatation mode
@@ -95,6 +130,11 @@ class TemplateApplication {
     bool mShowMenu;
     //! Show hide DearImgui demo (if you need to quick look how to use a control)
     bool mShowDemoMenu;
+    //! Find (in a worker thread) the mesh and triangle under the given cursor position
+    /*!
+      Uses the matrices of the last rendered frame, the result is collected by update()
+    */
+    void pick(const glm::vec2& mousePos);
   private:
     //! Specular exponent (for the Blinn-Phong shading model)
     float mAlpha;
@@ -107,15 +147,111 @@ class TemplateApplication {
     // Two buffers to interact with the Model class
     std::vector<image::Texture*> mTextures;
     std::vector<mesh::MeshData> mSeparators;
+    // Merge the textures with the same pixels (See mesh::Model::mergeTextures)
+    bool mDedupTextures = true;
+    size_t mTexturesLoaded = 0;
+    size_t mTextureBytesSaved = 0;
+    // Separators sorted by material and merged at load time (See mesh::Model::batchByMaterial)
+    size_t mSeparatorsLoaded = 0;
+    size_t mSeparatorsBatched = 0;
+    DrawStats mDrawStats = {};
+    // The meshes used by several nodes are stored once and drawn instanced (one range per
+    // separator, empty if there are none). The first instance in the GPU is the identity
+    std::vector<mesh::InstanceRange> mInstanceRanges;
+    // The instances whose transform mirrors, drawn with the clockwise triangles in front
+    std::vector<bool> mMirroredInstances;
+    size_t mInstanceCount = 0;
+    GLuint mInstanceBuffer = 0;
+    // The transforms of the scene, updated once per frame: the model node (the rotation of
+    // the model) and, as other roots, the nodes of the model file
+    scene::TransformHierarchy mScene;
+    uint32_t mModelNode = 0;
+    // The node of every instance (empty if the file has no nodes). An instance is drawn with
+    // the world matrix of its node times mInstanceBase (See mesh::Model::viewInstanceNodes)
+    std::vector<uint32_t> mInstanceNodes;
+    glm::mat4 mInstanceBase = glm::mat4(1.0f);
+    scene::HierarchyUpdateStats mSceneStats = {};
+    double mSceneUpdateTime = 0.0;
     // To keep track the elapsed time between frames
     double mLastTime = 0.0;
+    // Time spent loading the model (in seconds) and if it came from the binary cache
+    double mModelLoadTime = 0.0;
+    bool mModelFromCache = false;
+    // Vertex cache statistics of the model before and after reordering it
+    mesh::VertexCacheReport mCacheReport = {};
+    // Time spent processing the model after loading it (batching, reordering, levels of detail...)
+    double mModelProcessTime = 0.0;
+    // Set by the menu when a load option changed, the model is loaded again in update()
+    bool mReloadModel = false;
+    // Overdraw estimated on the CPU before and after reordering (only if enabled, it is slow)
+    bool mEstimateOverdraw = false;
+    mesh::OverdrawStats mOverdrawBefore = {};
+    mesh::OverdrawStats mOverdrawAfter = {};
+    // Send the vertices packed in 16 bytes (See mesh::VertexQuantizer) instead of 32. It is
+    // lossy, so it is only used if enabled in the menu
+    bool mQuantizedVertices = false;
+    // Values needed by the shader to decode the packed vertices, and the error they introduce
+    mesh::DecodeConstants mDecode = {};
+    mesh::QuantizationError mQuantizationError = {};
+    // Size in bytes of the vertex buffer sent to the GPU
+    size_t mVertexBytes = 0;
+    // The tangents are sent in their own buffer, only if a mesh has a normal map
+    size_t mTangentBytes = 0;
+    // Size in bytes of the index buffer sent to the GPU, and its size with only 32 bits indices
+    size_t mIndexBytes = 0;
+    size_t mIndexBytes32 = 0;
+    // Small clusters of triangles that are culled (frustum and back facing) before drawing
+    mesh::Meshlets mMeshlets;
+    bool mMeshletCulling = true;
+    mesh::MeshletCullStats mCullStats = {};
+    // Separators and instances outside the view frustum are not drawn (See mesh::FrustumCuller)
+    mesh::FrustumCuller mFrustumCuller;
+    bool mFrustumCulling = true;
+    bool mCullingHierarchy = true;
+    mesh::FrustumCullStats mFrustumStats = {};
+    double mFrustumCullTime = 0.0;
+    // Boxes hidden behind the biggest meshes, tested on a small depth buffer rasterized on the CPU
+    // (See mesh::OcclusionCuller), only the ones that passed the frustum culling
+    mesh::OcclusionCuller mOcclusionCuller;
+    bool mOcclusionCulling = false;
+    mesh::OcclusionCullStats mOcclusionStats = {};
+    double mOcclusionCullTime = 0.0;
+    // Separators of the levels of detail 1, 2... (same buffers as mSeparators)
+    std::vector<std::vector<mesh::MeshData> > mLods;
+    std::vector<size_t> mLodTriangles;
+    std::vector<float> mLodErrors;
+    double mLodTime = 0.0;
+    // Level of detail of every separator, by its error on screen (or the forced level)
+    mesh::LodSelector mLodSelector;
+    bool mAutoLod = true;
+    float mLodPixelError = mesh::LodSelector::DEFAULT_PIXEL_ERROR;
+    int mLodLevel = 0;
+    mesh::LodSelectionStats mLodStats = {};
+    // Ray casting against the full detail model (See pick), and the matrices of the last frame
+    mesh::Picker mPicker;
+    double mPickerBuildTime = 0.0;
+    glm::mat4 mLastPVM = glm::mat4(1.0f);
+    mesh::PickResult mPick = {};
     // Vertex Array Object used to manage the Vertex Buffer Objects
     GLuint mVao;
     void init_glfw();
     void load_OpenGL();
     void init_program();
     void load_model_data_and_send_to_gpu();
+    //! Free what was built from the model and load it again, with the current options
+    void reload_model();
+    //! Send the instance transforms of the model and point the instance attributes to them
+    void setup_instances(const mesh::Model& model);
+    //! Add the nodes of the model to the scene, the instances follow them
+    void setup_scene_nodes(const mesh::Model& model);
+    //! Send again the instances whose nodes moved in the last scene update, and move their boxes
+    void update_instances();
     void render();
+    //! Draw the visible meshlets of a separator, joining the consecutive ones in a single call
+    /*!
+      @return the number of draw calls
+    */
+    size_t draw_meshlets(size_t separator);
     void update();
     void free_resources();
     //! Setup the IMGUI library to work with current OpenGL and GLFW, also general look and feel